@@ -0,0 +1,174 @@
+#include "cache.h"
+#include "commit.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "string-list.h"
+#include "bloom.h"
+
+static uint32_t rotate_left(uint32_t value, int count)
+{
+	return (value << count) | (value >> (32 - count));
+}
+
+uint32_t murmur3_seeded(uint32_t seed, const char *data_, size_t len)
+{
+	const unsigned char *data = (const unsigned char *)data_;
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	const uint32_t m = 5;
+	const uint32_t n = 0xe6546b64;
+	size_t i, len4 = len / 4;
+	uint32_t k;
+
+	for (i = 0; i < len4; i++, data += 4) {
+		k = data[0] | (data[1] << 8) | (data[2] << 16) |
+			((uint32_t)data[3] << 24);
+		k *= c1;
+		k = rotate_left(k, 15);
+		k *= c2;
+
+		seed ^= k;
+		seed = rotate_left(seed, 13) * m + n;
+	}
+
+	k = 0;
+	switch (len & 3) {
+	case 3:
+		k ^= data[2] << 16;
+		/* fallthrough */
+	case 2:
+		k ^= data[1] << 8;
+		/* fallthrough */
+	case 1:
+		k ^= data[0];
+		k *= c1;
+		k = rotate_left(k, 15);
+		k *= c2;
+		seed ^= k;
+	}
+
+	seed ^= (uint32_t)len;
+	seed ^= seed >> 16;
+	seed *= 0x85ebca6b;
+	seed ^= seed >> 13;
+	seed *= 0xc2b2ae35;
+	seed ^= seed >> 16;
+	return seed;
+}
+
+void fill_bloom_key(const char *data, size_t len, struct bloom_key *key,
+		    const struct bloom_filter_settings *settings)
+{
+	const uint32_t seed0 = 0x293ae76f;
+	const uint32_t seed1 = 0x7e646e2c;
+	const uint32_t hash0 = murmur3_seeded(seed0, data, len);
+	const uint32_t hash1 = murmur3_seeded(seed1, data, len);
+	uint32_t i;
+
+	/* double hashing: the positions are hash0 + i * hash1 */
+	key->hashes = xmalloc(settings->num_hashes * sizeof(uint32_t));
+	for (i = 0; i < settings->num_hashes; i++)
+		key->hashes[i] = hash0 + i * hash1;
+}
+
+void clear_bloom_key(struct bloom_key *key)
+{
+	free(key->hashes);
+	key->hashes = NULL;
+}
+
+void add_key_to_filter(const struct bloom_key *key,
+		       struct bloom_filter *filter,
+		       const struct bloom_filter_settings *settings)
+{
+	uint64_t nbits = (uint64_t)filter->len * BITS_PER_WORD;
+	uint32_t i;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t pos = key->hashes[i] % nbits;
+		filter->data[pos / BITS_PER_WORD] |= 1 << (pos % BITS_PER_WORD);
+	}
+}
+
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings)
+{
+	uint64_t nbits = (uint64_t)filter->len * BITS_PER_WORD;
+	uint32_t i;
+
+	if (!nbits)
+		return -1;
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t pos = key->hashes[i] % nbits;
+		if (!(filter->data[pos / BITS_PER_WORD] &
+		      (1 << (pos % BITS_PER_WORD))))
+			return 0;
+	}
+	return 1;
+}
+
+static void add_path_and_leading_dirs(struct string_list *paths,
+				      const char *path)
+{
+	const char *slash;
+
+	string_list_append(paths, path);
+	for (slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/'))
+		string_list_append_nodup(paths, xstrndup(path, slash - path));
+}
+
+void compute_bloom_filter(struct commit *c, struct bloom_filter *filter,
+			  const struct bloom_filter_settings *settings)
+{
+	struct string_list paths = STRING_LIST_INIT_DUP;
+	struct diff_options diffopt;
+	int i, too_many;
+
+	diff_setup(&diffopt);
+	DIFF_OPT_SET(&diffopt, RECURSIVE);
+	diffopt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&diffopt);
+
+	if (c->parents)
+		diff_tree_sha1(c->parents->item->tree->object.sha1,
+			       c->tree->object.sha1, "", &diffopt);
+	else
+		diff_root_tree_sha1(c->tree->object.sha1, "", &diffopt);
+	diffcore_std(&diffopt);
+
+	too_many = diff_queued_diff.nr > BLOOM_FILTER_MAX_CHANGES;
+	if (!too_many) {
+		for (i = 0; i < diff_queued_diff.nr; i++) {
+			struct diff_filepair *p = diff_queued_diff.queue[i];
+			add_path_and_leading_dirs(&paths, p->two->path);
+		}
+		sort_string_list(&paths);
+		string_list_remove_duplicates(&paths, 0);
+		too_many = paths.nr > BLOOM_FILTER_MAX_CHANGES;
+	}
+	diff_flush(&diffopt);
+
+	if (too_many) {
+		/* a filter that says "maybe" to everything */
+		filter->len = 1;
+		filter->data = xmalloc(1);
+		filter->data[0] = 0xff;
+	} else {
+		filter->len = DIV_ROUND_UP(paths.nr * settings->bits_per_entry,
+					   BITS_PER_WORD);
+		/* an empty filter would mean "unknown" */
+		if (!filter->len)
+			filter->len = 1;
+		filter->data = xcalloc(filter->len, 1);
+		for (i = 0; i < paths.nr; i++) {
+			struct bloom_key key;
+			const char *path = paths.items[i].string;
+
+			fill_bloom_key(path, strlen(path), &key, settings);
+			add_key_to_filter(&key, filter, settings);
+			clear_bloom_key(&key);
+		}
+	}
+	string_list_clear(&paths, 0);
+}
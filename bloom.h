@@ -0,0 +1,68 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+/*
+ * Changed-path Bloom filters record, for a commit, the paths (and their
+ * leading directories) that differ between the commit and its first
+ * parent. A filter can tell for sure that a path did not change, which
+ * lets history walks limited to a path skip the tree diff for most
+ * commits. They are stored in the commit-graph file; see
+ * Documentation/technical/commit-graph-format.txt.
+ */
+
+struct commit;
+
+struct bloom_filter_settings {
+	uint32_t hash_version;
+	uint32_t num_hashes;
+	uint32_t bits_per_entry;
+};
+
+#define DEFAULT_BLOOM_FILTER_SETTINGS { 1, 7, 10 }
+#define BITS_PER_WORD 8
+
+/*
+ * Commits that change more paths than this get a filter with all bits
+ * set, which never rules anything out but stays small.
+ */
+#define BLOOM_FILTER_MAX_CHANGES 512
+
+struct bloom_filter {
+	unsigned char *data;
+	size_t len;
+};
+
+/* The num_hashes bit positions (before the modulo) of a path. */
+struct bloom_key {
+	uint32_t *hashes;
+};
+
+/* Version 3 of the 32-bit Murmur hash. */
+extern uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len);
+
+extern void fill_bloom_key(const char *data, size_t len, struct bloom_key *key,
+			   const struct bloom_filter_settings *settings);
+extern void clear_bloom_key(struct bloom_key *key);
+
+extern void add_key_to_filter(const struct bloom_key *key,
+			      struct bloom_filter *filter,
+			      const struct bloom_filter_settings *settings);
+
+/*
+ * Returns 0 if the key is definitely not in the filter, 1 if it may
+ * be, and -1 if the filter is empty and cannot tell.
+ */
+extern int bloom_filter_contains(const struct bloom_filter *filter,
+				 const struct bloom_key *key,
+				 const struct bloom_filter_settings *settings);
+
+/*
+ * Compute the filter of the paths changed by "c" against its first
+ * parent (or against the empty tree for a root commit). The commit
+ * and its first parent must be parsed. The data is allocated and
+ * belongs to the caller.
+ */
+extern void compute_bloom_filter(struct commit *c, struct bloom_filter *filter,
+				 const struct bloom_filter_settings *settings);
+
+#endif
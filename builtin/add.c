@@ -381,6 +381,7 @@ int cmd_add(int argc, const char **argv, const char *prefix)
 		if (!ignored_too) {
 			dir.flags |= DIR_COLLECT_IGNORED;
 			setup_standard_excludes(&dir);
+			dir.untracked = the_index.untracked;
 		}
 
 		memset(&empty_pathspec, 0, sizeof(empty_pathspec));
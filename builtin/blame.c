@@ -26,6 +26,10 @@
 #include "userdiff.h"
 #include "line-range.h"
 #include "line-log.h"
+#include "commit-graph.h"
+#include "bloom.h"
+#include "sha1-array.h"
+#include "fetch-object.h"
 
 static char blame_usage[] = N_("git blame [options] [rev-opts] [rev] [--] file");
 
@@ -520,6 +524,26 @@ static int fill_blob_sha1_and_mode(struct origin *origin)
  * We have an origin -- check if the same path exists in the
  * parent and return an origin structure to represent it.
  */
+/*
+ * Ask the changed-path Bloom filter of the commit of "origin" whether
+ * its path may differ from the one in the first parent.
+ */
+static int maybe_changed_path(struct origin *origin)
+{
+	const struct bloom_filter_settings *settings;
+	struct bloom_filter filter;
+	struct bloom_key key;
+	int ret;
+
+	settings = get_bloom_filter_settings();
+	if (!settings || !get_bloom_filter(origin->commit, &filter))
+		return 1;
+	fill_bloom_key(origin->path, strlen(origin->path), &key, settings);
+	ret = bloom_filter_contains(&filter, &key, settings);
+	clear_bloom_key(&key);
+	return ret != 0;
+}
+
 static struct origin *find_origin(struct scoreboard *sb,
 				  struct commit *parent,
 				  struct origin *origin)
@@ -538,6 +562,19 @@ static struct origin *find_origin(struct scoreboard *sb,
 			return origin_incref (porigin);
 		}
 
+	/*
+	 * The Bloom filters know about the first parent, and can
+	 * tell that the path is the same without a diff.
+	 */
+	if (!reverse && origin->commit->parents &&
+	    origin->commit->parents->item == parent &&
+	    !maybe_changed_path(origin)) {
+		porigin = get_origin(sb, parent, origin->path);
+		hashcpy(porigin->blob_sha1, origin->blob_sha1);
+		porigin->mode = origin->mode;
+		return porigin;
+	}
+
 	/* See if the origin->path is different between parent
 	 * and origin first.  Most of the time they are the
 	 * same and diff-tree is fairly efficient about this.
@@ -1277,6 +1314,18 @@ static void find_copy_in_parent(struct scoreboard *sb,
 	if (!DIFF_OPT_TST(&diff_opts, FIND_COPIES_HARDER))
 		diffcore_std(&diff_opts);
 
+	if (promisor_remote()) {
+		struct sha1_array to_fetch = SHA1_ARRAY_INIT;
+
+		for (i = 0; i < diff_queued_diff.nr; i++) {
+			struct diff_filespec *one = diff_queued_diff.queue[i]->one;
+			if (DIFF_FILE_VALID(one) && !S_ISGITLINK(one->mode))
+				sha1_array_append(&to_fetch, one->sha1);
+		}
+		prefetch_objects(&to_fetch);
+		sha1_array_clear(&to_fetch);
+	}
+
 	do {
 		struct blame_entry **unblamedtail = &unblamed;
 		blame_list = setup_blame_list(unblamed, &num_ents);
@@ -1398,6 +1447,26 @@ static void distribute_blame(struct scoreboard *sb, struct blame_entry *blamed)
 
 #define MAXSG 16
 
+/*
+ * In a partial clone, fetch the blobs of the target and all of its
+ * parents' origins together, before we start diffing them pairwise.
+ */
+static void prefetch_origin_blobs(struct origin *origin,
+				  struct origin **sg_origin, int num_sg)
+{
+	struct sha1_array to_fetch = SHA1_ARRAY_INIT;
+	int i;
+
+	if (!promisor_remote())
+		return;
+	sha1_array_append(&to_fetch, origin->blob_sha1);
+	for (i = 0; i < num_sg; i++)
+		if (sg_origin[i])
+			sha1_array_append(&to_fetch, sg_origin[i]->blob_sha1);
+	prefetch_objects(&to_fetch);
+	sha1_array_clear(&to_fetch);
+}
+
 static void pass_blame(struct scoreboard *sb, struct origin *origin, int opt)
 {
 	struct rev_info *revs = sb->revs;
@@ -1459,6 +1528,7 @@ static void pass_blame(struct scoreboard *sb, struct origin *origin, int opt)
 	}
 
 	num_commits++;
+	prefetch_origin_blobs(origin, sg_origin, num_sg);
 	for (i = 0, sg = first_scapegoat(revs, commit);
 	     i < num_sg && sg;
 	     sg = sg->next, i++) {
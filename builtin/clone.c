@@ -23,6 +23,7 @@
 #include "remote.h"
 #include "run-command.h"
 #include "connected.h"
+#include "bundle-uri.h"
 
 /*
  * Overall FIXMEs:
@@ -48,6 +49,9 @@ static int option_verbosity;
 static int option_progress = -1;
 static struct string_list option_config;
 static struct string_list option_reference;
+static struct string_list option_bundle_uri;
+static int transfer_bundle_uri;
+static struct list_objects_filter_options filter_options;
 
 static int opt_parse_reference(const struct option *opt, const char *arg, int unset)
 {
@@ -89,10 +93,13 @@ static struct option builtin_clone_options[] = {
 		   N_("checkout <branch> instead of the remote's HEAD")),
 	OPT_STRING('u', "upload-pack", &option_upload_pack, N_("path"),
 		   N_("path to git-upload-pack on the remote")),
+	OPT_STRING_LIST(0, "bundle-uri", &option_bundle_uri, N_("uri"),
+			N_("unbundle the bundle at <uri> before fetching")),
 	OPT_STRING(0, "depth", &option_depth, N_("depth"),
 		    N_("create a shallow clone of that depth")),
 	OPT_BOOL(0, "single-branch", &option_single_branch,
 		    N_("clone only one branch, HEAD or --branch")),
+	OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
 	OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
 		   N_("separate git dir from working tree")),
 	OPT_STRING_LIST('c', "config", &option_config, N_("key=value"),
@@ -438,6 +445,42 @@ static void remove_junk_on_signal(int signo)
 	raise(signo);
 }
 
+static int git_clone_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "transfer.bundleuri")) {
+		transfer_bundle_uri = git_config_bool(var, value);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
+/*
+ * Unbundle the bundles given with --bundle-uri, or else the ones the
+ * remote offers if transfer.bundleURI is set, so that the fetch that
+ * follows only has to get what they lack.
+ */
+static void fetch_bundle_uris(struct transport *transport)
+{
+	struct string_list uris = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	unsigned flags = 0;
+
+	for_each_string_list_item(item, &option_bundle_uri)
+		string_list_append(&uris, item->string);
+	if (!uris.nr && transfer_bundle_uri) {
+		transport_get_bundle_uris(transport, &uris);
+		flags |= BUNDLE_URI_FROM_REMOTE;
+	}
+
+	for_each_string_list_item(item, &uris) {
+		if (0 <= option_verbosity)
+			fprintf(stderr, _("Unbundling '%s'...\n"), item->string);
+		if (fetch_bundle_uri(item->string, flags))
+			warning(_("ignoring bundle '%s'"), item->string);
+	}
+	string_list_clear(&uris, 0);
+}
+
 static struct ref *find_remote_branch(const struct ref *refs, const char *branch)
 {
 	struct ref *ref;
@@ -864,7 +907,7 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	init_db(option_template, INIT_DB_QUIET);
 	write_config(&option_config);
 
-	git_config(git_default_config, NULL);
+	git_config(git_clone_config, NULL);
 
 	if (option_bare) {
 		if (option_mirror)
@@ -881,6 +924,15 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	git_config_set(key.buf, repo);
 	strbuf_reset(&key);
 
+	if (filter_options.choice) {
+		strbuf_addf(&key, "remote.%s.promisor", option_origin);
+		git_config_set(key.buf, "true");
+		strbuf_reset(&key);
+		strbuf_addf(&key, "remote.%s.partialclonefilter", option_origin);
+		git_config_set(key.buf, filter_options.filter_spec);
+		strbuf_reset(&key);
+	}
+
 	if (option_reference.nr)
 		setup_reference();
 
@@ -896,6 +948,10 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	if (is_local) {
 		if (option_depth)
 			warning(_("--depth is ignored in local clones; use file:// instead."));
+		if (filter_options.choice)
+			warning(_("--filter is ignored in local clones; use file:// instead."));
+		if (option_bundle_uri.nr)
+			warning(_("--bundle-uri is ignored in local clones; use file:// instead."));
 		if (!access(mkpath("%s/shallow", path), F_OK)) {
 			if (option_local > 0)
 				warning(_("source repository is shallow, ignoring --local"));
@@ -916,6 +972,11 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 				     option_depth);
 	if (option_single_branch)
 		transport_set_option(transport, TRANS_OPT_FOLLOWTAGS, "1");
+	if (filter_options.choice) {
+		transport_set_option(transport, TRANS_OPT_LIST_OBJECTS_FILTER,
+				     filter_options.filter_spec);
+		transport_set_option(transport, TRANS_OPT_FROM_PROMISOR, "1");
+	}
 
 	transport_set_verbosity(transport, option_verbosity, option_progress);
 
@@ -926,9 +987,13 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	if (transport->smart_options && !option_depth)
 		transport->smart_options->check_self_contained_and_connected = 1;
 
-	refs = transport_get_remote_refs(transport);
+	refs = transport_get_remote_refs(transport, NULL);
 
 	if (refs) {
+		/* bundles hold complete history, which these do not want */
+		if (!is_local && !option_depth && !filter_options.choice)
+			fetch_bundle_uris(transport);
+
 		mapped_refs = wanted_peer_refs(refs, refspec);
 		/*
 		 * transport_get_remote_refs() may return refs with null sha-1
@@ -0,0 +1,155 @@
+#include "builtin.h"
+#include "cache.h"
+#include "commit.h"
+#include "refs.h"
+#include "parse-options.h"
+#include "sha1-array.h"
+#include "commit-graph.h"
+
+static const char * const builtin_commit_graph_usage[] = {
+	N_("git commit-graph write [--object-dir <objdir>] [--reachable | --stdin-commits] [--[no-]changed-paths]"),
+	N_("git commit-graph verify [--object-dir <objdir>]"),
+	NULL
+};
+
+static const char * const builtin_commit_graph_write_usage[] = {
+	N_("git commit-graph write [--object-dir <objdir>] [--reachable | --stdin-commits] [--[no-]changed-paths]"),
+	NULL
+};
+
+static const char * const builtin_commit_graph_verify_usage[] = {
+	N_("git commit-graph verify [--object-dir <objdir>]"),
+	NULL
+};
+
+static const char *object_dir;
+
+static int add_ref_to_list(const char *refname, const unsigned char *sha1,
+			   int flags, void *cb_data)
+{
+	struct sha1_array *commits = cb_data;
+	sha1_array_append(commits, sha1);
+	return 0;
+}
+
+static void add_packed_commits(struct sha1_array *commits)
+{
+	struct packed_git *p;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		uint32_t i;
+
+		if (!p->pack_local || open_pack_index(p))
+			continue;
+		for (i = 0; i < p->num_objects; i++) {
+			const unsigned char *sha1 = nth_packed_object_sha1(p, i);
+			if (sha1_object_info(sha1, NULL) == OBJ_COMMIT)
+				sha1_array_append(commits, sha1);
+		}
+	}
+}
+
+static void add_stdin_commits(struct sha1_array *commits)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+		unsigned char sha1[20];
+
+		if (get_sha1_hex(buf.buf, sha1))
+			die(_("invalid commit object id: %s"), buf.buf);
+		sha1_array_append(commits, sha1);
+	}
+	strbuf_release(&buf);
+}
+
+static int graph_write(int argc, const char **argv, const char *prefix)
+{
+	struct sha1_array commits = SHA1_ARRAY_INIT;
+	int reachable = 0, stdin_commits = 0, changed_paths = -1, ret;
+	unsigned flags = 0;
+	struct option options[] = {
+		OPT_STRING(0, "object-dir", &object_dir, N_("dir"),
+			   N_("the object directory to store the graph")),
+		OPT_BOOL(0, "reachable", &reachable,
+			 N_("start walk at all refs")),
+		OPT_BOOL(0, "stdin-commits", &stdin_commits,
+			 N_("start walk at commits listed by stdin")),
+		OPT_BOOL(0, "changed-paths", &changed_paths,
+			 N_("store changed-path Bloom filters")),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_commit_graph_write_usage, 0);
+	if (argc)
+		usage_with_options(builtin_commit_graph_write_usage, options);
+	if (reachable && stdin_commits)
+		die(_("use at most one of --reachable and --stdin-commits"));
+
+	if (reachable) {
+		head_ref(add_ref_to_list, &commits);
+		for_each_ref(add_ref_to_list, &commits);
+	} else if (stdin_commits)
+		add_stdin_commits(&commits);
+	else
+		add_packed_commits(&commits);
+
+	/* by default, keep the filters if the current graph has them */
+	if (changed_paths < 0) {
+		char *graph_name = get_commit_graph_filename(object_dir);
+		struct commit_graph *g = load_commit_graph_one(graph_name);
+
+		changed_paths = g && g->chunk_bloom_data;
+		free_commit_graph(g);
+		free(graph_name);
+	}
+	if (changed_paths)
+		flags |= COMMIT_GRAPH_WRITE_BLOOM_FILTERS;
+
+	ret = write_commit_graph(object_dir, &commits, flags);
+	sha1_array_clear(&commits);
+	return !!ret;
+}
+
+static int graph_verify(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_STRING(0, "object-dir", &object_dir, N_("dir"),
+			   N_("the object directory containing the graph")),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_commit_graph_verify_usage, 0);
+	if (argc)
+		usage_with_options(builtin_commit_graph_verify_usage, options);
+
+	return !!verify_commit_graph(object_dir);
+}
+
+int cmd_commit_graph(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_STRING(0, "object-dir", &object_dir, N_("dir"),
+			   N_("the object directory to store the graph")),
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_commit_graph_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+	if (!object_dir)
+		object_dir = get_object_directory();
+
+	if (argc > 0) {
+		if (!strcmp(argv[0], "write"))
+			return graph_write(argc, argv, prefix);
+		if (!strcmp(argv[0], "verify"))
+			return graph_verify(argc, argv, prefix);
+	}
+
+	usage_with_options(builtin_commit_graph_usage, options);
+}
@@ -4,11 +4,14 @@
 #include "remote.h"
 #include "connect.h"
 #include "sha1-array.h"
+#include "argv-array.h"
 
 static const char fetch_pack_usage[] =
 "git fetch-pack [--all] [--stdin] [--quiet|-q] [--keep|-k] [--thin] "
 "[--include-tag] [--upload-pack=<git-upload-pack>] [--depth=<n>] "
-"[--no-progress] [--diag-url] [-v] [<host>:]<directory> [<refs>...]";
+"[--filter=<filter-spec>] [--negotiation-algorithm=<name>] "
+"[--no-progress] [--diag-url] [-v] "
+"[<host>:]<directory> [<refs>...]";
 
 static void add_sought_entry_mem(struct ref ***sought, int *nr, int *alloc,
 				 const char *name, int namelen)
@@ -48,6 +51,8 @@ int cmd_fetch_pack(int argc, const char **argv, const char *prefix)
 	struct child_process *conn;
 	struct fetch_pack_args args;
 	struct sha1_array shallow = SHA1_ARRAY_INIT;
+	struct packet_reader reader;
+	enum protocol_version version;
 
 	packet_trace_identity("fetch-pack");
 
@@ -102,6 +107,16 @@ int cmd_fetch_pack(int argc, const char **argv, const char *prefix)
 			args.depth = strtol(arg + 8, NULL, 0);
 			continue;
 		}
+		if (starts_with(arg, "--filter=")) {
+			if (parse_list_objects_filter(&args.filter_options,
+						      arg + 9))
+				usage(fetch_pack_usage);
+			continue;
+		}
+		if (starts_with(arg, "--negotiation-algorithm=")) {
+			args.negotiation_algorithm = arg + 24;
+			continue;
+		}
 		if (!strcmp("--no-progress", arg)) {
 			args.no_progress = 1;
 			continue;
@@ -175,10 +190,23 @@ int cmd_fetch_pack(int argc, const char **argv, const char *prefix)
 		if (!conn)
 			return args.diag_url ? 0 : 1;
 	}
-	get_remote_heads(fd[0], NULL, 0, &ref, 0, NULL, &shallow);
+	packet_reader_init(&reader, fd[0], NULL, 0,
+			   PACKET_READ_CHOMP_NEWLINE |
+			   PACKET_READ_GENTLE_ON_EOF);
+	version = discover_version(&reader);
+	if (version == protocol_v2) {
+		struct argv_array ref_prefixes = ARGV_ARRAY_INIT;
+
+		/* list only the refs we were asked for */
+		for (i = 0; !args.fetch_all && i < nr_sought; i++)
+			argv_array_push(&ref_prefixes, sought[i]->name);
+		get_remote_refs(fd[1], &reader, &ref, 0, &ref_prefixes);
+		argv_array_clear(&ref_prefixes);
+	} else
+		get_remote_heads(&reader, &ref, 0, NULL, &shallow);
 
 	ref = fetch_pack(&args, fd, conn, ref, dest, sought, nr_sought,
-			 &shallow, pack_lockfile_ptr);
+			 &shallow, pack_lockfile_ptr, version);
 	if (pack_lockfile) {
 		printf("lock %s\n", pack_lockfile);
 		fflush(stdout);
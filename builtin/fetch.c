@@ -211,7 +211,7 @@ static void find_non_local_tags(struct transport *transport,
 	struct string_list_item *item = NULL;
 
 	for_each_ref(add_existing, &existing_refs);
-	for (ref = transport_get_remote_refs(transport); ref; ref = ref->next) {
+	for (ref = transport_get_remote_refs(transport, NULL); ref; ref = ref->next) {
 		if (!starts_with(ref->name, "refs/tags/"))
 			continue;
 
@@ -292,7 +292,36 @@ static struct ref *get_ref_map(struct transport *transport,
 	/* opportunistically-updated references: */
 	struct ref *orefs = NULL, **oref_tail = &orefs;
 
-	const struct ref *remote_refs = transport_get_remote_refs(transport);
+	const struct ref *remote_refs;
+	struct argv_array ref_prefixes = ARGV_ARRAY_INIT;
+
+	/*
+	 * Tell the transport which refs we are going to look at, so
+	 * that it does not have to list all of them if it can help it.
+	 */
+	if (refspec_count) {
+		refspec_ref_prefixes(refspecs, refspec_count, &ref_prefixes);
+	} else if (!refmap_array) {
+		struct remote *remote = transport->remote;
+		struct branch *branch = branch_get(NULL);
+
+		if (remote && remote->fetch_refspec_nr)
+			refspec_ref_prefixes(remote->fetch,
+					     remote->fetch_refspec_nr,
+					     &ref_prefixes);
+		if (branch_has_merge_config(branch) && remote &&
+		    !strcmp(branch->remote_name, remote->name))
+			for (i = 0; i < branch->merge_nr; i++)
+				expand_ref_prefix(&ref_prefixes,
+						  branch->merge[i]->src);
+		if (!ref_prefixes.argc)
+			argv_array_push(&ref_prefixes, "HEAD");
+	}
+	if (tags != TAGS_UNSET && ref_prefixes.argc)
+		argv_array_push(&ref_prefixes, "refs/tags/");
+
+	remote_refs = transport_get_remote_refs(transport, &ref_prefixes);
+	argv_array_clear(&ref_prefixes);
 
 	if (refspec_count) {
 		struct refspec *fetch_refspec;
@@ -840,6 +869,12 @@ static struct transport *prepare_transport(struct remote *remote)
 		set_option(transport, TRANS_OPT_DEPTH, depth);
 	if (update_shallow)
 		set_option(transport, TRANS_OPT_UPDATE_SHALLOW, "yes");
+	if (remote->promisor) {
+		set_option(transport, TRANS_OPT_FROM_PROMISOR, "yes");
+		if (remote->partial_clone_filter)
+			set_option(transport, TRANS_OPT_LIST_OBJECTS_FILTER,
+				   remote->partial_clone_filter);
+	}
 	return transport;
 }
 
@@ -11,9 +11,10 @@
 #include "exec_cmd.h"
 #include "streaming.h"
 #include "thread-utils.h"
+#include "hashmap.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--promisor] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -77,6 +78,7 @@ static int do_fsck_object;
 static int verbose;
 static int show_stat;
 static int check_self_contained_and_connected;
+static int promisor;
 
 static struct progress *progress;
 
@@ -108,6 +110,49 @@ static pthread_mutex_t work_mutex;
 #define work_lock()		lock_mutex(&work_mutex)
 #define work_unlock()		unlock_mutex(&work_mutex)
 
+/*
+ * In the first pass, the objects inflated by the main thread wait
+ * in a ring of max_queued entries for a thread to hash them, or to
+ * apply them to their base if they are deltas.
+ */
+struct first_pass_job {
+	struct object_entry *obj;
+	void *data;
+};
+static struct first_pass_job *job_ring;
+static int job_first, nr_queued, max_queued, input_done;
+static pthread_cond_t work_cond;
+static pthread_cond_t space_cond;
+
+/*
+ * A delta received before its base was resolved waits for it in
+ * first_waiting[base] and then next_waiting[delta], ending with -1.
+ * The real_type of a delta stops being a delta type once it has
+ * been resolved.
+ */
+static int *first_waiting, *next_waiting;
+static pthread_mutex_t resolved_mutex;
+#define resolved_lock()		lock_mutex(&resolved_mutex)
+#define resolved_unlock()	unlock_mutex(&resolved_mutex)
+
+/*
+ * The contents of the objects received most recently, up to
+ * delta_base_cache_limit, for the deltas that follow them.
+ */
+struct received_object {
+	struct hashmap_entry ent;
+	struct received_object *next;
+	int obj_no;
+	void *data;
+	unsigned long size;
+};
+static struct hashmap received;
+static struct received_object *received_oldest, **received_newest;
+static size_t received_used;
+static pthread_mutex_t received_mutex;
+#define received_lock()		lock_mutex(&received_mutex)
+#define received_unlock()	unlock_mutex(&received_mutex)
+
 static pthread_mutex_t deepest_delta_mutex;
 #define deepest_delta_lock()	lock_mutex(&deepest_delta_mutex)
 #define deepest_delta_unlock()	unlock_mutex(&deepest_delta_mutex)
@@ -135,6 +180,10 @@ static void init_thread(void)
 	init_recursive_mutex(&read_mutex);
 	pthread_mutex_init(&counter_mutex, NULL);
 	pthread_mutex_init(&work_mutex, NULL);
+	pthread_cond_init(&work_cond, NULL);
+	pthread_cond_init(&space_cond, NULL);
+	pthread_mutex_init(&resolved_mutex, NULL);
+	pthread_mutex_init(&received_mutex, NULL);
 	if (show_stat)
 		pthread_mutex_init(&deepest_delta_mutex, NULL);
 	pthread_key_create(&key, NULL);
@@ -157,6 +206,10 @@ static void cleanup_thread(void)
 	pthread_mutex_destroy(&read_mutex);
 	pthread_mutex_destroy(&counter_mutex);
 	pthread_mutex_destroy(&work_mutex);
+	pthread_cond_destroy(&work_cond);
+	pthread_cond_destroy(&space_cond);
+	pthread_mutex_destroy(&resolved_mutex);
+	pthread_mutex_destroy(&received_mutex);
 	if (show_stat)
 		pthread_mutex_destroy(&deepest_delta_mutex);
 	for (i = 0; i < nr_threads; i++)
@@ -206,7 +259,14 @@ static unsigned check_object(struct object *obj)
 
 	if (!(obj->flags & FLAG_CHECKED)) {
 		unsigned long size;
-		int type = sha1_object_info(obj->sha1, &size);
+		int type;
+
+		/* a promisor pack may point at what we do not have */
+		if (promisor && !has_sha1_file(obj->sha1)) {
+			obj->flags |= FLAG_CHECKED;
+			return 1;
+		}
+		type = sha1_object_info(obj->sha1, &size);
 		if (type <= 0)
 			die(_("did not receive expected object %s"),
 			      sha1_to_hex(obj->sha1));
@@ -429,16 +489,21 @@ static void *unpack_entry_data(unsigned long offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
+	if (type == OBJ_BLOB && size > big_file_threshold)
+		buf = fixed_buf;
+	else
+		buf = xmalloc(size);
+#ifndef NO_PTHREADS
+	/* The first pass threads hash everything that is not streamed. */
+	if (threads_active && buf != fixed_buf)
+		sha1 = NULL;
+#endif
+	if (!is_delta_type(type) && sha1) {
 		hdrlen = sprintf(hdr, "%s %lu", typename(type), size) + 1;
 		git_SHA1_Init(&c);
 		git_SHA1_Update(&c, hdr, hdrlen);
 	} else
 		sha1 = NULL;
-	if (type == OBJ_BLOB && size > big_file_threshold)
-		buf = fixed_buf;
-	else
-		buf = xmalloc(size);
 
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
@@ -928,8 +993,15 @@ static struct base_data *find_unresolved_deltas_1(struct base_data *base,
 		struct object_entry *child = objects + deltas[base->ofs_first].obj_no;
 		struct base_data *result = alloc_base_data();
 
-		assert(child->real_type == OBJ_OFS_DELTA);
-		resolve_delta(child, base, result);
+		if (child->real_type == OBJ_OFS_DELTA)
+			resolve_delta(child, base, result);
+		else
+			/*
+			 * Resolved while the pack was received; only
+			 * walk through it, as one of its deltas may
+			 * still need its content.
+			 */
+			result->obj = child;
 		if (base->ofs_first == base->ofs_last)
 			free_base_data(base);
 
@@ -980,6 +1052,321 @@ static void resolve_base(struct object_entry *obj)
 }
 
 #ifndef NO_PTHREADS
+static int received_cmp(const struct received_object *a,
+			const struct received_object *b, const void *unused)
+{
+	return a->obj_no != b->obj_no;
+}
+
+static struct received_object *find_received(int obj_no)
+{
+	struct received_object key;
+
+	hashmap_entry_init(&key, obj_no);
+	key.obj_no = obj_no;
+	return hashmap_get(&received, &key, NULL);
+}
+
+/* Keep data, which now belongs to us, for the deltas that follow. */
+static void remember_received(struct object_entry *obj, void *data,
+			      unsigned long size)
+{
+	struct received_object *r;
+
+	received_lock();
+	if (size > delta_base_cache_limit || find_received(obj - objects)) {
+		received_unlock();
+		free(data);
+		return;
+	}
+	r = xmalloc(sizeof(*r));
+	hashmap_entry_init(r, obj - objects);
+	r->obj_no = obj - objects;
+	r->data = data;
+	r->size = size;
+	r->next = NULL;
+	hashmap_add(&received, r);
+	*received_newest = r;
+	received_newest = &r->next;
+	received_used += size;
+
+	while (received_used > delta_base_cache_limit) {
+		r = received_oldest;
+		received_oldest = r->next;
+		if (!received_oldest)
+			received_newest = &received_oldest;
+		hashmap_remove(&received, r, NULL);
+		received_used -= r->size;
+		free(r->data);
+		free(r);
+	}
+	received_unlock();
+}
+
+/*
+ * Return a copy of the content of an object that has been received
+ * and, if it is a delta, resolved.  A non-delta that has been
+ * forgotten is read back from the pack; for a delta, that would mean
+ * reading back and patching its whole chain of bases, so return NULL
+ * and leave the deltas based on it to the second pass instead.
+ */
+static void *received_data(struct object_entry *obj, unsigned long *size)
+{
+	struct received_object *r;
+	void *data = NULL;
+
+	received_lock();
+	r = find_received(obj - objects);
+	if (r) {
+		data = xmalloc(r->size);
+		memcpy(data, r->data, r->size);
+		*size = r->size;
+	}
+	received_unlock();
+	if (data || is_delta_type(obj->type))
+		return data;
+
+	data = get_data_from_pack(obj);
+	*size = obj->size;
+	if (*size <= delta_base_cache_limit)
+		remember_received(obj, xmemdupz(data, *size), *size);
+	return data;
+}
+
+/*
+ * Apply the delta obj (read from the pack if delta_data is NULL) to
+ * base_data, the content of its base, which we free. Return the
+ * result, and mark obj as resolved.
+ */
+static void *resolve_received_1(struct object_entry *obj, void *delta_data,
+				void *base_data, unsigned long base_size,
+				unsigned long *size)
+{
+	struct object_entry *base = &objects[obj->base_object_no];
+	enum object_type type = base->real_type;
+	void *data;
+
+	if (!delta_data)
+		delta_data = get_data_from_pack(obj);
+	data = patch_delta(base_data, base_size, delta_data, obj->size, size);
+	free(delta_data);
+	free(base_data);
+	if (!data)
+		bad_object(obj->idx.offset, _("failed to apply delta"));
+	hash_sha1_file(data, *size, typename(type), obj->idx.sha1);
+	sha1_object(data, NULL, *size, type, obj->idx.sha1);
+	if (show_stat) {
+		obj->delta_depth = base->delta_depth + 1;
+		deepest_delta_lock();
+		if (deepest_delta < obj->delta_depth)
+			deepest_delta = obj->delta_depth;
+		deepest_delta_unlock();
+	}
+	counter_lock();
+	nr_resolved_deltas++;
+	counter_unlock();
+	return data;
+}
+
+/*
+ * Resolve the delta obj against base_data (see resolve_received_1()),
+ * then the deltas that were waiting for it, and theirs.  Only the
+ * object being patched is held outside the bounded cache of received
+ * objects: a waiting delta whose base has been dropped from that cache
+ * by the time we get to it is left for the second pass.
+ */
+static void resolve_received(struct object_entry *obj, void *delta_data,
+			     void *base_data, unsigned long base_size)
+{
+	int *todo = NULL, nr = 0, alloc = 0;
+
+	for (;;) {
+		unsigned long size;
+		void *data;
+		int child;
+
+		data = resolve_received_1(obj, delta_data, base_data,
+					  base_size, &size);
+		resolved_lock();
+		obj->real_type = objects[obj->base_object_no].real_type;
+		child = first_waiting[obj - objects];
+		first_waiting[obj - objects] = -1;
+		resolved_unlock();
+		for (; child >= 0; child = next_waiting[child]) {
+			ALLOC_GROW(todo, nr + 1, alloc);
+			todo[nr++] = child;
+		}
+		remember_received(obj, data, size);
+
+		base_data = NULL;
+		while (nr && !base_data) {
+			obj = &objects[todo[--nr]];
+			base_data = received_data(&objects[obj->base_object_no],
+						  &base_size);
+		}
+		if (!base_data)
+			break;
+		delta_data = NULL;
+	}
+	free(todo);
+}
+
+static void *threaded_first_pass(void *data)
+{
+	set_thread_data(data);
+	for (;;) {
+		struct first_pass_job job;
+
+		work_lock();
+		while (!nr_queued && !input_done)
+			pthread_cond_wait(&work_cond, &work_mutex);
+		if (!nr_queued) {
+			work_unlock();
+			break;
+		}
+		job = job_ring[job_first];
+		job_first = (job_first + 1) % max_queued;
+		nr_queued--;
+		pthread_cond_signal(&space_cond);
+		work_unlock();
+
+		if (is_delta_type(job.obj->type)) {
+			unsigned long base_size;
+			void *base;
+
+			base = received_data(&objects[job.obj->base_object_no],
+					     &base_size);
+			if (base)
+				resolve_received(job.obj, job.data,
+						 base, base_size);
+			else
+				free(job.data); /* left to the second pass */
+			continue;
+		}
+		hash_sha1_file(job.data, job.obj->size,
+			       typename(job.obj->type), job.obj->idx.sha1);
+		sha1_object(job.data, NULL, job.obj->size, job.obj->type,
+			    job.obj->idx.sha1);
+		remember_received(job.obj, job.data, job.obj->size);
+	}
+	return NULL;
+}
+
+static void queue_first_pass(struct object_entry *obj, void *data)
+{
+	work_lock();
+	while (nr_queued == max_queued)
+		pthread_cond_wait(&space_cond, &work_mutex);
+	job_ring[(job_first + nr_queued) % max_queued].obj = obj;
+	job_ring[(job_first + nr_queued) % max_queued].data = data;
+	nr_queued++;
+	pthread_cond_signal(&work_cond);
+	work_unlock();
+}
+
+static void start_first_pass_threads(void)
+{
+	int i;
+
+	init_thread();
+	/* enough to keep the threads busy without hoarding memory */
+	max_queued = 4 * nr_threads;
+	job_ring = xcalloc(max_queued, sizeof(*job_ring));
+	job_first = nr_queued = input_done = 0;
+	first_waiting = xmalloc(nr_objects * sizeof(*first_waiting));
+	for (i = 0; i < nr_objects; i++)
+		first_waiting[i] = -1;
+	next_waiting = xmalloc(nr_objects * sizeof(*next_waiting));
+	hashmap_init(&received, (hashmap_cmp_fn)received_cmp, 0);
+	received_oldest = NULL;
+	received_newest = &received_oldest;
+	received_used = 0;
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 threaded_first_pass, thread_data + i);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+static void finish_first_pass_threads(void)
+{
+	int i;
+
+	work_lock();
+	input_done = 1;
+	pthread_cond_broadcast(&work_cond);
+	work_unlock();
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	cleanup_thread();
+	free(job_ring);
+	job_ring = NULL;
+	free(first_waiting);
+	free(next_waiting);
+	first_waiting = next_waiting = NULL;
+	while (received_oldest) {
+		struct received_object *r = received_oldest;
+		received_oldest = r->next;
+		free(r->data);
+	}
+	hashmap_free(&received, 1);
+}
+
+/* Make sure the threads can read the pack up to offset. */
+static void flush_received(off_t offset)
+{
+	if (output_fd >= 0 && consumed_bytes - input_offset < offset)
+		flush();
+}
+
+/*
+ * The OFS_DELTA obj has just been received, and its base must have
+ * been received before.  Hand it, and its data, to a thread if the
+ * base has been resolved, or leave it for the thread that resolves
+ * the base.  Deltas whose base is a REF_DELTA, or a blob too large
+ * to be kept in memory, are left for the second pass.
+ */
+static void resolve_while_receiving(struct object_entry *obj,
+				    off_t base_offset, void *data)
+{
+	int nr = obj - objects, lo = 0, hi = nr, base_no = -1, ready;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (base_offset < objects[mid].idx.offset)
+			hi = mid;
+		else if (base_offset > objects[mid].idx.offset)
+			lo = mid + 1;
+		else {
+			base_no = mid;
+			break;
+		}
+	}
+	if (base_no < 0) {
+		/* the second pass will complain about it */
+		free(data);
+		return;
+	}
+	obj->base_object_no = base_no;
+	flush_received(objects[base_no + 1].idx.offset);
+
+	resolved_lock();
+	ready = !is_delta_type(objects[base_no].real_type) &&
+		objects[base_no].real_type != OBJ_BAD;
+	if (!ready) {
+		flush_received(consumed_bytes);
+		next_waiting[nr] = first_waiting[base_no];
+		first_waiting[base_no] = nr;
+	}
+	resolved_unlock();
+
+	if (ready)
+		queue_first_pass(obj, data);
+	else
+		free(data);
+}
+
 static void *threaded_second_pass(void *data)
 {
 	set_thread_data(data);
@@ -1010,6 +1397,10 @@ static void *threaded_second_pass(void *data)
  * - find locations of all objects;
  * - calculate SHA1 of all non-delta objects;
  * - remember base (SHA1 or offset) for all deltas.
+ *
+ * Finding where an object ends needs inflating it, so the main
+ * thread does that; with threads, the hashing and checking of the
+ * inflated objects is left to them.
  */
 static void parse_pack_objects(unsigned char *sha1)
 {
@@ -1021,6 +1412,10 @@ static void parse_pack_objects(unsigned char *sha1)
 		progress = start_progress(
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+#ifndef NO_PTHREADS
+	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS"))
+		start_first_pass_threads();
+#endif
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &delta->base, obj->idx.sha1);
@@ -1028,17 +1423,37 @@ static void parse_pack_objects(unsigned char *sha1)
 		if (is_delta_type(obj->type)) {
 			nr_deltas++;
 			delta->obj_no = i;
+#ifndef NO_PTHREADS
+			if (threads_active && obj->type == OBJ_OFS_DELTA) {
+				resolve_while_receiving(obj, delta->base.offset,
+							data);
+				data = NULL;
+			}
+#endif
 			delta++;
 		} else if (!data) {
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
-		} else
-			sha1_object(data, NULL, obj->size, obj->type, obj->idx.sha1);
+		} else {
+#ifndef NO_PTHREADS
+			if (threads_active) {
+				/* hashed, checked and freed by a thread */
+				queue_first_pass(obj, data);
+				data = NULL;
+			}
+#endif
+			if (data)
+				sha1_object(data, NULL, obj->size, obj->type, obj->idx.sha1);
+		}
 		free(data);
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
+#ifndef NO_PTHREADS
+	if (threads_active)
+		finish_first_pass_threads();
+#endif
 	stop_progress(&progress);
 
 	/* Check pack integrity */
@@ -1089,6 +1504,11 @@ static void resolve_deltas(void)
 	if (verbose)
 		progress = start_progress(_("Resolving deltas"), nr_deltas);
 
+	/* all of them may have been resolved while receiving the pack */
+	display_progress(progress, nr_resolved_deltas);
+	if (nr_resolved_deltas == nr_deltas)
+		return;
+
 #ifndef NO_PTHREADS
 	nr_dispatched = 0;
 	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS")) {
@@ -1274,6 +1694,33 @@ static void fix_unresolved_deltas(struct sha1file *f, int nr_unresolved)
 	free(sorted_by_pos);
 }
 
+/*
+ * A ".promisor" file next to the pack says its objects came from a
+ * promisor remote, and that what they point at may be missing.
+ */
+static void write_promisor_file(const char *final_pack_name,
+				unsigned char *sha1)
+{
+	struct strbuf name = STRBUF_INIT;
+	size_t len;
+	int fd;
+
+	if (final_pack_name && strip_suffix(final_pack_name, ".pack", &len))
+		strbuf_add(&name, final_pack_name, len);
+	else
+		strbuf_addf(&name, "%s/pack/pack-%s",
+			    get_object_directory(), sha1_to_hex(sha1));
+	strbuf_addstr(&name, ".promisor");
+
+	fd = open(name.buf, O_WRONLY|O_CREAT|O_TRUNC, 0444);
+	if (fd < 0 && errno != EEXIST)
+		die_errno(_("cannot write promisor file '%s'"), name.buf);
+	if (fd >= 0 && close(fd))
+		die_errno(_("cannot close written promisor file '%s'"),
+			  name.buf);
+	strbuf_release(&name);
+}
+
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
 		  const char *keep_name, const char *keep_msg,
@@ -1316,6 +1763,9 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 		}
 	}
 
+	if (promisor)
+		write_promisor_file(final_pack_name, sha1);
+
 	if (final_pack_name != curr_pack_name) {
 		if (!final_pack_name) {
 			snprintf(name, sizeof(name), "%s/pack/pack-%s.pack",
@@ -1545,6 +1995,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				verify = 1;
 				show_stat = 1;
 				stat_only = 1;
+			} else if (!strcmp(arg, "--promisor")) {
+				promisor = 1;
 			} else if (!strcmp(arg, "--keep")) {
 				keep_msg = "";
 			} else if (starts_with(arg, "--keep=")) {
@@ -183,7 +183,9 @@ static int create_default_files(const char *template_path)
 	unsigned len = strlen(git_dir);
 	static char path[PATH_MAX];
 	struct stat st1;
-	char repo_version_string[10];
+	char repo_version_string[16];
+	/* copying the templates overwrites the version just checked */
+	int repo_version = repository_format_version;
 	char junk[2];
 	int reinit;
 	int filemode;
@@ -242,7 +244,11 @@ static int create_default_files(const char *template_path)
 	}
 
 	/* This forces creation of new config file */
-	sprintf(repo_version_string, "%d", GIT_REPO_VERSION);
+	/* do not downgrade a repository that uses extensions */
+	if (repo_version < GIT_REPO_VERSION)
+		repo_version = GIT_REPO_VERSION;
+	snprintf(repo_version_string, sizeof(repo_version_string), "%d",
+		 repo_version);
 	git_config_set("core.repositoryformatversion", repo_version_string);
 
 	path[len] = 0;
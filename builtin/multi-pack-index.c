@@ -0,0 +1,40 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "midx.h"
+
+static const char * const builtin_multi_pack_index_usage[] = {
+	N_("git multi-pack-index [--object-dir=<dir>] (write [--bitmap] | verify)"),
+	NULL
+};
+
+static const char *object_dir;
+static int write_bitmap;
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_STRING(0, "object-dir", &object_dir, N_("dir"),
+			   N_("the object directory containing set of packfile and pack-index pairs")),
+		OPT_BOOL(0, "bitmap", &write_bitmap,
+			 N_("write a reachability bitmap along with the index")),
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_multi_pack_index_usage, 0);
+	if (!object_dir)
+		object_dir = get_object_directory();
+
+	if (argc != 1)
+		usage_with_options(builtin_multi_pack_index_usage, options);
+
+	if (!strcmp(argv[0], "write"))
+		return write_midx_file(object_dir,
+				       write_bitmap ? MIDX_WRITE_BITMAP : 0);
+	if (!strcmp(argv[0], "verify"))
+		return !!verify_midx_file(object_dir);
+
+	die(_("unrecognized verb: %s"), argv[0]);
+}
@@ -14,12 +14,14 @@
 #include "diff.h"
 #include "revision.h"
 #include "list-objects.h"
+#include "list-objects-filter-options.h"
 #include "pack-objects.h"
 #include "progress.h"
 #include "refs.h"
 #include "streaming.h"
 #include "thread-utils.h"
 #include "pack-bitmap.h"
+#include "delta-islands.h"
 
 static const char *pack_usage[] = {
 	N_("git pack-objects --stdout [options...] [< ref-list | < object-list]"),
@@ -66,6 +68,20 @@ static int use_bitmap_index = 1;
 static int write_bitmap_index;
 static uint16_t write_bitmap_options;
 
+static int thin;
+static int use_delta_islands;
+
+static struct list_objects_filter_options filter_options;
+
+/*
+ * Delta bases that are not part of the pack, but that the other side
+ * has because the bitmap walk excluded them. An on-disk delta against
+ * one of them can be sent as-is in a thin pack. These entries are
+ * never written; they only anchor such deltas.
+ */
+static khash_sha1 *ext_bases;
+static uint32_t nr_ext_bases;
+
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = 256 * 1024 * 1024;
 static unsigned long cache_max_small_delta_size = 1000;
@@ -633,6 +649,12 @@ static struct object_entry **compute_write_order(void)
 		objects[i].delta_child = NULL;
 		objects[i].delta_sibling = NULL;
 	}
+	if (ext_bases) {
+		struct object_entry *base;
+		kh_foreach_value(ext_bases, base, {
+			base->delta_child = NULL;
+		});
+	}
 
 	/*
 	 * Fully connect delta_child/delta_sibling network.
@@ -1324,6 +1346,31 @@ static void cleanup_preferred_base(void)
 	done_pbase_paths_num = done_pbase_paths_alloc = 0;
 }
 
+static struct object_entry *find_ext_base(const unsigned char *sha1)
+{
+	struct object_entry *base;
+	khiter_t pos;
+	int ret;
+
+	if (!thin || !bitmap_has_sha1_in_uninteresting(sha1))
+		return NULL;
+
+	if (!ext_bases)
+		ext_bases = kh_init_sha1();
+	pos = kh_get_sha1(ext_bases, sha1);
+	if (pos < kh_end(ext_bases))
+		return kh_value(ext_bases, pos);
+
+	base = xcalloc(1, sizeof(*base));
+	hashcpy(base->idx.sha1, sha1);
+	base->preferred_base = 1;
+	base->filled = 1; /* keeps it out of the write order */
+	pos = kh_put_sha1(ext_bases, base->idx.sha1, &ret);
+	kh_value(ext_bases, pos) = base;
+	nr_ext_bases++;
+	return base;
+}
+
 static void check_object(struct object_entry *entry)
 {
 	if (entry->in_pack) {
@@ -1401,11 +1448,16 @@ static void check_object(struct object_entry *entry)
 			break;
 		}
 
-		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL))) {
+		if (base_ref &&
+		    ((base_entry = packlist_find(&to_pack, base_ref, NULL)) ||
+		     (base_entry = find_ext_base(base_ref))) &&
+		    (!use_delta_islands ||
+		     in_same_island(entry->idx.sha1, base_ref))) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
-			 * in the list of objects we want to pack. Goodie!
+			 * in the list of objects we want to pack, or the
+			 * other side has it already. Goodie!
 			 *
 			 * Depth value does not matter - find_deltas() will
 			 * never consider reused delta as the base object to
@@ -1472,8 +1524,9 @@ static int pack_offset_sort(const void *_a, const void *_b)
 
 static void get_object_details(void)
 {
-	uint32_t i;
+	uint32_t i, nr_reused_deltas = 0;
 	struct object_entry **sorted_by_offset;
+	uint64_t start = getnanotime();
 
 	sorted_by_offset = xcalloc(to_pack.nr_objects, sizeof(struct object_entry *));
 	for (i = 0; i < to_pack.nr_objects; i++)
@@ -1485,9 +1538,14 @@ static void get_object_details(void)
 		check_object(entry);
 		if (big_file_threshold < entry->size)
 			entry->no_try_delta = 1;
+		if (entry->delta)
+			nr_reused_deltas++;
 	}
 
 	free(sorted_by_offset);
+	trace_performance_since(start, "check objects for reuse"
+				" (%"PRIu32" deltas, %"PRIu32" thin bases)",
+				nr_reused_deltas, nr_ext_bases);
 }
 
 /*
@@ -1585,6 +1643,11 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (trg_entry->type != src_entry->type)
 		return -1;
 
+	/* Nor with bases that some island of the target cannot reach */
+	if (use_delta_islands &&
+	    !in_same_island(trg_entry->idx.sha1, src_entry->idx.sha1))
+		return -1;
+
 	/*
 	 * We do not bother to try a delta that we discarded on an
 	 * earlier try, but only when reusing delta data.  Note that
@@ -2170,6 +2233,7 @@ static void prepare_pack(int window, int depth)
 
 	if (nr_deltas && n > 1) {
 		unsigned nr_done = 0;
+		uint64_t start = getnanotime();
 		if (progress)
 			progress_state = start_progress(_("Compressing objects"),
 							nr_deltas);
@@ -2178,12 +2242,16 @@ static void prepare_pack(int window, int depth)
 		stop_progress(&progress_state);
 		if (nr_done != nr_deltas)
 			die("inconsistency with delta count");
+		trace_performance_since(start, "compute deltas (%"PRIu32")",
+					nr_deltas);
 	}
 	free(delta_list);
 }
 
 static int git_pack_config(const char *k, const char *v, void *cb)
 {
+	if (!strcmp(k, "pack.island"))
+		return island_config(k, v, cb);
 	if (!strcmp(k, "pack.window")) {
 		window = git_config_int(k, v);
 		return 0;
@@ -2283,6 +2351,9 @@ static void show_commit(struct commit *commit, void *data)
 	add_object_entry(commit->object.sha1, OBJ_COMMIT, NULL, 0);
 	commit->object.flags |= OBJECT_ADDED;
 
+	if (use_delta_islands)
+		propagate_island_marks(commit);
+
 	if (write_bitmap_index)
 		index_commit_for_bitmap(commit);
 }
@@ -2297,6 +2368,21 @@ static void show_object(struct object *obj,
 	add_object_entry(obj->sha1, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
 
+	if (use_delta_islands && obj->type == OBJ_TREE) {
+		struct object_entry *entry;
+		const char *p;
+		unsigned depth;
+
+		/* the empty string is a root tree, which is depth 0 */
+		depth = *name ? 1 : 0;
+		for (p = strchr(name, '/'); p; p = strchr(p + 1, '/'))
+			depth++;
+
+		entry = packlist_find(&to_pack, obj->sha1, NULL);
+		if (entry && depth > entry->tree_depth)
+			entry->tree_depth = depth;
+	}
+
 	/*
 	 * We will have generated the hash from the name,
 	 * but not saved a pointer to it - we can free it
@@ -2447,9 +2533,13 @@ static int pack_options_allow_reuse(void)
 
 static int get_object_list_from_bitmap(struct rev_info *revs)
 {
+	uint64_t start = getnanotime();
+
 	if (prepare_bitmap_walk(revs) < 0)
 		return -1;
+	trace_performance_since(start, "bitmap walk");
 
+	start = getnanotime();
 	if (pack_options_allow_reuse() &&
 	    !reuse_partial_packfile_from_bitmap(
 			&reuse_packfile,
@@ -2459,8 +2549,12 @@ static int get_object_list_from_bitmap(struct rev_info *revs)
 		nr_result += reuse_packfile_objects;
 		display_progress(progress_state, nr_result);
 	}
+	trace_performance_since(start, "bitmap pack reuse (%"PRIu32" objects)",
+				reuse_packfile_objects);
 
+	start = getnanotime();
 	traverse_bitmap_commit_list(&add_object_entry_from_bitmap);
+	trace_performance_since(start, "enumerate objects from bitmap");
 	return 0;
 }
 
@@ -2505,10 +2599,17 @@ static void get_object_list(int ac, const char **av)
 	if (use_bitmap_index && !get_object_list_from_bitmap(&revs))
 		return;
 
+	if (use_delta_islands)
+		load_delta_islands();
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(&revs, show_edge);
-	traverse_commit_list(&revs, show_commit, show_object, NULL);
+	traverse_commit_list_filtered(&filter_options, &revs,
+				      show_commit, show_object, NULL);
+
+	if (use_delta_islands)
+		resolve_tree_islands(&to_pack);
 
 	if (keep_unreachable)
 		add_objects_in_unpacked_packs(&revs);
@@ -2566,11 +2667,12 @@ static int option_parse_ulong(const struct option *opt,
 int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 {
 	int use_internal_rev_list = 0;
-	int thin = 0;
 	int all_progress_implied = 0;
-	const char *rp_av[6];
+	const char *rp_av[8];
 	int rp_ac = 0;
 	int rev_list_unpacked = 0, rev_list_all = 0, rev_list_reflog = 0;
+	int exclude_promisor_objects = 0;
+	uint64_t start;
 	struct option pack_objects_options[] = {
 		OPT_SET_INT('q', "quiet", &progress,
 			    N_("do not show progress meter"), 0),
@@ -2628,6 +2730,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		  PARSE_OPT_OPTARG, option_parse_unpack_unreachable },
 		OPT_BOOL(0, "thin", &thin,
 			 N_("create thin packs")),
+		OPT_BOOL(0, "delta-islands", &use_delta_islands,
+			 N_("respect islands during delta compression")),
 		OPT_BOOL(0, "honor-pack-keep", &ignore_packed_keep,
 			 N_("ignore packs that have companion .keep file")),
 		OPT_INTEGER(0, "compression", &pack_compression_level,
@@ -2638,6 +2742,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("use a bitmap index if available to speed up counting objects")),
 		OPT_BOOL(0, "write-bitmap-index", &write_bitmap_index,
 			 N_("write a bitmap index together with the pack index")),
+		OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
+		OPT_BOOL(0, "exclude-promisor-objects", &exclude_promisor_objects,
+			 N_("do not pack objects in promisor packfiles")),
 		OPT_END(),
 	};
 
@@ -2678,6 +2785,15 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		use_internal_rev_list = 1;
 		rp_av[rp_ac++] = "--unpacked";
 	}
+	/* islands flow from children to parents */
+	if (use_delta_islands)
+		rp_av[rp_ac++] = "--topo-order";
+	if (exclude_promisor_objects) {
+		use_internal_rev_list = 1;
+		rp_av[rp_ac++] = "--exclude-promisor-objects";
+	}
+	if (filter_options.choice && !use_internal_rev_list)
+		die("--filter requires --revs");
 
 	if (!reuse_object)
 		reuse_delta = 0;
@@ -2704,10 +2820,13 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (keep_unreachable && unpack_unreachable)
 		die("--keep-unreachable and --unpack-unreachable are incompatible.");
 
-	if (!use_internal_rev_list || !pack_to_stdout || is_repository_shallow())
+	if (!use_internal_rev_list || !pack_to_stdout || is_repository_shallow() ||
+	    use_delta_islands || filter_options.choice)
 		use_bitmap_index = 0;
 
-	if (pack_to_stdout || !rev_list_all)
+	/* a bitmap needs every reachable object to be in the pack */
+	if (pack_to_stdout || !rev_list_all || filter_options.choice ||
+	    exclude_promisor_objects)
 		write_bitmap_index = 0;
 
 	if (progress && all_progress_implied)
@@ -2732,7 +2851,11 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		return 0;
 	if (nr_result)
 		prepare_pack(window, depth);
+	start = getnanotime();
 	write_pack_file();
+	trace_performance_since(start, "write pack (%"PRIu32" objects,"
+				" %"PRIu32" reused, %"PRIu32" reused deltas)",
+				written, reused, reused_delta);
 	if (progress)
 		fprintf(stderr, "Total %"PRIu32" (delta %"PRIu32"),"
 			" reused %"PRIu32" (delta %"PRIu32")\n",
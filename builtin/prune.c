@@ -71,9 +71,11 @@ static int prune_dir(int i, struct strbuf *path)
 
 			/*
 			 * Do we know about this object?
-			 * It must have been reachable
+			 * It must have been reachable.  The objects of
+			 * a partial clone's promisor packs, and those
+			 * they refer to, are kept as well.
 			 */
-			if (lookup_object(sha1))
+			if (lookup_object(sha1) || is_promisor_object(sha1))
 				continue;
 
 			strbuf_addf(path, "/%s", de->d_name);
@@ -151,6 +153,8 @@ int cmd_prune(int argc, const char **argv, const char *prefix)
 	expire = ULONG_MAX;
 	save_commit_buffer = 0;
 	check_replace_refs = 0;
+	/* pruning must not fetch what a partial clone lacks */
+	fetch_if_missing = 0;
 	init_revisions(&revs, prefix);
 
 	argc = parse_options(argc, argv, prefix, options, prune_usage, 0);
@@ -7,12 +7,31 @@
 #include "strbuf.h"
 #include "string-list.h"
 #include "argv-array.h"
+#include "midx.h"
+#include "fetch-object.h"
 
 static int delta_base_offset = 1;
 static int pack_kept_objects = -1;
 static int write_bitmaps;
+static int use_delta_islands;
+static int write_midx = -1;
 static char *packdir, *packtmp;
 
+static int midx_has_bitmap(const char *object_dir)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir);
+	char *bitmap_name;
+	int ret;
+
+	if (!m)
+		return 0;
+	bitmap_name = get_midx_bitmap_filename(m);
+	ret = !access(bitmap_name, F_OK);
+	free(bitmap_name);
+	close_midx(m);
+	return ret;
+}
+
 static const char *const git_repack_usage[] = {
 	N_("git repack [options]"),
 	NULL
@@ -33,6 +52,14 @@ static int repack_config(const char *var, const char *value, void *cb)
 		write_bitmaps = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "repack.usedeltaislands")) {
+		use_delta_islands = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "repack.writemultipackindex")) {
+		write_midx = git_config_bool(var, value);
+		return 0;
+	}
 	return git_default_config(var, value, cb);
 }
 
@@ -76,7 +103,7 @@ static void remove_pack_on_signal(int signo)
 
 /*
  * Adds all packs hex strings to the fname list, which do not
- * have a corresponding .keep file.
+ * have a corresponding .keep or .promisor file.
  */
 static void get_non_kept_pack_filenames(struct string_list *fname_list)
 {
@@ -94,7 +121,8 @@ static void get_non_kept_pack_filenames(struct string_list *fname_list)
 
 		fname = xmemdupz(e->d_name, len);
 
-		if (!file_exists(mkpath("%s/%s.keep", packdir, fname)))
+		if (!file_exists(mkpath("%s/%s.keep", packdir, fname)) &&
+		    !file_exists(mkpath("%s/%s.promisor", packdir, fname)))
 			string_list_append_nodup(fname_list, fname);
 		else
 			free(fname);
@@ -174,6 +202,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("pass --local to git-pack-objects")),
 		OPT_BOOL('b', "write-bitmap-index", &write_bitmaps,
 				N_("write bitmap index")),
+		OPT_BOOL('i', "delta-islands", &use_delta_islands,
+				N_("pass --delta-islands to git-pack-objects")),
 		OPT_STRING(0, "unpack-unreachable", &unpack_unreachable, N_("approxidate"),
 				N_("with -A, do not loosen objects older than this")),
 		OPT_STRING(0, "window", &window, N_("n"),
@@ -223,6 +253,14 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_pushf(&cmd_args, "--no-reuse-object");
 	if (write_bitmaps)
 		argv_array_push(&cmd_args, "--write-bitmap-index");
+	if (use_delta_islands)
+		argv_array_push(&cmd_args, "--delta-islands");
+	/*
+	 * Packs from the promisor remote of a partial clone are left
+	 * alone; what they point at is not ours to pack.
+	 */
+	if (promisor_remote())
+		argv_array_push(&cmd_args, "--exclude-promisor-objects");
 
 	if (pack_everything & ALL_INTO_ONE) {
 		get_non_kept_pack_filenames(&existing_packs);
@@ -399,6 +437,24 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_clear(&cmd_args);
 	}
 
+	/*
+	 * An existing multi-pack index names the packs we just replaced;
+	 * refresh it rather than leave it stale (and hence unused).
+	 */
+	if (write_midx < 0) {
+		char *midx_name = get_midx_filename(get_object_directory());
+		write_midx = !access(midx_name, F_OK);
+		free(midx_name);
+	}
+	if (write_midx) {
+		unsigned flags = 0;
+
+		/* likewise for its bitmap, which would become useless */
+		if (write_bitmaps || midx_has_bitmap(get_object_directory()))
+			flags |= MIDX_WRITE_BITMAP;
+		write_midx_file(get_object_directory(), flags);
+	}
+
 	if (!no_update_server_info) {
 		argv_array_push(&cmd_args, "update-server-info");
 		memset(&cmd, 0, sizeof(cmd));
@@ -3,6 +3,7 @@
 #include "diff.h"
 #include "revision.h"
 #include "list-objects.h"
+#include "list-objects-filter-options.h"
 #include "pack.h"
 #include "pack-bitmap.h"
 #include "builtin.h"
@@ -42,18 +43,39 @@ static const char rev_list_usage[] =
 "    --abbrev=<n> | --no-abbrev\n"
 "    --abbrev-commit\n"
 "    --left-right\n"
+"    --disk-usage\n"
+"    --filter=<filter-spec>\n"
 "  special purpose:\n"
 "    --bisect\n"
 "    --bisect-vars\n"
 "    --bisect-all"
 ;
 
+static int show_disk_usage;
+static off_t total_disk_usage;
+
+static struct list_objects_filter_options filter_options;
+
+static off_t get_object_disk_usage(struct object *obj)
+{
+	struct object_info oi = {NULL};
+	unsigned long size;
+
+	oi.disk_sizep = &size;
+	if (sha1_object_info_extended(obj->sha1, &oi, 0) < 0)
+		die("unable to get disk usage of %s", sha1_to_hex(obj->sha1));
+	return size;
+}
+
 static void finish_commit(struct commit *commit, void *data);
 static void show_commit(struct commit *commit, void *data)
 {
 	struct rev_list_info *info = data;
 	struct rev_info *revs = info->revs;
 
+	if (show_disk_usage)
+		total_disk_usage += get_object_disk_usage(&commit->object);
+
 	if (info->flags & REV_LIST_QUIET) {
 		finish_commit(commit, data);
 		return;
@@ -106,7 +128,7 @@ static void show_commit(struct commit *commit, void *data)
 	else
 		putchar('\n');
 
-	if (revs->verbose_header && get_cached_commit_buffer(commit, NULL)) {
+	if (revs->verbose_header) {
 		struct strbuf buf = STRBUF_INIT;
 		struct pretty_print_context ctx = {0};
 		ctx.abbrev = revs->abbrev;
@@ -193,6 +215,8 @@ static void show_object(struct object *obj,
 {
 	struct rev_list_info *info = cb_data;
 	finish_object(obj, path, component, cb_data);
+	if (show_disk_usage)
+		total_disk_usage += get_object_disk_usage(obj);
 	if (info->flags & REV_LIST_QUIET)
 		return;
 	show_object_with_name(stdout, obj, path, component);
@@ -266,6 +290,12 @@ static int show_object_fast(
 	struct packed_git *found_pack,
 	off_t found_offset)
 {
+	/*
+	 * Objects in a bitmapped pack exist; those outside of it were
+	 * only reached by walking, like in finish_object().
+	 */
+	if (!found_pack && type == OBJ_BLOB && !has_sha1_file(sha1))
+		die("missing blob object '%s'", sha1_to_hex(sha1));
 	fprintf(stdout, "%s\n", sha1_to_hex(sha1));
 	return 1;
 }
@@ -280,6 +310,17 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	int bisect_find_all = 0;
 	int use_bitmap_index = 0;
 
+	/*
+	 * "--stdin" reads its revisions as soon as it is parsed; make
+	 * sure that does not fetch what a partial clone lacks.
+	 */
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--exclude-promisor-objects")) {
+			fetch_if_missing = 0;
+			break;
+		}
+	}
+
 	git_config(git_default_config, NULL);
 	init_revisions(&revs, prefix);
 	revs.abbrev = DEFAULT_ABBREV;
@@ -320,6 +361,21 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			bisect_show_vars = 1;
 			continue;
 		}
+		if (!strcmp(arg, "--disk-usage")) {
+			show_disk_usage = 1;
+			info.flags |= REV_LIST_QUIET;
+			continue;
+		}
+		if (starts_with(arg, "--filter=")) {
+			if (parse_list_objects_filter(&filter_options,
+						      arg + 9))
+				die("invalid --filter");
+			continue;
+		}
+		if (!strcmp(arg, "--no-filter")) {
+			list_objects_filter_release(&filter_options);
+			continue;
+		}
 		if (!strcmp(arg, "--use-bitmap-index")) {
 			use_bitmap_index = 1;
 			continue;
@@ -355,8 +411,18 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (bisect_list)
 		revs.limited = 1;
 
+	/* bitmaps know nothing of objects we may lack or leave out */
+	if (filter_options.choice || revs.exclude_promisor_objects)
+		use_bitmap_index = 0;
+
 	if (use_bitmap_index) {
-		if (revs.count && !revs.left_right && !revs.cherry_mark) {
+		if (show_disk_usage) {
+			if (!prepare_bitmap_walk(&revs)) {
+				printf("%"PRIuMAX"\n", (uintmax_t)
+				       get_disk_usage_from_bitmap(&revs));
+				return 0;
+			}
+		} else if (revs.count && !revs.left_right && !revs.cherry_mark) {
 			uint32_t commit_count;
 			if (!prepare_bitmap_walk(&revs)) {
 				count_bitmap_commit_list(&commit_count, NULL, NULL, NULL);
@@ -386,7 +452,8 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			return show_bisect_vars(&info, reaches, all);
 	}
 
-	traverse_commit_list(&revs, show_commit, show_object, &info);
+	traverse_commit_list_filtered(&filter_options, &revs,
+				      show_commit, show_object, &info);
 
 	if (revs.count) {
 		if (revs.left_right && revs.cherry_mark)
@@ -399,5 +466,8 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			printf("%d\n", revs.count_left + revs.count_right);
 	}
 
+	if (show_disk_usage)
+		printf("%"PRIuMAX"\n", (uintmax_t)total_disk_usage);
+
 	return 0;
 }
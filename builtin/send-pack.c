@@ -102,6 +102,7 @@ int cmd_send_pack(int argc, const char **argv, const char *prefix)
 	struct child_process *conn;
 	struct sha1_array extra_have = SHA1_ARRAY_INIT;
 	struct sha1_array shallow = SHA1_ARRAY_INIT;
+	struct packet_reader reader;
 	struct ref *remote_refs, *local_refs;
 	int ret;
 	int helper_status = 0;
@@ -230,7 +231,10 @@ int cmd_send_pack(int argc, const char **argv, const char *prefix)
 			args.verbose ? CONNECT_VERBOSE : 0);
 	}
 
-	get_remote_heads(fd[0], NULL, 0, &remote_refs, REF_NORMAL,
+	packet_reader_init(&reader, fd[0], NULL, 0,
+			   PACKET_READ_CHOMP_NEWLINE |
+			   PACKET_READ_GENTLE_ON_EOF);
+	get_remote_heads(&reader, &remote_refs, REF_NORMAL,
 			 &extra_have, &shallow);
 
 	transport_verify_remote_names(nr_refspecs, refspecs);
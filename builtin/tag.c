@@ -91,9 +91,13 @@ enum contains_result {
 /*
  * Test whether the candidate or one of its parents is contained in the list.
  * Do not recurse to find out, though, but return -1 if inconclusive.
+ *
+ * Commits whose generation number is below "cutoff" (the smallest
+ * generation number among the wanted commits) cannot reach any of them.
  */
 static enum contains_result contains_test(struct commit *candidate,
-			    const struct commit_list *want)
+			    const struct commit_list *want,
+			    uint32_t cutoff)
 {
 	/* was it previously marked as containing a want commit? */
 	if (candidate->object.flags & TMP_MARK)
@@ -109,6 +113,8 @@ static enum contains_result contains_test(struct commit *candidate,
 
 	if (parse_commit(candidate) < 0)
 		return 0;
+	if (candidate->generation < cutoff)
+		return 0;
 
 	return -1;
 }
@@ -140,7 +146,18 @@ static enum contains_result contains(struct commit *candidate,
 		const struct commit_list *want)
 {
 	struct stack stack = { 0, 0, NULL };
-	int result = contains_test(candidate, want);
+	const struct commit_list *p;
+	uint32_t cutoff = GENERATION_NUMBER_INFINITY;
+	int result;
+
+	for (p = want; p; p = p->next) {
+		struct commit *c = p->item;
+		parse_commit(c);
+		if (c->generation < cutoff)
+			cutoff = c->generation;
+	}
+
+	result = contains_test(candidate, want, cutoff);
 
 	if (result != CONTAINS_UNKNOWN)
 		return result;
@@ -159,7 +176,7 @@ static enum contains_result contains(struct commit *candidate,
 		 * If we just popped the stack, parents->item has been marked,
 		 * therefore contains_test will return a meaningful 0 or 1.
 		 */
-		else switch (contains_test(parents->item, want)) {
+		else switch (contains_test(parents->item, want, cutoff)) {
 		case CONTAINS_YES:
 			commit->object.flags |= TMP_MARK;
 			stack.nr--;
@@ -173,7 +190,7 @@ static enum contains_result contains(struct commit *candidate,
 		}
 	}
 	free(stack.stack);
-	return contains_test(candidate, want);
+	return contains_test(candidate, want, cutoff);
 }
 
 static void show_tag_lines(const unsigned char *sha1, int lines)
@@ -11,9 +11,10 @@
 #include "progress.h"
 #include "decorate.h"
 #include "fsck.h"
+#include "thread-utils.h"
 
 static int dry_run, quiet, recover, has_errors, strict;
-static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict] < pack-file";
+static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict] [--threads=<n>] < pack-file";
 
 /* We always read in 4kB chunks. */
 static unsigned char buffer[4096];
@@ -133,6 +134,74 @@ struct delta_info {
 
 static struct delta_info *delta_list;
 
+static int nr_threads;
+
+#ifndef NO_PTHREADS
+
+/*
+ * With threads, the main thread only reads and inflates the pack
+ * stream.  Undeltified objects and deltas whose base is known are
+ * handed to the worker threads, which apply the deltas, hash and
+ * write the results and resolve the deltas that were waiting for
+ * them.
+ */
+struct unpack_job {
+	unsigned nr;
+	enum object_type type;		/* OBJ_REF_DELTA if base_sha1 is set */
+	unsigned char base_sha1[20];
+	void *data;
+	unsigned long size;
+	struct unpack_job *next;
+};
+
+static pthread_t *threads;
+static int threads_active;
+
+/* Protects the object store, obj_list[].sha1 and delta_list. */
+static pthread_mutex_t obj_mutex;
+#define obj_lock()		lock_mutex(&obj_mutex)
+#define obj_unlock()		unlock_mutex(&obj_mutex)
+
+/* Protects the job queue. */
+static pthread_mutex_t work_mutex;
+#define work_lock()		lock_mutex(&work_mutex)
+#define work_unlock()		unlock_mutex(&work_mutex)
+
+static pthread_cond_t work_cond;
+static pthread_cond_t space_cond;
+static struct unpack_job *job_queue, **job_tail = &job_queue;
+static int nr_queued, max_queued, input_done;
+
+static inline void lock_mutex(pthread_mutex_t *mutex)
+{
+	if (threads_active)
+		pthread_mutex_lock(mutex);
+}
+
+static inline void unlock_mutex(pthread_mutex_t *mutex)
+{
+	if (threads_active)
+		pthread_mutex_unlock(mutex);
+}
+
+/* A worker out of memory must not close packs another is reading. */
+static void try_to_free_from_threads(size_t size)
+{
+	obj_lock();
+	release_pack_memory(size);
+	obj_unlock();
+}
+
+static try_to_free_t old_try_to_free_routine;
+
+#else
+
+#define obj_lock()
+#define obj_unlock()
+
+#endif
+
+/* The caller holds obj_lock(). */
 static void add_delta_to_list(unsigned nr, unsigned const char *base_sha1,
 			      off_t base_offset,
 			      void *delta, unsigned long size)
@@ -215,8 +284,25 @@ static void write_rest(void)
 	}
 }
 
-static void added_object(unsigned nr, enum object_type type,
-			 void *data, unsigned long size);
+static void added_object(unsigned nr, const unsigned char *sha1,
+			 enum object_type type, void *data, unsigned long size);
+
+/*
+ * Like write_sha1_file(), but only the lookup of an existing copy
+ * needs the object store; hashing and writing can run in parallel.
+ */
+static void write_loose(void *buf, unsigned long size,
+			enum object_type type, unsigned char *sha1)
+{
+	int exists;
+
+	hash_sha1_file(buf, size, typename(type), sha1);
+	obj_lock();
+	exists = has_sha1_file(sha1);
+	obj_unlock();
+	if (!exists && write_loose_sha1_file(buf, size, typename(type), sha1) < 0)
+		die("failed to write object");
+}
 
 /*
  * Write out nr-th object from the list, now we know the contents
@@ -226,36 +312,44 @@ static void added_object(unsigned nr, enum object_type type,
 static void write_object(unsigned nr, enum object_type type,
 			 void *buf, unsigned long size)
 {
+	unsigned char sha1[20];
+
 	if (!strict) {
-		if (write_sha1_file(buf, size, typename(type), obj_list[nr].sha1) < 0)
-			die("failed to write object");
-		added_object(nr, type, buf, size);
+		write_loose(buf, size, type, sha1);
+		added_object(nr, sha1, type, buf, size);
 		free(buf);
 		obj_list[nr].obj = NULL;
 	} else if (type == OBJ_BLOB) {
 		struct blob *blob;
-		if (write_sha1_file(buf, size, typename(type), obj_list[nr].sha1) < 0)
-			die("failed to write object");
-		added_object(nr, type, buf, size);
+		write_loose(buf, size, type, sha1);
+		added_object(nr, sha1, type, buf, size);
 		free(buf);
 
-		blob = lookup_blob(obj_list[nr].sha1);
+		obj_lock();
+		blob = lookup_blob(sha1);
 		if (blob)
 			blob->object.flags |= FLAG_WRITTEN;
 		else
 			die("invalid blob object");
+		obj_unlock();
 		obj_list[nr].obj = NULL;
 	} else {
 		struct object *obj;
 		int eaten;
-		hash_sha1_file(buf, size, typename(type), obj_list[nr].sha1);
-		added_object(nr, type, buf, size);
-		obj = parse_object_buffer(obj_list[nr].sha1, type, size, buf, &eaten);
+		hash_sha1_file(buf, size, typename(type), sha1);
+		/*
+		 * Make the buffer available to resolve_against_held()
+		 * before added_object() tells everybody about this one.
+		 */
+		obj_lock();
+		obj = parse_object_buffer(sha1, type, size, buf, &eaten);
 		if (!obj)
 			die("invalid %s", typename(type));
 		add_object_buffer(obj, buf, size);
 		obj->flags |= FLAG_OPEN;
+		obj_unlock();
 		obj_list[nr].obj = obj;
+		added_object(nr, sha1, type, buf, size);
 	}
 }
 
@@ -277,63 +371,230 @@ static void resolve_delta(unsigned nr, enum object_type type,
 
 /*
  * We now know the contents of an object (which is nr-th in the pack);
- * resolve all the deltified objects that are based on it.
+ * record its name and resolve all the deltified objects that are
+ * based on it.
  */
-static void added_object(unsigned nr, enum object_type type,
-			 void *data, unsigned long size)
+static void added_object(unsigned nr, const unsigned char *sha1,
+			 enum object_type type, void *data, unsigned long size)
 {
 	struct delta_info **p = &delta_list;
-	struct delta_info *info;
-
+	struct delta_info *info, *children = NULL;
+
+	/*
+	 * Take the waiting deltas off the list in the same critical
+	 * section that makes the name visible to unpack_delta_entry(),
+	 * so that a delta is either queued for us or sees its base.
+	 */
+	obj_lock();
+	hashcpy(obj_list[nr].sha1, sha1);
 	while ((info = *p) != NULL) {
-		if (!hashcmp(info->base_sha1, obj_list[nr].sha1) ||
+		if (!hashcmp(info->base_sha1, sha1) ||
 		    info->base_offset == obj_list[nr].offset) {
 			*p = info->next;
-			p = &delta_list;
-			resolve_delta(info->nr, type, data, size,
-				      info->delta, info->size);
-			free(info);
+			info->next = children;
+			children = info;
 			continue;
 		}
 		p = &info->next;
 	}
+	obj_unlock();
+
+	while ((info = children) != NULL) {
+		children = info->next;
+		resolve_delta(info->nr, type, data, size,
+			      info->delta, info->size);
+		free(info);
+	}
 }
 
-static void unpack_non_delta_entry(enum object_type type, unsigned long size,
-				   unsigned nr)
+/* The caller holds obj_lock(). */
+static struct obj_buffer *lookup_held(const unsigned char *sha1,
+				      enum object_type *type)
 {
-	void *buf = get_data(size);
-
-	if (!dry_run && buf)
-		write_object(nr, type, buf, size);
-	else
-		free(buf);
+	struct object *obj = lookup_object(sha1);
+	if (!obj)
+		return NULL;
+	*type = obj->type;
+	return lookup_object_buffer(obj);
 }
 
 static int resolve_against_held(unsigned nr, const unsigned char *base,
 				void *delta_data, unsigned long delta_size)
 {
-	struct object *obj;
 	struct obj_buffer *obj_buffer;
-	obj = lookup_object(base);
-	if (!obj)
-		return 0;
-	obj_buffer = lookup_object_buffer(obj);
+	enum object_type type;
+
+	/* Held buffers are never freed, so we can use them unlocked. */
+	obj_lock();
+	obj_buffer = lookup_held(base, &type);
+	obj_unlock();
 	if (!obj_buffer)
 		return 0;
-	resolve_delta(nr, obj->type, obj_buffer->buffer,
+	resolve_delta(nr, type, obj_buffer->buffer,
 		      obj_buffer->size, delta_data, delta_size);
 	return 1;
 }
 
+static void resolve_base(unsigned nr, const unsigned char *base_sha1,
+			 void *delta_data, unsigned long delta_size)
+{
+	void *base;
+	enum object_type type;
+	unsigned long base_size;
+
+	if (resolve_against_held(nr, base_sha1, delta_data, delta_size))
+		return;
+
+	obj_lock();
+	base = read_sha1_file(base_sha1, &type, &base_size);
+	obj_unlock();
+	if (!base) {
+		error("failed to read delta-pack base object %s",
+		      sha1_to_hex(base_sha1));
+		if (!recover)
+			exit(1);
+		has_errors = 1;
+		return;
+	}
+	resolve_delta(nr, type, base, base_size, delta_data, delta_size);
+	free(base);
+}
+
+#ifndef NO_PTHREADS
+
+static void run_job(struct unpack_job *job)
+{
+	if (job->type == OBJ_REF_DELTA)
+		resolve_base(job->nr, job->base_sha1, job->data, job->size);
+	else
+		write_object(job->nr, job->type, job->data, job->size);
+	free(job);
+}
+
+static void *run_thread(void *unused)
+{
+	for (;;) {
+		struct unpack_job *job;
+
+		work_lock();
+		while (!job_queue && !input_done)
+			pthread_cond_wait(&work_cond, &work_mutex);
+		job = job_queue;
+		if (job) {
+			job_queue = job->next;
+			if (!job_queue)
+				job_tail = &job_queue;
+			nr_queued--;
+			pthread_cond_signal(&space_cond);
+		}
+		work_unlock();
+		if (!job)
+			break;
+		run_job(job);
+	}
+	return NULL;
+}
+
+/*
+ * Mutex and conditional variable can't be statically-initialized on Windows.
+ */
+static void init_thread(void)
+{
+	int i;
+
+	pthread_mutex_init(&obj_mutex, NULL);
+	pthread_mutex_init(&work_mutex, NULL);
+	pthread_cond_init(&work_cond, NULL);
+	pthread_cond_init(&space_cond, NULL);
+	/* enough to keep the workers busy without hoarding memory */
+	max_queued = 4 * nr_threads;
+	threads_active = 1;
+	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
+
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&threads[i], NULL, run_thread, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+/* Wait until the workers have finished the queue, and stop them. */
+static void cleanup_thread(void)
+{
+	int i;
+
+	if (!threads_active)
+		return;
+	work_lock();
+	input_done = 1;
+	pthread_cond_broadcast(&work_cond);
+	work_unlock();
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	set_try_to_free_routine(old_try_to_free_routine);
+	threads_active = 0;
+	pthread_mutex_destroy(&obj_mutex);
+	pthread_mutex_destroy(&work_mutex);
+	pthread_cond_destroy(&work_cond);
+	pthread_cond_destroy(&space_cond);
+}
+
+static void queue_job(unsigned nr, enum object_type type,
+		      const unsigned char *base_sha1,
+		      void *data, unsigned long size)
+{
+	struct unpack_job *job = xcalloc(1, sizeof(*job));
+
+	job->nr = nr;
+	job->type = type;
+	if (base_sha1)
+		hashcpy(job->base_sha1, base_sha1);
+	job->data = data;
+	job->size = size;
+
+	work_lock();
+	while (nr_queued >= max_queued)
+		pthread_cond_wait(&space_cond, &work_mutex);
+	*job_tail = job;
+	job_tail = &job->next;
+	nr_queued++;
+	pthread_cond_signal(&work_cond);
+	work_unlock();
+}
+
+#endif
+
+static void unpack_non_delta_entry(enum object_type type, unsigned long size,
+				   unsigned nr)
+{
+	void *buf = get_data(size);
+
+	if (dry_run || !buf) {
+		free(buf);
+		return;
+	}
+#ifndef NO_PTHREADS
+	if (threads_active) {
+		queue_job(nr, type, NULL, buf, size);
+		return;
+	}
+#endif
+	write_object(nr, type, buf, size);
+}
+
 static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 			       unsigned nr)
 {
-	void *delta_data, *base;
-	unsigned long base_size;
+	void *delta_data;
 	unsigned char base_sha1[20];
+	int base_found = 0;
 
 	if (type == OBJ_REF_DELTA) {
+		enum object_type base_type;
+
 		hashcpy(base_sha1, fill(20));
 		use(20);
 		delta_data = get_data(delta_size);
@@ -341,19 +602,18 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 			free(delta_data);
 			return;
 		}
-		if (has_sha1_file(base_sha1))
-			; /* Ok we have this one */
-		else if (resolve_against_held(nr, base_sha1,
-					      delta_data, delta_size))
-			return; /* we are done */
-		else {
+		obj_lock();
+		base_found = has_sha1_file(base_sha1) ||
+			     lookup_held(base_sha1, &base_type);
+		if (!base_found) {
 			/* cannot resolve yet --- queue it */
 			hashcpy(obj_list[nr].sha1, null_sha1);
 			add_delta_to_list(nr, base_sha1, 0, delta_data, delta_size);
-			return;
 		}
+		obj_unlock();
+		if (!base_found)
+			return;
 	} else {
-		unsigned base_found = 0;
 		unsigned char *pack, c;
 		off_t base_offset;
 		unsigned lo, mid, hi;
@@ -380,6 +640,7 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 			free(delta_data);
 			return;
 		}
+		obj_lock();
 		lo = 0;
 		hi = nr;
 		while (lo < hi) {
@@ -397,28 +658,24 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 		if (!base_found) {
 			/*
 			 * The delta base object is itself a delta that
-			 * has not been resolved yet.
+			 * has not been resolved yet, or is still being
+			 * written by another thread.
 			 */
 			hashcpy(obj_list[nr].sha1, null_sha1);
 			add_delta_to_list(nr, null_sha1, base_offset, delta_data, delta_size);
-			return;
 		}
+		obj_unlock();
+		if (!base_found)
+			return;
 	}
 
-	if (resolve_against_held(nr, base_sha1, delta_data, delta_size))
-		return;
-
-	base = read_sha1_file(base_sha1, &type, &base_size);
-	if (!base) {
-		error("failed to read delta-pack base object %s",
-		      sha1_to_hex(base_sha1));
-		if (!recover)
-			exit(1);
-		has_errors = 1;
+#ifndef NO_PTHREADS
+	if (threads_active) {
+		queue_job(nr, OBJ_REF_DELTA, base_sha1, delta_data, delta_size);
 		return;
 	}
-	resolve_delta(nr, type, base, base_size, delta_data, delta_size);
-	free(base);
+#endif
+	resolve_base(nr, base_sha1, delta_data, delta_size);
 }
 
 static void unpack_one(unsigned nr)
@@ -482,16 +739,45 @@ static void unpack_all(void)
 	if (!quiet)
 		progress = start_progress(_("Unpacking objects"), nr_objects);
 	obj_list = xcalloc(nr_objects, sizeof(*obj_list));
+#ifndef NO_PTHREADS
+	/*
+	 * A dry run has nothing to write, and recovery wants to
+	 * carry on after errors that would kill a worker.
+	 */
+	if (!dry_run && !recover &&
+	    (nr_threads > 1 || getenv("GIT_FORCE_THREADS")))
+		init_thread();
+#endif
 	for (i = 0; i < nr_objects; i++) {
 		unpack_one(i);
 		display_progress(progress, i + 1);
 	}
+#ifndef NO_PTHREADS
+	cleanup_thread();
+#endif
 	stop_progress(&progress);
 
 	if (delta_list)
 		die("unresolved deltas left after unpacking");
 }
 
+static int unpack_config(const char *k, const char *v, void *cb)
+{
+	if (!strcmp(k, "pack.threads")) {
+		nr_threads = git_config_int(k, v);
+		if (nr_threads < 0)
+			die(_("invalid number of threads specified (%d)"),
+			    nr_threads);
+#ifdef NO_PTHREADS
+		if (nr_threads != 1)
+			warning(_("no threads support, ignoring %s"), k);
+		nr_threads = 1;
+#endif
+		return 0;
+	}
+	return git_default_config(k, v, cb);
+}
+
 int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 {
 	int i;
@@ -499,7 +785,7 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 
 	check_replace_refs = 0;
 
-	git_config(git_default_config, NULL);
+	git_config(unpack_config, NULL);
 
 	quiet = !isatty(2);
 
@@ -523,6 +809,19 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 				strict = 1;
 				continue;
 			}
+			if (starts_with(arg, "--threads=")) {
+				char *end;
+				nr_threads = strtoul(arg + 10, &end, 0);
+				if (!arg[10] || *end || nr_threads < 0)
+					usage(unpack_usage);
+#ifdef NO_PTHREADS
+				if (nr_threads != 1)
+					warning(_("no threads support, "
+						  "ignoring %s"), arg);
+				nr_threads = 1;
+#endif
+				continue;
+			}
 			if (starts_with(arg, "--pack_header=")) {
 				struct pack_header *hdr;
 				char *c;
@@ -544,6 +843,15 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 		/* We don't take any non-flag arguments now.. Maybe some day */
 		usage(unpack_usage);
 	}
+
+#ifndef NO_PTHREADS
+	if (!nr_threads) {
+		nr_threads = online_cpus();
+		/* the workers soon outrun the single thread reading the pack */
+		if (nr_threads > 3)
+			nr_threads = 3;
+	}
+#endif
 	git_SHA1_Init(&ctx);
 	unpack_all();
 	git_SHA1_Update(&ctx, buffer, offset);
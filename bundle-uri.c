@@ -0,0 +1,149 @@
+#include "cache.h"
+#include "bundle-uri.h"
+#include "bundle.h"
+#include "refs.h"
+#include "run-command.h"
+#include "url.h"
+
+/* how many times an http download is resumed before giving up */
+#define BUNDLE_URI_ATTEMPTS 3
+
+/*
+ * Have the remote helper for the scheme of "uri" (e.g.
+ * git-remote-https) download it with its "get" command.
+ */
+static int download_with_helper(const char *uri, const char *file)
+{
+	struct child_process helper;
+	const char *argv[3];
+	struct strbuf buf = STRBUF_INIT;
+	int ret;
+
+	argv[0] = xstrfmt("remote-%.*s", (int)(strstr(uri, "://") - uri), uri);
+	argv[1] = uri;
+	argv[2] = NULL;
+
+	memset(&helper, 0, sizeof(helper));
+	helper.argv = argv;
+	helper.git_cmd = 1;
+	helper.in = -1;
+	helper.out = -1;
+	if (start_command(&helper)) {
+		free((char *)argv[0]);
+		return -1;
+	}
+
+	/* the empty line after the command tells the helper to exit */
+	strbuf_addf(&buf, "get %s %s\n\n", uri, file);
+	write_in_full(helper.in, buf.buf, buf.len);
+	close(helper.in);
+	strbuf_reset(&buf);
+	strbuf_read(&buf, helper.out, 0);
+	close(helper.out);
+
+	ret = finish_command(&helper);
+	strbuf_release(&buf);
+	free((char *)argv[0]);
+	return ret ? -1 : 0;
+}
+
+static int is_http_uri(const char *uri)
+{
+	return starts_with(uri, "https://") || starts_with(uri, "http://");
+}
+
+static int download_bundle(const char *uri, const char *file)
+{
+	const char *path = uri;
+	int attempt;
+
+	if (skip_prefix(uri, "file://", &path) || !is_url(uri)) {
+		unlink(file);
+		if (copy_file(file, path, 0666))
+			return error(_("could not copy bundle '%s'"), path);
+		return 0;
+	}
+
+	for (attempt = 0; attempt < BUNDLE_URI_ATTEMPTS; attempt++)
+		if (!download_with_helper(uri, file))
+			return 0;
+	return error(_("could not download bundle '%s'"), uri);
+}
+
+static int unbundle_file(const char *file, const char *uri)
+{
+	struct bundle_header header;
+	struct strbuf refname = STRBUF_INIT, msg = STRBUF_INIT;
+	int fd, i;
+
+	memset(&header, 0, sizeof(header));
+	fd = read_bundle_header(file, &header);
+	if (fd < 0)
+		return -1;
+	if (verify_bundle(&header, 0)) {
+		close(fd);
+		return -1;
+	}
+	if (unbundle(&header, fd, 0))
+		return -1;
+
+	/* the pack was added behind our back */
+	reprepare_packed_git();
+
+	strbuf_addf(&msg, "bundle-uri: %s", uri);
+	for (i = 0; i < header.references.nr; i++) {
+		struct ref_list_entry *e = header.references.list + i;
+		const char *name;
+
+		if (!skip_prefix(e->name, "refs/", &name) ||
+		    !has_sha1_file(e->sha1))
+			continue;
+		strbuf_reset(&refname);
+		strbuf_addf(&refname, "refs/bundles/%s", name);
+		if (check_refname_format(refname.buf, 0))
+			continue;
+		update_ref(msg.buf, refname.buf, e->sha1, NULL, 0,
+			   UPDATE_REFS_MSG_ON_ERR);
+	}
+	strbuf_release(&refname);
+	strbuf_release(&msg);
+	return 0;
+}
+
+int fetch_bundle_uri(const char *uri, unsigned flags)
+{
+	struct strbuf file = STRBUF_INIT;
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	int ret = -1;
+
+	/*
+	 * Do not let the server make us read our own files, or run
+	 * whatever remote helper it names.
+	 */
+	if ((flags & BUNDLE_URI_FROM_REMOTE) && !is_http_uri(uri))
+		return error(_("refusing bundle '%s' offered by the remote: "
+			       "not an http(s) URL"), uri);
+
+	/*
+	 * Name the download after the URI, so that a later attempt
+	 * finds (and resumes) what an interrupted one left behind.
+	 */
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, uri, strlen(uri));
+	git_SHA1_Final(sha1, &ctx);
+	strbuf_addstr(&file, git_path("bundles/%s.bundle", sha1_to_hex(sha1)));
+	if (safe_create_leading_directories(file.buf)) {
+		error(_("could not create leading directories of '%s'"),
+		      file.buf);
+		goto out;
+	}
+
+	if (download_bundle(uri, file.buf))
+		goto out;
+	ret = unbundle_file(file.buf, uri);
+	unlink_or_warn(file.buf);
+out:
+	strbuf_release(&file);
+	return ret;
+}
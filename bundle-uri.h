@@ -0,0 +1,19 @@
+#ifndef BUNDLE_URI_H
+#define BUNDLE_URI_H
+
+/*
+ * Download the bundle at "uri" (an http(s) URL, or a local path or
+ * file:// URL), unbundle it into the repository and point refs under
+ * "refs/bundles/" at its tips, so that a following fetch tells the
+ * server it already has them.  An http download that fails midway is
+ * resumed where it stopped, by the next attempt or the next call.
+ *
+ * With BUNDLE_URI_FROM_REMOTE in "flags", "uri" came from the server
+ * and only http(s) URLs are accepted.
+ *
+ * Returns 0 on success and -1 after reporting an error.
+ */
+#define BUNDLE_URI_FROM_REMOTE 01
+extern int fetch_bundle_uri(const char *uri, unsigned flags);
+
+#endif
@@ -176,6 +176,7 @@ struct cache_entry {
 #define CE_ADDED             (1 << 19)
 
 #define CE_HASHED            (1 << 20)
+#define CE_FSMONITOR_VALID   (1 << 21) /* unchanged since the fsmonitor token */
 #define CE_WT_REMOVE         (1 << 22) /* remove in work directory */
 #define CE_CONFLICTED        (1 << 23)
 
@@ -295,8 +296,12 @@ static inline unsigned int canon_mode(unsigned int mode)
 #define RESOLVE_UNDO_CHANGED	(1 << 4)
 #define CACHE_TREE_CHANGED	(1 << 5)
 #define SPLIT_INDEX_ORDERED	(1 << 6)
+#define FSMONITOR_CHANGED	(1 << 7)
+#define UNTRACKED_CHANGED	(1 << 8)
 
 struct split_index;
+struct ewah_bitmap;
+struct untracked_cache;
 struct index_state {
 	struct cache_entry **cache;
 	unsigned int version;
@@ -306,10 +311,14 @@ struct index_state {
 	struct split_index *split_index;
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
-		 initialized : 1;
+		 initialized : 1,
+		 fsmonitor_has_run_once : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	unsigned char sha1[20];
+	char *fsmonitor_last_update;
+	struct ewah_bitmap *fsmonitor_dirty;
+	struct untracked_cache *untracked;
 };
 
 extern struct index_state the_index;
@@ -492,6 +501,11 @@ extern int read_index_preload(struct index_state *, const struct pathspec *paths
 extern int do_read_index(struct index_state *istate, const char *path,
 			 int must_exist); /* for testting only! */
 extern int read_index_from(struct index_state *, const char *path);
+/*
+ * Verify the checksum of the index even with index.skipHash, which
+ * otherwise leaves it to "git fsck".
+ */
+extern int verify_index_checksum;
 extern int is_index_unborn(struct index_state *);
 extern int read_index_unmerged(struct index_state *);
 #define COMMIT_LOCK		(1 << 0)
@@ -559,6 +573,17 @@ extern void fill_stat_data(struct stat_data *sd, struct stat *st);
  */
 extern int match_stat_data(const struct stat_data *sd, struct stat *st);
 
+/*
+ * Stat data that is not older than the index file cannot be trusted:
+ * the file may have been modified again in the same second after it
+ * was recorded ("racy git"). match_stat_data_racy() treats it as
+ * changed.
+ */
+extern int is_racy_stat(const struct index_state *istate,
+			const struct stat_data *sd);
+extern int match_stat_data_racy(const struct index_state *istate,
+				const struct stat_data *sd, struct stat *st);
+
 extern void fill_stat_cache_info(struct cache_entry *ce, struct stat *st);
 
 #define REFRESH_REALLY		0x0001	/* ignore_valid */
@@ -629,8 +654,24 @@ extern unsigned long pack_size_limit_cfg;
  */
 extern int check_replace_refs;
 
+/*
+ * In a partial clone, should an object that is missing locally be
+ * fetched from the promisor remote when it is read?  True by default;
+ * commands that must not trigger such fetches (e.g. because they only
+ * want to know what is missing) set it to false.
+ */
+extern int fetch_if_missing;
+
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int core_commit_graph;
+extern int core_multi_pack_index;
+
+enum ref_storage_format {
+	REF_STORAGE_FILES = 0,
+	REF_STORAGE_REFTABLE
+};
+extern enum ref_storage_format ref_storage_format;
 extern int core_apply_sparse_checkout;
 extern int precomposed_unicode;
 
@@ -693,6 +734,8 @@ extern char *notes_ref_name;
 extern int grafts_replace_parents;
 
 #define GIT_REPO_VERSION 0
+/* the newest version we can read, given that we know its extensions */
+#define GIT_REPO_VERSION_READ 1
 extern int repository_format_version;
 extern int check_repository_format(void);
 
@@ -867,6 +910,27 @@ static inline void *read_sha1_file(const unsigned char *sha1, enum object_type *
 	return read_sha1_file_extended(sha1, type, size, LOOKUP_REPLACE_OBJECT);
 }
 
+/*
+ * Threads that share the object store hold a lock around
+ * read_sha1_file(), which then also serializes inflating the object.
+ * read_sha1_deflated() only finds the object and takes its still
+ * deflated data, if it is a loose object or is stored whole in a pack,
+ * so that inflate_sha1_deflated() can be called without the lock.
+ * read_sha1_deflated() returns -1 for any other object, which has to
+ * be read with read_sha1_file() instead; inflate_sha1_deflated()
+ * releases the data and returns NULL if it is corrupt.
+ */
+struct deflated_object {
+	enum object_type type;
+	unsigned long size;
+	unsigned char *data;
+	unsigned long len;
+	unsigned loose:1; /* data maps a loose object file */
+};
+extern int read_sha1_deflated(const unsigned char *sha1, struct deflated_object *obj);
+extern void *inflate_sha1_deflated(const unsigned char *sha1, struct deflated_object *obj,
+				   enum object_type *type, unsigned long *size);
+
 /*
  * This internal function is only declared here for the benefit of
  * lookup_replace_object().  Please do not call it directly.
@@ -897,6 +961,14 @@ static inline const unsigned char *lookup_replace_object_extended(const unsigned
 extern int sha1_object_info(const unsigned char *, unsigned long *);
 extern int hash_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *sha1);
 extern int write_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *return_sha1);
+
+/*
+ * Write buf as a loose object named sha1, which the caller computed
+ * with hash_sha1_file(), even if the object already exists.  Unlike
+ * write_sha1_file(), this does not look at the object database at all
+ * and can be called from several threads at once.
+ */
+extern int write_loose_sha1_file(const void *buf, unsigned long len, const char *type, const unsigned char *sha1);
 extern int pretend_sha1_file(void *, unsigned long, enum object_type, unsigned char *);
 extern int force_object_loose(const unsigned char *sha1, time_t mtime);
 extern int git_open_noatime(const char *name);
@@ -913,6 +985,13 @@ extern int move_temp_to_file(const char *tmpfile, const char *filename);
 
 extern int has_sha1_pack(const unsigned char *sha1);
 
+/*
+ * Return true iff the object is in a pack that came from a promisor
+ * remote (see fetch-object.h), or is referenced by an object in such
+ * a pack.  These are the objects a partial clone is allowed to lack.
+ */
+extern int is_promisor_object(const unsigned char *sha1);
+
 /*
  * Return true iff we have an object named sha1, whether local or in
  * an alternate object database, and whether packed or loose.  This
@@ -1026,6 +1105,13 @@ extern int get_sha1_mb(const char *str, unsigned char *sha1);
  */
 extern int refname_match(const char *abbrev_name, const char *full_name);
 
+/*
+ * Add to "prefixes" every full refname that "prefix" could be an
+ * abbreviation of, according to the same rules.
+ */
+struct argv_array;
+extern void expand_ref_prefix(struct argv_array *prefixes, const char *prefix);
+
 extern int create_symref(const char *ref, const char *refs_heads_master, const char *logmsg);
 extern int validate_headref(const char *ref);
 
@@ -1138,6 +1224,7 @@ extern int has_symlink_leading_path(const char *name, int len);
 extern int threaded_has_symlink_leading_path(struct cache_def *, const char *, int);
 extern int check_leading_path(const char *name, int len);
 extern int has_dirs_only_path(const char *name, int len, int prefix_len);
+extern int threaded_has_dirs_only_path(struct cache_def *, const char *, int, int);
 extern void schedule_dir_for_removal(const char *name, int len);
 extern void remove_scheduled_dirs(void);
 
@@ -1175,7 +1262,9 @@ extern struct packed_git {
 	int pack_fd;
 	unsigned pack_local:1,
 		 pack_keep:1,
-		 do_not_close:1;
+		 pack_promisor:1,
+		 do_not_close:1,
+		 multi_pack_index:1;
 	unsigned char sha1[20];
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
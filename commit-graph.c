@@ -0,0 +1,920 @@
+#include "cache.h"
+#include "commit.h"
+#include "refs.h"
+#include "csum-file.h"
+#include "commit-graph.h"
+
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_FANOUT_SIZE (4 * 256)
+#define GRAPH_CHUNKLOOKUP_WIDTH 12
+#define GRAPH_MIN_SIZE (GRAPH_HEADER_SIZE + 4 * GRAPH_CHUNKLOOKUP_WIDTH + \
+			GRAPH_FANOUT_SIZE + GRAPH_OID_LEN)
+
+/* Remember to update object flag allocation in object.h */
+#define GRAPH_REACHABLE (1u<<15)
+
+static struct commit_graph *commit_graph;
+static int commit_graph_prepared;
+
+/*
+ * Set while the graph is being verified, so that the commits are
+ * parsed from the objects and can be compared against the graph.
+ */
+static int commit_graph_disabled;
+
+char *get_commit_graph_filename(const char *obj_dir)
+{
+	return xstrfmt("%s/info/commit-graph", obj_dir);
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+void free_commit_graph(struct commit_graph *g)
+{
+	if (!g)
+		return;
+	if (g->data)
+		munmap((void *)g->data, g->data_len);
+	free(g);
+}
+
+struct commit_graph *load_commit_graph_one(const char *graph_file)
+{
+	struct commit_graph *graph;
+	const unsigned char *data, *chunk_lookup;
+	struct stat st;
+	size_t graph_size;
+	uint64_t bloom_indexes_size = 0;
+	uint64_t commit_data_size = 0;
+	uint32_t i;
+	int fd;
+
+	fd = git_open_noatime(graph_file);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	graph_size = xsize_t(st.st_size);
+	if (graph_size < GRAPH_MIN_SIZE) {
+		close(fd);
+		error("commit-graph file %s is too small", graph_file);
+		return NULL;
+	}
+	data = xmmap(NULL, graph_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	graph = xcalloc(1, sizeof(*graph));
+	graph->data = data;
+	graph->data_len = graph_size;
+
+	if (get_be32(data) != GRAPH_SIGNATURE) {
+		error("commit-graph signature %X does not match signature %X",
+		      get_be32(data), GRAPH_SIGNATURE);
+		goto cleanup_fail;
+	}
+	if (data[4] != GRAPH_VERSION) {
+		error("commit-graph version %d does not match version %d",
+		      data[4], GRAPH_VERSION);
+		goto cleanup_fail;
+	}
+	if (data[5] != GRAPH_OID_VERSION) {
+		error("commit-graph hash version %d does not match version %d",
+		      data[5], GRAPH_OID_VERSION);
+		goto cleanup_fail;
+	}
+	graph->num_chunks = data[6];
+
+	if (GRAPH_HEADER_SIZE + (graph->num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH
+	    > graph_size - GRAPH_OID_LEN) {
+		error("commit-graph chunk lookup table is truncated");
+		goto cleanup_fail;
+	}
+
+	chunk_lookup = data + GRAPH_HEADER_SIZE;
+	for (i = 0; i < graph->num_chunks; i++) {
+		uint32_t chunk_id = get_be32(chunk_lookup);
+		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+		uint64_t next_offset = get_be64(chunk_lookup + 4 + GRAPH_CHUNKLOOKUP_WIDTH);
+		uint64_t chunk_size;
+
+		chunk_lookup += GRAPH_CHUNKLOOKUP_WIDTH;
+
+		if (chunk_offset > next_offset ||
+		    next_offset > graph_size - GRAPH_OID_LEN) {
+			error("improper chunk offset %08x%08x",
+			      (uint32_t)(chunk_offset >> 32),
+			      (uint32_t)chunk_offset);
+			goto cleanup_fail;
+		}
+		chunk_size = next_offset - chunk_offset;
+
+		switch (chunk_id) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			if (chunk_size != GRAPH_FANOUT_SIZE)
+				goto bad_chunk;
+			graph->chunk_oid_fanout = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			if (chunk_size % GRAPH_OID_LEN)
+				goto bad_chunk;
+			graph->chunk_oid_lookup = data + chunk_offset;
+			graph->num_commits = chunk_size / GRAPH_OID_LEN;
+			break;
+
+		case GRAPH_CHUNKID_DATA:
+			graph->chunk_commit_data = data + chunk_offset;
+			commit_data_size = chunk_size;
+			break;
+
+		case GRAPH_CHUNKID_LARGEEDGES:
+			if (chunk_size % 4)
+				goto bad_chunk;
+			graph->chunk_large_edges = data + chunk_offset;
+			graph->num_large_edges = chunk_size / 4;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMINDEXES:
+			graph->chunk_bloom_indexes = data + chunk_offset;
+			bloom_indexes_size = chunk_size;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMDATA:
+			if (chunk_size < 12)
+				goto bad_chunk;
+			graph->chunk_bloom_data = data + chunk_offset;
+			graph->bloom_data_len = chunk_size;
+			break;
+
+		default:
+			/* unknown chunks are ignored for forward compatibility */
+			continue;
+		}
+		continue;
+
+	bad_chunk:
+		error("commit-graph chunk %08x has improper size", chunk_id);
+		goto cleanup_fail;
+	}
+
+	if (!graph->chunk_oid_fanout || !graph->chunk_oid_lookup ||
+	    !graph->chunk_commit_data) {
+		error("commit-graph file %s is missing a required chunk",
+		      graph_file);
+		goto cleanup_fail;
+	}
+	for (i = 1; i < 256; i++) {
+		if (get_be32(graph->chunk_oid_fanout + 4 * (i - 1)) >
+		    get_be32(graph->chunk_oid_fanout + 4 * i)) {
+			error("commit-graph OID fanout is out of order");
+			goto cleanup_fail;
+		}
+	}
+	if (get_be32(graph->chunk_oid_fanout + 4 * 255) != graph->num_commits) {
+		error("commit-graph fanout does not match the number of commits");
+		goto cleanup_fail;
+	}
+	if (commit_data_size != (uint64_t)GRAPH_DATA_WIDTH * graph->num_commits) {
+		error("commit-graph commit data does not match the number of commits");
+		goto cleanup_fail;
+	}
+
+	if (graph->chunk_bloom_indexes && graph->chunk_bloom_data &&
+	    bloom_indexes_size == 4 * (uint64_t)graph->num_commits) {
+		const unsigned char *p = graph->chunk_bloom_data;
+
+		graph->bloom_filter_settings.hash_version = get_be32(p);
+		graph->bloom_filter_settings.num_hashes = get_be32(p + 4);
+		graph->bloom_filter_settings.bits_per_entry = get_be32(p + 8);
+	}
+	/* filters hashed in a way we do not know are of no use */
+	if (graph->bloom_filter_settings.hash_version != 1 ||
+	    !graph->bloom_filter_settings.num_hashes) {
+		graph->chunk_bloom_indexes = NULL;
+		graph->chunk_bloom_data = NULL;
+	}
+	return graph;
+
+cleanup_fail:
+	free_commit_graph(graph);
+	return NULL;
+}
+
+static int has_replace_ref(const char *refname, const unsigned char *sha1,
+			   int flags, void *cb_data)
+{
+	return 1;
+}
+
+static int prepare_commit_graph(void)
+{
+	char *graph_name;
+
+	if (commit_graph_prepared)
+		return !!commit_graph;
+	commit_graph_prepared = 1;
+
+	if (!core_commit_graph)
+		return 0;
+	/*
+	 * Replace refs swap whole commit objects; the graph only knows
+	 * about the originals.
+	 */
+	if (check_replace_refs && for_each_replace_ref(has_replace_ref, NULL))
+		return 0;
+
+	graph_name = get_commit_graph_filename(get_object_directory());
+	commit_graph = load_commit_graph_one(graph_name);
+	free(graph_name);
+	return !!commit_graph;
+}
+
+void close_commit_graph(void)
+{
+	free_commit_graph(commit_graph);
+	commit_graph = NULL;
+	commit_graph_prepared = 0;
+}
+
+static int bsearch_graph(struct commit_graph *g, const unsigned char *sha1,
+			 uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	hi = get_be32(g->chunk_oid_fanout + 4 * sha1[0]);
+	lo = sha1[0] ? get_be32(g->chunk_oid_fanout + 4 * (sha1[0] - 1)) : 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, g->chunk_oid_lookup + GRAPH_OID_LEN * mi);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static uint32_t graph_generation(struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+	return get_be32(commit_data + GRAPH_OID_LEN + 8) >> 2;
+}
+
+static struct commit_list **insert_parent_or_die(struct commit_graph *g,
+						 uint32_t pos,
+						 struct commit_list **pptr)
+{
+	struct commit *c;
+
+	if (pos >= g->num_commits)
+		die("invalid parent position %"PRIu32" in commit-graph", pos);
+	c = lookup_commit(g->chunk_oid_lookup + GRAPH_OID_LEN * pos);
+	if (!c)
+		die("could not find commit %s",
+		    sha1_to_hex(g->chunk_oid_lookup + GRAPH_OID_LEN * pos));
+	c->graph_pos = pos;
+	return &commit_list_insert(c, pptr)->next;
+}
+
+static void fill_commit_in_graph(struct commit_graph *g, struct commit *item,
+				 uint32_t pos)
+{
+	const unsigned char *commit_data;
+	struct commit_list **pptr;
+	uint32_t edge_value, edge_index;
+	uint64_t date;
+
+	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+
+	item->object.parsed = 1;
+	item->graph_pos = pos;
+	item->generation = graph_generation(g, pos);
+	item->tree = lookup_tree(commit_data);
+
+	date = get_be64(commit_data + GRAPH_OID_LEN + 8) & (((uint64_t)1 << 34) - 1);
+	item->date = (unsigned long)date;
+
+	pptr = &item->parents;
+
+	edge_value = get_be32(commit_data + GRAPH_OID_LEN);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return;
+	pptr = insert_parent_or_die(g, edge_value, pptr);
+
+	edge_value = get_be32(commit_data + GRAPH_OID_LEN + 4);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return;
+	if (!(edge_value & GRAPH_OCTOPUS_EDGES_NEEDED)) {
+		insert_parent_or_die(g, edge_value, pptr);
+		return;
+	}
+
+	if (!g->chunk_large_edges)
+		die("commit-graph needs an EDGE chunk for %s",
+		    sha1_to_hex(item->object.sha1));
+	edge_index = edge_value & GRAPH_EDGE_LAST_MASK;
+	do {
+		if (edge_index >= g->num_large_edges)
+			die("commit-graph EDGE chunk is too short for %s",
+			    sha1_to_hex(item->object.sha1));
+		edge_value = get_be32(g->chunk_large_edges + 4 * edge_index++);
+		pptr = insert_parent_or_die(g, edge_value & GRAPH_EDGE_LAST_MASK,
+					    pptr);
+	} while (!(edge_value & GRAPH_LAST_EDGE));
+}
+
+static int find_commit_in_graph(struct commit *item, uint32_t *pos)
+{
+	if (commit_graph_disabled || !prepare_commit_graph())
+		return 0;
+	/* grafts and shallow boundaries can be registered at any time */
+	if (has_commit_grafts())
+		return 0;
+
+	if (item->graph_pos != COMMIT_NOT_FROM_GRAPH) {
+		*pos = item->graph_pos;
+		return 1;
+	}
+	return bsearch_graph(commit_graph, item->object.sha1, pos);
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	uint32_t pos;
+
+	if (!find_commit_in_graph(item, &pos))
+		return 0;
+	fill_commit_in_graph(commit_graph, item, pos);
+	return 1;
+}
+
+void load_commit_graph_info(struct commit *item)
+{
+	uint32_t pos;
+
+	if (!find_commit_in_graph(item, &pos))
+		return;
+	item->graph_pos = pos;
+	item->generation = graph_generation(commit_graph, pos);
+}
+
+const struct bloom_filter_settings *get_bloom_filter_settings(void)
+{
+	if (commit_graph_disabled || !prepare_commit_graph() ||
+	    !commit_graph->chunk_bloom_data || has_commit_grafts())
+		return NULL;
+	return &commit_graph->bloom_filter_settings;
+}
+
+static int graph_bloom_filter(struct commit_graph *g, uint32_t pos,
+			      struct bloom_filter *filter)
+{
+	uint32_t start, end;
+
+	if (!g->chunk_bloom_data)
+		return 0;
+	start = pos ? get_be32(g->chunk_bloom_indexes + 4 * (pos - 1)) : 0;
+	end = get_be32(g->chunk_bloom_indexes + 4 * pos);
+	if (start > end || end > g->bloom_data_len - 12)
+		return 0;
+	filter->data = (unsigned char *)g->chunk_bloom_data + 12 + start;
+	filter->len = end - start;
+	return 1;
+}
+
+int get_bloom_filter(struct commit *c, struct bloom_filter *filter)
+{
+	uint32_t pos;
+
+	if (!find_commit_in_graph(c, &pos))
+		return 0;
+	return graph_bloom_filter(commit_graph, pos, filter);
+}
+
+struct packed_commit_list {
+	struct commit **list;
+	int nr;
+	int alloc;
+};
+
+static int commit_compare(const void *a_, const void *b_)
+{
+	const struct commit *a = *(const struct commit **)a_;
+	const struct commit *b = *(const struct commit **)b_;
+	return hashcmp(a->object.sha1, b->object.sha1);
+}
+
+static int commit_pos(struct packed_commit_list *commits,
+		      const struct commit *c)
+{
+	struct commit **found;
+
+	found = bsearch(&c, commits->list, commits->nr,
+			sizeof(*commits->list), commit_compare);
+	if (!found)
+		return -1;
+	return found - commits->list;
+}
+
+static void add_commit_to_list(struct packed_commit_list *commits,
+			       struct commit *c)
+{
+	if (c->object.flags & GRAPH_REACHABLE)
+		return;
+	c->object.flags |= GRAPH_REACHABLE;
+	ALLOC_GROW(commits->list, commits->nr + 1, commits->alloc);
+	commits->list[commits->nr++] = c;
+}
+
+static void close_reachable(struct packed_commit_list *commits)
+{
+	int i;
+
+	/* commits->nr grows as parents are discovered */
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *c = commits->list[i];
+		struct commit_list *parent;
+
+		if (parse_commit(c))
+			die("unable to parse commit %s",
+			    sha1_to_hex(c->object.sha1));
+		for (parent = c->parents; parent; parent = parent->next)
+			add_commit_to_list(commits, parent->item);
+	}
+
+	for (i = 0; i < commits->nr; i++)
+		commits->list[i]->object.flags &= ~GRAPH_REACHABLE;
+}
+
+static void write_graph_chunk_fanout(struct sha1file *f,
+				     struct packed_commit_list *commits)
+{
+	int i, count = 0;
+	struct commit **list = commits->list;
+
+	/*
+	 * Write the first-level table (the list is sorted,
+	 * but we use a 256-entry lookup to be able to avoid
+	 * having to do eight extra binary search iterations).
+	 */
+	for (i = 0; i < 256; i++) {
+		uint32_t n;
+
+		while (count < commits->nr &&
+		       list[count]->object.sha1[0] <= i)
+			count++;
+		n = htonl(count);
+		sha1write(f, &n, 4);
+	}
+}
+
+static void write_graph_chunk_oids(struct sha1file *f,
+				   struct packed_commit_list *commits)
+{
+	int i;
+
+	for (i = 0; i < commits->nr; i++)
+		sha1write(f, commits->list[i]->object.sha1, GRAPH_OID_LEN);
+}
+
+static uint32_t parent_pos_or_die(struct packed_commit_list *commits,
+				  struct commit *parent)
+{
+	int pos = commit_pos(commits, parent);
+
+	if (pos < 0)
+		die("BUG: parent %s missing from commit-graph",
+		    sha1_to_hex(parent->object.sha1));
+	return pos;
+}
+
+static void write_graph_chunk_data(struct sha1file *f,
+				   struct packed_commit_list *commits)
+{
+	uint32_t num_extra_edges = 0;
+	int i;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *c = commits->list[i];
+		struct commit_list *parent = c->parents;
+		uint32_t packed[4];
+
+		sha1write(f, c->tree->object.sha1, GRAPH_OID_LEN);
+
+		if (!parent)
+			packed[0] = GRAPH_PARENT_NONE;
+		else {
+			packed[0] = parent_pos_or_die(commits, parent->item);
+			parent = parent->next;
+		}
+
+		if (!parent)
+			packed[1] = GRAPH_PARENT_NONE;
+		else if (parent->next) {
+			packed[1] = GRAPH_OCTOPUS_EDGES_NEEDED | num_extra_edges;
+			num_extra_edges += commit_list_count(parent);
+		} else
+			packed[1] = parent_pos_or_die(commits, parent->item);
+
+		packed[2] = (uint32_t)((uint64_t)c->date >> 32) & 0x3;
+		packed[2] |= c->generation << 2;
+		packed[3] = (uint32_t)c->date;
+
+		packed[0] = htonl(packed[0]);
+		packed[1] = htonl(packed[1]);
+		packed[2] = htonl(packed[2]);
+		packed[3] = htonl(packed[3]);
+		sha1write(f, packed, sizeof(packed));
+	}
+}
+
+static void write_graph_chunk_large_edges(struct sha1file *f,
+					  struct packed_commit_list *commits)
+{
+	int i;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit_list *parent = commits->list[i]->parents;
+
+		if (!parent || !parent->next || !parent->next->next)
+			continue;
+
+		/* the first parent lives in the CDAT chunk */
+		for (parent = parent->next; parent; parent = parent->next) {
+			uint32_t edge = parent_pos_or_die(commits, parent->item);
+			if (!parent->next)
+				edge |= GRAPH_LAST_EDGE;
+			edge = htonl(edge);
+			sha1write(f, &edge, 4);
+		}
+	}
+}
+
+static int generation_known(const struct commit *c)
+{
+	return c->generation != GENERATION_NUMBER_INFINITY &&
+	       c->generation != GENERATION_NUMBER_ZERO;
+}
+
+static void compute_generation_numbers(struct packed_commit_list *commits)
+{
+	struct commit_list *list = NULL;
+	int i;
+
+	for (i = 0; i < commits->nr; i++) {
+		if (generation_known(commits->list[i]))
+			continue;
+
+		commit_list_insert(commits->list[i], &list);
+		while (list) {
+			struct commit *current = list->item;
+			struct commit_list *parent;
+			uint32_t max_generation = 0;
+			int all_parents_computed = 1;
+
+			for (parent = current->parents; parent; parent = parent->next) {
+				if (!generation_known(parent->item)) {
+					all_parents_computed = 0;
+					commit_list_insert(parent->item, &list);
+					break;
+				}
+				if (parent->item->generation > max_generation)
+					max_generation = parent->item->generation;
+			}
+
+			if (all_parents_computed) {
+				current->generation = max_generation + 1;
+				if (current->generation > GENERATION_NUMBER_MAX)
+					current->generation = GENERATION_NUMBER_MAX;
+				pop_commit(&list);
+			}
+		}
+	}
+}
+
+static void write_graph_chunk_bloom_indexes(struct sha1file *f,
+					    struct packed_commit_list *commits,
+					    struct bloom_filter *filters)
+{
+	uint32_t offset = 0;
+	int i;
+
+	for (i = 0; i < commits->nr; i++) {
+		uint32_t be32;
+
+		offset += filters[i].len;
+		be32 = htonl(offset);
+		sha1write(f, &be32, 4);
+	}
+}
+
+static void write_graph_chunk_bloom_data(struct sha1file *f,
+					 struct packed_commit_list *commits,
+					 struct bloom_filter *filters,
+					 const struct bloom_filter_settings *settings)
+{
+	uint32_t header[3];
+	int i;
+
+	header[0] = htonl(settings->hash_version);
+	header[1] = htonl(settings->num_hashes);
+	header[2] = htonl(settings->bits_per_entry);
+	sha1write(f, header, sizeof(header));
+
+	for (i = 0; i < commits->nr; i++)
+		sha1write(f, filters[i].data, filters[i].len);
+}
+
+static struct bloom_filter *compute_bloom_filters(struct packed_commit_list *commits,
+						  const struct bloom_filter_settings *settings,
+						  uint64_t *total_len)
+{
+	struct bloom_filter *filters;
+	int i;
+
+	filters = xcalloc(commits->nr, sizeof(*filters));
+	*total_len = 0;
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *c = commits->list[i];
+
+		/* close_reachable() parsed the parents, too */
+		compute_bloom_filter(c, &filters[i], settings);
+		*total_len += filters[i].len;
+	}
+	if (*total_len > 0xffffffff)
+		die("changed-path Bloom filters do not fit in a commit-graph");
+	return filters;
+}
+
+static void write_chunk_lookup_row(struct sha1file *f, uint32_t id,
+				   uint64_t offset)
+{
+	uint32_t row[3];
+
+	row[0] = htonl(id);
+	row[1] = htonl((uint32_t)(offset >> 32));
+	row[2] = htonl((uint32_t)offset);
+	sha1write(f, row, sizeof(row));
+}
+
+int write_commit_graph(const char *obj_dir, struct sha1_array *commit_ids,
+		       unsigned flags)
+{
+	static struct lock_file lk;
+	struct packed_commit_list commits = { NULL, 0, 0 };
+	struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct bloom_filter *filters = NULL;
+	uint64_t bloom_len = 0;
+	struct sha1file *f;
+	char *graph_name;
+	uint32_t chunk_ids[7];
+	uint64_t chunk_offsets[7];
+	uint32_t num_extra_edges = 0;
+	unsigned char header[GRAPH_HEADER_SIZE];
+	int i, num_chunks;
+
+	/*
+	 * The parents would be written as the grafts and shallow
+	 * boundaries rewrite them, and the graph would still be used
+	 * after they are gone.
+	 */
+	if (has_commit_grafts())
+		return error("cannot write a commit-graph in a shallow or grafted repository");
+
+	for (i = 0; i < commit_ids->nr; i++) {
+		struct commit *c = lookup_commit_reference_gently(commit_ids->sha1[i], 1);
+		if (c)
+			add_commit_to_list(&commits, c);
+	}
+	close_reachable(&commits);
+
+	qsort(commits.list, commits.nr, sizeof(*commits.list), commit_compare);
+	compute_generation_numbers(&commits);
+	if (flags & COMMIT_GRAPH_WRITE_BLOOM_FILTERS)
+		filters = compute_bloom_filters(&commits, &bloom_settings,
+						&bloom_len);
+
+	for (i = 0; i < commits.nr; i++) {
+		int num_parents = commit_list_count(commits.list[i]->parents);
+		if (num_parents > 2)
+			num_extra_edges += num_parents - 1;
+	}
+
+	num_chunks = 0;
+	chunk_ids[num_chunks] = GRAPH_CHUNKID_OIDFANOUT;
+	chunk_offsets[num_chunks++] = GRAPH_FANOUT_SIZE;
+	chunk_ids[num_chunks] = GRAPH_CHUNKID_OIDLOOKUP;
+	chunk_offsets[num_chunks++] = (uint64_t)GRAPH_OID_LEN * commits.nr;
+	chunk_ids[num_chunks] = GRAPH_CHUNKID_DATA;
+	chunk_offsets[num_chunks++] = (uint64_t)GRAPH_DATA_WIDTH * commits.nr;
+	if (num_extra_edges) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_LARGEEDGES;
+		chunk_offsets[num_chunks++] = 4 * (uint64_t)num_extra_edges;
+	}
+	if (filters) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMINDEXES;
+		chunk_offsets[num_chunks++] = 4 * (uint64_t)commits.nr;
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMDATA;
+		chunk_offsets[num_chunks++] = 12 + bloom_len;
+	}
+	chunk_ids[num_chunks] = 0;
+
+	/* turn the chunk sizes into offsets */
+	chunk_offsets[num_chunks] = GRAPH_HEADER_SIZE +
+		(num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	for (i = 0; i < num_chunks; i++) {
+		uint64_t size = chunk_offsets[i];
+		chunk_offsets[i] = chunk_offsets[num_chunks];
+		chunk_offsets[num_chunks] += size;
+	}
+
+	graph_name = get_commit_graph_filename(obj_dir);
+	if (safe_create_leading_directories(graph_name))
+		die_errno("unable to create leading directories of %s",
+			  graph_name);
+	hold_lock_file_for_update(&lk, graph_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(lk.fd, lk.filename);
+
+	put_be32(header, GRAPH_SIGNATURE);
+	header[4] = GRAPH_VERSION;
+	header[5] = GRAPH_OID_VERSION;
+	header[6] = num_chunks;
+	header[7] = 0; /* unused padding byte */
+	sha1write(f, header, sizeof(header));
+
+	for (i = 0; i <= num_chunks; i++)
+		write_chunk_lookup_row(f, chunk_ids[i], chunk_offsets[i]);
+
+	write_graph_chunk_fanout(f, &commits);
+	write_graph_chunk_oids(f, &commits);
+	write_graph_chunk_data(f, &commits);
+	if (num_extra_edges)
+		write_graph_chunk_large_edges(f, &commits);
+	if (filters) {
+		write_graph_chunk_bloom_indexes(f, &commits, filters);
+		write_graph_chunk_bloom_data(f, &commits, filters,
+					     &bloom_settings);
+	}
+
+	close_commit_graph();
+	sha1close(f, NULL, CSUM_FSYNC);
+	lk.fd = -1;
+	if (commit_lock_file(&lk))
+		die_errno("unable to write commit-graph file %s", graph_name);
+
+	free(graph_name);
+	if (filters) {
+		for (i = 0; i < commits.nr; i++)
+			free(filters[i].data);
+		free(filters);
+	}
+	free(commits.list);
+	return 0;
+}
+
+static int graph_report(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vreportf("error: ", fmt, ap);
+	va_end(ap);
+	return 1;
+}
+
+static int verify_one_commit(struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *sha1 = g->chunk_oid_lookup + GRAPH_OID_LEN * pos;
+	const unsigned char *commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+	struct commit *c = lookup_commit(sha1);
+	struct commit graph_commit;
+	struct commit_list *a, *b;
+	int errors = 0;
+
+	if (!c || parse_commit(c))
+		return graph_report("failed to parse %s from object database",
+				    sha1_to_hex(sha1));
+
+	memset(&graph_commit, 0, sizeof(graph_commit));
+	hashcpy(graph_commit.object.sha1, sha1);
+	fill_commit_in_graph(g, &graph_commit, pos);
+
+	if (hashcmp(commit_data, c->tree->object.sha1))
+		errors += graph_report("root tree for commit %s in commit-graph is %s != %s",
+				       sha1_to_hex(sha1), sha1_to_hex(commit_data),
+				       sha1_to_hex(c->tree->object.sha1));
+
+	for (a = graph_commit.parents, b = c->parents;
+	     a && b;
+	     a = a->next, b = b->next) {
+		if (a->item != b->item) {
+			errors += graph_report("commit-graph parent for %s is %s != %s",
+					       sha1_to_hex(sha1),
+					       sha1_to_hex(a->item->object.sha1),
+					       sha1_to_hex(b->item->object.sha1));
+			break;
+		}
+	}
+	if (!a != !b)
+		errors += graph_report("commit-graph parent list for commit %s has the wrong length",
+				       sha1_to_hex(sha1));
+
+	if (graph_commit.date != c->date)
+		errors += graph_report("commit date for commit %s in commit-graph is %lu != %lu",
+				       sha1_to_hex(sha1), graph_commit.date, c->date);
+
+	if (graph_commit.generation != GENERATION_NUMBER_ZERO) {
+		uint32_t max_generation = 0;
+
+		for (a = graph_commit.parents; a; a = a->next) {
+			uint32_t parent_generation = graph_generation(g, a->item->graph_pos);
+			if (parent_generation > max_generation)
+				max_generation = parent_generation;
+		}
+		if (max_generation == GENERATION_NUMBER_MAX)
+			max_generation--;
+		if (graph_commit.generation != max_generation + 1)
+			errors += graph_report("commit-graph generation for commit %s is %u != %u",
+					       sha1_to_hex(sha1), graph_commit.generation,
+					       max_generation + 1);
+	}
+
+	if (g->chunk_bloom_data) {
+		struct bloom_filter stored, computed;
+
+		if (c->parents && parse_commit(c->parents->item))
+			return errors + graph_report("failed to parse parent of %s",
+						     sha1_to_hex(sha1));
+		compute_bloom_filter(c, &computed, &g->bloom_filter_settings);
+		if (!graph_bloom_filter(g, pos, &stored))
+			errors += graph_report("commit-graph has a malformed Bloom filter index for commit %s",
+					       sha1_to_hex(sha1));
+		else if (stored.len != computed.len ||
+			 memcmp(stored.data, computed.data, stored.len))
+			errors += graph_report("commit-graph changed-path Bloom filter for commit %s is wrong",
+					       sha1_to_hex(sha1));
+		free(computed.data);
+	}
+
+	free_commit_list(graph_commit.parents);
+	return errors;
+}
+
+int verify_commit_graph(const char *obj_dir)
+{
+	struct commit_graph *g;
+	char *graph_name;
+	git_SHA_CTX ctx;
+	unsigned char checksum[20];
+	uint32_t i;
+	int errors = 0;
+
+	graph_name = get_commit_graph_filename(obj_dir);
+	g = load_commit_graph_one(graph_name);
+	if (!g) {
+		if (access(graph_name, F_OK))
+			errors = 0; /* no graph is not an error */
+		else
+			errors = graph_report("unable to load commit-graph %s",
+					      graph_name);
+		free(graph_name);
+		return errors;
+	}
+	free(graph_name);
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, g->data, g->data_len - GRAPH_OID_LEN);
+	git_SHA1_Final(checksum, &ctx);
+	if (hashcmp(checksum, g->data + g->data_len - GRAPH_OID_LEN))
+		errors += graph_report("the commit-graph file has incorrect checksum and is likely corrupt");
+
+	for (i = 1; i < g->num_commits; i++) {
+		if (hashcmp(g->chunk_oid_lookup + GRAPH_OID_LEN * (i - 1),
+			    g->chunk_oid_lookup + GRAPH_OID_LEN * i) >= 0)
+			errors += graph_report("commit-graph has incorrect OID order: %s then %s",
+					       sha1_to_hex(g->chunk_oid_lookup + GRAPH_OID_LEN * (i - 1)),
+					       sha1_to_hex(g->chunk_oid_lookup + GRAPH_OID_LEN * i));
+	}
+	if (errors) {
+		free_commit_graph(g);
+		return errors;
+	}
+
+	commit_graph_disabled = 1;
+	for (i = 0; i < g->num_commits; i++)
+		errors += verify_one_commit(g, i);
+	commit_graph_disabled = 0;
+
+	free_commit_graph(g);
+	return errors;
+}
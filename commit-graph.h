@@ -0,0 +1,114 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include "commit.h"
+#include "sha1-array.h"
+#include "bloom.h"
+
+/*
+ * The commit-graph file ("$GIT_OBJECT_DIRECTORY/info/commit-graph")
+ * caches the parents, root tree and commit date of a set of commits in
+ * a fixed-width table, so that history walks do not have to inflate
+ * commit objects just to learn about their topology.
+ *
+ * See Documentation/technical/commit-graph-format.txt for the layout.
+ */
+
+#define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_LARGEEDGES 0x45444745 /* "EDGE" */
+#define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
+#define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+
+#define GRAPH_VERSION 1
+#define GRAPH_OID_VERSION 1 /* SHA-1 */
+#define GRAPH_OID_LEN 20
+
+#define GRAPH_DATA_WIDTH (GRAPH_OID_LEN + 16)
+
+#define GRAPH_PARENT_NONE 0x70000000
+#define GRAPH_OCTOPUS_EDGES_NEEDED 0x80000000
+#define GRAPH_EDGE_LAST_MASK 0x7fffffff
+#define GRAPH_LAST_EDGE 0x80000000
+
+struct commit_graph {
+	const unsigned char *data;
+	size_t data_len;
+
+	unsigned char num_chunks;
+	uint32_t num_commits;
+
+	const unsigned char *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_large_edges;
+	uint32_t num_large_edges;
+	const unsigned char *chunk_bloom_indexes;
+	const unsigned char *chunk_bloom_data;
+	size_t bloom_data_len;
+
+	struct bloom_filter_settings bloom_filter_settings;
+};
+
+/* Return the path of the commit-graph file in "obj_dir"; free() it. */
+extern char *get_commit_graph_filename(const char *obj_dir);
+
+/*
+ * Map and validate the commit-graph file at "graph_file". Returns NULL
+ * if the file does not exist or is malformed.
+ */
+extern struct commit_graph *load_commit_graph_one(const char *graph_file);
+extern void free_commit_graph(struct commit_graph *g);
+
+/*
+ * Fill in the parents, tree and date of "item" from the commit-graph
+ * of the repository, if one is present, enabled by "core.commitGraph",
+ * and usable (i.e. no grafts, shallow boundaries or replace refs can
+ * change what the commit objects themselves say). Returns 1 if "item"
+ * was parsed from the graph, 0 if the caller must read the object.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * Record the graph position and generation number of "item", which
+ * was parsed from its object, if the commit-graph knows about it.
+ */
+extern void load_commit_graph_info(struct commit *item);
+
+/* Drop the in-core commit-graph, e.g. before rewriting the file. */
+extern void close_commit_graph(void);
+
+/*
+ * Return the settings of the changed-path Bloom filters of the
+ * repository's commit-graph, or NULL if it has none (or cannot be used).
+ */
+extern const struct bloom_filter_settings *get_bloom_filter_settings(void);
+
+/*
+ * Point "filter" at the changed-path Bloom filter of "c" against its
+ * first parent, as stored in the commit-graph. Returns 0 (and leaves
+ * "filter" alone) if the graph has no filter for "c".
+ */
+extern int get_bloom_filter(struct commit *c, struct bloom_filter *filter);
+
+/* Also store changed-path Bloom filters. */
+#define COMMIT_GRAPH_WRITE_BLOOM_FILTERS (1 << 0)
+
+/*
+ * Write a commit-graph file to "obj_dir" containing the commits named
+ * in "commits" and everything reachable from them.  Returns -1 with an
+ * error, writing nothing, in a shallow or grafted repository.
+ */
+extern int write_commit_graph(const char *obj_dir, struct sha1_array *commits,
+			      unsigned flags);
+
+/*
+ * Check the commit-graph file in "obj_dir" against its trailing
+ * checksum and against the commit objects it describes. Returns the
+ * number of problems found.
+ */
+extern int verify_commit_graph(const char *obj_dir);
+
+#endif
@@ -13,6 +13,20 @@ struct commit_list {
 	struct commit_list *next;
 };
 
+#define COMMIT_NOT_FROM_GRAPH 0xFFFFFFFF
+
+/*
+ * A commit's generation number is one more than the largest generation
+ * number of its parents (1 for root commits), so a commit can only reach
+ * commits with a strictly smaller generation number. Commits that are
+ * not in the commit-graph get GENERATION_NUMBER_INFINITY; a graph written
+ * without generation numbers stores GENERATION_NUMBER_ZERO for all of
+ * its commits.
+ */
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+#define GENERATION_NUMBER_ZERO 0
+
 struct commit {
 	struct object object;
 	void *util;
@@ -20,6 +34,8 @@ struct commit {
 	unsigned long date;
 	struct commit_list *parents;
 	struct tree *tree;
+	uint32_t graph_pos;
+	uint32_t generation;
 };
 
 extern int save_commit_buffer;
@@ -235,6 +251,7 @@ struct ref;
 extern int register_shallow(const unsigned char *sha1);
 extern int unregister_shallow(const unsigned char *sha1);
 extern int for_each_commit_graft(each_commit_graft_fn, void *);
+extern int has_commit_grafts(void);
 extern int is_repository_shallow(void);
 extern struct commit_list *get_shallow_commits(struct object_array *heads,
 		int depth, int shallow_flag, int not_shallow_flag);
@@ -349,6 +366,7 @@ extern void print_commit_list(struct commit_list *list,
 extern void check_commit_signature(const struct commit* commit, struct signature_check *sigc);
 
 int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused);
+int compare_commits_by_gen_then_commit_date(const void *a_, const void *b_, void *unused);
 
 LAST_ARG_MUST_BE_NULL
 extern int run_commit_hook(int editor_is_used, const char *index_file, const char *name, ...);
@@ -9,6 +9,9 @@
 #include "url.h"
 #include "string-list.h"
 #include "sha1-array.h"
+#include "argv-array.h"
+#include "protocol.h"
+#include "version.h"
 
 static char *server_capabilities;
 static const char *parse_feature_value(const char *, const char *, int *);
@@ -112,7 +115,7 @@ static void annotate_refs_with_symref_info(struct ref *ref)
 /*
  * Read all the refs from the other end
  */
-struct ref **get_remote_heads(int in, char *src_buf, size_t src_len,
+struct ref **get_remote_heads(struct packet_reader *reader,
 			      struct ref **list, unsigned int flags,
 			      struct sha1_array *extra_have,
 			      struct sha1_array *shallow_points)
@@ -126,18 +129,15 @@ struct ref **get_remote_heads(int in, char *src_buf, size_t src_len,
 		unsigned char old_sha1[20];
 		char *name;
 		int len, name_len;
-		char *buffer = packet_buffer;
+		char *buffer;
 		const char *arg;
 
-		len = packet_read(in, &src_buf, &src_len,
-				  packet_buffer, sizeof(packet_buffer),
-				  PACKET_READ_GENTLE_ON_EOF |
-				  PACKET_READ_CHOMP_NEWLINE);
-		if (len < 0)
+		if (packet_reader_read(reader) == PACKET_READ_EOF)
 			die_initial_contact(got_at_least_one_head);
-
+		len = reader->pktlen;
 		if (!len)
 			break;
+		buffer = reader->buffer;
 
 		if (len > 4 && skip_prefix(buffer, "ERR ", &arg))
 			die("remote error: %s", arg);
@@ -181,6 +181,167 @@ struct ref **get_remote_heads(int in, char *src_buf, size_t src_len,
 	return list;
 }
 
+static struct argv_array server_capabilities_v2 = ARGV_ARRAY_INIT;
+
+enum protocol_version discover_version(struct packet_reader *reader)
+{
+	enum protocol_version version = protocol_v0;
+
+	/*
+	 * Only peek: a v0 server starts right away with its ref
+	 * advertisement, which get_remote_heads() will want to read.
+	 */
+	switch (packet_reader_peek(reader)) {
+	case PACKET_READ_EOF:
+		die_initial_contact(0);
+	case PACKET_READ_NORMAL:
+		if (!strcmp(reader->line, "version 2"))
+			version = protocol_v2;
+		break;
+	default:
+		break;
+	}
+
+	if (version == protocol_v2) {
+		packet_reader_read(reader);
+		argv_array_clear(&server_capabilities_v2);
+		while (packet_reader_read(reader) == PACKET_READ_NORMAL)
+			argv_array_push(&server_capabilities_v2, reader->line);
+		if (reader->status != PACKET_READ_FLUSH)
+			die("expected flush after capabilities");
+	}
+	return version;
+}
+
+static const char *server_capability_v2(const char *c)
+{
+	int i;
+
+	for (i = 0; i < server_capabilities_v2.argc; i++) {
+		const char *out;
+		if (skip_prefix(server_capabilities_v2.argv[i], c, &out) &&
+		    (!*out || *out == '='))
+			return out;
+	}
+	return NULL;
+}
+
+int server_supports_v2(const char *c, int die_on_error)
+{
+	if (server_capability_v2(c))
+		return 1;
+	if (die_on_error)
+		die("server doesn't support '%s'", c);
+	return 0;
+}
+
+int server_supports_feature(const char *c, const char *feature,
+			    int die_on_error)
+{
+	const char *value = server_capability_v2(c);
+
+	if (value && *value == '=' && parse_feature_request(value + 1, feature))
+		return 1;
+	if (die_on_error)
+		die("server doesn't support feature '%s'", feature);
+	return 0;
+}
+
+/* Parse one line of "ls-refs" output: "<oid> <name> [<attribute>...]". */
+static int process_ref_v2(const char *line, struct ref ***list)
+{
+	struct string_list fields = STRING_LIST_INIT_DUP;
+	unsigned char old_sha1[20];
+	struct ref *ref;
+	int i, ret = 0;
+
+	string_list_split(&fields, line, ' ', -1);
+	if (fields.nr < 2 || get_sha1_hex(fields.items[0].string, old_sha1))
+		goto out;
+
+	ref = alloc_ref(fields.items[1].string);
+	hashcpy(ref->old_sha1, old_sha1);
+	**list = ref;
+	*list = &ref->next;
+
+	for (i = 2; i < fields.nr; i++) {
+		const char *arg = fields.items[i].string;
+
+		if (skip_prefix(arg, "symref-target:", &arg)) {
+			ref->symref = xstrdup(arg);
+		} else if (skip_prefix(arg, "peeled:", &arg)) {
+			/* list it the way a v0 advertisement does */
+			struct ref *peeled;
+			char *name = xstrfmt("%s^{}", ref->name);
+
+			peeled = alloc_ref(name);
+			free(name);
+			if (get_sha1_hex(arg, peeled->old_sha1)) {
+				free(peeled);
+				goto out;
+			}
+			**list = peeled;
+			*list = &peeled->next;
+		}
+	}
+	ret = 1;
+out:
+	string_list_clear(&fields, 0);
+	return ret;
+}
+
+struct ref **get_remote_refs(int fd_out, struct packet_reader *reader,
+			     struct ref **list, int for_push,
+			     const struct argv_array *ref_prefixes)
+{
+	struct strbuf req = STRBUF_INIT;
+	int i;
+
+	*list = NULL;
+	server_supports_v2("ls-refs", 1);
+	packet_buf_write(&req, "command=ls-refs\n");
+	if (server_supports_v2("agent", 0))
+		packet_buf_write(&req, "agent=%s\n", git_user_agent_sanitized());
+	packet_buf_delim(&req);
+	if (!for_push)
+		packet_buf_write(&req, "peel\n");
+	packet_buf_write(&req, "symrefs\n");
+	for (i = 0; ref_prefixes && i < ref_prefixes->argc; i++)
+		packet_buf_write(&req, "ref-prefix %s\n", ref_prefixes->argv[i]);
+	packet_buf_flush(&req);
+	write_or_die(fd_out, req.buf, req.len);
+	strbuf_release(&req);
+
+	while (packet_reader_read(reader) == PACKET_READ_NORMAL)
+		if (!process_ref_v2(reader->line, &list))
+			die("invalid ls-refs response: %s", reader->line);
+	if (reader->status != PACKET_READ_FLUSH)
+		die("expected flush after ref listing");
+	return list;
+}
+
+int get_bundle_uris(int fd_out, struct packet_reader *reader,
+		    struct string_list *uris)
+{
+	struct strbuf req = STRBUF_INIT;
+
+	if (!server_supports_v2("bundle-uri", 0))
+		return -1;
+	packet_buf_write(&req, "command=bundle-uri\n");
+	if (server_supports_v2("agent", 0))
+		packet_buf_write(&req, "agent=%s\n", git_user_agent_sanitized());
+	packet_buf_delim(&req);
+	packet_buf_flush(&req);
+	write_or_die(fd_out, req.buf, req.len);
+	strbuf_release(&req);
+
+	while (packet_reader_read(reader) == PACKET_READ_NORMAL)
+		string_list_append(uris, reader->line);
+	if (reader->status != PACKET_READ_FLUSH)
+		die("expected flush after bundle-uri listing");
+	return 0;
+}
+
 static const char *parse_feature_value(const char *feature_list, const char *feature, int *lenp)
 {
 	int len;
@@ -658,8 +819,15 @@ struct child_process *git_connect(int fd[2], const char *url,
 	char *hostandport, *path;
 	struct child_process *conn = &no_fork;
 	enum protocol protocol;
+	enum protocol_version version = get_protocol_version_config();
 	struct strbuf cmd = STRBUF_INIT;
 
+	/* Only upload-pack knows how to speak protocol v2. */
+	if (version == protocol_v2 &&
+	    (!strcmp(prog, "git-receive-pack") ||
+	     !strcmp(prog, "git-upload-archive")))
+		version = protocol_v0;
+
 	/* Without this we cannot rely on waitpid() to tell
 	 * what happened to our children.
 	 */
@@ -687,13 +855,25 @@ struct child_process *git_connect(int fd[2], const char *url,
 		 *
 		 * Note: Do not add any other headers here!  Doing so
 		 * will cause older git-daemon servers to crash.
+		 *
+		 * A protocol version request goes after a second NUL
+		 * byte, where older servers do not look.
 		 */
-		packet_write(fd[1],
-			     "%s %s%chost=%s%c",
-			     prog, path, 0,
-			     target_host, 0);
+		if (version > 0)
+			packet_write(fd[1],
+				     "%s %s%chost=%s%c%cversion=%d%c",
+				     prog, path, 0,
+				     target_host, 0,
+				     0, version, 0);
+		else
+			packet_write(fd[1],
+				     "%s %s%chost=%s%c",
+				     prog, path, 0,
+				     target_host, 0);
 		free(target_host);
 	} else {
+		struct argv_array env = ARGV_ARRAY_INIT;
+
 		conn = xcalloc(1, sizeof(*conn));
 
 		strbuf_addstr(&cmd, prog);
@@ -714,6 +894,10 @@ struct child_process *git_connect(int fd[2], const char *url,
 			argv_array_push(&conn->args, ssh);
 			if (putty && !strcasestr(ssh, "tortoiseplink"))
 				argv_array_push(&conn->args, "-batch");
+			if (version > 0 && !putty)
+				argv_array_pushl(&conn->args, "-o",
+						 "SendEnv=" GIT_PROTOCOL_ENVIRONMENT,
+						 NULL);
 			if (port) {
 				/* P is for PuTTY, p is for OpenSSH */
 				argv_array_push(&conn->args, putty ? "-P" : "-p");
@@ -722,13 +906,22 @@ struct child_process *git_connect(int fd[2], const char *url,
 			argv_array_push(&conn->args, ssh_host);
 		} else {
 			/* remove repo-local variables from the environment */
-			conn->env = local_repo_env;
+			const char * const *var;
+			for (var = local_repo_env; *var; var++)
+				argv_array_push(&env, *var);
 			conn->use_shell = 1;
 		}
 		argv_array_push(&conn->args, cmd.buf);
+		if (version > 0)
+			argv_array_pushf(&env, GIT_PROTOCOL_ENVIRONMENT "=version=%d",
+					 version);
+		if (env.argc)
+			conn->env = env.argv;
 
 		if (start_command(conn))
 			die("unable to fork");
+		conn->env = NULL;
+		argv_array_clear(&env);
 
 		fd[0] = conn->out; /* read from child's stdout */
 		fd[1] = conn->in;  /* write to child's stdin */
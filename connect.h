@@ -1,6 +1,8 @@
 #ifndef CONNECT_H
 #define CONNECT_H
 
+#include "protocol.h"
+
 #define CONNECT_VERBOSE       (1u << 0)
 #define CONNECT_DIAG_URL      (1u << 1)
 extern struct child_process *git_connect(int fd[2], const char *url, const char *prog, int flags);
@@ -11,4 +13,24 @@ extern int parse_feature_request(const char *features, const char *feature);
 extern const char *server_feature_value(const char *feature, int *len_ret);
 extern int url_is_local_not_ssh(const char *url);
 
+struct packet_reader;
+/*
+ * Find out which protocol version the server on the other end of
+ * "reader" speaks.  For protocol v2 its capabilities are read and
+ * remembered for server_supports_v2(); for v0 nothing is consumed.
+ */
+extern enum protocol_version discover_version(struct packet_reader *reader);
+extern int server_supports_v2(const char *c, int die_on_error);
+/* Does v2 capability "c" (e.g. "fetch") list "feature" in its value? */
+extern int server_supports_feature(const char *c, const char *feature,
+				   int die_on_error);
+
+struct string_list;
+/*
+ * Protocol v2: append to "uris" the bundles the server offers with the
+ * "bundle-uri" command.  Returns -1 if it did not advertise the command.
+ */
+extern int get_bundle_uris(int fd_out, struct packet_reader *reader,
+			   struct string_list *uris);
+
 #endif
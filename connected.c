@@ -3,6 +3,25 @@
 #include "sigchain.h"
 #include "connected.h"
 #include "transport.h"
+#include "commit.h"
+#include "fetch-object.h"
+
+static int use_bitmaps = -1;
+
+static int connected_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "pack.usebitmaps"))
+		use_bitmaps = git_config_bool(var, value);
+	return 0;
+}
+
+static void load_connected_config(void)
+{
+	if (use_bitmaps >= 0)
+		return;
+	use_bitmaps = 1;
+	git_config(connected_config, NULL);
+}
 
 int check_everything_connected(sha1_iterate_fn fn, int quiet, void *cb_data)
 {
@@ -17,6 +36,11 @@ int check_everything_connected(sha1_iterate_fn fn, int quiet, void *cb_data)
  * these commits locally exists and is connected to our existing refs.
  * Note that this does _not_ validate the individual objects.
  *
+ * With a reachability bitmap, rev-list takes everything in the bitmap
+ * closure of our refs for granted and only walks the new objects.
+ * In a partial clone, objects that came from the promisor remote are
+ * taken for granted the same way.
+ *
  * Returns 0 if everything is connected, non-zero otherwise.
  */
 static int check_everything_connected_real(sha1_iterate_fn fn,
@@ -26,7 +50,7 @@ static int check_everything_connected_real(sha1_iterate_fn fn,
 					   const char *shallow_file)
 {
 	struct child_process rev_list;
-	const char *argv[9];
+	const char *argv[11];
 	char commit[41];
 	unsigned char sha1[20];
 	int err = 0, ac = 0;
@@ -58,6 +82,12 @@ static int check_everything_connected_real(sha1_iterate_fn fn,
 	argv[ac++] = "--all";
 	if (quiet)
 		argv[ac++] = "--quiet";
+	load_connected_config();
+	if (use_bitmaps && !shallow_file && !is_repository_shallow())
+		argv[ac++] = "--use-bitmap-index";
+	/* a partial clone lacks what its promisor packs point at */
+	if (promisor_remote())
+		argv[ac++] = "--exclude-promisor-objects";
 	argv[ac] = NULL;
 
 	memset(&rev_list, 0, sizeof(rev_list));
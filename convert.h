@@ -33,11 +33,41 @@ enum eol {
 
 extern enum eol core_eol;
 
+struct convert_driver;
+
+enum crlf_action {
+	CRLF_GUESS = -1,
+	CRLF_BINARY = 0,
+	CRLF_TEXT,
+	CRLF_INPUT,
+	CRLF_CRLF,
+	CRLF_AUTO
+};
+
+/* The conversion attributes of a path, as looked up by convert_attrs() */
+struct conv_attrs {
+	struct convert_driver *drv;
+	enum crlf_action crlf_action;
+	enum eol eol_attr;
+	int ident;
+};
+
+extern void convert_attrs(struct conv_attrs *ca, const char *path);
+
 /* returns 1 if *dst was used */
 extern int convert_to_git(const char *path, const char *src, size_t len,
 			  struct strbuf *dst, enum safe_crlf checksafe);
 extern int convert_to_working_tree(const char *path, const char *src,
 				   size_t len, struct strbuf *dst);
+/*
+ * Like convert_to_working_tree(), with attributes looked up beforehand.
+ * Unless ca->drv is set (which runs an external filter), this does not
+ * look at the attributes, the index or the object store, and can be
+ * called from several threads at once.
+ */
+extern int convert_to_working_tree_ca(const struct conv_attrs *ca,
+				      const char *path, const char *src,
+				      size_t len, struct strbuf *dst);
 extern int renormalize_buffer(const char *path, const char *src, size_t len,
 			      struct strbuf *dst);
 static inline int would_convert_to_git(const char *path, const char *src,
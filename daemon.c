@@ -4,6 +4,8 @@
 #include "run-command.h"
 #include "strbuf.h"
 #include "string-list.h"
+#include "argv-array.h"
+#include "protocol.h"
 
 #ifndef HOST_NAME_MAX
 #define HOST_NAME_MAX 256
@@ -221,7 +223,7 @@ static const char *path_ok(const char *directory)
 	return NULL;		/* Fallthrough. Deny by default */
 }
 
-typedef int (*daemon_service_fn)(void);
+typedef int (*daemon_service_fn)(const struct argv_array *env);
 struct daemon_service {
 	const char *name;
 	const char *config_name;
@@ -320,7 +322,8 @@ error_return:
 	return -1;
 }
 
-static int run_service(const char *dir, struct daemon_service *service)
+static int run_service(const char *dir, struct daemon_service *service,
+		       const struct argv_array *env)
 {
 	const char *path;
 	int enabled = service->enabled;
@@ -380,7 +383,7 @@ static int run_service(const char *dir, struct daemon_service *service)
 	 */
 	signal(SIGTERM, SIG_IGN);
 
-	return service->fn();
+	return service->fn(env);
 }
 
 static void copy_to_log(int fd)
@@ -404,12 +407,15 @@ static void copy_to_log(int fd)
 	fclose(fp);
 }
 
-static int run_service_command(const char **argv)
+static int run_service_command(const char **argv,
+			       const struct argv_array *env)
 {
 	struct child_process cld;
 
 	memset(&cld, 0, sizeof(cld));
 	cld.argv = argv;
+	if (env->argc)
+		cld.env = env->argv;
 	cld.git_cmd = 1;
 	cld.err = -1;
 	if (start_command(&cld))
@@ -423,7 +429,7 @@ static int run_service_command(const char **argv)
 	return finish_command(&cld);
 }
 
-static int upload_pack(void)
+static int upload_pack(const struct argv_array *env)
 {
 	/* Timeout as string */
 	char timeout_buf[64];
@@ -432,19 +438,19 @@ static int upload_pack(void)
 	argv[2] = timeout_buf;
 
 	snprintf(timeout_buf, sizeof timeout_buf, "--timeout=%u", timeout);
-	return run_service_command(argv);
+	return run_service_command(argv, env);
 }
 
-static int upload_archive(void)
+static int upload_archive(const struct argv_array *env)
 {
 	static const char *argv[] = { "upload-archive", ".", NULL };
-	return run_service_command(argv);
+	return run_service_command(argv, env);
 }
 
-static int receive_pack(void)
+static int receive_pack(const struct argv_array *env)
 {
 	static const char *argv[] = { "receive-pack", ".", NULL };
-	return run_service_command(argv);
+	return run_service_command(argv, env);
 }
 
 static struct daemon_service daemon_service[] = {
@@ -505,9 +511,10 @@ static void parse_host_and_port(char *hostport, char **host,
 }
 
 /*
- * Read the host as supplied by the client connection.
+ * Read the host as supplied by the client connection, and return
+ * where the arguments after it start.
  */
-static void parse_host_arg(char *extra_args, int buflen)
+static char *parse_host_arg(char *extra_args, int buflen)
 {
 	char *val;
 	int vallen;
@@ -589,6 +596,39 @@ static void parse_host_arg(char *extra_args, int buflen)
 		ip_address = xstrdup(addrbuf);
 #endif
 	}
+	return extra_args;
+}
+
+/*
+ * Anything after the host comes after an extra NUL, where older
+ * daemons, which die on anything they do not understand, do not
+ * look.  Of that we only know "version=<n>", which we pass on to
+ * the service in GIT_PROTOCOL.
+ */
+static void parse_extra_args(struct argv_array *env, char *extra_args,
+			     int buflen)
+{
+	char *end = extra_args + buflen;
+	struct strbuf git_protocol = STRBUF_INIT;
+
+	extra_args = parse_host_arg(extra_args, buflen);
+	if (extra_args < end && !*extra_args) {
+		for (extra_args++; extra_args < end && *extra_args;
+		     extra_args += strlen(extra_args) + 1) {
+			if (!starts_with(extra_args, "version="))
+				continue;
+			if (git_protocol.len)
+				strbuf_addch(&git_protocol, ':');
+			strbuf_addstr(&git_protocol, extra_args);
+		}
+	}
+
+	if (git_protocol.len) {
+		loginfo("Extended attribute \"protocol\": %s", git_protocol.buf);
+		argv_array_pushf(env, GIT_PROTOCOL_ENVIRONMENT "=%s",
+				 git_protocol.buf);
+	}
+	strbuf_release(&git_protocol);
 }
 
 
@@ -596,6 +636,7 @@ static int execute(void)
 {
 	char *line = packet_buffer;
 	int pktlen, len, i;
+	struct argv_array env = ARGV_ARRAY_INIT;
 	char *addr = getenv("REMOTE_ADDR"), *port = getenv("REMOTE_PORT");
 
 	if (addr)
@@ -622,7 +663,7 @@ static int execute(void)
 	hostname = canon_hostname = ip_address = tcp_port = NULL;
 
 	if (len != pktlen)
-		parse_host_arg(line + len + 1, pktlen - len - 1);
+		parse_extra_args(&env, line + len + 1, pktlen - len - 1);
 
 	for (i = 0; i < ARRAY_SIZE(daemon_service); i++) {
 		struct daemon_service *s = &(daemon_service[i]);
@@ -635,10 +676,13 @@ static int execute(void)
 			 * Note: The directory here is probably context sensitive,
 			 * and might depend on the actual service being performed.
 			 */
-			return run_service(arg, s);
+			int rc = run_service(arg, s, &env);
+			argv_array_clear(&env);
+			return rc;
 		}
 	}
 
+	argv_array_clear(&env);
 	logerror("Protocol error: '%s'", line);
 	return -1;
 }
@@ -0,0 +1,322 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "refs.h"
+#include "string-list.h"
+#include "pack.h"
+#include "pack-objects.h"
+#include "pack-bitmap.h"
+#include "delta-islands.h"
+
+/* The regexes of "pack.island", in configuration order. */
+static regex_t *island_regexes;
+static unsigned int island_regexes_nr, island_regexes_alloc;
+
+/* The names of the islands; "util" holds the island number + 1. */
+static struct string_list island_names = STRING_LIST_INIT_DUP;
+
+/*
+ * The set of islands of an object. Sets are shared between objects
+ * and copied before they are modified when "refcount" is above one.
+ */
+struct island_bitmap {
+	uint32_t refcount;
+	uint32_t bits[FLEX_ARRAY];
+};
+
+static uint32_t island_bitmap_size;
+
+/* sha1 -> struct island_bitmap */
+static khash_sha1 *island_marks;
+
+#define ISLAND_BITMAP_BLOCK(x) ((x) / 32)
+#define ISLAND_BITMAP_MASK(x) (1u << ((x) % 32))
+
+static struct island_bitmap *island_bitmap_new(const struct island_bitmap *old)
+{
+	size_t size = sizeof(struct island_bitmap) +
+		      island_bitmap_size * sizeof(uint32_t);
+	struct island_bitmap *b = xcalloc(1, size);
+
+	if (old)
+		memcpy(b, old, size);
+	b->refcount = 0;
+	return b;
+}
+
+static void island_bitmap_or(struct island_bitmap *self,
+			     const struct island_bitmap *other)
+{
+	uint32_t i;
+
+	for (i = 0; i < island_bitmap_size; i++)
+		self->bits[i] |= other->bits[i];
+}
+
+static int island_bitmap_is_subset(const struct island_bitmap *self,
+				   const struct island_bitmap *super)
+{
+	uint32_t i;
+
+	if (self == super)
+		return 1;
+	for (i = 0; i < island_bitmap_size; i++)
+		if ((self->bits[i] & super->bits[i]) != self->bits[i])
+			return 0;
+	return 1;
+}
+
+static void island_bitmap_set(struct island_bitmap *self, uint32_t i)
+{
+	self->bits[ISLAND_BITMAP_BLOCK(i)] |= ISLAND_BITMAP_MASK(i);
+}
+
+static struct island_bitmap *get_island_marks(const unsigned char *sha1)
+{
+	khiter_t pos;
+
+	if (!island_marks)
+		return NULL;
+	pos = kh_get_sha1(island_marks, sha1);
+	if (pos >= kh_end(island_marks))
+		return NULL;
+	return kh_value(island_marks, pos);
+}
+
+/* Add the islands in "marks" to those of "obj". */
+static void set_island_marks(struct object *obj, struct island_bitmap *marks)
+{
+	struct island_bitmap *b;
+	khiter_t pos;
+	int hash_ret;
+
+	pos = kh_put_sha1(island_marks, obj->sha1, &hash_ret);
+	if (hash_ret) {
+		/* a new object: share the parent's set */
+		kh_value(island_marks, pos) = marks;
+		marks->refcount++;
+		return;
+	}
+
+	b = kh_value(island_marks, pos);
+	if (island_bitmap_is_subset(marks, b))
+		return;
+
+	if (b->refcount > 1) {
+		b->refcount--;
+		b = island_bitmap_new(b);
+		b->refcount = 1;
+		kh_value(island_marks, pos) = b;
+	}
+	island_bitmap_or(b, marks);
+}
+
+int island_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "pack.island")) {
+		if (!value)
+			return config_error_nonbool(var);
+		ALLOC_GROW(island_regexes, island_regexes_nr + 1,
+			   island_regexes_alloc);
+		if (regcomp(&island_regexes[island_regexes_nr], value,
+			    REG_EXTENDED))
+			return error("failed to load island regex for '%s': %s",
+				     var, value);
+		island_regexes_nr++;
+	}
+	return 0;
+}
+
+struct island_tip {
+	unsigned char sha1[20];
+	uint32_t island;
+};
+
+static struct island_tip *island_tips;
+static unsigned int island_tips_nr, island_tips_alloc;
+
+static int find_island_for_ref(const char *refname, const unsigned char *sha1,
+			       int flags, void *data)
+{
+	regmatch_t matches[8];
+	struct strbuf name = STRBUF_INIT;
+	struct string_list_item *item;
+	unsigned int i, m;
+
+	/* the last matching regex wins, so later config overrides */
+	for (i = island_regexes_nr; i > 0; i--)
+		if (!regexec(&island_regexes[i - 1], refname,
+			     ARRAY_SIZE(matches), matches, 0))
+			break;
+	if (!i)
+		return 0;
+
+	/* the island name is made of the capture groups, joined by "-" */
+	for (m = 1; m < ARRAY_SIZE(matches); m++) {
+		regmatch_t *match = &matches[m];
+
+		if (match->rm_so == -1)
+			continue;
+		if (name.len)
+			strbuf_addch(&name, '-');
+		strbuf_add(&name, refname + match->rm_so,
+			   match->rm_eo - match->rm_so);
+	}
+
+	item = string_list_insert(&island_names, name.buf);
+	if (!item->util)
+		item->util = (void *)(intptr_t)island_names.nr;
+	strbuf_release(&name);
+
+	ALLOC_GROW(island_tips, island_tips_nr + 1, island_tips_alloc);
+	hashcpy(island_tips[island_tips_nr].sha1, sha1);
+	island_tips[island_tips_nr].island = (intptr_t)item->util - 1;
+	island_tips_nr++;
+	return 0;
+}
+
+static void mark_island_tip(struct island_tip *tip)
+{
+	struct island_bitmap *b;
+	struct object *obj;
+	khiter_t pos;
+	int hash_ret;
+
+	obj = parse_object(tip->sha1);
+	while (obj) {
+		pos = kh_put_sha1(island_marks, obj->sha1, &hash_ret);
+		if (hash_ret) {
+			b = island_bitmap_new(NULL);
+			b->refcount = 1;
+			kh_value(island_marks, pos) = b;
+		} else
+			b = kh_value(island_marks, pos);
+		island_bitmap_set(b, tip->island);
+
+		if (obj->type != OBJ_TAG)
+			break;
+		obj = ((struct tag *)obj)->tagged;
+		if (obj)
+			obj = parse_object(obj->sha1);
+	}
+}
+
+void load_delta_islands(void)
+{
+	unsigned int i;
+
+	island_marks = kh_init_sha1();
+	for_each_ref(find_island_for_ref, NULL);
+
+	/* each tip starts with a set of its own */
+	island_bitmap_size = (island_names.nr / 32) + 1;
+	for (i = 0; i < island_tips_nr; i++)
+		mark_island_tip(&island_tips[i]);
+
+	free(island_tips);
+	island_tips = NULL;
+	island_tips_nr = island_tips_alloc = 0;
+}
+
+void propagate_island_marks(struct commit *commit)
+{
+	struct island_bitmap *marks = get_island_marks(commit->object.sha1);
+	struct commit_list *p;
+
+	if (!marks)
+		return;
+
+	parse_commit(commit);
+	if (commit->tree)
+		set_island_marks(&commit->tree->object, marks);
+	for (p = commit->parents; p; p = p->next)
+		set_island_marks(&p->item->object, marks);
+}
+
+struct tree_islands_todo {
+	struct object_entry *entry;
+	unsigned int depth;
+};
+
+static int tree_depth_compare(const void *a, const void *b)
+{
+	const struct tree_islands_todo *todo_a = a;
+	const struct tree_islands_todo *todo_b = b;
+
+	if (todo_a->depth != todo_b->depth)
+		return todo_a->depth < todo_b->depth ? -1 : 1;
+	return 0;
+}
+
+void resolve_tree_islands(struct packing_data *to_pack)
+{
+	struct tree_islands_todo *todo;
+	unsigned int nr = 0;
+	uint32_t i;
+
+	if (!island_marks)
+		return;
+
+	todo = xmalloc(to_pack->nr_objects * sizeof(*todo));
+	for (i = 0; i < to_pack->nr_objects; i++) {
+		if (to_pack->objects[i].type != OBJ_TREE)
+			continue;
+		todo[nr].entry = &to_pack->objects[i];
+		todo[nr].depth = to_pack->objects[i].tree_depth;
+		nr++;
+	}
+	qsort(todo, nr, sizeof(*todo), tree_depth_compare);
+
+	for (i = 0; i < nr; i++) {
+		struct object_entry *ent = todo[i].entry;
+		struct island_bitmap *marks;
+		struct tree_desc desc;
+		struct name_entry entry;
+		struct tree *tree;
+
+		marks = get_island_marks(ent->idx.sha1);
+		if (!marks)
+			continue;
+
+		tree = lookup_tree(ent->idx.sha1);
+		if (!tree || parse_tree(tree) < 0)
+			die("bad tree object %s", sha1_to_hex(ent->idx.sha1));
+
+		init_tree_desc(&desc, tree->buffer, tree->size);
+		while (tree_entry(&desc, &entry)) {
+			struct object *obj;
+
+			if (S_ISGITLINK(entry.mode))
+				continue;
+
+			obj = lookup_object(entry.sha1);
+			if (!obj)
+				continue;
+
+			set_island_marks(obj, marks);
+		}
+
+		free_tree_buffer(tree);
+	}
+
+	free(todo);
+}
+
+int in_same_island(const unsigned char *trg, const unsigned char *src)
+{
+	struct island_bitmap *trg_marks, *src_marks;
+
+	/* an object outside of all islands can use any base */
+	trg_marks = get_island_marks(trg);
+	if (!trg_marks)
+		return 1;
+
+	/* the base must be in every island the target is in */
+	src_marks = get_island_marks(src);
+	if (!src_marks)
+		return 0;
+
+	return island_bitmap_is_subset(trg_marks, src_marks);
+}
@@ -0,0 +1,36 @@
+#ifndef DELTA_ISLANDS_H
+#define DELTA_ISLANDS_H
+
+/*
+ * Delta islands partition the objects of a repository by the refs they
+ * are reachable from, as configured by "pack.island". An object may
+ * only be stored as a delta against a base that is in every island the
+ * object is in, so that a pack served for any one island can reuse the
+ * deltas as they are on disk.
+ */
+
+struct commit;
+struct packing_data;
+
+/* Handles "pack.island"; to be called from a git_config() callback. */
+extern int island_config(const char *var, const char *value, void *cb);
+
+/* Assign the refs matching "pack.island" to their islands. */
+extern void load_delta_islands(void);
+
+/*
+ * Pass the islands of "commit" on to its parents and its tree. Commits
+ * must be fed children first (i.e. in topological order).
+ */
+extern void propagate_island_marks(struct commit *commit);
+
+/*
+ * Pass the islands of the trees in "to_pack" on to their entries,
+ * top-level trees first (as given by their "tree_depth").
+ */
+extern void resolve_tree_islands(struct packing_data *to_pack);
+
+/* Return 1 if "trg" may be stored as a delta against "src". */
+extern int in_same_island(const unsigned char *trg, const unsigned char *src);
+
+#endif /* DELTA_ISLANDS_H */
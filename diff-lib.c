@@ -12,6 +12,7 @@
 #include "refs.h"
 #include "submodule.h"
 #include "dir.h"
+#include "fsmonitor.h"
 
 /*
  * diff-files
@@ -95,6 +96,7 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 
 	if (diff_unmerged_stage < 0)
 		diff_unmerged_stage = 2;
+	refresh_fsmonitor(&the_index);
 	entries = active_nr;
 	for (i = 0; i < entries; i++) {
 		unsigned int oldmode, newmode;
@@ -17,6 +17,8 @@
 #include "ll-merge.h"
 #include "string-list.h"
 #include "argv-array.h"
+#include "sha1-array.h"
+#include "fetch-object.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -4740,8 +4742,52 @@ void diffcore_fix_diff_index(struct diff_options *options)
 	qsort(q->queue, q->nr, sizeof(q->queue[0]), diffnamecmp);
 }
 
+static int diff_needs_contents(struct diff_options *options)
+{
+	if (options->output_format & ~(DIFF_FORMAT_RAW |
+				       DIFF_FORMAT_NAME |
+				       DIFF_FORMAT_NAME_STATUS |
+				       DIFF_FORMAT_SUMMARY |
+				       DIFF_FORMAT_NO_OUTPUT |
+				       DIFF_FORMAT_CALLBACK))
+		return 1;
+	return options->skip_stat_unmatch || options->break_opt != -1 ||
+		options->detect_rename || options->pickaxe ||
+		DIFF_OPT_TST(options, DIFF_FROM_CONTENTS);
+}
+
+static void add_if_blob(struct sha1_array *to_fetch,
+			struct diff_filespec *filespec)
+{
+	if (DIFF_FILE_VALID(filespec) && filespec->sha1_valid &&
+	    !S_ISGITLINK(filespec->mode))
+		sha1_array_append(to_fetch, filespec->sha1);
+}
+
+/*
+ * In a partial clone, fetch every blob the queued filepairs may
+ * need in one go, instead of one at a time as they get populated.
+ */
+static void diff_prefetch_blobs(struct diff_options *options)
+{
+	struct diff_queue_struct *q = &diff_queued_diff;
+	struct sha1_array to_fetch = SHA1_ARRAY_INIT;
+	int i;
+
+	if (!q->nr || !promisor_remote() || !diff_needs_contents(options))
+		return;
+	for (i = 0; i < q->nr; i++) {
+		add_if_blob(&to_fetch, q->queue[i]->one);
+		add_if_blob(&to_fetch, q->queue[i]->two);
+	}
+	prefetch_objects(&to_fetch);
+	sha1_array_clear(&to_fetch);
+}
+
 void diffcore_std(struct diff_options *options)
 {
+	diff_prefetch_blobs(options);
+
 	/* NOTE please keep the following in sync with diff_tree_combined() */
 	if (options->skip_stat_unmatch)
 		diffcore_skip_stat_unmatch(options);
@@ -12,6 +12,7 @@
 #include "refs.h"
 #include "wildmatch.h"
 #include "pathspec.h"
+#include "fsmonitor.h"
 
 struct path_simplify {
 	int len;
@@ -31,8 +32,23 @@ enum path_treatment {
 	path_untracked
 };
 
+/*
+ * Support data structure for our opendir/readdir/closedir wrappers,
+ * which read from the untracked cache instead when it is valid.
+ */
+struct cached_dir {
+	DIR *fdir;
+	struct untracked_cache_dir *untracked;
+	int nr_files;
+	int nr_dirs;
+
+	struct dirent *de;
+	const char *file;
+	struct untracked_cache_dir *ucd;
+};
+
 static enum path_treatment read_directory_recursive(struct dir_struct *dir,
-	const char *path, int len,
+	const char *path, int len, struct untracked_cache_dir *untracked,
 	int check_only, const struct path_simplify *simplify);
 static int get_dtype(struct dirent *de, const char *path, int len);
 
@@ -529,17 +545,24 @@ static void trim_trailing_spaces(char *buf)
 		*last_space = '\0';
 }
 
-int add_excludes_from_file_to_list(const char *fname,
-				   const char *base,
-				   int baselen,
-				   struct exclude_list *el,
-				   int check_index)
+/*
+ * If sha1 is given, the SHA-1 of the contents of the file is stored
+ * there, or the null SHA-1 if it cannot be read.
+ */
+static int add_excludes(const char *fname,
+			const char *base,
+			int baselen,
+			struct exclude_list *el,
+			int check_index,
+			unsigned char *sha1)
 {
 	struct stat st;
 	int fd, i, lineno = 1;
 	size_t size = 0;
 	char *buf, *entry;
 
+	if (sha1)
+		hashclr(sha1);
 	fd = open(fname, O_RDONLY);
 	if (fd < 0 || fstat(fd, &st) < 0) {
 		if (errno != ENOENT)
@@ -549,6 +572,8 @@ int add_excludes_from_file_to_list(const char *fname,
 		if (!check_index ||
 		    (buf = read_skip_worktree_file_from_index(fname, &size)) == NULL)
 			return -1;
+		if (sha1)
+			hash_sha1_file(buf, size, "blob", sha1);
 		if (size == 0) {
 			free(buf);
 			return 0;
@@ -560,6 +585,8 @@ int add_excludes_from_file_to_list(const char *fname,
 	} else {
 		size = xsize_t(st.st_size);
 		if (size == 0) {
+			if (sha1)
+				hash_sha1_file("", 0, "blob", sha1);
 			close(fd);
 			return 0;
 		}
@@ -569,6 +596,8 @@ int add_excludes_from_file_to_list(const char *fname,
 			close(fd);
 			return -1;
 		}
+		if (sha1)
+			hash_sha1_file(buf, size, "blob", sha1);
 		buf[size++] = '\n';
 		close(fd);
 	}
@@ -589,6 +618,15 @@ int add_excludes_from_file_to_list(const char *fname,
 	return 0;
 }
 
+int add_excludes_from_file_to_list(const char *fname,
+				   const char *base,
+				   int baselen,
+				   struct exclude_list *el,
+				   int check_index)
+{
+	return add_excludes(fname, base, baselen, el, check_index, NULL);
+}
+
 struct exclude_list *add_exclude_list(struct dir_struct *dir,
 				      int group_type, const char *src)
 {
@@ -606,14 +644,22 @@ struct exclude_list *add_exclude_list(struct dir_struct *dir,
 /*
  * Used to set up core.excludesfile and .git/info/exclude lists.
  */
-void add_excludes_from_file(struct dir_struct *dir, const char *fname)
+static void add_excludes_from_file_1(struct dir_struct *dir, const char *fname,
+				     unsigned char *sha1)
 {
 	struct exclude_list *el;
 	el = add_exclude_list(dir, EXC_FILE, fname);
-	if (add_excludes_from_file_to_list(fname, "", 0, el, 0) < 0)
+	if (add_excludes(fname, "", 0, el, 0, sha1) < 0)
 		die("cannot use %s as an exclude file", fname);
 }
 
+void add_excludes_from_file(struct dir_struct *dir, const char *fname)
+{
+	/* the untracked cache only knows about the standard excludes */
+	dir->unmanaged_exclude_files++;
+	add_excludes_from_file_1(dir, fname, NULL);
+}
+
 int match_basename(const char *basename, int basenamelen,
 		   const char *pattern, int prefix, int patternlen,
 		   int flags)
@@ -779,6 +825,111 @@ static struct exclude *last_exclude_matching_from_lists(struct dir_struct *dir,
 	return NULL;
 }
 
+/*
+ * Find the subdirectory "name" (of length len, without the trailing
+ * slash) of an untracked cache directory. If it is not there, NULL is
+ * returned and *pos is set to where it would be inserted.
+ */
+static struct untracked_cache_dir *find_untracked(struct untracked_cache_dir *dir,
+						  const char *name, int len,
+						  int *pos)
+{
+	int first = 0, last = dir->dirs_nr;
+
+	while (last > first) {
+		int next = (last + first) >> 1;
+		struct untracked_cache_dir *d = dir->dirs[next];
+		int cmp = strncmp(name, d->name, len);
+
+		if (!cmp && d->name[len])
+			cmp = -1;
+		if (!cmp)
+			return d;
+		if (cmp < 0)
+			last = next;
+		else
+			first = next + 1;
+	}
+	if (pos)
+		*pos = first;
+	return NULL;
+}
+
+static struct untracked_cache_dir *lookup_untracked(struct untracked_cache *uc,
+						    struct untracked_cache_dir *dir,
+						    const char *name, int len)
+{
+	struct untracked_cache_dir *d;
+	int pos;
+
+	if (!dir)
+		return NULL;
+	if (len && name[len - 1] == '/')
+		len--;
+	d = find_untracked(dir, name, len, &pos);
+	if (d)
+		return d;
+
+	uc->dir_created++;
+	d = xcalloc(1, sizeof(*d) + len + 1);
+	memcpy(d->name, name, len);
+	ALLOC_GROW(dir->dirs, dir->dirs_nr + 1, dir->dirs_alloc);
+	memmove(dir->dirs + pos + 1, dir->dirs + pos,
+		(dir->dirs_nr - pos) * sizeof(*dir->dirs));
+	dir->dirs_nr++;
+	dir->dirs[pos] = d;
+	return d;
+}
+
+static void add_untracked(struct untracked_cache_dir *dir, const char *name)
+{
+	if (!dir)
+		return;
+	ALLOC_GROW(dir->untracked, dir->untracked_nr + 1,
+		   dir->untracked_alloc);
+	dir->untracked[dir->untracked_nr++] = xstrdup(name);
+}
+
+static void invalidate_directory(struct untracked_cache *uc,
+				 struct untracked_cache_dir *dir)
+{
+	int i;
+
+	if (dir->valid)
+		uc->dir_invalidated++;
+	dir->valid = 0;
+	for (i = 0; i < dir->untracked_nr; i++)
+		free(dir->untracked[i]);
+	dir->untracked_nr = 0;
+}
+
+static void free_untracked_cache_dir(struct untracked_cache_dir *ucd)
+{
+	int i;
+
+	if (!ucd)
+		return;
+	for (i = 0; i < ucd->untracked_nr; i++)
+		free(ucd->untracked[i]);
+	for (i = 0; i < ucd->dirs_nr; i++)
+		free_untracked_cache_dir(ucd->dirs[i]);
+	free(ucd->untracked);
+	free(ucd->dirs);
+	free(ucd);
+}
+
+/* The exclude patterns that apply to dir and everything below changed */
+static void invalidate_gitignore(struct untracked_cache *uc,
+				 struct untracked_cache_dir *dir)
+{
+	int i;
+
+	uc->gitignore_invalidated++;
+	invalidate_directory(uc, dir);
+	for (i = 0; i < dir->dirs_nr; i++)
+		invalidate_gitignore(uc, dir->dirs[i]);
+}
+
 /*
  * Loads the per-directory exclude list for the substring of base
  * which has a char length of baselen.
@@ -841,6 +992,15 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 		stk->prev = dir->exclude_stack;
 		stk->baselen = cp - base;
 		stk->exclude_ix = group->nr;
+		if (!dir->untracked)
+			; /* not using the untracked cache */
+		else if (!stk->baselen)
+			stk->ucd = dir->untracked->root;
+		else if (stk->prev && stk->prev->ucd)
+			stk->ucd = find_untracked(stk->prev->ucd,
+						  base + current,
+						  stk->baselen - current - 1,
+						  NULL);
 		el = add_exclude_list(dir, EXC_DIRS, NULL);
 		strbuf_add(&dir->basebuf, base + current, stk->baselen - current);
 		assert(stk->baselen == dir->basebuf.len);
@@ -873,11 +1033,22 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 			 * strbuf_detach() and free() here in the caller.
 			 */
 			struct strbuf sb = STRBUF_INIT;
+			unsigned char sha1[20];
+
 			strbuf_addbuf(&sb, &dir->basebuf);
 			strbuf_addstr(&sb, dir->exclude_per_dir);
 			el->src = strbuf_detach(&sb, NULL);
-			add_excludes_from_file_to_list(el->src, el->src,
-						       stk->baselen, el, 1);
+			add_excludes(el->src, el->src, stk->baselen, el, 1,
+				     stk->ucd ? sha1 : NULL);
+
+			/*
+			 * What was cached for this directory and below
+			 * was decided with other patterns.
+			 */
+			if (stk->ucd && hashcmp(sha1, stk->ucd->exclude_sha1)) {
+				invalidate_gitignore(dir->untracked, stk->ucd);
+				hashcpy(stk->ucd->exclude_sha1, sha1);
+			}
 		}
 		dir->exclude_stack = stk;
 		current = stk->baselen;
@@ -1058,7 +1229,8 @@ static enum exist_status directory_exists_in_index(const char *dirname, int len)
  *  (c) otherwise, we recurse into it.
  */
 static enum path_treatment treat_directory(struct dir_struct *dir,
-	const char *dirname, int len, int exclude,
+	struct untracked_cache_dir *untracked,
+	const char *dirname, int len, int baselen, int exclude,
 	const struct path_simplify *simplify)
 {
 	/* The "len-1" is to strip the final '/' */
@@ -1085,7 +1257,10 @@ static enum path_treatment treat_directory(struct dir_struct *dir,
 	if (!(dir->flags & DIR_HIDE_EMPTY_DIRECTORIES))
 		return exclude ? path_excluded : path_untracked;
 
-	return read_directory_recursive(dir, dirname, len, 1, simplify);
+	untracked = lookup_untracked(dir->untracked, untracked,
+				     dirname + baselen, len - baselen);
+	return read_directory_recursive(dir, dirname, len,
+					untracked, 1, simplify);
 }
 
 /*
@@ -1201,7 +1376,9 @@ static int get_dtype(struct dirent *de, const char *path, int len)
 }
 
 static enum path_treatment treat_one_path(struct dir_struct *dir,
+					  struct untracked_cache_dir *untracked,
 					  struct strbuf *path,
+					  int baselen,
 					  const struct path_simplify *simplify,
 					  int dtype, struct dirent *de)
 {
@@ -1253,22 +1430,64 @@ static enum path_treatment treat_one_path(struct dir_struct *dir,
 		return path_none;
 	case DT_DIR:
 		strbuf_addch(path, '/');
-		return treat_directory(dir, path->buf, path->len, exclude,
-			simplify);
+		return treat_directory(dir, untracked, path->buf, path->len,
+				       baselen, exclude, simplify);
 	case DT_REG:
 	case DT_LNK:
 		return exclude ? path_excluded : path_untracked;
 	}
 }
 
+static enum path_treatment treat_path_fast(struct dir_struct *dir,
+					   struct cached_dir *cdir,
+					   struct strbuf *path,
+					   int baselen,
+					   const struct path_simplify *simplify)
+{
+	strbuf_setlen(path, baselen);
+	if (!cdir->ucd) {
+		strbuf_addstr(path, cdir->file);
+		return path_untracked;
+	}
+	strbuf_addstr(path, cdir->ucd->name);
+	/* treat_one_path() does this before it calls treat_directory() */
+	strbuf_addch(path, '/');
+	if (!(dir->flags & (DIR_SHOW_OTHER_DIRECTORIES | DIR_NO_GITLINKS)) &&
+	    directory_exists_in_index(path->buf, path->len - 1) ==
+	    index_nonexistent) {
+		/* treat_directory() would check this every time, too */
+		unsigned char sha1[20];
+		if (!resolve_gitlink_ref(path->buf, "HEAD", sha1))
+			return path_untracked;
+	}
+	if (cdir->ucd->check_only)
+		/*
+		 * The directory was only checked for untracked files, as
+		 * treat_directory() does for a directory that is not in
+		 * the index. Do that again: it may have changed.
+		 */
+		return read_directory_recursive(dir, path->buf, path->len,
+						cdir->ucd, 1, simplify);
+	/*
+	 * We went into it last time, and whatever the index says
+	 * about it now is still the same, or the cache would have been
+	 * invalidated.
+	 */
+	return path_recurse;
+}
+
 static enum path_treatment treat_path(struct dir_struct *dir,
-				      struct dirent *de,
+				      struct untracked_cache_dir *untracked,
+				      struct cached_dir *cdir,
 				      struct strbuf *path,
 				      int baselen,
 				      const struct path_simplify *simplify)
 {
 	int dtype;
+	struct dirent *de = cdir->de;
 
+	if (!de)
+		return treat_path_fast(dir, cdir, path, baselen, simplify);
 	if (is_dot_or_dotdot(de->d_name) || !strcmp(de->d_name, ".git"))
 		return path_none;
 	strbuf_setlen(path, baselen);
@@ -1277,7 +1496,115 @@ static enum path_treatment treat_path(struct dir_struct *dir,
 		return path_none;
 
 	dtype = DTYPE(de);
-	return treat_one_path(dir, path, simplify, dtype, de);
+	return treat_one_path(dir, untracked, path, baselen, simplify,
+			      dtype, de);
+}
+
+/*
+ * Can we believe what the untracked cache says about this directory?
+ * If not, it is emptied so that it can be filled again by reading
+ * the directory.
+ */
+static int valid_cached_dir(struct dir_struct *dir,
+			    struct untracked_cache_dir *untracked,
+			    struct strbuf *path,
+			    int check_only)
+{
+	struct stat st;
+	int i;
+
+	/*
+	 * prep_exclude() would only be called for this directory when
+	 * the first path in it is checked, but we need to know now if
+	 * its exclude file changed.
+	 */
+	prep_exclude(dir, path->buf, path->len);
+
+	if (!(dir->untracked->use_fsmonitor && untracked->valid)) {
+		if (stat(path->len ? path->buf : ".", &st)) {
+			memset(&untracked->stat_data, 0,
+			       sizeof(untracked->stat_data));
+			goto invalid;
+		}
+		if (!untracked->valid ||
+		    match_stat_data_racy(&the_index, &untracked->stat_data, &st)) {
+			fill_stat_data(&untracked->stat_data, &st);
+			goto invalid;
+		}
+	}
+	if (untracked->check_only == !!check_only && untracked->valid)
+		return 1;
+
+invalid:
+	invalidate_directory(dir->untracked, untracked);
+	/* only those we go into again are kept */
+	for (i = 0; i < untracked->dirs_nr; i++)
+		untracked->dirs[i]->recurse = 0;
+	untracked->check_only = !!check_only;
+	return 0;
+}
+
+static int open_cached_dir(struct cached_dir *cdir,
+			   struct dir_struct *dir,
+			   struct untracked_cache_dir *untracked,
+			   struct strbuf *path,
+			   int check_only)
+{
+	memset(cdir, 0, sizeof(*cdir));
+	cdir->untracked = untracked;
+	if (untracked && valid_cached_dir(dir, untracked, path, check_only))
+		return 0;
+	cdir->fdir = opendir(path->len ? path->buf : ".");
+	if (dir->untracked)
+		dir->untracked->dir_opened++;
+	if (!cdir->fdir)
+		return -1;
+	return 0;
+}
+
+/*
+ * From the cache, the subdirectories we went into come first, then
+ * the untracked paths, except those subdirectories again.
+ */
+static int read_cached_dir(struct cached_dir *cdir)
+{
+	struct untracked_cache_dir *d = cdir->untracked;
+
+	if (cdir->fdir) {
+		cdir->de = readdir(cdir->fdir);
+		return cdir->de ? 0 : -1;
+	}
+	while (cdir->nr_dirs < d->dirs_nr) {
+		cdir->ucd = d->dirs[cdir->nr_dirs++];
+		if (cdir->ucd->recurse)
+			return 0;
+	}
+	cdir->ucd = NULL;
+	while (cdir->nr_files < d->untracked_nr) {
+		const char *file = d->untracked[cdir->nr_files++];
+		int len = strlen(file);
+		struct untracked_cache_dir *sub;
+
+		if (len && file[len - 1] == '/') {
+			sub = find_untracked(d, file, len - 1, NULL);
+			if (sub && sub->recurse)
+				continue;
+		}
+		cdir->file = file;
+		return 0;
+	}
+	return -1;
+}
+
+static void close_cached_dir(struct cached_dir *cdir)
+{
+	if (cdir->fdir)
+		closedir(cdir->fdir);
+	/* Whatever we found, it is now what the cache says */
+	if (cdir->untracked) {
+		cdir->untracked->valid = 1;
+		cdir->untracked->recurse = 1;
+	}
 }
 
 /*
@@ -1293,38 +1620,46 @@ static enum path_treatment treat_path(struct dir_struct *dir,
  */
 static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 				    const char *base, int baselen,
+				    struct untracked_cache_dir *untracked,
 				    int check_only,
 				    const struct path_simplify *simplify)
 {
-	DIR *fdir;
+	struct cached_dir cdir;
 	enum path_treatment state, subdir_state, dir_state = path_none;
-	struct dirent *de;
 	struct strbuf path = STRBUF_INIT;
 
 	strbuf_add(&path, base, baselen);
 
-	fdir = opendir(path.len ? path.buf : ".");
-	if (!fdir)
+	if (open_cached_dir(&cdir, dir, untracked, &path, check_only))
 		goto out;
 
-	while ((de = readdir(fdir)) != NULL) {
+	while (!read_cached_dir(&cdir)) {
 		/* check how the file or directory should be treated */
-		state = treat_path(dir, de, &path, baselen, simplify);
+		state = treat_path(dir, untracked, &cdir, &path, baselen,
+				   simplify);
 		if (state > dir_state)
 			dir_state = state;
 
 		/* recurse into subdir if instructed by treat_path */
 		if (state == path_recurse) {
+			struct untracked_cache_dir *ud;
+			ud = lookup_untracked(dir->untracked, untracked,
+					      path.buf + baselen,
+					      path.len - baselen);
 			subdir_state = read_directory_recursive(dir, path.buf,
-				path.len, check_only, simplify);
+				path.len, ud, check_only, simplify);
 			if (subdir_state > dir_state)
 				dir_state = subdir_state;
 		}
 
 		if (check_only) {
 			/* abort early if maximum state has been reached */
-			if (dir_state == path_untracked)
+			if (dir_state == path_untracked) {
+				if (cdir.fdir)
+					add_untracked(untracked,
+						      path.buf + baselen);
 				break;
+			}
 			/* skip the dir_add_* part */
 			continue;
 		}
@@ -1344,13 +1679,15 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 		case path_untracked:
 			if (!(dir->flags & DIR_SHOW_IGNORED))
 				dir_add_name(dir, path.buf, path.len);
+			if (cdir.fdir)
+				add_untracked(untracked, path.buf + baselen);
 			break;
 
 		default:
 			break;
 		}
 	}
-	closedir(fdir);
+	close_cached_dir(&cdir);
  out:
 	strbuf_release(&path);
 
@@ -1420,7 +1757,7 @@ static int treat_leading_path(struct dir_struct *dir,
 			break;
 		if (simplify_away(sb.buf, sb.len, simplify))
 			break;
-		if (treat_one_path(dir, &sb, simplify,
+		if (treat_one_path(dir, NULL, &sb, baselen, simplify,
 				   DT_DIR, NULL) == path_none)
 			break; /* do not recurse into it */
 		if (len <= baselen) {
@@ -1433,9 +1770,103 @@ static int treat_leading_path(struct dir_struct *dir,
 	return rc;
 }
 
+/*
+ * Is this a traversal of the whole working tree? Pathspecs without a
+ * leading directory do not prune anything.
+ */
+static int simplify_whole_tree(const struct path_simplify *simplify)
+{
+	if (simplify)
+		for (; simplify->path; simplify++)
+			if (simplify->len)
+				return 0;
+	return 1;
+}
+
+static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *dir,
+							    int base_len,
+							    const struct path_simplify *simplify)
+{
+	struct untracked_cache *uc = dir->untracked;
+	struct untracked_cache_dir *root;
+	const char *worktree = get_git_work_tree();
+	unsigned flags;
+
+	if (!uc || !worktree)
+		return NULL;
+
+	/*
+	 * Optimize for the main use case only: whole-tree "git status"
+	 * and "git add -A". We would have to go through
+	 * treat_leading_path() for a subset of the working tree.
+	 */
+	if (base_len || !simplify_whole_tree(simplify))
+		return NULL;
+
+	/* Without a pathspec to match, nothing ignored is collected */
+	flags = dir->flags & ~DIR_COLLECT_IGNORED;
+	if (flags & (DIR_SHOW_IGNORED | DIR_SHOW_IGNORED_TOO |
+		     DIR_COLLECT_KILLED_ONLY))
+		return NULL;
+
+	/*
+	 * We only know about the per-directory exclude files,
+	 * $GIT_DIR/info/exclude and core.excludesfile, as read by
+	 * setup_standard_excludes().
+	 */
+	if (!dir->exclude_per_dir || dir->unmanaged_exclude_files ||
+	    dir->exclude_list_group[EXC_CMDL].nr)
+		return NULL;
+
+	/*
+	 * A cache made for another working tree, or for another kind
+	 * of traversal, is useless: start over.
+	 */
+	if (uc->root &&
+	    (strcmp(uc->ident.buf, worktree) || flags != uc->dir_flags ||
+	     strcmp(uc->exclude_per_dir, dir->exclude_per_dir))) {
+		free_untracked_cache_dir(uc->root);
+		uc->root = NULL;
+	}
+	uc->dir_created = 0;
+	uc->gitignore_invalidated = 0;
+	uc->dir_invalidated = 0;
+	uc->dir_opened = 0;
+	if (!uc->root) {
+		uc->root = xcalloc(1, sizeof(*uc->root) + 1);
+		uc->dir_created++;
+		strbuf_reset(&uc->ident);
+		strbuf_addstr(&uc->ident, worktree);
+		uc->dir_flags = flags;
+		free(uc->exclude_per_dir);
+		uc->exclude_per_dir = xstrdup(dir->exclude_per_dir);
+	}
+	root = uc->root;
+
+	/* Check $GIT_DIR/info/exclude and core.excludesfile */
+	if (hashcmp(dir->info_exclude_sha1, uc->info_exclude_sha1)) {
+		invalidate_gitignore(uc, root);
+		hashcpy(uc->info_exclude_sha1, dir->info_exclude_sha1);
+	}
+	if (hashcmp(dir->excludes_file_sha1, uc->excludes_file_sha1)) {
+		invalidate_gitignore(uc, root);
+		hashcpy(uc->excludes_file_sha1, dir->excludes_file_sha1);
+	}
+
+	/* Learn from the fsmonitor which directories did not change */
+	if (uc == the_index.untracked)
+		refresh_fsmonitor(&the_index);
+	else
+		uc->use_fsmonitor = 0;
+
+	root->recurse = 1;
+	return root;
+}
+
 int read_directory(struct dir_struct *dir, const char *path, int len, const struct pathspec *pathspec)
 {
 	struct path_simplify *simplify;
+	struct untracked_cache_dir *untracked;
 
 	/*
 	 * Check out create_simplify()
@@ -1459,9 +1890,31 @@ int read_directory(struct dir_struct *dir, const char *path, int len, const stru
 	 * create_simplify().
 	 */
 	simplify = create_simplify(pathspec ? pathspec->_raw : NULL);
+	untracked = validate_untracked_cache(dir, len, simplify);
+	if (!untracked)
+		/*
+		 * make sure untracked cache code path is disabled,
+		 * e.g. prep_exclude()
+		 */
+		dir->untracked = NULL;
 	if (!len || treat_leading_path(dir, path, len, simplify))
-		read_directory_recursive(dir, path, len, 0, simplify);
+		read_directory_recursive(dir, path, len, untracked, 0, simplify);
 	free_simplify(simplify);
+	if (dir->untracked) {
+		static struct trace_key trace_untracked_stats = TRACE_KEY_INIT(UNTRACKED_STATS);
+		struct untracked_cache *uc = dir->untracked;
+
+		trace_printf_key(&trace_untracked_stats,
+				 "untracked cache: node creation %d, "
+				 "gitignore invalidation %d, "
+				 "directory invalidation %d, opendir %d\n",
+				 uc->dir_created, uc->gitignore_invalidated,
+				 uc->dir_invalidated, uc->dir_opened);
+		if (uc == the_index.untracked &&
+		    (uc->dir_created || uc->gitignore_invalidated ||
+		     uc->dir_invalidated || uc->dir_opened))
+			the_index.cache_changed |= UNTRACKED_CHANGED;
+	}
 	qsort(dir->entries, dir->nr, sizeof(struct dir_entry *), cmp_name);
 	qsort(dir->ignored, dir->ignored_nr, sizeof(struct dir_entry *), cmp_name);
 	return dir->nr;
@@ -1626,10 +2079,13 @@ void setup_standard_excludes(struct dir_struct *dir)
 		home_config_paths(NULL, &xdg_path, "ignore");
 		excludes_file = xdg_path;
 	}
+	hashclr(dir->info_exclude_sha1);
+	hashclr(dir->excludes_file_sha1);
 	if (!access_or_warn(path, R_OK, 0))
-		add_excludes_from_file(dir, path);
+		add_excludes_from_file_1(dir, path, dir->info_exclude_sha1);
 	if (excludes_file && !access_or_warn(excludes_file, R_OK, 0))
-		add_excludes_from_file(dir, excludes_file);
+		add_excludes_from_file_1(dir, excludes_file,
+					 dir->excludes_file_sha1);
 }
 
 int remove_path(const char *name)
@@ -1681,3 +2137,266 @@ void clear_directory(struct dir_struct *dir)
 	}
 	strbuf_release(&dir->basebuf);
 }
+
+void free_untracked_cache(struct untracked_cache *uc)
+{
+	if (!uc)
+		return;
+	free_untracked_cache_dir(uc->root);
+	free(uc->exclude_per_dir);
+	strbuf_release(&uc->ident);
+	free(uc);
+}
+
+#define UNTRACKED_VALID 1
+#define UNTRACKED_CHECK_ONLY 2
+
+/* ctime, mtime (seconds and nanoseconds), dev, ino, uid, gid, size */
+#define ONDISK_STAT_DATA_SIZE (9 * 4)
+#define ONDISK_DIR_HEADER_SIZE (3 * 4 + ONDISK_STAT_DATA_SIZE + 20)
+
+static void stat_data_to_disk(unsigned char *to, const struct stat_data *sd)
+{
+	put_be32(to, sd->sd_ctime.sec);
+	put_be32(to + 4, sd->sd_ctime.nsec);
+	put_be32(to + 8, sd->sd_mtime.sec);
+	put_be32(to + 12, sd->sd_mtime.nsec);
+	put_be32(to + 16, sd->sd_dev);
+	put_be32(to + 20, sd->sd_ino);
+	put_be32(to + 24, sd->sd_uid);
+	put_be32(to + 28, sd->sd_gid);
+	put_be32(to + 32, sd->sd_size);
+}
+
+static void stat_data_from_disk(struct stat_data *sd, const unsigned char *from)
+{
+	sd->sd_ctime.sec = get_be32(from);
+	sd->sd_ctime.nsec = get_be32(from + 4);
+	sd->sd_mtime.sec = get_be32(from + 8);
+	sd->sd_mtime.nsec = get_be32(from + 12);
+	sd->sd_dev = get_be32(from + 16);
+	sd->sd_ino = get_be32(from + 20);
+	sd->sd_uid = get_be32(from + 24);
+	sd->sd_gid = get_be32(from + 28);
+	sd->sd_size = get_be32(from + 32);
+}
+
+static void write_one_dir(struct strbuf *out, struct untracked_cache_dir *ucd)
+{
+	unsigned char hdr[ONDISK_DIR_HEADER_SIZE];
+	int i, dirs_nr = 0;
+
+	for (i = 0; i < ucd->dirs_nr; i++)
+		if (ucd->dirs[i]->recurse)
+			dirs_nr++;
+
+	strbuf_add(out, ucd->name, strlen(ucd->name) + 1);
+	put_be32(hdr, (ucd->valid ? UNTRACKED_VALID : 0) |
+		      (ucd->check_only ? UNTRACKED_CHECK_ONLY : 0));
+	put_be32(hdr + 4, ucd->untracked_nr);
+	put_be32(hdr + 8, dirs_nr);
+	stat_data_to_disk(hdr + 12, &ucd->stat_data);
+	hashcpy(hdr + 12 + ONDISK_STAT_DATA_SIZE, ucd->exclude_sha1);
+	strbuf_add(out, hdr, sizeof(hdr));
+	for (i = 0; i < ucd->untracked_nr; i++)
+		strbuf_add(out, ucd->untracked[i],
+			   strlen(ucd->untracked[i]) + 1);
+	for (i = 0; i < ucd->dirs_nr; i++)
+		if (ucd->dirs[i]->recurse)
+			write_one_dir(out, ucd->dirs[i]);
+}
+
+void write_untracked_extension(struct strbuf *out, struct untracked_cache *uc)
+{
+	unsigned char be32[4];
+
+	strbuf_add(out, uc->ident.buf, uc->ident.len + 1);
+	put_be32(be32, uc->dir_flags);
+	strbuf_add(out, be32, 4);
+	strbuf_add(out, uc->info_exclude_sha1, 20);
+	strbuf_add(out, uc->excludes_file_sha1, 20);
+	if (uc->exclude_per_dir)
+		strbuf_addstr(out, uc->exclude_per_dir);
+	strbuf_addch(out, '\0');
+	if (uc->root)
+		write_one_dir(out, uc->root);
+}
+
+static struct untracked_cache_dir *read_one_dir(const unsigned char **data_p,
+						const unsigned char *end)
+{
+	const unsigned char *data = *data_p, *eos;
+	struct untracked_cache_dir *ucd;
+	uint32_t flags, untracked_nr, dirs_nr, i;
+	size_t len;
+
+	eos = memchr(data, '\0', end - data);
+	if (!eos || end - (eos + 1) < ONDISK_DIR_HEADER_SIZE)
+		return NULL;
+	len = eos - data;
+	ucd = xcalloc(1, sizeof(*ucd) + len + 1);
+	memcpy(ucd->name, data, len);
+	data = eos + 1;
+
+	flags = get_be32(data);
+	untracked_nr = get_be32(data + 4);
+	dirs_nr = get_be32(data + 8);
+	stat_data_from_disk(&ucd->stat_data, data + 12);
+	hashcpy(ucd->exclude_sha1, data + 12 + ONDISK_STAT_DATA_SIZE);
+	data += ONDISK_DIR_HEADER_SIZE;
+	ucd->valid = !!(flags & UNTRACKED_VALID);
+	ucd->check_only = !!(flags & UNTRACKED_CHECK_ONLY);
+	ucd->recurse = 1;
+
+	for (i = 0; i < untracked_nr; i++) {
+		eos = memchr(data, '\0', end - data);
+		if (!eos)
+			goto corrupt;
+		add_untracked(ucd, (const char *)data);
+		data = eos + 1;
+	}
+	for (i = 0; i < dirs_nr; i++) {
+		struct untracked_cache_dir *sub = read_one_dir(&data, end);
+		if (!sub)
+			goto corrupt;
+		ALLOC_GROW(ucd->dirs, ucd->dirs_nr + 1, ucd->dirs_alloc);
+		ucd->dirs[ucd->dirs_nr++] = sub;
+	}
+	*data_p = data;
+	return ucd;
+
+corrupt:
+	free_untracked_cache_dir(ucd);
+	return NULL;
+}
+
+struct untracked_cache *read_untracked_extension(const void *data_, unsigned long sz)
+{
+	const unsigned char *data = data_, *end = data + sz, *eos;
+	struct untracked_cache *uc;
+
+	eos = memchr(data, '\0', sz);
+	if (!eos || end - (eos + 1) < 4 + 20 + 20)
+		return NULL;
+	uc = xcalloc(1, sizeof(*uc));
+	strbuf_init(&uc->ident, 0);
+	strbuf_add(&uc->ident, data, eos - data);
+	data = eos + 1;
+	uc->dir_flags = get_be32(data);
+	hashcpy(uc->info_exclude_sha1, data + 4);
+	hashcpy(uc->excludes_file_sha1, data + 24);
+	data += 44;
+
+	eos = memchr(data, '\0', end - data);
+	if (!eos)
+		goto corrupt;
+	if (*data)
+		uc->exclude_per_dir = xstrdup((const char *)data);
+	data = eos + 1;
+
+	if (data < end) {
+		uc->root = read_one_dir(&data, end);
+		if (!uc->root || data != end)
+			goto corrupt;
+	}
+	return uc;
+
+corrupt:
+	free_untracked_cache(uc);
+	return NULL;
+}
+
+void add_untracked_cache(struct index_state *istate)
+{
+	if (!istate->untracked) {
+		istate->untracked = xcalloc(1, sizeof(*istate->untracked));
+		strbuf_init(&istate->untracked->ident, 0);
+	}
+	istate->cache_changed |= UNTRACKED_CHANGED;
+}
+
+void remove_untracked_cache(struct index_state *istate)
+{
+	if (istate->untracked) {
+		free_untracked_cache(istate->untracked);
+		istate->untracked = NULL;
+		istate->cache_changed |= UNTRACKED_CHANGED;
+	}
+}
+
+/*
+ * "core.untrackedCache" is read on demand rather than with the rest
+ * of the core settings, as the index may well be read before the
+ * command gets around to calling git_config().
+ */
+static int untracked_cache_config = -1;
+
+static int untracked_cache_config_cb(const char *var, const char *value,
+				     void *cb)
+{
+	if (!strcmp(var, "core.untrackedcache"))
+		untracked_cache_config = git_config_bool(var, value);
+	return 0;
+}
+
+int get_untracked_cache_config(void)
+{
+	static int loaded;
+
+	if (!loaded) {
+		git_config(untracked_cache_config_cb, NULL);
+		loaded = 1;
+	}
+	return untracked_cache_config;
+}
+
+void tweak_untracked_cache(struct index_state *istate)
+{
+	switch (get_untracked_cache_config()) {
+	case 0:
+		remove_untracked_cache(istate);
+		break;
+	case 1:
+		if (!istate->untracked)
+			add_untracked_cache(istate);
+		break;
+	}
+}
+
+void untracked_cache_invalidate_path(struct index_state *istate,
+				     const char *path)
+{
+	struct untracked_cache *uc = istate->untracked;
+	struct untracked_cache_dir *d;
+	int all, invalidated;
+
+	if (!uc || !uc->root)
+		return;
+
+	/*
+	 * Whether a directory is shown as untracked as a whole
+	 * depends on what is below it, all the way down.
+	 */
+	all = uc->dir_flags & DIR_SHOW_OTHER_DIRECTORIES;
+	invalidated = uc->dir_invalidated;
+	d = uc->root;
+	for (;;) {
+		const char *slash = strchr(path, '/');
+		struct untracked_cache_dir *sub;
+
+		if (all || !slash)
+			invalidate_directory(uc, d);
+		if (!slash)
+			break;
+		sub = find_untracked(d, path, slash - path, NULL);
+		if (!sub) {
+			/* we did not go there; what contains it changed */
+			invalidate_directory(uc, d);
+			break;
+		}
+		d = sub;
+		path = slash + 1;
+	}
+	if (uc->dir_invalidated != invalidated)
+		istate->cache_changed |= UNTRACKED_CHANGED;
+}
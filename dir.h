@@ -66,6 +66,7 @@ struct exclude_stack {
 	struct exclude_stack *prev; /* the struct exclude_stack for the parent directory */
 	int baselen;
 	int exclude_ix; /* index of exclude_list within EXC_DIRS exclude_list_group */
+	struct untracked_cache_dir *ucd; /* the directory in the untracked cache */
 };
 
 struct exclude_list_group {
@@ -73,6 +74,51 @@ struct exclude_list_group {
 	struct exclude_list *el;
 };
 
+/*
+ * The untracked cache remembers, per directory, what the last
+ * traversal found there: the untracked paths and the subdirectories
+ * it went into. A directory whose stat data did not change since, and
+ * whose exclude files are the same, need not be opened again.
+ *
+ * See the "Untracked cache" extension in
+ * Documentation/technical/index-format.txt.
+ */
+struct untracked_cache_dir {
+	struct untracked_cache_dir **dirs;
+	char **untracked;
+	struct stat_data stat_data;
+	unsigned int untracked_nr, untracked_alloc;
+	unsigned int dirs_nr, dirs_alloc;
+	/* read with check_only, i.e. only to see if it has untracked files */
+	unsigned int check_only : 1;
+	/* the untracked list and subdirectories are up to date */
+	unsigned int valid : 1;
+	/* visited by the last traversal of its parent */
+	unsigned int recurse : 1;
+	/* SHA-1 of the per-directory exclude file, null if there is none */
+	unsigned char exclude_sha1[20];
+	char name[FLEX_ARRAY];
+};
+
+struct untracked_cache {
+	/* SHA-1 of $GIT_DIR/info/exclude and core.excludesfile */
+	unsigned char info_exclude_sha1[20];
+	unsigned char excludes_file_sha1[20];
+	char *exclude_per_dir;
+	/* the location of the working tree the cache was made for */
+	struct strbuf ident;
+	/* dir_struct.flags of the traversals that filled the cache */
+	unsigned dir_flags;
+	struct untracked_cache_dir *root;
+	/* directories need not be stat()ed: the fsmonitor tells us */
+	unsigned use_fsmonitor : 1;
+	/* statistics of the last traversal */
+	int dir_created;
+	int gitignore_invalidated;
+	int dir_invalidated;
+	int dir_opened;
+};
+
 struct dir_struct {
 	int nr, alloc;
 	int ignored_nr, ignored_alloc;
@@ -120,6 +166,18 @@ struct dir_struct {
 	struct exclude_stack *exclude_stack;
 	struct exclude *exclude;
 	struct strbuf basebuf;
+
+	/*
+	 * Set to the_index.untracked to let read_directory() use and
+	 * update the untracked cache, when the traversal is one it can
+	 * answer (the whole working tree, standard excludes only).
+	 */
+	struct untracked_cache *untracked;
+	/* SHA-1 of the files read by setup_standard_excludes() */
+	unsigned char info_exclude_sha1[20];
+	unsigned char excludes_file_sha1[20];
+	/* number of other exclude files, which the cache cannot track */
+	int unmanaged_exclude_files;
 };
 
 /*
@@ -195,6 +253,30 @@ extern int remove_dir_recursively(struct strbuf *path, int flag);
 /* tries to remove the path with empty directories along it, ignores ENOENT */
 extern int remove_path(const char *path);
 
+extern void free_untracked_cache(struct untracked_cache *uc);
+extern struct untracked_cache *read_untracked_extension(const void *data,
+							unsigned long sz);
+extern void write_untracked_extension(struct strbuf *out,
+				      struct untracked_cache *uc);
+
+/* Start an empty untracked cache, or drop it */
+extern void add_untracked_cache(struct index_state *istate);
+extern void remove_untracked_cache(struct index_state *istate);
+/* "core.untrackedCache": 1 or 0, or -1 if it is not set */
+extern int get_untracked_cache_config(void);
+/*
+ * Apply "core.untrackedCache" to the cache that was read with the
+ * index, and throw it away if it was made for another working tree.
+ */
+extern void tweak_untracked_cache(struct index_state *istate);
+
+/*
+ * The path was added to or removed from the index, or changed in the
+ * working tree: forget what is cached about the directories it is in.
+ */
+extern void untracked_cache_invalidate_path(struct index_state *istate,
+					    const char *path);
+
 extern int strcmp_icase(const char *a, const char *b);
 extern int strncmp_icase(const char *a, const char *b, size_t count);
 extern int fnmatch_icase(const char *pattern, const char *string, int flags);
@@ -0,0 +1,15 @@
+#include "git-compat-util.h"
+#include "fetch-negotiator.h"
+#include "negotiator/default.h"
+#include "negotiator/skipping.h"
+
+void fetch_negotiator_init(struct fetch_negotiator *negotiator,
+			   const char *algorithm)
+{
+	if (!algorithm || !strcmp(algorithm, "default"))
+		default_negotiator_init(negotiator);
+	else if (!strcmp(algorithm, "skipping"))
+		skipping_negotiator_init(negotiator);
+	else
+		die("unknown fetch negotiation algorithm '%s'", algorithm);
+}
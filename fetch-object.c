@@ -0,0 +1,109 @@
+#include "cache.h"
+#include "remote.h"
+#include "transport.h"
+#include "sha1-array.h"
+#include "fetch-object.h"
+
+static int find_promisor(struct remote *remote, void *cb_data)
+{
+	const char **name = cb_data;
+
+	if (!remote->promisor)
+		return 0;
+	*name = remote->name;
+	return 1;
+}
+
+const char *promisor_remote(void)
+{
+	static const char *name;
+	static int initialized;
+
+	if (!initialized) {
+		for_each_remote(find_promisor, &name);
+		initialized = 1;
+	}
+	return name;
+}
+
+int fetch_objects(const struct sha1_array *sha1s)
+{
+	const char *name = promisor_remote();
+	struct remote *remote;
+	struct transport *transport;
+	struct ref *refs = NULL, **tail = &refs;
+	int i, ret, save_fetch_if_missing = fetch_if_missing;
+
+	if (!name || !sha1s->nr)
+		return -1;
+	remote = remote_get(name);
+	if (!remote->url_nr)
+		return error(_("promisor remote '%s' has no URL"), name);
+
+	trace_printf("trace: fetching %d missing object(s) from '%s'\n",
+		     sha1s->nr, name);
+	for (i = 0; i < sha1s->nr; i++) {
+		struct ref *ref = alloc_ref(sha1_to_hex(sha1s->sha1[i]));
+		hashcpy(ref->old_sha1, sha1s->sha1[i]);
+		*tail = ref;
+		tail = &ref->next;
+	}
+
+	/* Nothing we do below may go looking for missing objects again. */
+	fetch_if_missing = 0;
+	transport = transport_get(remote, remote->url[0]);
+	transport_set_option(transport, TRANS_OPT_FROM_PROMISOR, "1");
+	transport_set_option(transport, TRANS_OPT_NO_DEPENDENTS, "1");
+	ret = transport_fetch_refs(transport, refs);
+	transport_unlock_pack(transport);
+	transport_disconnect(transport);
+	free_refs(refs);
+	fetch_if_missing = save_fetch_if_missing;
+
+	if (ret)
+		return error(_("unable to fetch missing objects from '%s'"),
+			     name);
+	reprepare_packed_git();
+	for (i = 0; i < sha1s->nr; i++)
+		if (!has_sha1_file(sha1s->sha1[i]))
+			return error(_("promisor remote '%s' did not send %s"),
+				     name, sha1_to_hex(sha1s->sha1[i]));
+	return 0;
+}
+
+int fetch_object(const unsigned char *sha1)
+{
+	struct sha1_array to_fetch = SHA1_ARRAY_INIT;
+	int ret;
+
+	if (!promisor_remote())
+		return -1;
+	sha1_array_append(&to_fetch, sha1);
+	ret = fetch_objects(&to_fetch);
+	sha1_array_clear(&to_fetch);
+	return ret;
+}
+
+static void collect_missing(const unsigned char sha1[20], void *data)
+{
+	struct sha1_array *missing = data;
+
+	/* unlike has_sha1_file(), this knows about pretend_sha1_file() */
+	if (sha1_object_info(sha1, NULL) < 0)
+		sha1_array_append(missing, sha1);
+}
+
+void prefetch_objects(struct sha1_array *sha1s)
+{
+	struct sha1_array missing = SHA1_ARRAY_INIT;
+	int save_fetch_if_missing = fetch_if_missing;
+
+	if (!fetch_if_missing || !sha1s->nr || !promisor_remote())
+		return;
+	fetch_if_missing = 0;
+	sha1_array_for_each_unique(sha1s, collect_missing, &missing);
+	fetch_if_missing = save_fetch_if_missing;
+	if (missing.nr)
+		fetch_objects(&missing);
+	sha1_array_clear(&missing);
+}
@@ -0,0 +1,36 @@
+#ifndef FETCH_OBJECT_H
+#define FETCH_OBJECT_H
+
+struct sha1_array;
+
+/*
+ * Return the name of the remote this repository was partially cloned
+ * from, i.e. the first one with "remote.<name>.promisor" set, or NULL
+ * if this is not a partial clone.
+ */
+extern const char *promisor_remote(void);
+
+/*
+ * Fetch the given objects, which we lack, from the promisor remote in
+ * a single request.  Only the objects themselves are asked for; no
+ * negotiation takes place and nothing they point at is sent unless
+ * the remote chooses to.  Returns 0 if all of them are present
+ * afterwards.
+ */
+extern int fetch_objects(const struct sha1_array *sha1s);
+
+/* The same, for a single object. */
+extern int fetch_object(const unsigned char *sha1);
+
+/*
+ * Callers that are about to read many objects one after another
+ * (checkout, diff, blame) call this first with everything they will
+ * need, so that whatever is missing arrives in one request rather
+ * than one round-trip per object.  Objects we already have are
+ * skipped, and nothing happens outside a partial clone.  Failure is
+ * not reported; the consumer finds out when it reads the object.
+ * The array may be reordered.
+ */
+extern void prefetch_objects(struct sha1_array *sha1s);
+
+#endif
@@ -12,8 +12,9 @@
 #include "connect.h"
 #include "transport.h"
 #include "version.h"
-#include "prio-queue.h"
 #include "sha1-array.h"
+#include "protocol.h"
+#include "fetch-negotiator.h"
 
 static int transfer_unpack_limit = -1;
 static int fetch_unpack_limit = -1;
@@ -28,12 +29,6 @@ static const char *alternate_shallow_file;
 
 /* Remember to update object flag allocation in object.h */
 #define COMPLETE	(1U << 0)
-#define COMMON		(1U << 1)
-#define COMMON_REF	(1U << 2)
-#define SEEN		(1U << 3)
-#define POPPED		(1U << 4)
-
-static int marked;
 
 /*
  * After sending this many "have"s if we do not get any new ACK , we
@@ -41,124 +36,21 @@ static int marked;
  */
 #define MAX_IN_VAIN 256
 
-static struct prio_queue rev_list = { compare_commits_by_commit_date };
-static int non_common_revs, multi_ack, use_sideband, allow_tip_sha1_in_want;
-
-static void rev_list_push(struct commit *commit, int mark)
-{
-	if (!(commit->object.flags & mark)) {
-		commit->object.flags |= mark;
-
-		if (parse_commit(commit))
-			return;
-
-		prio_queue_put(&rev_list, commit);
-
-		if (!(commit->object.flags & COMMON))
-			non_common_revs++;
-	}
-}
+static int multi_ack, use_sideband, allow_tip_sha1_in_want;
+static int server_supports_filtering;
+static const char *negotiation_algorithm;
 
-static int rev_list_insert_ref(const char *refname, const unsigned char *sha1, int flag, void *cb_data)
+static int add_tip_ref(const char *refname, const unsigned char *sha1, int flag, void *cb_data)
 {
+	struct fetch_negotiator *negotiator = cb_data;
 	struct object *o = deref_tag(parse_object(sha1), refname, 0);
 
 	if (o && o->type == OBJ_COMMIT)
-		rev_list_push((struct commit *)o, SEEN);
+		negotiator->add_tip(negotiator, (struct commit *)o);
 
 	return 0;
 }
 
-static int clear_marks(const char *refname, const unsigned char *sha1, int flag, void *cb_data)
-{
-	struct object *o = deref_tag(parse_object(sha1), refname, 0);
-
-	if (o && o->type == OBJ_COMMIT)
-		clear_commit_marks((struct commit *)o,
-				   COMMON | COMMON_REF | SEEN | POPPED);
-	return 0;
-}
-
-/*
-   This function marks a rev and its ancestors as common.
-   In some cases, it is desirable to mark only the ancestors (for example
-   when only the server does not yet know that they are common).
-*/
-
-static void mark_common(struct commit *commit,
-		int ancestors_only, int dont_parse)
-{
-	if (commit != NULL && !(commit->object.flags & COMMON)) {
-		struct object *o = (struct object *)commit;
-
-		if (!ancestors_only)
-			o->flags |= COMMON;
-
-		if (!(o->flags & SEEN))
-			rev_list_push(commit, SEEN);
-		else {
-			struct commit_list *parents;
-
-			if (!ancestors_only && !(o->flags & POPPED))
-				non_common_revs--;
-			if (!o->parsed && !dont_parse)
-				if (parse_commit(commit))
-					return;
-
-			for (parents = commit->parents;
-					parents;
-					parents = parents->next)
-				mark_common(parents->item, 0, dont_parse);
-		}
-	}
-}
-
-/*
-  Get the next rev to send, ignoring the common.
-*/
-
-static const unsigned char *get_rev(void)
-{
-	struct commit *commit = NULL;
-
-	while (commit == NULL) {
-		unsigned int mark;
-		struct commit_list *parents;
-
-		if (rev_list.nr == 0 || non_common_revs == 0)
-			return NULL;
-
-		commit = prio_queue_get(&rev_list);
-		parse_commit(commit);
-		parents = commit->parents;
-
-		commit->object.flags |= POPPED;
-		if (!(commit->object.flags & COMMON))
-			non_common_revs--;
-
-		if (commit->object.flags & COMMON) {
-			/* do not send "have", and ignore ancestors */
-			commit = NULL;
-			mark = COMMON | SEEN;
-		} else if (commit->object.flags & COMMON_REF)
-			/* send "have", and ignore ancestors */
-			mark = COMMON | SEEN;
-		else
-			/* send "have", also for its ancestors */
-			mark = SEEN;
-
-		while (parents) {
-			if (!(parents->item->object.flags & SEEN))
-				rev_list_push(parents->item, mark);
-			if (mark & COMMON)
-				mark_common(parents->item, 1, 0);
-			parents = parents->next;
-		}
-	}
-
-	return commit->object.sha1;
-}
-
 enum ack_type {
 	NAK = 0,
 	ACK,
@@ -223,18 +115,18 @@ static void send_request(struct fetch_pack_args *args,
 		write_or_die(fd, buf->buf, buf->len);
 }
 
-static void insert_one_alternate_ref(const struct ref *ref, void *unused)
+static void insert_one_alternate_ref(const struct ref *ref, void *negotiator)
 {
-	rev_list_insert_ref(NULL, ref->old_sha1, 0, NULL);
+	add_tip_ref(NULL, ref->old_sha1, 0, negotiator);
 }
 
 #define INITIAL_FLUSH 16
 #define PIPESAFE_FLUSH 32
 #define LARGE_FLUSH 1024
 
-static int next_flush(struct fetch_pack_args *args, int count)
+static int next_flush(int stateless_rpc, int count)
 {
-	int flush_limit = args->stateless_rpc ? LARGE_FLUSH : PIPESAFE_FLUSH;
+	int flush_limit = stateless_rpc ? LARGE_FLUSH : PIPESAFE_FLUSH;
 
 	if (count < flush_limit)
 		count <<= 1;
@@ -243,7 +135,15 @@ static int next_flush(struct fetch_pack_args *args, int count)
 	return count;
 }
 
-static int find_common(struct fetch_pack_args *args,
+/* Queue our ref tips as the starting points for "have" lines. */
+static void mark_tips(struct fetch_negotiator *negotiator)
+{
+	for_each_ref(add_tip_ref, negotiator);
+	for_each_alternate_ref(insert_one_alternate_ref, negotiator);
+}
+
+static int find_common(struct fetch_negotiator *negotiator,
+		       struct fetch_pack_args *args,
 		       int fd[2], unsigned char *result_sha1,
 		       struct ref *refs)
 {
@@ -258,12 +158,9 @@ static int find_common(struct fetch_pack_args *args,
 
 	if (args->stateless_rpc && multi_ack == 1)
 		die("--stateless-rpc requires multi_ack_detailed");
-	if (marked)
-		for_each_ref(clear_marks, NULL);
-	marked = 1;
-
-	for_each_ref(rev_list_insert_ref, NULL);
-	for_each_alternate_ref(insert_one_alternate_ref, NULL);
+	/* Without dependents we send no "have" at all. */
+	if (!args->no_dependents)
+		mark_tips(negotiator);
 
 	fetching = 0;
 	for ( ; refs ; refs = refs->next) {
@@ -281,7 +178,8 @@ static int find_common(struct fetch_pack_args *args,
 		 * interested in the case we *know* the object is
 		 * reachable and we have already scanned it.
 		 */
-		if (((o = lookup_object(remote)) != NULL) &&
+		if (!args->no_dependents &&
+		    ((o = lookup_object(remote)) != NULL) &&
 				(o->flags & COMPLETE)) {
 			continue;
 		}
@@ -317,6 +215,9 @@ static int find_common(struct fetch_pack_args *args,
 		write_shallow_commits(&req_buf, 1, NULL);
 	if (args->depth > 0)
 		packet_buf_write(&req_buf, "deepen %d", args->depth);
+	if (server_supports_filtering && args->filter_options.choice)
+		packet_buf_write(&req_buf, "filter %s",
+				 args->filter_options.filter_spec);
 	packet_buf_flush(&req_buf);
 	state_len = req_buf.len;
 
@@ -360,7 +261,7 @@ static int find_common(struct fetch_pack_args *args,
 
 	flushes = 0;
 	retval = -1;
-	while ((sha1 = get_rev())) {
+	while ((sha1 = negotiator->next(negotiator))) {
 		packet_buf_write(&req_buf, "have %s\n", sha1_to_hex(sha1));
 		if (args->verbose)
 			fprintf(stderr, "have %s\n", sha1_to_hex(sha1));
@@ -372,7 +273,7 @@ static int find_common(struct fetch_pack_args *args,
 			send_request(args, fd[1], &req_buf);
 			strbuf_setlen(&req_buf, state_len);
 			flushes++;
-			flush_at = next_flush(args, count);
+			flush_at = next_flush(args->stateless_rpc, count);
 
 			/*
 			 * We keep one window "ahead" of the other side, and
@@ -398,11 +299,13 @@ static int find_common(struct fetch_pack_args *args,
 				case ACK_continue: {
 					struct commit *commit =
 						lookup_commit(result_sha1);
+					int was_common;
 					if (!commit)
 						die("invalid commit %s", sha1_to_hex(result_sha1));
+					was_common = negotiator->ack(negotiator, commit);
 					if (args->stateless_rpc
 					 && ack == ACK_common
-					 && !(commit->object.flags & COMMON)) {
+					 && !was_common) {
 						/* We need to replay the have for this object
 						 * on the next RPC request so the peer knows
 						 * it is in common with us.
@@ -411,14 +314,11 @@ static int find_common(struct fetch_pack_args *args,
 						packet_buf_write(&req_buf, "have %s\n", hex);
 						state_len = req_buf.len;
 					}
-					mark_common(commit, 0, 1);
 					retval = 0;
 					in_vain = 0;
 					got_continue = 1;
-					if (ack == ACK_ready) {
-						clear_prio_queue(&rev_list);
+					if (ack == ACK_ready)
 						got_ready = 1;
-					}
 					break;
 					}
 				}
@@ -429,6 +329,8 @@ static int find_common(struct fetch_pack_args *args,
 					fprintf(stderr, "giving up\n");
 				break; /* give up */
 			}
+			if (got_ready)
+				break;
 		}
 	}
 done:
@@ -563,7 +465,8 @@ static void mark_alternate_complete(const struct ref *ref, void *unused)
 	mark_complete(NULL, ref->old_sha1, 0, NULL);
 }
 
-static int everything_local(struct fetch_pack_args *args,
+static int everything_local(struct fetch_negotiator *negotiator,
+			    struct fetch_pack_args *args,
 			    struct ref **refs,
 			    struct ref **sought, int nr_sought)
 {
@@ -571,6 +474,15 @@ static int everything_local(struct fetch_pack_args *args,
 	int retval;
 	unsigned long cutoff = 0;
 
+	/*
+	 * The objects we are asked for are known to be missing, and
+	 * the flags on any object we have belong to our caller.
+	 */
+	if (args->no_dependents) {
+		filter_refs(args, refs, sought, nr_sought);
+		return 0;
+	}
+
 	save_commit_buffer = 0;
 
 	for (ref = *refs; ref; ref = ref->next) {
@@ -613,11 +525,7 @@ static int everything_local(struct fetch_pack_args *args,
 		if (!o || o->type != OBJ_COMMIT || !(o->flags & COMPLETE))
 			continue;
 
-		if (!(o->flags & SEEN)) {
-			rev_list_push((struct commit *)o, COMMON_REF | SEEN);
-
-			mark_common((struct commit *)o, 1, 1);
-		}
+		negotiator->known_common(negotiator, (struct commit *)o);
 	}
 
 	filter_refs(args, refs, sought, nr_sought);
@@ -665,7 +573,7 @@ static int get_pack(struct fetch_pack_args *args,
 	char keep_arg[256];
 	char hdr_arg[256];
 	const char **av, *cmd_name;
-	int do_keep = args->keep_pack;
+	int do_keep = args->keep_pack || args->from_promisor;
 	struct child_process cmd;
 	int ret;
 
@@ -689,7 +597,7 @@ static int get_pack(struct fetch_pack_args *args,
 	cmd.argv = argv;
 	av = argv;
 	*hdr_arg = 0;
-	if (!args->keep_pack && unpack_limit) {
+	if (!do_keep && unpack_limit) {
 		struct pack_header header;
 
 		if (read_pack_header(demux.out, &header))
@@ -726,6 +634,8 @@ static int get_pack(struct fetch_pack_args *args,
 		}
 		if (args->check_self_contained_and_connected)
 			*av++ = "--check-self-contained-and-connected";
+		if (args->from_promisor)
+			*av++ = "--promisor";
 	}
 	else {
 		*av++ = cmd_name = "unpack-objects";
@@ -786,6 +696,11 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 	unsigned char sha1[20];
 	const char *agent_feature;
 	int agent_len;
+	struct fetch_negotiator negotiator;
+
+	fetch_negotiator_init(&negotiator, args->negotiation_algorithm ?
+			      args->negotiation_algorithm :
+			      negotiation_algorithm);
 
 	sort_ref_list(&ref, ref_compare_name);
 	qsort(sought, nr_sought, sizeof(*sought), cmp_ref_by_name);
@@ -823,6 +738,12 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 			fprintf(stderr, "Server supports allow-tip-sha1-in-want\n");
 		allow_tip_sha1_in_want = 1;
 	}
+	if (server_supports("filter")) {
+		if (args->verbose)
+			fprintf(stderr, "Server supports filter\n");
+		server_supports_filtering = 1;
+	} else if (args->filter_options.choice)
+		warning("filtering not recognized by server, ignoring");
 	if (!server_supports("thin-pack"))
 		args->use_thin_pack = 0;
 	if (!server_supports("no-progress"))
@@ -842,12 +763,12 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 				agent_len, agent_feature);
 	}
 
-	if (everything_local(args, &ref, sought, nr_sought)) {
+	if (everything_local(&negotiator, args, &ref, sought, nr_sought)) {
 		packet_flush(fd[1]);
 		goto all_done;
 	}
-	if (find_common(args, fd, sha1, ref) < 0)
-		if (!args->keep_pack)
+	if (find_common(&negotiator, args, fd, sha1, ref) < 0)
+		if (!args->keep_pack && !args->no_dependents)
 			/* When cloning, it is not unusual to have
 			 * no common commit.
 			 */
@@ -866,6 +787,332 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 		die("git fetch-pack: fetch failed.");
 
  all_done:
+	negotiator.release(&negotiator);
+	return ref;
+}
+
+/*
+ * Protocol v2 has no state on the server side between requests: each
+ * "fetch" request repeats the wants and the haves we already know to
+ * be common, and adds a batch of new haves, until the server says it
+ * is ready to send a pack (or we run out of haves and say "done").
+ */
+enum fetch_state {
+	FETCH_CHECK_LOCAL = 0,
+	FETCH_SEND_REQUEST,
+	FETCH_PROCESS_ACKS,
+	FETCH_GET_PACK,
+	FETCH_DONE
+};
+
+static int add_wants(struct fetch_pack_args *args, const struct ref *wants,
+		     struct strbuf *req_buf)
+{
+	int fetching = 0;
+
+	for ( ; wants ; wants = wants->next) {
+		const unsigned char *remote = wants->old_sha1;
+		struct object *o;
+
+		/* see the comment in find_common() */
+		if (!args->no_dependents &&
+		    ((o = lookup_object(remote)) != NULL) &&
+				(o->flags & COMPLETE))
+			continue;
+		packet_buf_write(req_buf, "want %s\n", sha1_to_hex(remote));
+		fetching++;
+	}
+	return fetching;
+}
+
+static int add_haves(struct fetch_negotiator *negotiator,
+		     struct strbuf *req_buf, int *haves_to_send,
+		     int *in_vain)
+{
+	int haves_added = 0;
+	const unsigned char *sha1;
+
+	while ((sha1 = negotiator->next(negotiator))) {
+		packet_buf_write(req_buf, "have %s\n", sha1_to_hex(sha1));
+		if (++haves_added >= *haves_to_send)
+			break;
+	}
+	*in_vain += haves_added;
+	/* Increase the number of haves to send in the next round */
+	*haves_to_send = next_flush(1, *haves_to_send);
+	return haves_added;
+}
+
+/*
+ * Returns 1 if the request ended with "done", so that a pack comes
+ * next, 0 if it did not, and -1 (without sending anything) if there
+ * is nothing we want.
+ */
+static int send_fetch_request(struct fetch_negotiator *negotiator,
+			      int fd_out, struct fetch_pack_args *args,
+			      const struct ref *wants, struct strbuf *common,
+			      int *haves_to_send, int *in_vain)
+{
+	struct strbuf req_buf = STRBUF_INIT;
+	int done = 0;
+
+	packet_buf_write(&req_buf, "command=fetch\n");
+	if (server_supports_v2("agent", 0))
+		packet_buf_write(&req_buf, "agent=%s\n",
+				 git_user_agent_sanitized());
+	packet_buf_delim(&req_buf);
+	if (args->use_thin_pack)
+		packet_buf_write(&req_buf, "thin-pack\n");
+	if (args->no_progress)
+		packet_buf_write(&req_buf, "no-progress\n");
+	if (args->include_tag)
+		packet_buf_write(&req_buf, "include-tag\n");
+	if (prefer_ofs_delta)
+		packet_buf_write(&req_buf, "ofs-delta\n");
+
+	if (is_repository_shallow() || args->depth > 0)
+		server_supports_feature("fetch", "shallow", 1);
+	if (is_repository_shallow())
+		write_shallow_commits(&req_buf, 1, NULL);
+	if (args->depth > 0)
+		packet_buf_write(&req_buf, "deepen %d\n", args->depth);
+
+	if (args->filter_options.choice) {
+		if (server_supports_feature("fetch", "filter", 0))
+			packet_buf_write(&req_buf, "filter %s\n",
+					 args->filter_options.filter_spec);
+		else
+			warning("filtering not recognized by server, ignoring");
+	}
+
+	if (!add_wants(args, wants, &req_buf)) {
+		strbuf_release(&req_buf);
+		return -1;
+	}
+
+	/* the server forgets what we told it last time */
+	strbuf_addbuf(&req_buf, common);
+
+	if (args->no_dependents ||
+	    !add_haves(negotiator, &req_buf, haves_to_send, in_vain) ||
+	    *in_vain >= MAX_IN_VAIN) {
+		packet_buf_write(&req_buf, "done\n");
+		done = 1;
+	}
+
+	packet_buf_flush(&req_buf);
+	write_or_die(fd_out, req_buf.buf, req_buf.len);
+	strbuf_release(&req_buf);
+	return done;
+}
+
+/*
+ * Returns 2 if the server is ready to send a pack, 1 if it
+ * acknowledged some of our haves and 0 otherwise.
+ */
+static int process_acks(struct fetch_negotiator *negotiator,
+			struct packet_reader *reader, struct strbuf *common)
+{
+	int received_ready = 0, received_ack = 0;
+
+	if (packet_reader_read(reader) != PACKET_READ_NORMAL ||
+	    strcmp(reader->line, "acknowledgments"))
+		die("git fetch-pack: expected 'acknowledgments', received '%s'",
+		    reader->line ? reader->line : "");
+
+	while (packet_reader_read(reader) == PACKET_READ_NORMAL) {
+		const char *arg;
+		unsigned char sha1[20];
+
+		if (!strcmp(reader->line, "NAK"))
+			continue;
+
+		if (skip_prefix(reader->line, "ACK ", &arg)) {
+			struct commit *commit;
+
+			if (get_sha1_hex(arg, sha1))
+				die("git fetch-pack: invalid ACK line '%s'",
+				    reader->line);
+			commit = lookup_commit(sha1);
+			if (!commit)
+				die("invalid commit %s", sha1_to_hex(sha1));
+			if (!negotiator->ack(negotiator, commit))
+				packet_buf_write(common, "have %s\n",
+						 sha1_to_hex(sha1));
+			received_ack = 1;
+			continue;
+		}
+
+		if (!strcmp(reader->line, "ready")) {
+			received_ready = 1;
+			continue;
+		}
+
+		die("git fetch-pack: unexpected acknowledgment line: '%s'",
+		    reader->line);
+	}
+
+	if (reader->status != PACKET_READ_FLUSH &&
+	    reader->status != PACKET_READ_DELIM)
+		die("git fetch-pack: error processing acks: %d", reader->status);
+	/* a pack follows a delimiter, and only after "ready" */
+	if (received_ready && reader->status != PACKET_READ_DELIM)
+		die("git fetch-pack: expected a pack after 'ready'");
+	if (!received_ready && reader->status != PACKET_READ_FLUSH)
+		die("git fetch-pack: expected no pack without 'ready'");
+
+	if (received_ready)
+		return 2;
+	return received_ack;
+}
+
+static void receive_shallow_info(struct fetch_pack_args *args,
+				 struct packet_reader *reader,
+				 struct sha1_array *shallow)
+{
+	packet_reader_read(reader);
+	while (packet_reader_read(reader) == PACKET_READ_NORMAL) {
+		const char *arg;
+		unsigned char sha1[20];
+
+		if (skip_prefix(reader->line, "shallow ", &arg)) {
+			if (get_sha1_hex(arg, sha1))
+				die("invalid shallow line: %s", reader->line);
+			if (args->depth > 0)
+				register_shallow(sha1);
+			else
+				sha1_array_append(shallow, sha1);
+			continue;
+		}
+		if (skip_prefix(reader->line, "unshallow ", &arg)) {
+			if (get_sha1_hex(arg, sha1))
+				die("invalid unshallow line: %s", reader->line);
+			if (!lookup_object(sha1))
+				die("object not found: %s", reader->line);
+			/* make sure that it is parsed as shallow */
+			if (!parse_object(sha1))
+				die("error in object: %s", reader->line);
+			if (unregister_shallow(sha1))
+				die("no shallow found: %s", reader->line);
+			continue;
+		}
+		die("expected shallow/unshallow, got %s", reader->line);
+	}
+
+	if (reader->status != PACKET_READ_DELIM)
+		die("error processing shallow info: %d", reader->status);
+}
+
+static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
+				    int fd[2],
+				    const struct ref *orig_ref,
+				    struct ref **sought, int nr_sought,
+				    struct sha1_array *shallow,
+				    struct shallow_info *si,
+				    char **pack_lockfile)
+{
+	struct ref *ref = copy_ref_list(orig_ref);
+	enum fetch_state state = FETCH_CHECK_LOCAL;
+	struct packet_reader reader;
+	struct strbuf common = STRBUF_INIT;
+	int in_vain = 0, si_prepared = 0;
+	int haves_to_send = INITIAL_FLUSH;
+	struct fetch_negotiator negotiator;
+
+	fetch_negotiator_init(&negotiator, args->negotiation_algorithm ?
+			      args->negotiation_algorithm :
+			      negotiation_algorithm);
+
+	packet_reader_init(&reader, fd[0], NULL, 0,
+			   PACKET_READ_CHOMP_NEWLINE);
+
+	while (state != FETCH_DONE) {
+		switch (state) {
+		case FETCH_CHECK_LOCAL:
+			sort_ref_list(&ref, ref_compare_name);
+			qsort(sought, nr_sought, sizeof(*sought),
+			      cmp_ref_by_name);
+
+			/* v2 lets us ask for any object the server has */
+			allow_tip_sha1_in_want = 1;
+			use_sideband = 2;
+			if (args->depth > 0 || is_repository_shallow())
+				server_supports_feature("fetch", "shallow", 1);
+
+			if (everything_local(&negotiator, args, &ref,
+					     sought, nr_sought)) {
+				state = FETCH_DONE;
+				break;
+			}
+			/* Without dependents we send no "have" at all. */
+			if (!args->no_dependents)
+				mark_tips(&negotiator);
+			state = FETCH_SEND_REQUEST;
+			break;
+		case FETCH_SEND_REQUEST:
+			switch (send_fetch_request(&negotiator, fd[1], args,
+						   ref, &common,
+						   &haves_to_send, &in_vain)) {
+			case -1:
+				/* nothing left to ask for */
+				state = FETCH_DONE;
+				break;
+			case 1:
+				state = FETCH_GET_PACK;
+				break;
+			default:
+				state = FETCH_PROCESS_ACKS;
+				break;
+			}
+			break;
+		case FETCH_PROCESS_ACKS:
+			switch (process_acks(&negotiator, &reader, &common)) {
+			case 2:
+				state = FETCH_GET_PACK;
+				break;
+			case 1:
+				in_vain = 0;
+				/* fallthrough */
+			default:
+				state = FETCH_SEND_REQUEST;
+				break;
+			}
+			break;
+		case FETCH_GET_PACK:
+			if (packet_reader_peek(&reader) == PACKET_READ_NORMAL &&
+			    !strcmp(reader.line, "shallow-info"))
+				receive_shallow_info(args, &reader, shallow);
+
+			if (packet_reader_read(&reader) != PACKET_READ_NORMAL ||
+			    strcmp(reader.line, "packfile"))
+				die("git fetch-pack: expected 'packfile', "
+				    "received '%s'",
+				    reader.line ? reader.line : "");
+
+			prepare_shallow_info(si, shallow);
+			si_prepared = 1;
+			if (args->depth > 0)
+				setup_alternate_shallow(&shallow_lock,
+							&alternate_shallow_file,
+							NULL);
+			else if (si->nr_ours || si->nr_theirs)
+				alternate_shallow_file =
+					setup_temporary_shallow(si->shallow);
+			else
+				alternate_shallow_file = NULL;
+			if (get_pack(args, fd, pack_lockfile))
+				die("git fetch-pack: fetch failed.");
+			state = FETCH_DONE;
+			break;
+		case FETCH_DONE:
+			break;
+		}
+	}
+
+	negotiator.release(&negotiator);
+	if (!si_prepared)
+		prepare_shallow_info(si, shallow);
+	strbuf_release(&common);
 	return ref;
 }
 
@@ -896,6 +1143,9 @@ static int fetch_pack_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "fetch.negotiationalgorithm"))
+		return git_config_string(&negotiation_algorithm, var, value);
+
 	return git_default_config(var, value, cb);
 }
 
@@ -1033,7 +1283,8 @@ struct ref *fetch_pack(struct fetch_pack_args *args,
 		       const char *dest,
 		       struct ref **sought, int nr_sought,
 		       struct sha1_array *shallow,
-		       char **pack_lockfile)
+		       char **pack_lockfile,
+		       enum protocol_version version)
 {
 	struct ref *ref_cpy;
 	struct shallow_info si;
@@ -1042,13 +1293,19 @@ struct ref *fetch_pack(struct fetch_pack_args *args,
 	if (nr_sought)
 		nr_sought = remove_duplicates_in_refs(sought, nr_sought);
 
-	if (!ref) {
-		packet_flush(fd[1]);
-		die("no matching remote head");
+	if (version == protocol_v2) {
+		/* the server's shallow roots come with the pack */
+		ref_cpy = do_fetch_pack_v2(args, fd, ref, sought, nr_sought,
+					   shallow, &si, pack_lockfile);
+	} else {
+		if (!ref) {
+			packet_flush(fd[1]);
+			die("no matching remote head");
+		}
+		prepare_shallow_info(&si, shallow);
+		ref_cpy = do_fetch_pack(args, fd, ref, sought, nr_sought,
+					&si, pack_lockfile);
 	}
-	prepare_shallow_info(&si, shallow);
-	ref_cpy = do_fetch_pack(args, fd, ref, sought, nr_sought,
-				&si, pack_lockfile);
 	reprepare_packed_git();
 	update_shallow(args, sought, nr_sought, &si);
 	clear_shallow_info(&si);
@@ -3,6 +3,8 @@
 
 #include "string-list.h"
 #include "run-command.h"
+#include "list-objects-filter-options.h"
+#include "protocol.h"
 
 struct sha1_array;
 
@@ -25,12 +27,18 @@ struct fetch_pack_args {
 	unsigned self_contained_and_connected:1;
 	unsigned cloning:1;
 	unsigned update_shallow:1;
+	unsigned from_promisor:1;
+	unsigned no_dependents:1;
+	struct list_objects_filter_options filter_options;
+	/* "default", "skipping"; NULL for fetch.negotiationAlgorithm */
+	const char *negotiation_algorithm;
 };
 
 /*
  * sought represents remote references that should be updated from.
  * On return, the names that were found on the remote will have been
- * marked as such.
+ * marked as such.  With protocol v2, "ref" is what "ls-refs" returned
+ * and the connection is ready for a "fetch" command.
  */
 struct ref *fetch_pack(struct fetch_pack_args *args,
 		       int fd[], struct child_process *conn,
@@ -39,6 +47,7 @@ struct ref *fetch_pack(struct fetch_pack_args *args,
 		       struct ref **sought,
 		       int nr_sought,
 		       struct sha1_array *shallow,
-		       char **pack_lockfile);
+		       char **pack_lockfile,
+		       enum protocol_version version);
 
 #endif
@@ -0,0 +1,314 @@
+#include "cache.h"
+#include "fsmonitor.h"
+#include "dir.h"
+#include "run-command.h"
+#include "strbuf.h"
+#include "ewah/ewok.h"
+
+/*
+ * "core.fsmonitor" is read on demand rather than with the rest of the
+ * core settings, as the index may well be read before the command
+ * gets around to calling git_config().
+ */
+static const char *fsmonitor_hook;
+
+static int fsmonitor_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "core.fsmonitor")) {
+		free((char *)fsmonitor_hook);
+		fsmonitor_hook = NULL;
+		if (!value)
+			return config_error_nonbool(var);
+		if (*value)
+			fsmonitor_hook = xstrdup(value);
+	}
+	return 0;
+}
+
+static const char *get_fsmonitor_hook(void)
+{
+	static int loaded;
+
+	if (!loaded) {
+		git_config(fsmonitor_config, NULL);
+		loaded = 1;
+	}
+	return fsmonitor_hook;
+}
+
+int read_fsmonitor_extension(struct index_state *istate,
+			     const void *data_, unsigned long sz)
+{
+	const char *data = data_, *end = data + sz, *token, *eot;
+	struct ewah_bitmap *dirty;
+	uint32_t version, ewah_size;
+	int ret;
+
+	if (sz < 4 + 1 + 4)
+		return error("corrupt fsmonitor extension (too short)");
+	version = get_be32(data);
+	if (version != FSMONITOR_VERSION)
+		return error("bad fsmonitor extension version %"PRIu32, version);
+	token = data + 4;
+	eot = memchr(token, '\0', end - token);
+	if (!eot || end - (eot + 1) < 4)
+		return error("corrupt fsmonitor extension (bad token)");
+	ewah_size = get_be32(eot + 1);
+	data = eot + 1 + 4;
+	if (ewah_size != end - data)
+		return error("corrupt fsmonitor extension (bad bitmap size)");
+
+	dirty = ewah_new();
+	ret = ewah_read_mmap(dirty, data, ewah_size);
+	if (ret != ewah_size) {
+		ewah_free(dirty);
+		return error("corrupt fsmonitor extension (bad bitmap)");
+	}
+	free(istate->fsmonitor_last_update);
+	istate->fsmonitor_last_update = xstrdup(token);
+	if (istate->fsmonitor_dirty)
+		ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = dirty;
+	return 0;
+}
+
+static int write_strbuf(void *user_data, const void *data, size_t len)
+{
+	struct strbuf *sb = user_data;
+	strbuf_add(sb, data, len);
+	return len;
+}
+
+void fill_fsmonitor_bitmap(struct index_state *istate)
+{
+	int i, skipped = 0;
+
+	if (!istate->fsmonitor_last_update)
+		return;
+	if (istate->fsmonitor_dirty)
+		ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = ewah_new();
+	/* positions are those in the index as written, without removals */
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			skipped++;
+		else if (!(ce->ce_flags & CE_FSMONITOR_VALID))
+			ewah_set(istate->fsmonitor_dirty, i - skipped);
+	}
+}
+
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
+{
+	struct strbuf bitmap = STRBUF_INIT;
+	unsigned char be32[4];
+
+	if (!istate->fsmonitor_dirty)
+		die("BUG: fsmonitor bitmap not filled before writing the index");
+	ewah_serialize_to(istate->fsmonitor_dirty, write_strbuf, &bitmap);
+	ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+
+	put_be32(be32, FSMONITOR_VERSION);
+	strbuf_add(sb, be32, 4);
+	strbuf_add(sb, istate->fsmonitor_last_update,
+		   strlen(istate->fsmonitor_last_update) + 1);
+	put_be32(be32, bitmap.len);
+	strbuf_add(sb, be32, 4);
+	strbuf_addbuf(sb, &bitmap);
+	strbuf_release(&bitmap);
+}
+
+static void fsmonitor_ewah_callback(size_t pos, void *data)
+{
+	struct index_state *istate = data;
+
+	if (pos < istate->cache_nr)
+		istate->cache[pos]->ce_flags &= ~CE_FSMONITOR_VALID;
+}
+
+void tweak_fsmonitor(struct index_state *istate)
+{
+	int i;
+
+	if (!get_fsmonitor_hook()) {
+		if (istate->fsmonitor_last_update)
+			remove_fsmonitor(istate);
+		return;
+	}
+
+	if (!istate->fsmonitor_last_update) {
+		/* First use: nothing is known about the working tree yet */
+		istate->fsmonitor_last_update = xstrdup("");
+		istate->cache_changed |= FSMONITOR_CHANGED;
+		return;
+	}
+
+	if (!istate->fsmonitor_dirty)
+		return;
+	if (istate->fsmonitor_dirty->bit_size <= istate->cache_nr) {
+		/* Everything is valid, except what was recorded as dirty */
+		for (i = 0; i < istate->cache_nr; i++)
+			if (!S_ISGITLINK(istate->cache[i]->ce_mode))
+				istate->cache[i]->ce_flags |= CE_FSMONITOR_VALID;
+		ewah_each_bit(istate->fsmonitor_dirty,
+			      fsmonitor_ewah_callback, istate);
+	}
+	ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+}
+
+void remove_fsmonitor(struct index_state *istate)
+{
+	int i;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+	free(istate->fsmonitor_last_update);
+	istate->fsmonitor_last_update = NULL;
+	if (istate->fsmonitor_dirty) {
+		ewah_free(istate->fsmonitor_dirty);
+		istate->fsmonitor_dirty = NULL;
+	}
+	istate->cache_changed |= FSMONITOR_CHANGED;
+}
+
+/*
+ * Run the hook as "<hook> <version> <token>". It answers with a new
+ * token and then the paths that changed since the old one, each
+ * terminated by NUL.
+ */
+static int query_fsmonitor(const char *last_update, struct strbuf *answer)
+{
+	struct child_process cp;
+	const char *argv[4];
+	char version[16];
+	int ret = 0;
+
+	snprintf(version, sizeof(version), "%d", FSMONITOR_VERSION);
+	argv[0] = get_fsmonitor_hook();
+	argv[1] = version;
+	argv[2] = last_update;
+	argv[3] = NULL;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.argv = argv;
+	cp.use_shell = 1;
+	cp.no_stdin = 1;
+	cp.out = -1;
+	if (start_command(&cp))
+		return error("could not run fsmonitor hook '%s'", argv[0]);
+	if (strbuf_read(answer, cp.out, 1024) < 0)
+		ret = error("could not read the answer of fsmonitor hook '%s'",
+			    argv[0]);
+	close(cp.out);
+	if (finish_command(&cp))
+		ret = -1;
+	return ret;
+}
+
+static void invalidate_entries(struct index_state *istate, int pos,
+			       const char *name, int len)
+{
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+
+		if (ce_namelen(ce) < len || memcmp(ce->name, name, len))
+			break;
+		ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	}
+}
+
+/*
+ * A path the hook reported may be a file, or a directory, in which
+ * case everything below it is suspect. Either way, the untracked
+ * cache for the directory containing it, and for the directory
+ * itself, is out of date.
+ */
+static void fsmonitor_invalidate_path(struct index_state *istate,
+				      const char *name, int len)
+{
+	struct strbuf dir = STRBUF_INIT;
+	int pos;
+
+	while (len && name[len - 1] == '/')
+		len--;
+	if (!len)
+		return;
+
+	pos = index_name_pos(istate, name, len);
+	if (pos < 0)
+		pos = -pos - 1;
+	while (pos < istate->cache_nr &&
+	       ce_namelen(istate->cache[pos]) == len &&
+	       !memcmp(istate->cache[pos]->name, name, len))
+		istate->cache[pos++]->ce_flags &= ~CE_FSMONITOR_VALID;
+
+	strbuf_add(&dir, name, len);
+	untracked_cache_invalidate_path(istate, dir.buf);
+	strbuf_addch(&dir, '/');
+	untracked_cache_invalidate_path(istate, dir.buf);
+	pos = index_name_pos(istate, dir.buf, dir.len);
+	if (pos < 0)
+		pos = -pos - 1;
+	invalidate_entries(istate, pos, dir.buf, dir.len);
+	strbuf_release(&dir);
+}
+
+void refresh_fsmonitor(struct index_state *istate)
+{
+	struct strbuf answer = STRBUF_INIT;
+	char *new_token = NULL;
+	int i, everything = 1;
+
+	if (!istate->fsmonitor_last_update || istate->fsmonitor_has_run_once ||
+	    !get_fsmonitor_hook())
+		return;
+	istate->fsmonitor_has_run_once = 1;
+
+	if (!query_fsmonitor(istate->fsmonitor_last_update, &answer) &&
+	    answer.len && answer.buf[0] &&
+	    memchr(answer.buf, '\0', answer.len)) {
+		size_t bol, eol;
+
+		new_token = xstrdup(answer.buf);
+		/* An empty old token means we never knew anything */
+		everything = !*istate->fsmonitor_last_update;
+		for (bol = strlen(answer.buf) + 1;
+		     !everything && bol < answer.len; bol = eol + 1) {
+			const char *p = memchr(answer.buf + bol, '\0',
+					       answer.len - bol);
+
+			eol = p ? p - answer.buf : answer.len;
+			if (eol - bol == 1 && answer.buf[bol] == '/')
+				everything = 1;
+			else
+				fsmonitor_invalidate_path(istate, answer.buf + bol,
+							  eol - bol);
+		}
+	}
+	strbuf_release(&answer);
+
+	/* The untracked cache need not stat() what was not reported */
+	if (istate->untracked)
+		istate->untracked->use_fsmonitor = !everything;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (everything)
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+		else if (ce->ce_flags & CE_FSMONITOR_VALID)
+			ce_mark_uptodate(ce);
+	}
+
+	/*
+	 * Without an answer, keep nothing: the entries that are found
+	 * unchanged from now on are recorded against an empty token,
+	 * which makes the next query start over.
+	 */
+	free(istate->fsmonitor_last_update);
+	istate->fsmonitor_last_update = new_token ? new_token : xstrdup("");
+	istate->cache_changed |= FSMONITOR_CHANGED;
+}
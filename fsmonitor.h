@@ -0,0 +1,70 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+/*
+ * A file system monitor is a hook ("core.fsmonitor") that knows which
+ * paths in the working tree changed since a point in time named by an
+ * opaque token. The index remembers the last token in its "FSMN"
+ * extension, along with which entries were known to be unchanged at
+ * that time, so that those entries need not be lstat()ed again unless
+ * the hook reports them.
+ *
+ * See Documentation/githooks.txt for the protocol of the hook.
+ */
+
+#define FSMONITOR_VERSION 1
+
+extern int read_fsmonitor_extension(struct index_state *istate,
+				    const void *data, unsigned long sz);
+extern void write_fsmonitor_extension(struct strbuf *sb,
+				      struct index_state *istate);
+
+/*
+ * Record which entries of the index are not CE_FSMONITOR_VALID, before
+ * the index is written out (and possibly split).
+ */
+extern void fill_fsmonitor_bitmap(struct index_state *istate);
+
+/*
+ * Apply the extension that was read with the index: mark the entries
+ * that were unchanged at the time of the token CE_FSMONITOR_VALID, or
+ * drop the extension if "core.fsmonitor" is not set.
+ */
+extern void tweak_fsmonitor(struct index_state *istate);
+
+/*
+ * Ask the hook (once per process) what changed since the token,
+ * invalidate those entries, and mark the remaining valid ones
+ * CE_UPTODATE so that they are not lstat()ed.
+ */
+extern void refresh_fsmonitor(struct index_state *istate);
+
+/* Forget about the file system monitor, e.g. when it is turned off */
+extern void remove_fsmonitor(struct index_state *istate);
+
+/*
+ * An entry was found unchanged by lstat(): it stays valid until the
+ * hook reports it.
+ */
+static inline void mark_fsmonitor_valid(struct index_state *istate,
+					struct cache_entry *ce)
+{
+	if (istate->fsmonitor_last_update && !S_ISGITLINK(ce->ce_mode) &&
+	    !(ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce->ce_flags |= CE_FSMONITOR_VALID;
+		istate->cache_changed |= FSMONITOR_CHANGED;
+	}
+}
+
+/* The entry was changed in the index; it has to be checked again. */
+static inline void mark_fsmonitor_invalid(struct index_state *istate,
+					  struct cache_entry *ce)
+{
+	if (istate->fsmonitor_last_update &&
+	    (ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce->ce_flags &= ~CE_FSMONITOR_VALID;
+		istate->cache_changed |= FSMONITOR_CHANGED;
+	}
+}
+
+#endif
@@ -163,6 +163,13 @@ struct http_get_options {
 	 * for details.
 	 */
 	struct strbuf *base_url;
+
+	/*
+	 * If not NULL, contains additional HTTP headers to be sent with
+	 * the request. The strings in the list must not be freed until
+	 * after the request has completed.
+	 */
+	struct string_list *extra_headers;
 };
 
 /* Return values for http_get_*() */
@@ -180,6 +187,13 @@ struct http_get_options {
  */
 int http_get_strbuf(const char *url, struct strbuf *result, struct http_get_options *options);
 
+/*
+ * Downloads a URL into a file, going through "<filename>.temp" so
+ * that an interrupted download is resumed by the next call.
+ */
+int http_get_file(const char *url, const char *filename,
+		  struct http_get_options *options);
+
 extern int http_fetch_ref(const char *base, struct ref *ref);
 
 /* Helpers for fetching packs */
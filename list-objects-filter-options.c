@@ -0,0 +1,50 @@
+#include "cache.h"
+#include "list-objects-filter-options.h"
+
+int parse_list_objects_filter(struct list_objects_filter_options *filter,
+			      const char *arg)
+{
+	const char *v;
+	char *end;
+
+	if (filter->choice)
+		return error(_("multiple filter-specs cannot be combined"));
+
+	if (!strcmp(arg, "blob:none")) {
+		filter->choice = LOFC_BLOB_NONE;
+	} else if (skip_prefix(arg, "blob:limit=", &v)) {
+		if (!git_parse_ulong(v, &filter->blob_limit_value))
+			return error(_("invalid filter-spec '%s'"), arg);
+		filter->choice = LOFC_BLOB_LIMIT;
+	} else if (skip_prefix(arg, "tree:", &v)) {
+		if (!isdigit(*v))
+			return error(_("invalid filter-spec '%s'"), arg);
+		filter->tree_depth_value = strtoul(v, &end, 10);
+		if (*end)
+			return error(_("invalid filter-spec '%s'"), arg);
+		filter->choice = LOFC_TREE_DEPTH;
+	} else {
+		return error(_("invalid filter-spec '%s'"), arg);
+	}
+
+	filter->filter_spec = xstrdup(arg);
+	return 0;
+}
+
+int opt_parse_list_objects_filter(const struct option *opt,
+				  const char *arg, int unset)
+{
+	struct list_objects_filter_options *filter = opt->value;
+
+	if (unset || !arg) {
+		list_objects_filter_release(filter);
+		return 0;
+	}
+	return parse_list_objects_filter(filter, arg);
+}
+
+void list_objects_filter_release(struct list_objects_filter_options *filter)
+{
+	free(filter->filter_spec);
+	memset(filter, 0, sizeof(*filter));
+}
@@ -0,0 +1,50 @@
+#ifndef LIST_OBJECTS_FILTER_OPTIONS_H
+#define LIST_OBJECTS_FILTER_OPTIONS_H
+
+#include "parse-options.h"
+
+/*
+ * The kinds of object filter that can be requested with
+ * "--filter=<filter-spec>".
+ */
+enum list_objects_filter_choice {
+	LOFC_DISABLED = 0,
+	LOFC_BLOB_NONE,
+	LOFC_BLOB_LIMIT,
+	LOFC_TREE_DEPTH
+};
+
+struct list_objects_filter_options {
+	/*
+	 * The filter-spec as given by the user.  It is kept so that
+	 * it can be passed verbatim to a subordinate command or sent
+	 * to the other side of a fetch.
+	 */
+	char *filter_spec;
+
+	enum list_objects_filter_choice choice;
+
+	/* blob:limit=<n> omits blobs of <n> bytes or more */
+	unsigned long blob_limit_value;
+
+	/* tree:<depth> omits trees and blobs at least <depth> deep */
+	unsigned long tree_depth_value;
+};
+
+/*
+ * Parse "blob:none", "blob:limit=<n>[kmg]" or "tree:<depth>" into
+ * the filter options.  Returns 0 on success, or an error.
+ */
+extern int parse_list_objects_filter(struct list_objects_filter_options *,
+				     const char *arg);
+
+extern int opt_parse_list_objects_filter(const struct option *opt,
+					 const char *arg, int unset);
+
+#define OPT_PARSE_LIST_OBJECTS_FILTER(fo) \
+	OPT_CALLBACK(0, "filter", fo, N_("args"), \
+		     N_("object filtering"), opt_parse_list_objects_filter)
+
+extern void list_objects_filter_release(struct list_objects_filter_options *);
+
+#endif
@@ -6,25 +6,85 @@
 #include "diff.h"
 #include "tree-walk.h"
 #include "revision.h"
+#include "decorate.h"
 #include "list-objects.h"
+#include "list-objects-filter-options.h"
 
-static void process_blob(struct rev_info *revs,
+struct traversal_context {
+	struct rev_info *revs;
+	show_object_fn show_object;
+	void *show_data;
+	struct list_objects_filter_options *filter;
+	/* shallowest depth at which each tree was walked, plus one */
+	struct decoration tree_depth;
+};
+
+/*
+ * Objects given explicitly by the user are never filtered; "depth"
+ * is negative for them.  Otherwise it counts the trees between the
+ * object and the root tree of the commit it was reached from, which
+ * itself is at depth 0.
+ */
+static int filter_omits_blob(struct traversal_context *ctx,
+			     struct blob *blob, int depth)
+{
+	unsigned long size;
+
+	if (!ctx->filter || depth < 0)
+		return 0;
+
+	switch (ctx->filter->choice) {
+	case LOFC_BLOB_NONE:
+		return 1;
+	case LOFC_BLOB_LIMIT:
+		/* a blob we do not have cannot be measured; keep it */
+		if (sha1_object_info(blob->object.sha1, &size) < 0)
+			return 0;
+		return size >= ctx->filter->blob_limit_value;
+	case LOFC_TREE_DEPTH:
+		return depth >= ctx->filter->tree_depth_value;
+	default:
+		return 0;
+	}
+}
+
+static int filter_omits_tree(struct traversal_context *ctx, int depth)
+{
+	if (!ctx->filter || depth < 0)
+		return 0;
+	return ctx->filter->choice == LOFC_TREE_DEPTH &&
+		depth >= ctx->filter->tree_depth_value;
+}
+
+static void process_blob(struct traversal_context *ctx,
 			 struct blob *blob,
-			 show_object_fn show,
 			 struct name_path *path,
 			 const char *name,
-			 void *cb_data)
+			 int depth)
 {
 	struct object *obj = &blob->object;
 
-	if (!revs->blob_objects)
+	if (!ctx->revs->blob_objects)
 		return;
 	if (!obj)
 		die("bad blob object");
 	if (obj->flags & (UNINTERESTING | SEEN))
 		return;
+	/*
+	 * A blob we are told to leave out of a partial clone may well
+	 * be missing; do not look at it any further.
+	 */
+	if (ctx->revs->exclude_promisor_objects &&
+	    is_promisor_object(obj->sha1))
+		return;
+	/*
+	 * An omitted blob is not marked SEEN, so that it is still shown
+	 * if it is also reachable at a depth the filter allows.
+	 */
+	if (filter_omits_blob(ctx, blob, depth))
+		return;
 	obj->flags |= SEEN;
-	show(obj, path, name, cb_data);
+	ctx->show_object(obj, path, name, ctx->show_data);
 }
 
 /*
@@ -49,24 +109,22 @@ static void process_blob(struct rev_info *revs,
  * the link, and how to do it. Whether it necessarily makes
  * any sense what-so-ever to ever do that is another issue.
  */
-static void process_gitlink(struct rev_info *revs,
+static void process_gitlink(struct traversal_context *ctx,
 			    const unsigned char *sha1,
-			    show_object_fn show,
 			    struct name_path *path,
-			    const char *name,
-			    void *cb_data)
+			    const char *name)
 {
 	/* Nothing to do */
 }
 
-static void process_tree(struct rev_info *revs,
+static void process_tree(struct traversal_context *ctx,
 			 struct tree *tree,
-			 show_object_fn show,
 			 struct name_path *path,
 			 struct strbuf *base,
 			 const char *name,
-			 void *cb_data)
+			 int depth)
 {
+	struct rev_info *revs = ctx->revs;
 	struct object *obj = &tree->object;
 	struct tree_desc desc;
 	struct name_entry entry;
@@ -74,20 +132,45 @@ static void process_tree(struct rev_info *revs,
 	enum interesting match = revs->diffopt.pathspec.nr == 0 ?
 		all_entries_interesting: entry_not_interesting;
 	int baselen = base->len;
+	int child_depth = depth < 0 ? 1 : depth + 1;
 
 	if (!revs->tree_objects)
 		return;
 	if (!obj)
 		die("bad tree object");
-	if (obj->flags & (UNINTERESTING | SEEN))
+	if (obj->flags & UNINTERESTING)
+		return;
+	if (obj->flags & SEEN) {
+		/*
+		 * With a depth filter, a tree first reached deep down
+		 * may have had some of its entries omitted; walk it
+		 * again when it turns up closer to the root.
+		 */
+		intptr_t seen_depth;
+
+		if (!ctx->filter || ctx->filter->choice != LOFC_TREE_DEPTH ||
+		    depth < 0)
+			return;
+		seen_depth = (intptr_t)lookup_decoration(&ctx->tree_depth, obj);
+		if (!seen_depth || seen_depth - 1 <= depth)
+			return;
+	}
+	if (revs->exclude_promisor_objects && is_promisor_object(obj->sha1))
+		return;
+	if (filter_omits_tree(ctx, depth))
 		return;
 	if (parse_tree(tree) < 0) {
 		if (revs->ignore_missing_links)
 			return;
 		die("bad tree object %s", sha1_to_hex(obj->sha1));
 	}
-	obj->flags |= SEEN;
-	show(obj, path, name, cb_data);
+	if (!(obj->flags & SEEN)) {
+		obj->flags |= SEEN;
+		ctx->show_object(obj, path, name, ctx->show_data);
+	}
+	if (ctx->filter && ctx->filter->choice == LOFC_TREE_DEPTH && depth >= 0)
+		add_decoration(&ctx->tree_depth, obj,
+			       (void *)(intptr_t)(depth + 1));
 	me.up = path;
 	me.elem = name;
 	me.elem_len = strlen(name);
@@ -111,19 +194,18 @@ static void process_tree(struct rev_info *revs,
 		}
 
 		if (S_ISDIR(entry.mode))
-			process_tree(revs,
+			process_tree(ctx,
 				     lookup_tree(entry.sha1),
-				     show, &me, base, entry.path,
-				     cb_data);
+				     &me, base, entry.path,
+				     child_depth);
 		else if (S_ISGITLINK(entry.mode))
-			process_gitlink(revs, entry.sha1,
-					show, &me, entry.path,
-					cb_data);
+			process_gitlink(ctx, entry.sha1,
+					&me, entry.path);
 		else
-			process_blob(revs,
+			process_blob(ctx,
 				     lookup_blob(entry.sha1),
-				     show, &me, entry.path,
-				     cb_data);
+				     &me, entry.path,
+				     child_depth);
 	}
 	strbuf_setlen(base, baselen);
 	free_tree_buffer(tree);
@@ -185,17 +267,35 @@ static void add_pending_tree(struct rev_info *revs, struct tree *tree)
 	add_pending_object(revs, &tree->object, "");
 }
 
-void traverse_commit_list(struct rev_info *revs,
-			  show_commit_fn show_commit,
-			  show_object_fn show_object,
-			  void *data)
+void traverse_commit_list_filtered(struct list_objects_filter_options *filter,
+				   struct rev_info *revs,
+				   show_commit_fn show_commit,
+				   show_object_fn show_object,
+				   void *data)
 {
-	int i;
+	int i, nr_given;
 	struct commit *commit;
 	struct strbuf base;
+	struct traversal_context ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.revs = revs;
+	ctx.show_object = show_object;
+	ctx.show_data = data;
+	if (filter && filter->choice)
+		ctx.filter = filter;
+
+	/*
+	 * What is pending before the walk was named by the user; the
+	 * root trees of the commits we walk are queued after it.
+	 */
+	nr_given = revs->pending.nr;
 
 	strbuf_init(&base, PATH_MAX);
 	while ((commit = get_revision(revs)) != NULL) {
+		if (revs->exclude_promisor_objects &&
+		    is_promisor_object(commit->object.sha1))
+			continue;
 		/*
 		 * an uninteresting boundary commit may not have its tree
 		 * parsed yet, but we are not going to show them anyway
@@ -208,7 +308,11 @@ void traverse_commit_list(struct rev_info *revs,
 		struct object_array_entry *pending = revs->pending.objects + i;
 		struct object *obj = pending->item;
 		const char *name = pending->name;
-		if (obj->flags & (UNINTERESTING | SEEN))
+		int depth = i < nr_given ? -1 : 0;
+		if (obj->flags & UNINTERESTING)
+			continue;
+		/* process_tree() may want to walk a seen tree again */
+		if ((obj->flags & SEEN) && obj->type != OBJ_TREE)
 			continue;
 		if (obj->type == OBJ_TAG) {
 			obj->flags |= SEEN;
@@ -216,13 +320,13 @@ void traverse_commit_list(struct rev_info *revs,
 			continue;
 		}
 		if (obj->type == OBJ_TREE) {
-			process_tree(revs, (struct tree *)obj, show_object,
-				     NULL, &base, name, data);
+			process_tree(&ctx, (struct tree *)obj,
+				     NULL, &base, name, depth);
 			continue;
 		}
 		if (obj->type == OBJ_BLOB) {
-			process_blob(revs, (struct blob *)obj, show_object,
-				     NULL, name, data);
+			process_blob(&ctx, (struct blob *)obj,
+				     NULL, name, depth);
 			continue;
 		}
 		die("unknown pending object %s (%s)",
@@ -234,5 +338,15 @@ void traverse_commit_list(struct rev_info *revs,
 		revs->pending.alloc = 0;
 		revs->pending.objects = NULL;
 	}
+	free(ctx.tree_depth.hash);
 	strbuf_release(&base);
 }
+
+void traverse_commit_list(struct rev_info *revs,
+			  show_commit_fn show_commit,
+			  show_object_fn show_object,
+			  void *data)
+{
+	traverse_commit_list_filtered(NULL, revs, show_commit, show_object,
+				      data);
+}
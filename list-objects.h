@@ -1,10 +1,21 @@
 #ifndef LIST_OBJECTS_H
 #define LIST_OBJECTS_H
 
+struct list_objects_filter_options;
+
 typedef void (*show_commit_fn)(struct commit *, void *);
 typedef void (*show_object_fn)(struct object *, const struct name_path *, const char *, void *);
 void traverse_commit_list(struct rev_info *, show_commit_fn, show_object_fn, void *);
 
+/*
+ * Like traverse_commit_list(), but leave out the trees and blobs that
+ * the filter omits.  Objects named explicitly by the user are always
+ * shown.
+ */
+void traverse_commit_list_filtered(struct list_objects_filter_options *,
+				   struct rev_info *,
+				   show_commit_fn, show_object_fn, void *);
+
 typedef void (*show_edge_fn)(struct commit *);
 void mark_edges_uninteresting(struct rev_info *, show_edge_fn);
 
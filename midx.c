@@ -0,0 +1,916 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "sha1-lookup.h"
+#include "midx.h"
+#include "pack.h"
+#include "revision.h"
+#include "pack-bitmap.h"
+
+#define MIDX_HEADER_SIZE 12
+#define MIDX_CHUNKLOOKUP_WIDTH 12
+#define MIDX_FANOUT_SIZE (4 * 256)
+#define MIDX_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_WIDTH 8
+#define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + MIDX_FANOUT_SIZE + MIDX_OID_LEN)
+
+struct multi_pack_index *multi_pack_index;
+
+char *get_midx_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index", object_dir);
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+void close_midx(struct multi_pack_index *m)
+{
+	if (!m)
+		return;
+	munmap((void *)m->data, m->data_len);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir)
+{
+	struct multi_pack_index *m;
+	const unsigned char *data, *chunk_lookup;
+	const char *cur_name;
+	char *midx_name;
+	struct stat st;
+	size_t midx_size;
+	uint64_t oid_lookup_size = 0, object_offsets_size = 0;
+	uint32_t i;
+	int fd;
+
+	midx_name = get_midx_filename(object_dir);
+	fd = git_open_noatime(midx_name);
+	if (fd < 0) {
+		free(midx_name);
+		return NULL;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(midx_name);
+		return NULL;
+	}
+	midx_size = xsize_t(st.st_size);
+	if (midx_size < MIDX_MIN_SIZE) {
+		close(fd);
+		error("multi-pack-index file %s is too small", midx_name);
+		free(midx_name);
+		return NULL;
+	}
+	data = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	m = xcalloc(1, sizeof(*m) + strlen(object_dir) + 1);
+	strcpy(m->object_dir, object_dir);
+	m->data = data;
+	m->data_len = midx_size;
+
+	if (get_be32(data) != MIDX_SIGNATURE) {
+		error("multi-pack-index signature 0x%08x does not match signature 0x%08x",
+		      get_be32(data), MIDX_SIGNATURE);
+		goto cleanup_fail;
+	}
+	if (data[4] != MIDX_VERSION) {
+		error("multi-pack-index version %d not recognized", data[4]);
+		goto cleanup_fail;
+	}
+	if (data[5] != MIDX_OID_VERSION) {
+		error("multi-pack-index hash version %d not recognized", data[5]);
+		goto cleanup_fail;
+	}
+	m->num_chunks = data[6];
+	if (data[7]) {
+		error("multi-pack-index has unsupported base files");
+		goto cleanup_fail;
+	}
+	m->num_packs = get_be32(data + 8);
+
+	if (MIDX_HEADER_SIZE + (m->num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH
+	    > midx_size - MIDX_OID_LEN) {
+		error("multi-pack-index chunk lookup table is truncated");
+		goto cleanup_fail;
+	}
+
+	chunk_lookup = data + MIDX_HEADER_SIZE;
+	for (i = 0; i < m->num_chunks; i++) {
+		uint32_t chunk_id = get_be32(chunk_lookup);
+		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+		uint64_t next_offset = get_be64(chunk_lookup + 4 + MIDX_CHUNKLOOKUP_WIDTH);
+
+		uint64_t chunk_size;
+
+		chunk_lookup += MIDX_CHUNKLOOKUP_WIDTH;
+
+		if (chunk_offset > next_offset ||
+		    next_offset > midx_size - MIDX_OID_LEN) {
+			error("improper chunk offset in multi-pack-index");
+			goto cleanup_fail;
+		}
+		chunk_size = next_offset - chunk_offset;
+
+		switch (chunk_id) {
+		case MIDX_CHUNKID_PACKNAMES:
+			m->chunk_pack_names = data + chunk_offset;
+			m->chunk_pack_names_len = chunk_size;
+			break;
+
+		case MIDX_CHUNKID_OIDFANOUT:
+			if (chunk_size != MIDX_FANOUT_SIZE) {
+				error("multi-pack-index OID fanout is of the wrong size");
+				goto cleanup_fail;
+			}
+			m->chunk_oid_fanout = data + chunk_offset;
+			break;
+
+		case MIDX_CHUNKID_OIDLOOKUP:
+			m->chunk_oid_lookup = data + chunk_offset;
+			oid_lookup_size = chunk_size;
+			break;
+
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			m->chunk_object_offsets = data + chunk_offset;
+			object_offsets_size = chunk_size;
+			break;
+
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			if (chunk_size % MIDX_LARGE_OFFSET_WIDTH) {
+				error("multi-pack-index large offsets are of the wrong size");
+				goto cleanup_fail;
+			}
+			m->chunk_large_offsets = data + chunk_offset;
+			m->num_large_offsets = chunk_size / MIDX_LARGE_OFFSET_WIDTH;
+			break;
+
+		default:
+			/* unknown chunks are ignored for forward compatibility */
+			break;
+		}
+	}
+
+	if (!m->chunk_pack_names || !m->chunk_oid_fanout ||
+	    !m->chunk_oid_lookup || !m->chunk_object_offsets) {
+		error("multi-pack-index %s is missing a required chunk", midx_name);
+		goto cleanup_fail;
+	}
+
+	for (i = 1; i < 256; i++) {
+		if (get_be32(m->chunk_oid_fanout + 4 * (i - 1)) >
+		    get_be32(m->chunk_oid_fanout + 4 * i)) {
+			error("multi-pack-index OID fanout is out of order");
+			goto cleanup_fail;
+		}
+	}
+	m->num_objects = get_be32(m->chunk_oid_fanout + 4 * 255);
+	if (oid_lookup_size != (uint64_t)MIDX_OID_LEN * m->num_objects ||
+	    object_offsets_size != (uint64_t)MIDX_OFFSET_WIDTH * m->num_objects) {
+		error("multi-pack-index chunks do not match the number of objects");
+		goto cleanup_fail;
+	}
+
+	m->pack_names = xcalloc(m->num_packs, sizeof(*m->pack_names));
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+
+	cur_name = (const char *)m->chunk_pack_names;
+	for (i = 0; i < m->num_packs; i++) {
+		const char *end = (const char *)m->chunk_pack_names +
+				  m->chunk_pack_names_len;
+
+		if (cur_name >= end || !memchr(cur_name, '\0', end - cur_name)) {
+			error("multi-pack-index pack names are truncated");
+			goto cleanup_fail;
+		}
+		m->pack_names[i] = cur_name;
+		if (i && strcmp(m->pack_names[i - 1], cur_name) >= 0) {
+			error("multi-pack-index pack names out of order: '%s' before '%s'",
+			      m->pack_names[i - 1], cur_name);
+			goto cleanup_fail;
+		}
+		cur_name += strlen(cur_name) + 1;
+	}
+
+	free(midx_name);
+	return m;
+
+cleanup_fail:
+	free(midx_name);
+	close_midx(m);
+	return NULL;
+}
+
+static int midx_pack_pos(struct multi_pack_index *m, const char *idx_name)
+{
+	uint32_t lo = 0, hi = m->num_packs;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = strcmp(idx_name, m->pack_names[mi]);
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
+
+void prepare_multi_pack_index_one(const char *object_dir)
+{
+	struct multi_pack_index *m;
+	struct packed_git *p;
+	struct strbuf pack_dir = STRBUF_INIT;
+	struct strbuf idx_name = STRBUF_INIT;
+	uint32_t i;
+
+	if (!core_multi_pack_index)
+		return;
+	for (m = multi_pack_index; m; m = m->next)
+		if (!strcmp(m->object_dir, object_dir))
+			return;
+
+	m = load_multi_pack_index(object_dir);
+	if (!m)
+		return;
+
+	strbuf_addf(&pack_dir, "%s/pack/", object_dir);
+	for (p = packed_git; p; p = p->next) {
+		const char *base;
+		size_t len;
+		int pos;
+
+		if (strncmp(p->pack_name, pack_dir.buf, pack_dir.len))
+			continue;
+		base = p->pack_name + pack_dir.len;
+		if (strchr(base, '/') || !strip_suffix(base, ".pack", &len))
+			continue;
+		strbuf_reset(&idx_name);
+		strbuf_add(&idx_name, base, len);
+		strbuf_addstr(&idx_name, ".idx");
+		pos = midx_pack_pos(m, idx_name.buf);
+		if (pos >= 0)
+			m->packs[pos] = p;
+	}
+	strbuf_release(&pack_dir);
+	strbuf_release(&idx_name);
+
+	/*
+	 * A pack that vanished may have held the only copy the index
+	 * points at for some object; do not trust a stale index.
+	 */
+	for (i = 0; i < m->num_packs; i++) {
+		if (!m->packs[i]) {
+			close_midx(m);
+			return;
+		}
+	}
+	for (i = 0; i < m->num_packs; i++)
+		m->packs[i]->multi_pack_index = 1;
+
+	m->next = multi_pack_index;
+	multi_pack_index = m;
+}
+
+void midx_forget_pack(struct packed_git *p)
+{
+	struct multi_pack_index **mp = &multi_pack_index;
+
+	if (!p->multi_pack_index)
+		return;
+	while (*mp) {
+		struct multi_pack_index *m = *mp;
+		uint32_t i;
+
+		for (i = 0; i < m->num_packs; i++)
+			if (m->packs[i] == p)
+				break;
+		if (i == m->num_packs) {
+			mp = &m->next;
+			continue;
+		}
+		m->packs[i] = NULL;
+		*mp = m->next;
+		m->next = NULL;
+		for (i = 0; i < m->num_packs; i++)
+			if (m->packs[i])
+				m->packs[i]->multi_pack_index = 0;
+	}
+	p->multi_pack_index = 0;
+}
+
+int bsearch_midx(const unsigned char *sha1, struct multi_pack_index *m,
+		 uint32_t *result)
+{
+	uint32_t lo, hi;
+
+	hi = get_be32(m->chunk_oid_fanout + 4 * sha1[0]);
+	lo = sha1[0] ? get_be32(m->chunk_oid_fanout + 4 * (sha1[0] - 1)) : 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, m->chunk_oid_lookup + MIDX_OID_LEN * mi);
+		if (!cmp) {
+			*result = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+const unsigned char *nth_midxed_object_sha1(struct multi_pack_index *m,
+					    uint32_t pos)
+{
+	if (pos >= m->num_objects)
+		return NULL;
+	return m->chunk_oid_lookup + MIDX_OID_LEN * pos;
+}
+
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+{
+	return get_be32(m->chunk_object_offsets + MIDX_OFFSET_WIDTH * pos);
+}
+
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+{
+	const unsigned char *offset_data;
+	uint32_t offset32;
+
+	offset_data = m->chunk_object_offsets + MIDX_OFFSET_WIDTH * pos;
+	offset32 = get_be32(offset_data + 4);
+
+	if (m->chunk_large_offsets && offset32 & MIDX_LARGE_OFFSET_NEEDED) {
+		if (sizeof(off_t) < sizeof(uint64_t))
+			die(_("multi-pack-index stores a 64-bit offset, but off_t is too small"));
+
+		offset32 ^= MIDX_LARGE_OFFSET_NEEDED;
+		if (offset32 >= m->num_large_offsets)
+			die(_("multi-pack-index large offset %u out of range"),
+			    offset32);
+		return get_be64(m->chunk_large_offsets +
+				MIDX_LARGE_OFFSET_WIDTH * offset32);
+	}
+
+	return offset32;
+}
+
+const unsigned char *get_midx_checksum(struct multi_pack_index *m)
+{
+	return m->data + m->data_len - MIDX_OID_LEN;
+}
+
+struct midx_pack_order_entry {
+	uint32_t pack_int_id;
+	off_t offset;
+	uint32_t pos;
+};
+
+static int midx_pack_order_compare(const void *a_, const void *b_)
+{
+	const struct midx_pack_order_entry *a = a_, *b = b_;
+
+	if (a->pack_int_id != b->pack_int_id)
+		return a->pack_int_id < b->pack_int_id ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+uint32_t *midx_pack_order(struct multi_pack_index *m)
+{
+	struct midx_pack_order_entry *entries;
+	uint32_t *order, i;
+
+	entries = xmalloc(m->num_objects * sizeof(*entries));
+	for (i = 0; i < m->num_objects; i++) {
+		entries[i].pack_int_id = nth_midxed_pack_int_id(m, i);
+		entries[i].offset = nth_midxed_offset(m, i);
+		entries[i].pos = i;
+	}
+	qsort(entries, m->num_objects, sizeof(*entries), midx_pack_order_compare);
+
+	order = xmalloc(m->num_objects * sizeof(*order));
+	for (i = 0; i < m->num_objects; i++)
+		order[i] = entries[i].pos;
+	free(entries);
+	return order;
+}
+
+int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e,
+		    struct multi_pack_index *m)
+{
+	struct packed_git *p;
+	uint32_t pos, pack_int_id;
+
+	if (!bsearch_midx(sha1, m, &pos))
+		return 0;
+
+	pack_int_id = nth_midxed_pack_int_id(m, pos);
+	if (pack_int_id >= m->num_packs)
+		die(_("bad pack-int-id: %u (%u total packs)"),
+		    pack_int_id, m->num_packs);
+	p = m->packs[pack_int_id];
+
+	if (p->num_bad_objects) {
+		uint32_t i;
+		for (i = 0; i < p->num_bad_objects; i++)
+			if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+				return -1;
+	}
+
+	/*
+	 * As in fill_pack_entry(), make sure the packfile is still
+	 * accessible before handing out a location in it.
+	 */
+	if (!is_pack_valid(p))
+		return -1;
+
+	e->offset = nth_midxed_offset(m, pos);
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
+struct pack_info {
+	char *pack_name; /* "pack-<sha1>.idx" */
+	struct packed_git *p; /* NULL if the entries come from the old index */
+	uint32_t orig_pack_int_id;
+	time_t mtime;
+};
+
+struct pack_midx_entry {
+	unsigned char sha1[20];
+	uint32_t pack_int_id;
+	time_t pack_mtime;
+	off_t offset;
+};
+
+static int pack_info_compare(const void *a_, const void *b_)
+{
+	const struct pack_info *a = a_, *b = b_;
+	return strcmp(a->pack_name, b->pack_name);
+}
+
+static int midx_entry_compare(const void *a_, const void *b_)
+{
+	const struct pack_midx_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+
+	/* like sort_pack(), prefer the copy in the younger pack */
+	if (a->pack_mtime > b->pack_mtime)
+		return -1;
+	else if (a->pack_mtime < b->pack_mtime)
+		return 1;
+
+	return a->pack_int_id - b->pack_int_id;
+}
+
+static void add_pack_to_midx(const char *pack_dir, const char *idx_name,
+			     struct multi_pack_index *old,
+			     struct pack_info **packs, uint32_t *nr,
+			     uint32_t *alloc)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct pack_info *info;
+	struct stat st;
+	size_t base_len;
+	int old_pos = old ? midx_pack_pos(old, idx_name) : -1;
+
+	strbuf_addf(&path, "%s/%s", pack_dir, idx_name);
+	base_len = path.len - strlen(".idx");
+
+	ALLOC_GROW(*packs, *nr + 1, *alloc);
+	info = &(*packs)[*nr];
+	memset(info, 0, sizeof(*info));
+
+	if (old_pos >= 0) {
+		strbuf_setlen(&path, base_len);
+		strbuf_addstr(&path, ".pack");
+		if (stat(path.buf, &st))
+			goto cleanup;
+		info->orig_pack_int_id = old_pos;
+		info->mtime = st.st_mtime;
+	} else {
+		info->p = add_packed_git(path.buf, path.len, 1);
+		if (!info->p)
+			goto cleanup;
+		if (open_pack_index(info->p)) {
+			warning(_("failed to open pack-index '%s'"), path.buf);
+			close_pack_index(info->p);
+			free(info->p);
+			info->p = NULL;
+			goto cleanup;
+		}
+		info->mtime = info->p->mtime;
+	}
+	info->pack_name = xstrdup(idx_name);
+	(*nr)++;
+
+cleanup:
+	strbuf_release(&path);
+}
+
+static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *old,
+						  struct pack_info *packs,
+						  uint32_t nr_packs,
+						  uint32_t *nr_objects)
+{
+	struct pack_midx_entry *entries;
+	uint32_t *old_to_new = NULL;
+	uint32_t i, j, total = 0, alloc = 0;
+
+	if (old) {
+		old_to_new = xmalloc(old->num_packs * sizeof(*old_to_new));
+		for (i = 0; i < old->num_packs; i++)
+			old_to_new[i] = nr_packs;
+	}
+	for (i = 0; i < nr_packs; i++) {
+		if (packs[i].p)
+			alloc += packs[i].p->num_objects;
+		else
+			old_to_new[packs[i].orig_pack_int_id] = i;
+	}
+	if (old)
+		alloc += old->num_objects;
+	entries = xmalloc(alloc * sizeof(*entries) + 1);
+
+	if (old) {
+		for (i = 0; i < old->num_objects; i++) {
+			uint32_t new_id = old_to_new[nth_midxed_pack_int_id(old, i)];
+			struct pack_midx_entry *e;
+
+			/* the pack is gone */
+			if (new_id == nr_packs)
+				continue;
+			e = &entries[total++];
+			hashcpy(e->sha1, old->chunk_oid_lookup + MIDX_OID_LEN * i);
+			e->pack_int_id = new_id;
+			e->pack_mtime = packs[new_id].mtime;
+			e->offset = nth_midxed_offset(old, i);
+		}
+	}
+
+	for (i = 0; i < nr_packs; i++) {
+		struct packed_git *p = packs[i].p;
+
+		if (!p)
+			continue;
+		for (j = 0; j < p->num_objects; j++) {
+			struct pack_midx_entry *e = &entries[total++];
+			hashcpy(e->sha1, nth_packed_object_sha1(p, j));
+			e->pack_int_id = i;
+			e->pack_mtime = p->mtime;
+			e->offset = nth_packed_object_offset(p, j);
+		}
+	}
+
+	qsort(entries, total, sizeof(*entries), midx_entry_compare);
+
+	/* drop duplicates, keeping the preferred copy sorted first */
+	for (i = j = 0; i < total; i++) {
+		if (j && !hashcmp(entries[j - 1].sha1, entries[i].sha1))
+			continue;
+		entries[j++] = entries[i];
+	}
+
+	free(old_to_new);
+	*nr_objects = j;
+	return entries;
+}
+
+static void write_midx_pack_names(struct sha1file *f, struct pack_info *packs,
+				  uint32_t nr_packs, size_t padded_len)
+{
+	static const unsigned char padding[4];
+	size_t written = 0;
+	uint32_t i;
+
+	for (i = 0; i < nr_packs; i++) {
+		size_t len = strlen(packs[i].pack_name) + 1;
+		sha1write(f, packs[i].pack_name, len);
+		written += len;
+	}
+	sha1write(f, padding, padded_len - written);
+}
+
+static void write_midx_oid_fanout(struct sha1file *f,
+				  struct pack_midx_entry *entries,
+				  uint32_t nr_objects)
+{
+	uint32_t i, count = 0;
+
+	for (i = 0; i < 256; i++) {
+		uint32_t n;
+
+		while (count < nr_objects && entries[count].sha1[0] <= i)
+			count++;
+		n = htonl(count);
+		sha1write(f, &n, 4);
+	}
+}
+
+static uint32_t write_midx_object_offsets(struct sha1file *f,
+					  struct pack_midx_entry *entries,
+					  uint32_t nr_objects)
+{
+	uint32_t i, nr_large_offset = 0;
+
+	for (i = 0; i < nr_objects; i++) {
+		uint32_t data[2];
+
+		data[0] = htonl(entries[i].pack_int_id);
+		if ((uint64_t)entries[i].offset > 0x7fffffff)
+			data[1] = htonl(MIDX_LARGE_OFFSET_NEEDED | nr_large_offset++);
+		else
+			data[1] = htonl((uint32_t)entries[i].offset);
+		sha1write(f, data, sizeof(data));
+	}
+	return nr_large_offset;
+}
+
+static void write_midx_large_offsets(struct sha1file *f,
+				     struct pack_midx_entry *entries,
+				     uint32_t nr_objects)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_objects; i++) {
+		uint64_t offset = entries[i].offset;
+		uint32_t data[2];
+
+		if (offset <= 0x7fffffff)
+			continue;
+		data[0] = htonl((uint32_t)(offset >> 32));
+		data[1] = htonl((uint32_t)offset);
+		sha1write(f, data, sizeof(data));
+	}
+}
+
+static void write_chunk_lookup_row(struct sha1file *f, uint32_t id,
+				   uint64_t offset)
+{
+	uint32_t row[3];
+
+	row[0] = htonl(id);
+	row[1] = htonl((uint32_t)(offset >> 32));
+	row[2] = htonl((uint32_t)offset);
+	sha1write(f, row, sizeof(row));
+}
+
+char *get_midx_bitmap_filename(struct multi_pack_index *m)
+{
+	return xstrfmt("%s/pack/multi-pack-index-%s.bitmap", m->object_dir,
+		       sha1_to_hex(get_midx_checksum(m)));
+}
+
+/* Remove the bitmaps of other multi-pack indexes than "keep". */
+static void remove_stale_midx_bitmaps(const char *pack_dir, const char *keep)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(pack_dir);
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (!starts_with(de->d_name, "multi-pack-index-") ||
+		    !ends_with(de->d_name, ".bitmap"))
+			continue;
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", pack_dir, de->d_name);
+		if (keep && !strcmp(path.buf, keep))
+			continue;
+		if (unlink(path.buf))
+			warning(_("unable to remove stale bitmap %s: %s"),
+				path.buf, strerror(errno));
+	}
+	closedir(dir);
+	strbuf_release(&path);
+}
+
+int write_midx_file(const char *object_dir, unsigned flags)
+{
+	static struct lock_file lk;
+	struct multi_pack_index *old, *m;
+	struct pack_info *packs = NULL;
+	struct pack_midx_entry *entries;
+	uint32_t nr_packs = 0, alloc_packs = 0, nr_objects, nr_large_offset = 0;
+	uint32_t chunk_ids[6];
+	uint64_t chunk_offsets[6];
+	unsigned char header[MIDX_HEADER_SIZE];
+	struct sha1file *f;
+	struct strbuf pack_dir = STRBUF_INIT;
+	size_t pack_name_len = 0;
+	char *midx_name, *bitmap_name;
+	struct dirent *de;
+	DIR *dir;
+	uint32_t i;
+	int num_chunks, ret = 0;
+
+	old = load_multi_pack_index(object_dir);
+
+	strbuf_addf(&pack_dir, "%s/pack", object_dir);
+	dir = opendir(pack_dir.buf);
+	if (!dir)
+		die_errno(_("unable to open pack directory: %s"), pack_dir.buf);
+	while ((de = readdir(dir)) != NULL) {
+		if (!ends_with(de->d_name, ".idx"))
+			continue;
+		add_pack_to_midx(pack_dir.buf, de->d_name, old,
+				 &packs, &nr_packs, &alloc_packs);
+	}
+	closedir(dir);
+
+	/*
+	 * Pack names are stored sorted; entries taken from the old index
+	 * still refer to it through orig_pack_int_id.
+	 */
+	qsort(packs, nr_packs, sizeof(*packs), pack_info_compare);
+
+	entries = get_sorted_entries(old, packs, nr_packs, &nr_objects);
+
+	for (i = 0; i < nr_packs; i++)
+		pack_name_len += strlen(packs[i].pack_name) + 1;
+	pack_name_len = (pack_name_len + 3) & ~3;
+
+	for (i = 0; i < nr_objects; i++)
+		if ((uint64_t)entries[i].offset > 0x7fffffff)
+			nr_large_offset++;
+
+	num_chunks = nr_large_offset ? 5 : 4;
+
+	chunk_ids[0] = MIDX_CHUNKID_PACKNAMES;
+	chunk_ids[1] = MIDX_CHUNKID_OIDFANOUT;
+	chunk_ids[2] = MIDX_CHUNKID_OIDLOOKUP;
+	chunk_ids[3] = MIDX_CHUNKID_OBJECTOFFSETS;
+	chunk_ids[4] = nr_large_offset ? MIDX_CHUNKID_LARGEOFFSETS : 0;
+	chunk_ids[5] = 0;
+
+	chunk_offsets[0] = MIDX_HEADER_SIZE + (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + pack_name_len;
+	chunk_offsets[2] = chunk_offsets[1] + MIDX_FANOUT_SIZE;
+	chunk_offsets[3] = chunk_offsets[2] + (uint64_t)MIDX_OID_LEN * nr_objects;
+	chunk_offsets[4] = chunk_offsets[3] + (uint64_t)MIDX_OFFSET_WIDTH * nr_objects;
+	chunk_offsets[5] = chunk_offsets[4] + (uint64_t)MIDX_LARGE_OFFSET_WIDTH * nr_large_offset;
+
+	midx_name = get_midx_filename(object_dir);
+	hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(lk.fd, lk.filename);
+
+	put_be32(header, MIDX_SIGNATURE);
+	header[4] = MIDX_VERSION;
+	header[5] = MIDX_OID_VERSION;
+	header[6] = num_chunks;
+	header[7] = 0; /* number of base multi-pack-index files */
+	put_be32(header + 8, nr_packs);
+	sha1write(f, header, sizeof(header));
+
+	for (i = 0; i <= num_chunks; i++)
+		write_chunk_lookup_row(f, chunk_ids[i], chunk_offsets[i]);
+
+	write_midx_pack_names(f, packs, nr_packs, pack_name_len);
+	write_midx_oid_fanout(f, entries, nr_objects);
+	for (i = 0; i < nr_objects; i++)
+		sha1write(f, entries[i].sha1, MIDX_OID_LEN);
+	write_midx_object_offsets(f, entries, nr_objects);
+	if (nr_large_offset)
+		write_midx_large_offsets(f, entries, nr_objects);
+
+	close_midx(old);
+	sha1close(f, NULL, CSUM_FSYNC);
+	lk.fd = -1;
+	if (commit_lock_file(&lk))
+		die_errno(_("unable to write multi-pack-index %s"), midx_name);
+
+	/* the bitmap is named after the checksum of the index it goes with */
+	m = load_multi_pack_index(object_dir);
+	if (!m)
+		die(_("unable to read back multi-pack-index %s"), midx_name);
+	bitmap_name = get_midx_bitmap_filename(m);
+	if ((flags & MIDX_WRITE_BITMAP) && write_midx_bitmap(m, bitmap_name))
+		ret = error(_("unable to write multi-pack-index bitmap %s"),
+			    bitmap_name);
+	remove_stale_midx_bitmaps(pack_dir.buf, bitmap_name);
+	free(bitmap_name);
+	close_midx(m);
+
+	for (i = 0; i < nr_packs; i++) {
+		if (packs[i].p) {
+			close_pack_index(packs[i].p);
+			free(packs[i].p);
+		}
+		free(packs[i].pack_name);
+	}
+	free(packs);
+	free(entries);
+	free(midx_name);
+	strbuf_release(&pack_dir);
+	return ret;
+}
+
+static int midx_report(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vreportf("error: ", fmt, ap);
+	va_end(ap);
+	return 1;
+}
+
+int verify_midx_file(const char *object_dir)
+{
+	struct multi_pack_index *m;
+	struct packed_git **packs;
+	char *midx_name;
+	git_SHA_CTX ctx;
+	unsigned char checksum[20];
+	uint32_t i;
+	int errors = 0;
+
+	midx_name = get_midx_filename(object_dir);
+	m = load_multi_pack_index(object_dir);
+	if (!m) {
+		if (!access(midx_name, F_OK))
+			errors = midx_report("unable to load multi-pack-index %s",
+					     midx_name);
+		free(midx_name);
+		return errors;
+	}
+	free(midx_name);
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, m->data, m->data_len - MIDX_OID_LEN);
+	git_SHA1_Final(checksum, &ctx);
+	if (hashcmp(checksum, m->data + m->data_len - MIDX_OID_LEN))
+		errors += midx_report("incorrect checksum in multi-pack-index");
+
+	packs = xcalloc(m->num_packs, sizeof(*packs));
+	for (i = 0; i < m->num_packs; i++) {
+		struct strbuf path = STRBUF_INIT;
+
+		strbuf_addf(&path, "%s/pack/%s", object_dir, m->pack_names[i]);
+		packs[i] = add_packed_git(path.buf, path.len, 1);
+		if (!packs[i] || open_pack_index(packs[i]))
+			errors += midx_report("failed to load pack '%s' in multi-pack-index",
+					      m->pack_names[i]);
+		strbuf_release(&path);
+	}
+
+	for (i = 0; i < 255; i++) {
+		if (get_be32(m->chunk_oid_fanout + 4 * i) >
+		    get_be32(m->chunk_oid_fanout + 4 * (i + 1)))
+			errors += midx_report("oid fanout out of order: fanout[%d] > fanout[%d]",
+					      i, i + 1);
+	}
+
+	for (i = 0; i < m->num_objects; i++) {
+		const unsigned char *sha1 = m->chunk_oid_lookup + MIDX_OID_LEN * i;
+		uint32_t pack_int_id = nth_midxed_pack_int_id(m, i);
+		off_t m_offset, p_offset;
+
+		if (i && hashcmp(sha1 - MIDX_OID_LEN, sha1) >= 0)
+			errors += midx_report("oid lookup out of order: %s before %s",
+					      sha1_to_hex(sha1 - MIDX_OID_LEN),
+					      sha1_to_hex(sha1));
+
+		if (pack_int_id >= m->num_packs) {
+			errors += midx_report("bad pack-int-id %u for %s",
+					      pack_int_id, sha1_to_hex(sha1));
+			continue;
+		}
+		if (!packs[pack_int_id] || !packs[pack_int_id]->index_data)
+			continue;
+
+		m_offset = nth_midxed_offset(m, i);
+		p_offset = find_pack_entry_one(sha1, packs[pack_int_id]);
+		if (m_offset != p_offset)
+			errors += midx_report("incorrect object offset for %s: %"PRIuMAX" != %"PRIuMAX,
+					      sha1_to_hex(sha1),
+					      (uintmax_t)m_offset, (uintmax_t)p_offset);
+	}
+
+	for (i = 0; i < m->num_packs; i++) {
+		if (!packs[i])
+			continue;
+		close_pack_index(packs[i]);
+		free(packs[i]);
+	}
+	free(packs);
+	close_midx(m);
+	return errors;
+}
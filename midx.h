@@ -0,0 +1,128 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+/*
+ * A multi-pack index ("$GIT_OBJECT_DIRECTORY/pack/multi-pack-index")
+ * maps every object in a set of packfiles to the pack holding it and
+ * its offset in that pack, so that an object can be located with a
+ * single binary search instead of one search per pack.
+ *
+ * See Documentation/technical/multi-pack-index.txt for the layout.
+ */
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_OID_VERSION 1 /* SHA-1 */
+#define MIDX_OID_LEN 20
+
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+struct pack_entry;
+
+struct multi_pack_index {
+	struct multi_pack_index *next;
+
+	const unsigned char *data;
+	size_t data_len;
+
+	unsigned char num_chunks;
+	uint32_t num_packs;
+	uint32_t num_objects;
+
+	const unsigned char *chunk_pack_names;
+	size_t chunk_pack_names_len;
+	const unsigned char *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_object_offsets;
+	const unsigned char *chunk_large_offsets;
+	uint32_t num_large_offsets;
+
+	/* pack basenames ("pack-<sha1>.idx"), sorted */
+	const char **pack_names;
+	/* the packed_git for each pack name, once installed */
+	struct packed_git **packs;
+
+	char object_dir[FLEX_ARRAY];
+};
+
+/* The multi-pack indexes of all object directories in use. */
+extern struct multi_pack_index *multi_pack_index;
+
+/* Return the path of the multi-pack index in "object_dir"; free() it. */
+extern char *get_midx_filename(const char *object_dir);
+
+/* Map and validate the multi-pack index of "object_dir", or NULL. */
+extern struct multi_pack_index *load_multi_pack_index(const char *object_dir);
+extern void close_midx(struct multi_pack_index *m);
+
+/*
+ * Load the multi-pack index of "object_dir" (once) and associate it
+ * with the packs of that directory found in the packed_git list.
+ * Packs covered by the index get their "multi_pack_index" bit set so
+ * that find_pack_entry() does not probe them one by one. If a pack
+ * named by the index has disappeared, the index is not used.
+ */
+extern void prepare_multi_pack_index_one(const char *object_dir);
+
+/*
+ * "p" is about to be freed: stop using the multi-pack index covering
+ * it, and probe its other packs one by one again. The index is not
+ * freed, since a bitmap may still refer to it, but its pointer to "p"
+ * is cleared.
+ */
+extern void midx_forget_pack(struct packed_git *p);
+
+/*
+ * Look "sha1" up in "m"; on success fill in "e" and return 1.
+ */
+extern int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e,
+			   struct multi_pack_index *m);
+
+/*
+ * Find the position of "sha1" in the sorted list of objects of "m";
+ * returns 0 if it is not there.
+ */
+extern int bsearch_midx(const unsigned char *sha1, struct multi_pack_index *m,
+			uint32_t *pos);
+
+/* The object at position "pos" of "m", or NULL if out of range. */
+extern const unsigned char *nth_midxed_object_sha1(struct multi_pack_index *m,
+						   uint32_t pos);
+extern uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos);
+extern off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
+
+/* The trailing checksum of "m", which names its bitmap. */
+extern const unsigned char *get_midx_checksum(struct multi_pack_index *m);
+
+/*
+ * Return the positions of the objects of "m" in "pack order": sorted
+ * by pack (in the order of the pack names), then by offset, as if the
+ * packs were concatenated. This is the order of the bits of a
+ * multi-pack bitmap. The array has m->num_objects entries; free() it.
+ */
+extern uint32_t *midx_pack_order(struct multi_pack_index *m);
+
+/* Also write a reachability bitmap over the objects of the index. */
+#define MIDX_WRITE_BITMAP (1 << 0)
+
+/*
+ * Write a multi-pack index covering all packs in "object_dir". Entries
+ * of packs covered by an existing index are reused from it, so that
+ * only the indexes of new packs have to be read. Bitmaps of previous
+ * indexes are removed.
+ */
+extern int write_midx_file(const char *object_dir, unsigned flags);
+
+/* Return the path of the bitmap of "m"; free() it. */
+extern char *get_midx_bitmap_filename(struct multi_pack_index *m);
+
+/* Check the multi-pack index of "object_dir"; returns the number of errors. */
+extern int verify_midx_file(const char *object_dir);
+
+#endif
@@ -29,10 +29,12 @@ struct object_array {
 /*
  * object flag allocation:
  * revision.h:      0---------10                                26
- * fetch-pack.c:    0---4
+ * fetch-pack.c:    0
+ * negotiator/:      1--4
  * walker.c:        0-2
  * upload-pack.c:               11----------------19
  * builtin/blame.c:               12-13
+ * commit-graph.c:                      15
  * bisect.c:                               16
  * bundle.c:                               16
  * http-push.c:                            16-----19
@@ -10,6 +10,7 @@
 #include "pack-bitmap.h"
 #include "sha1-lookup.h"
 #include "pack-objects.h"
+#include "midx.h"
 
 struct bitmapped_commit {
 	struct commit *commit;
@@ -550,3 +551,123 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	if (rename(tmp_file, filename))
 		die_errno("unable to rename temporary bitmap file to '%s'", filename);
 }
+
+struct midx_bitmap_data {
+	struct packing_data *to_pack;
+	struct commit **commits;
+	unsigned int commits_nr, commits_alloc;
+	int missing;
+};
+
+static struct object_entry *midx_bitmap_entry(struct midx_bitmap_data *data,
+					      struct object *object)
+{
+	struct object_entry *entry;
+
+	entry = packlist_find(data->to_pack, object->sha1, NULL);
+	if (!entry) {
+		if (!data->missing)
+			error("object %s is not in the multi-pack-index",
+			      sha1_to_hex(object->sha1));
+		data->missing = 1;
+		return NULL;
+	}
+	entry->type = object->type;
+	return entry;
+}
+
+static void midx_bitmap_show_commit(struct commit *commit, void *_data)
+{
+	struct midx_bitmap_data *data = _data;
+
+	if (!midx_bitmap_entry(data, &commit->object))
+		return;
+	ALLOC_GROW(data->commits, data->commits_nr + 1, data->commits_alloc);
+	data->commits[data->commits_nr++] = commit;
+}
+
+static void midx_bitmap_show_object(struct object *object,
+				    const struct name_path *path,
+				    const char *last, void *_data)
+{
+	struct object_entry *entry = midx_bitmap_entry(_data, object);
+	char *name;
+
+	if (!entry)
+		return;
+	name = path_name(path, last);
+	entry->hash = pack_name_hash(name);
+	free(name);
+}
+
+/**
+ * Write a bitmap over all the objects of the multi-pack index "m".
+ * Bits follow the pack order of "m" (see midx_pack_order()), while
+ * commit positions and the name-hash cache use the position of the
+ * objects in "m". Every object reachable from the refs must be in "m".
+ */
+int write_midx_bitmap(struct multi_pack_index *m, const char *filename)
+{
+	const char *argv[] = { NULL, "--all", NULL };
+	struct packing_data to_pack;
+	struct midx_bitmap_data data;
+	struct pack_idx_entry **index;
+	struct rev_info revs;
+	unsigned char checksum[20];
+	uint32_t *order, i;
+
+	memset(&to_pack, 0, sizeof(to_pack));
+	for (i = 0; i < m->num_objects; i++) {
+		const unsigned char *sha1 = nth_midxed_object_sha1(m, i);
+		uint32_t index_pos;
+
+		if (packlist_find(&to_pack, sha1, &index_pos))
+			die("BUG: duplicate object %s in multi-pack-index",
+			    sha1_to_hex(sha1));
+		packlist_alloc(&to_pack, sha1, index_pos);
+	}
+
+	memset(&data, 0, sizeof(data));
+	data.to_pack = &to_pack;
+
+	init_revisions(&revs, NULL);
+	setup_revisions(2, argv, &revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+	if (prepare_revision_walk(&revs))
+		die("revision walk setup failed");
+	traverse_commit_list(&revs, midx_bitmap_show_commit,
+			     midx_bitmap_show_object, &data);
+
+	if (data.missing) {
+		free(data.commits);
+		free(to_pack.objects);
+		free(to_pack.index);
+		return -1;
+	}
+
+	/* packlist_alloc() appends, so objects[i] is at midx position i */
+	index = xmalloc(m->num_objects * sizeof(*index));
+	order = midx_pack_order(m);
+	for (i = 0; i < m->num_objects; i++)
+		index[i] = &to_pack.objects[order[i]].idx;
+
+	hashcpy(checksum, get_midx_checksum(m));
+	bitmap_writer_set_checksum(checksum);
+	bitmap_writer_build_type_index(index, m->num_objects);
+	bitmap_writer_select_commits(data.commits, data.commits_nr, -1);
+	bitmap_writer_build(&to_pack);
+
+	for (i = 0; i < m->num_objects; i++)
+		index[i] = &to_pack.objects[i].idx;
+	bitmap_writer_finish(index, m->num_objects, filename,
+			     BITMAP_OPT_HASH_CACHE);
+
+	free(order);
+	free(index);
+	free(data.commits);
+	free(to_pack.objects);
+	free(to_pack.index);
+	return 0;
+}
@@ -9,6 +9,7 @@
 #include "pack-bitmap.h"
 #include "pack-revindex.h"
 #include "pack-objects.h"
+#include "midx.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -28,6 +29,9 @@ struct stored_bitmap {
  *
  * If there is more than one bitmap index available (e.g. because of alternates),
  * the active bitmap index is the largest one.
+ *
+ * A multi-pack index may carry a bitmap instead, covering the objects of
+ * all of its packs; it is preferred over the bitmap of a single pack.
  */
 static struct bitmap_index {
 	/* Packfile to which this bitmap index belongs to */
@@ -36,6 +40,16 @@ static struct bitmap_index {
 	/* reverse index for the packfile */
 	struct pack_revindex *reverse_index;
 
+	/*
+	 * Multi-pack index to which this bitmap index belongs to, if any
+	 * (in which case `pack` is NULL). The bits follow the "pack order"
+	 * of its objects: `midx_order` maps bit positions to positions in
+	 * the multi-pack index, and `midx_bit_pos` is its inverse.
+	 */
+	struct multi_pack_index *midx;
+	uint32_t *midx_order;
+	uint32_t *midx_bit_pos;
+
 	/*
 	 * Mark the first `reuse_objects` in the packfile as reused:
 	 * they will be sent as-is without using them for repacking
@@ -86,6 +100,9 @@ static struct bitmap_index {
 	/* Bitmap result of the last performed walk */
 	struct bitmap *result;
 
+	/* Objects excluded by the "have" side of the last walk, if any */
+	struct bitmap *haves;
+
 	/* Version of the bitmap index */
 	unsigned int version;
 
@@ -93,6 +110,46 @@ static struct bitmap_index {
 
 } bitmap_git;
 
+static uint32_t bitmap_num_objects(void)
+{
+	if (bitmap_git.midx)
+		return bitmap_git.midx->num_objects;
+	return bitmap_git.pack->num_objects;
+}
+
+/*
+ * Return the name of the object at bit position "pos". Its position in
+ * the (pack or multi-pack) index, which is also its position in the
+ * name-hash cache, and the pack and offset holding it are stored in
+ * "index_pos", "pack" and "offset".
+ */
+static const unsigned char *nth_bitmap_object(uint32_t pos,
+					      uint32_t *index_pos,
+					      struct packed_git **pack,
+					      off_t *offset)
+{
+	if (bitmap_git.midx) {
+		struct multi_pack_index *m = bitmap_git.midx;
+		uint32_t midx_pos = bitmap_git.midx_order[pos];
+
+		*index_pos = midx_pos;
+		*pack = m->packs[nth_midxed_pack_int_id(m, midx_pos)];
+		if (!*pack)
+			die("pack of bitmapped object %s has gone away",
+			    sha1_to_hex(nth_midxed_object_sha1(m, midx_pos)));
+		*offset = nth_midxed_offset(m, midx_pos);
+		return nth_midxed_object_sha1(m, midx_pos);
+	} else {
+		struct revindex_entry *entry;
+
+		entry = &bitmap_git.reverse_index->revindex[pos];
+		*index_pos = entry->nr;
+		*pack = bitmap_git.pack;
+		*offset = entry->offset;
+		return nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+	}
+}
+
 static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 {
 	struct ewah_bitmap *parent;
@@ -158,7 +215,7 @@ static int load_bitmap_header(struct bitmap_index *index)
 
 		if (flags & BITMAP_OPT_HASH_CACHE) {
 			unsigned char *end = index->map + index->map_size - 20;
-			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
+			index->hashes = ((uint32_t *)end) - bitmap_num_objects();
 		}
 	}
 
@@ -218,7 +275,13 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		index->map_pos += sizeof(struct bitmap_disk_entry);
 
 		commit_idx_pos = ntohl(entry->object_pos);
-		sha1 = nth_packed_object_sha1(index->pack, commit_idx_pos);
+		if (index->midx)
+			sha1 = nth_midxed_object_sha1(index->midx, commit_idx_pos);
+		else
+			sha1 = nth_packed_object_sha1(index->pack, commit_idx_pos);
+		if (!sha1)
+			return error("Corrupted bitmap index (commit %u out of range)",
+				     commit_idx_pos);
 
 		xor_offset = (int)entry->xor_offset;
 		flags = (int)entry->flags;
@@ -265,7 +328,7 @@ static int open_pack_bitmap_1(struct packed_git *packfile)
 		return -1;
 	}
 
-	if (bitmap_git.pack) {
+	if (bitmap_git.pack || bitmap_git.midx) {
 		warning("ignoring extra bitmap file: %s", packfile->pack_name);
 		close(fd);
 		return -1;
@@ -287,13 +350,72 @@ static int open_pack_bitmap_1(struct packed_git *packfile)
 	return 0;
 }
 
+static int open_midx_bitmap_1(struct multi_pack_index *m)
+{
+	int fd;
+	struct stat st;
+	char *bitmap_name;
+	struct bitmap_disk_header *header;
+
+	bitmap_name = get_midx_bitmap_filename(m);
+	fd = git_open_noatime(bitmap_name);
+
+	if (fd < 0) {
+		free(bitmap_name);
+		return -1;
+	}
+
+	if (fstat(fd, &st)) {
+		free(bitmap_name);
+		close(fd);
+		return -1;
+	}
+
+	bitmap_git.midx = m;
+	bitmap_git.map_size = xsize_t(st.st_size);
+	bitmap_git.map = xmmap(NULL, bitmap_git.map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	bitmap_git.map_pos = 0;
+	close(fd);
+
+	if (load_bitmap_header(&bitmap_git) < 0)
+		goto failed;
+
+	header = (struct bitmap_disk_header *)bitmap_git.map;
+	if (hashcmp(header->checksum, get_midx_checksum(m))) {
+		error("bitmap %s does not match its multi-pack-index", bitmap_name);
+		goto failed;
+	}
+
+	free(bitmap_name);
+	return 0;
+
+failed:
+	munmap(bitmap_git.map, bitmap_git.map_size);
+	bitmap_git.map = NULL;
+	bitmap_git.map_size = 0;
+	bitmap_git.hashes = NULL;
+	bitmap_git.midx = NULL;
+	free(bitmap_name);
+	return -1;
+}
+
 static int load_pack_bitmap(void)
 {
+	uint64_t start = getnanotime();
+
 	assert(bitmap_git.map && !bitmap_git.loaded);
 
 	bitmap_git.bitmaps = kh_init_sha1();
 	bitmap_git.ext_index.positions = kh_init_sha1_pos();
-	bitmap_git.reverse_index = revindex_for_pack(bitmap_git.pack);
+	if (bitmap_git.midx) {
+		uint32_t i, nr = bitmap_git.midx->num_objects;
+
+		bitmap_git.midx_order = midx_pack_order(bitmap_git.midx);
+		bitmap_git.midx_bit_pos = xmalloc(nr * sizeof(uint32_t));
+		for (i = 0; i < nr; i++)
+			bitmap_git.midx_bit_pos[bitmap_git.midx_order[i]] = i;
+	} else
+		bitmap_git.reverse_index = revindex_for_pack(bitmap_git.pack);
 
 	if (!(bitmap_git.commits = read_bitmap_1(&bitmap_git)) ||
 		!(bitmap_git.trees = read_bitmap_1(&bitmap_git)) ||
@@ -305,6 +427,8 @@ static int load_pack_bitmap(void)
 		goto failed;
 
 	bitmap_git.loaded = 1;
+	trace_performance_since(start, "load bitmap index (%u bitmaps)",
+				bitmap_git.entry_count);
 	return 0;
 
 failed:
@@ -330,12 +454,18 @@ char *pack_bitmap_filename(struct packed_git *p)
 
 static int open_pack_bitmap(void)
 {
+	struct multi_pack_index *m;
 	struct packed_git *p;
 	int ret = -1;
 
 	assert(!bitmap_git.map && !bitmap_git.loaded);
 
 	prepare_packed_git();
+	for (m = multi_pack_index; m; m = m->next) {
+		if (open_midx_bitmap_1(m) == 0)
+			return 0;
+	}
+
 	for (p = packed_git; p; p = p->next) {
 		if (open_pack_bitmap_1(p) == 0)
 			ret = 0;
@@ -367,7 +497,7 @@ static inline int bitmap_position_extended(const unsigned char *sha1)
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_git.pack->num_objects;
+		return bitmap_pos + bitmap_num_objects();
 	}
 
 	return -1;
@@ -375,7 +505,17 @@ static inline int bitmap_position_extended(const unsigned char *sha1)
 
 static inline int bitmap_position_packfile(const unsigned char *sha1)
 {
-	off_t offset = find_pack_entry_one(sha1, bitmap_git.pack);
+	off_t offset;
+
+	if (bitmap_git.midx) {
+		uint32_t pos;
+
+		if (!bsearch_midx(sha1, bitmap_git.midx, &pos))
+			return -1;
+		return bitmap_git.midx_bit_pos[pos];
+	}
+
+	offset = find_pack_entry_one(sha1, bitmap_git.pack);
 	if (!offset)
 		return -1;
 
@@ -415,7 +555,7 @@ static int ext_index_add_object(struct object *object, const char *name)
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_git.pack->num_objects;
+	return bitmap_pos + bitmap_num_objects();
 }
 
 static void show_object(struct object *object, const struct name_path *path,
@@ -590,7 +730,7 @@ static void show_extended_objects(struct bitmap *objects,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, bitmap_git.pack->num_objects + i))
+		if (!bitmap_get(objects, bitmap_num_objects() + i))
 			continue;
 
 		obj = eindex->objects[i];
@@ -610,7 +750,7 @@ static void show_objects_for_type(
 	struct ewah_iterator it;
 	eword_t filter;
 
-	if (bitmap_git.reuse_objects == bitmap_git.pack->num_objects)
+	if (bitmap_git.reuse_objects == bitmap_num_objects())
 		return;
 
 	ewah_iterator_init(&it, type_filter);
@@ -620,8 +760,9 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_WORD; ++offset) {
 			const unsigned char *sha1;
-			struct revindex_entry *entry;
-			uint32_t hash = 0;
+			struct packed_git *pack;
+			uint32_t index_pos, hash = 0;
+			off_t pack_offset;
 
 			if ((word >> offset) == 0)
 				break;
@@ -631,13 +772,13 @@ static void show_objects_for_type(
 			if (pos + offset < bitmap_git.reuse_objects)
 				continue;
 
-			entry = &bitmap_git.reverse_index->revindex[pos + offset];
-			sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+			sha1 = nth_bitmap_object(pos + offset, &index_pos,
+						 &pack, &pack_offset);
 
 			if (bitmap_git.hashes)
-				hash = ntohl(bitmap_git.hashes[entry->nr]);
+				hash = ntohl(bitmap_git.hashes[index_pos]);
 
-			show_reach(sha1, object_type, 0, hash, bitmap_git.pack, entry->offset);
+			show_reach(sha1, object_type, 0, hash, pack, pack_offset);
 		}
 
 		pos += BITS_IN_WORD;
@@ -651,7 +792,11 @@ static int in_bitmapped_pack(struct object_list *roots)
 		struct object *object = roots->item;
 		roots = roots->next;
 
-		if (find_pack_entry_one(object->sha1, bitmap_git.pack) > 0)
+		if (bitmap_git.midx) {
+			uint32_t pos;
+			if (bsearch_midx(object->sha1, bitmap_git.midx, &pos))
+				return 1;
+		} else if (find_pack_entry_one(object->sha1, bitmap_git.pack) > 0)
 			return 1;
 	}
 
@@ -746,10 +891,25 @@ int prepare_bitmap_walk(struct rev_info *revs)
 
 	bitmap_git.result = wants_bitmap;
 
-	bitmap_free(haves_bitmap);
+	bitmap_free(bitmap_git.haves);
+	bitmap_git.haves = haves_bitmap;
 	return 0;
 }
 
+int bitmap_has_sha1_in_uninteresting(const unsigned char *sha1)
+{
+	int pos;
+
+	if (!bitmap_git.loaded || !bitmap_git.haves)
+		return 0;
+
+	pos = bitmap_position(sha1);
+	if (pos < 0)
+		return 0;
+
+	return bitmap_get(bitmap_git.haves, pos);
+}
+
 int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
 				       uint32_t *entries,
 				       off_t *up_to)
@@ -766,6 +926,10 @@ int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
 
 	assert(result);
 
+	/* the objects of a multi-pack bitmap are spread over several packs */
+	if (bitmap_git.midx)
+		return -1;
+
 	for (i = 0; i < result->word_alloc; ++i) {
 		if (result->words[i] != (eword_t)~0) {
 			reuse_objects += ewah_bit_ctz64(~result->words[i]);
@@ -830,6 +994,22 @@ void traverse_bitmap_commit_list(show_reachable_fn show_reachable)
 	bitmap_git.result = NULL;
 }
 
+static struct ewah_bitmap *type_bitmap(enum object_type type)
+{
+	switch (type) {
+	case OBJ_COMMIT:
+		return bitmap_git.commits;
+	case OBJ_TREE:
+		return bitmap_git.trees;
+	case OBJ_BLOB:
+		return bitmap_git.blobs;
+	case OBJ_TAG:
+		return bitmap_git.tags;
+	default:
+		return NULL;
+	}
+}
+
 static uint32_t count_object_type(struct bitmap *objects,
 				  enum object_type type)
 {
@@ -839,26 +1019,9 @@ static uint32_t count_object_type(struct bitmap *objects,
 	struct ewah_iterator it;
 	eword_t filter;
 
-	switch (type) {
-	case OBJ_COMMIT:
-		ewah_iterator_init(&it, bitmap_git.commits);
-		break;
-
-	case OBJ_TREE:
-		ewah_iterator_init(&it, bitmap_git.trees);
-		break;
-
-	case OBJ_BLOB:
-		ewah_iterator_init(&it, bitmap_git.blobs);
-		break;
-
-	case OBJ_TAG:
-		ewah_iterator_init(&it, bitmap_git.tags);
-		break;
-
-	default:
+	if (!type_bitmap(type))
 		return 0;
-	}
+	ewah_iterator_init(&it, type_bitmap(type));
 
 	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
 		eword_t word = objects->words[i++] & filter;
@@ -867,7 +1030,7 @@ static uint32_t count_object_type(struct bitmap *objects,
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_git.pack->num_objects + i))
+			bitmap_get(objects, bitmap_num_objects() + i))
 			count++;
 	}
 
@@ -892,6 +1055,97 @@ void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees,
 		*tags = count_object_type(bitmap_git.result, OBJ_TAG);
 }
 
+/*
+ * The size taken on disk by the object at bit position "pos": the
+ * distance to the next object in its pack.
+ */
+static off_t bitmap_object_disk_size(uint32_t pos)
+{
+	struct revindex_entry *entry;
+
+	if (bitmap_git.midx) {
+		const unsigned char *sha1;
+		struct packed_git *pack;
+		uint32_t index_pos;
+		off_t offset;
+
+		sha1 = nth_bitmap_object(pos, &index_pos, &pack, &offset);
+		/* packs covered by the midx may not have their .idx loaded */
+		if (open_pack_index(pack))
+			die("cannot open index of %s", pack->pack_name);
+		entry = find_pack_revindex(pack, offset);
+		if (!entry)
+			die("object %s not found at its offset in %s",
+			    sha1_to_hex(sha1), pack->pack_name);
+	} else
+		entry = &bitmap_git.reverse_index->revindex[pos];
+
+	return entry[1].offset - entry->offset;
+}
+
+static off_t disk_usage_for_type(struct bitmap *objects,
+				 enum object_type type)
+{
+	struct eindex *eindex = &bitmap_git.ext_index;
+	struct ewah_iterator it;
+	eword_t filter;
+	size_t i = 0;
+	off_t total = 0;
+
+	ewah_iterator_init(&it, type_bitmap(type));
+
+	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
+		eword_t word = objects->words[i] & filter;
+		size_t base = i * BITS_IN_WORD;
+		uint32_t offset;
+
+		for (offset = 0; offset < BITS_IN_WORD; offset++) {
+			if ((word >> offset) == 0)
+				break;
+
+			offset += ewah_bit_ctz64(word >> offset);
+			total += bitmap_object_disk_size(base + offset);
+		}
+		i++;
+	}
+
+	for (i = 0; i < eindex->count; i++) {
+		struct object *obj = eindex->objects[i];
+		struct object_info oi = {NULL};
+		unsigned long size;
+
+		if (obj->type != type ||
+		    !bitmap_get(objects, bitmap_num_objects() + i))
+			continue;
+
+		oi.disk_sizep = &size;
+		if (sha1_object_info_extended(obj->sha1, &oi, 0) < 0)
+			die("unable to get disk usage of %s",
+			    sha1_to_hex(obj->sha1));
+		total += size;
+	}
+
+	return total;
+}
+
+off_t get_disk_usage_from_bitmap(struct rev_info *revs)
+{
+	struct bitmap *result = bitmap_git.result;
+	off_t total;
+
+	assert(result);
+
+	total = disk_usage_for_type(result, OBJ_COMMIT);
+	if (revs->tree_objects)
+		total += disk_usage_for_type(result, OBJ_TREE);
+	if (revs->blob_objects)
+		total += disk_usage_for_type(result, OBJ_BLOB);
+	if (revs->tag_objects)
+		total += disk_usage_for_type(result, OBJ_TAG);
+
+	return total;
+}
+
 struct bitmap_test_data {
 	struct bitmap *base;
 	struct progress *prg;
@@ -1029,16 +1283,17 @@ int rebuild_existing_bitmaps(struct packing_data *mapping,
 	if (prepare_bitmap_git() < 0)
 		return -1;
 
-	num_objects = bitmap_git.pack->num_objects;
+	num_objects = bitmap_num_objects();
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
 		const unsigned char *sha1;
-		struct revindex_entry *entry;
+		struct packed_git *pack;
 		struct object_entry *oe;
+		uint32_t index_pos;
+		off_t offset;
 
-		entry = &bitmap_git.reverse_index->revindex[i];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+		sha1 = nth_bitmap_object(i, &index_pos, &pack, &offset);
 		oe = packlist_find(mapping, sha1, NULL);
 
 		if (oe)
@@ -42,10 +42,12 @@ typedef int (*show_reachable_fn)(
 
 int prepare_bitmap_git(void);
 void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees, uint32_t *blobs, uint32_t *tags);
+off_t get_disk_usage_from_bitmap(struct rev_info *revs);
 void traverse_bitmap_commit_list(show_reachable_fn show_reachable);
 void test_bitmap_walk(struct rev_info *revs);
 char *pack_bitmap_filename(struct packed_git *p);
 int prepare_bitmap_walk(struct rev_info *revs);
+int bitmap_has_sha1_in_uninteresting(const unsigned char *sha1);
 int reuse_partial_packfile_from_bitmap(struct packed_git **packfile, uint32_t *entries, off_t *up_to);
 int rebuild_existing_bitmaps(struct packing_data *mapping, khash_sha1 *reused_bitmaps, int show_progress);
 
@@ -61,4 +63,7 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 			  const char *filename,
 			  uint16_t options);
 
+struct multi_pack_index;
+int write_midx_bitmap(struct multi_pack_index *m, const char *filename);
+
 #endif
@@ -0,0 +1,426 @@
+#include "cache.h"
+#include "parallel-checkout.h"
+#include "thread-utils.h"
+
+static struct trace_key trace_parallel_checkout = TRACE_KEY_INIT(PARALLEL_CHECKOUT);
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	PC_ITEM_COLLIDED,
+	PC_ITEM_REWRITTEN,
+	PC_ITEM_READ_FAILED,
+	PC_ITEM_CREATE_FAILED,
+	PC_ITEM_WRITE_FAILED
+};
+
+struct parallel_checkout_item {
+	struct cache_entry *ce;
+	char *path;
+	struct conv_attrs ca;
+	enum pc_item_status status;
+	int saved_errno;
+	unsigned have_st:1;
+	struct stat st;
+};
+
+static struct parallel_checkout {
+	int active;
+	struct parallel_checkout_item *items;
+	int nr, alloc;
+	int next; /* the next item to be picked up by a worker */
+} parallel_checkout;
+
+/*
+ * "checkout.workers" is read on demand, as unpack_trees() is called
+ * by commands that do not read the configuration themselves.
+ */
+static int checkout_workers = 1;
+
+static int parallel_checkout_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "checkout.workers")) {
+		checkout_workers = git_config_int(var, value);
+		if (checkout_workers < 0)
+			die("invalid number of checkout workers (%d)",
+			    checkout_workers);
+#ifdef NO_PTHREADS
+		if (checkout_workers != 1)
+			warning("no threads support, ignoring %s", var);
+#endif
+	}
+	return 0;
+}
+
+static int get_checkout_workers(void)
+{
+	static int loaded;
+
+	if (!loaded) {
+		git_config(parallel_checkout_config, NULL);
+		loaded = 1;
+	}
+#ifdef NO_PTHREADS
+	return 1;
+#else
+	if (!checkout_workers)	/* 0 means one per processor */
+		return online_cpus();
+	return checkout_workers;
+#endif
+}
+
+void init_parallel_checkout(void)
+{
+	if (parallel_checkout.active)
+		die("BUG: parallel checkout already initialized");
+	if (get_checkout_workers() > 1)
+		parallel_checkout.active = 1;
+}
+
+int enqueue_checkout(struct cache_entry *ce, const char *path)
+{
+	struct parallel_checkout_item *pc_item;
+	struct conv_attrs ca;
+	unsigned long size;
+
+	if (!parallel_checkout.active)
+		return -1;
+	/* the attributes cannot be looked up from the workers */
+	convert_attrs(&ca, ce->name);
+	if (ca.drv)
+		return -1;
+	/* large blobs are streamed to the file, rather than read whole */
+	if (sha1_object_info(ce->sha1, &size) != OBJ_BLOB ||
+	    size > big_file_threshold)
+		return -1;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+	pc_item = &parallel_checkout.items[parallel_checkout.nr++];
+	memset(pc_item, 0, sizeof(*pc_item));
+	pc_item->ce = ce;
+	pc_item->path = xstrdup(path);
+	pc_item->ca = ca;
+	return 0;
+}
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t read_mutex;
+#define read_lock()		pthread_mutex_lock(&read_mutex)
+#define read_unlock()		pthread_mutex_unlock(&read_mutex)
+
+static pthread_mutex_t queue_mutex;
+#define queue_lock()		pthread_mutex_lock(&queue_mutex)
+#define queue_unlock()		pthread_mutex_unlock(&queue_mutex)
+
+static void try_to_free_from_threads(size_t size)
+{
+	read_lock();
+	release_pack_memory(size);
+	read_unlock();
+}
+#else
+#define read_lock()		(void)0
+#define read_unlock()		(void)0
+#define queue_lock()		(void)0
+#define queue_unlock()		(void)0
+#endif
+
+/*
+ * Read the blob of ce. Only finding the object and copying its
+ * deflated data needs the lock; a delta is read whole under it.
+ */
+static void *read_pc_item_blob(struct cache_entry *ce,
+			       enum object_type *type, unsigned long *size)
+{
+	struct deflated_object obj;
+	void *new = NULL;
+	int ret;
+
+	read_lock();
+	ret = read_sha1_deflated(ce->sha1, &obj);
+	read_unlock();
+	if (!ret)
+		new = inflate_sha1_deflated(ce->sha1, &obj, type, size);
+	if (!new) {
+		read_lock();
+		new = read_sha1_file(ce->sha1, type, size);
+		read_unlock();
+	}
+	return new;
+}
+
+/*
+ * Write one queued entry. Only the object store needs the lock: the
+ * inflation, the conversion and the file system work happen in
+ * parallel. Each worker keeps its own lstat() cache in "dirs".
+ */
+static void write_pc_item(struct parallel_checkout_item *pc_item,
+			  const struct checkout *state,
+			  struct cache_def *dirs)
+{
+	struct cache_entry *ce = pc_item->ce;
+	struct strbuf buf = STRBUF_INIT;
+	enum object_type type;
+	unsigned long size;
+	size_t newsize;
+	void *new;
+	const char *slash;
+	int fd, mode;
+
+	/*
+	 * The leading directories were created when the entry was
+	 * queued, but an entry checked out later may have replaced one
+	 * of them, e.g. with a symlink on a case insensitive file
+	 * system. Leave such an entry to the final serial pass.
+	 */
+	slash = strrchr(pc_item->path, '/');
+	if (slash && !threaded_has_dirs_only_path(dirs, pc_item->path,
+						  slash - pc_item->path,
+						  state->base_dir_len)) {
+		pc_item->status = PC_ITEM_COLLIDED;
+		return;
+	}
+
+	new = read_pc_item_blob(ce, &type, &size);
+	if (!new || type != OBJ_BLOB) {
+		free(new);
+		pc_item->status = PC_ITEM_READ_FAILED;
+		return;
+	}
+
+	if (convert_to_working_tree_ca(&pc_item->ca, ce->name,
+				       new, size, &buf)) {
+		free(new);
+		new = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+
+	/*
+	 * Whatever was in the way has been removed already, so if the
+	 * file exists now, another entry of this checkout wrote it.
+	 */
+	mode = (ce->ce_mode & 0100) ? 0777 : 0666;
+	fd = open(pc_item->path, O_WRONLY | O_CREAT | O_EXCL, mode);
+	if (fd < 0) {
+		pc_item->saved_errno = errno;
+		pc_item->status = errno == EEXIST ?
+			PC_ITEM_COLLIDED : PC_ITEM_CREATE_FAILED;
+		free(new);
+		return;
+	}
+
+	if (write_in_full(fd, new, size) != size)
+		pc_item->status = PC_ITEM_WRITE_FAILED;
+	else
+		pc_item->status = PC_ITEM_WRITTEN;
+	/* use fstat() only when path == ce->name */
+	if (fstat_is_reliable() &&
+	    state->refresh_cache && !state->base_dir_len &&
+	    !fstat(fd, &pc_item->st))
+		pc_item->have_st = 1;
+	close(fd);
+	free(new);
+}
+
+static void *pc_worker(void *data)
+{
+	const struct checkout *state = data;
+	struct cache_def dirs = CACHE_DEF_INIT;
+
+	for (;;) {
+		struct parallel_checkout_item *pc_item = NULL;
+
+		queue_lock();
+		if (parallel_checkout.next < parallel_checkout.nr)
+			pc_item = &parallel_checkout.items[parallel_checkout.next++];
+		queue_unlock();
+		if (!pc_item)
+			break;
+		write_pc_item(pc_item, state, &dirs);
+	}
+	cache_def_clear(&dirs);
+	return NULL;
+}
+
+static void write_items(const struct checkout *state, int nr_workers)
+{
+#ifndef NO_PTHREADS
+	pthread_t *workers;
+	try_to_free_t old_try_to_free_routine;
+	int i, ret;
+
+	if (nr_workers > 1) {
+		init_recursive_mutex(&read_mutex);
+		pthread_mutex_init(&queue_mutex, NULL);
+		old_try_to_free_routine =
+			set_try_to_free_routine(try_to_free_from_threads);
+
+		workers = xcalloc(nr_workers, sizeof(*workers));
+		for (i = 0; i < nr_workers; i++) {
+			ret = pthread_create(&workers[i], NULL,
+					     pc_worker, (void *)state);
+			if (ret)
+				die("unable to create checkout thread: %s",
+				    strerror(ret));
+		}
+		for (i = 0; i < nr_workers; i++)
+			pthread_join(workers[i], NULL);
+		free(workers);
+
+		set_try_to_free_routine(old_try_to_free_routine);
+		pthread_mutex_destroy(&queue_mutex);
+		pthread_mutex_destroy(&read_mutex);
+		return;
+	}
+#endif
+	pc_worker((void *)state);
+}
+
+static int finish_pc_item(struct parallel_checkout_item *pc_item,
+			  const struct checkout *state)
+{
+	struct cache_entry *ce = pc_item->ce;
+
+	switch (pc_item->status) {
+	case PC_ITEM_WRITTEN:
+		break;
+	case PC_ITEM_REWRITTEN:
+		/* by rewrite_collided(), which reported any error */
+		return 0;
+	case PC_ITEM_READ_FAILED:
+		return error("unable to read sha1 file of %s (%s)",
+			     pc_item->path, sha1_to_hex(ce->sha1));
+	case PC_ITEM_CREATE_FAILED:
+		return error("unable to create file %s (%s)",
+			     pc_item->path, strerror(pc_item->saved_errno));
+	case PC_ITEM_WRITE_FAILED:
+		return error("unable to write file %s", pc_item->path);
+	default:
+		die("BUG: parallel checkout item %s was not written",
+		    pc_item->path);
+	}
+
+	if (state->refresh_cache) {
+		assert(state->istate);
+		if (!pc_item->have_st)
+			lstat(ce->name, &pc_item->st);
+		fill_stat_cache_info(ce, &pc_item->st);
+		ce->ce_flags |= CE_UPDATE_IN_BASE;
+		state->istate->cache_changed |= CE_ENTRY_CHANGED;
+	}
+	return 0;
+}
+
+static int same_file(const struct stat *st, const struct stat *files, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (st->st_ino == files[i].st_ino && st->st_dev == files[i].st_dev)
+			return 1;
+	return 0;
+}
+
+/*
+ * Entries collided with one another (e.g. "A" and "a" on a case
+ * insensitive file system), but which of them got to create the
+ * file first depended on the workers.  Check out every entry of
+ * this checkout (those with CE_UPDATE) that ended up as one of the
+ * collided files, including those that were written right away, in
+ * index order, so that the last one wins as in a serial checkout.
+ */
+static int rewrite_collided(const struct checkout *state, int collided)
+{
+	struct index_state *istate = state->istate;
+	struct parallel_checkout_item *pc_item = parallel_checkout.items;
+	struct parallel_checkout_item *end = pc_item + parallel_checkout.nr;
+	struct strbuf path = STRBUF_INIT;
+	struct stat *files;
+	struct cache_entry **group = NULL;
+	int i, nr_files = 0, nr_group = 0, alloc_group = 0, errs = 0;
+
+	files = xcalloc(collided, sizeof(*files));
+	for (i = 0; i < parallel_checkout.nr; i++)
+		if (pc_item[i].status == PC_ITEM_COLLIDED &&
+		    !lstat(pc_item[i].path, &files[nr_files]))
+			nr_files++;
+
+	/* find the whole group before writing changes the inodes */
+	strbuf_add(&path, state->base_dir, state->base_dir_len);
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct parallel_checkout_item *item = NULL;
+		struct stat st;
+
+		if (!(ce->ce_flags & CE_UPDATE))
+			continue;
+		/* the queued items are in index order, too */
+		if (pc_item < end && pc_item->ce == ce)
+			item = pc_item++;
+		if (item && item->status == PC_ITEM_COLLIDED) {
+			item->status = PC_ITEM_REWRITTEN;
+		} else if (item && item->status != PC_ITEM_WRITTEN) {
+			continue;
+		} else if (item && item->have_st) {
+			if (!same_file(&item->st, files, nr_files))
+				continue;
+			item->status = PC_ITEM_REWRITTEN;
+		} else {
+			strbuf_setlen(&path, state->base_dir_len);
+			strbuf_addstr(&path, ce->name);
+			if (lstat(path.buf, &st) ||
+			    !same_file(&st, files, nr_files))
+				continue;
+			if (item)
+				item->status = PC_ITEM_REWRITTEN;
+		}
+		ALLOC_GROW(group, nr_group + 1, alloc_group);
+		group[nr_group++] = ce;
+	}
+
+	/* parallel checkout is over: this writes them right away */
+	for (i = 0; i < nr_group; i++)
+		errs |= checkout_entry(group[i], state, NULL);
+
+	strbuf_release(&path);
+	free(group);
+	free(files);
+	return errs;
+}
+
+int run_parallel_checkout(const struct checkout *state)
+{
+	int i, errs = 0, collided = 0, nr_workers;
+
+	if (!parallel_checkout.active)
+		return 0;
+	parallel_checkout.active = 0;
+
+	nr_workers = get_checkout_workers();
+	if (nr_workers > parallel_checkout.nr)
+		nr_workers = parallel_checkout.nr;
+	parallel_checkout.next = 0;
+	write_items(state, nr_workers);
+
+	for (i = 0; i < parallel_checkout.nr; i++)
+		if (parallel_checkout.items[i].status == PC_ITEM_COLLIDED)
+			collided++;
+	if (collided)
+		errs |= rewrite_collided(state, collided);
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+		errs |= finish_pc_item(pc_item, state);
+		free(pc_item->path);
+	}
+	trace_printf_key(&trace_parallel_checkout,
+			 "parallel checkout: %d entries, %d workers, %d collided\n",
+			 parallel_checkout.nr, nr_workers, collided);
+
+	free(parallel_checkout.items);
+	parallel_checkout.items = NULL;
+	parallel_checkout.nr = parallel_checkout.alloc = 0;
+	return errs;
+}
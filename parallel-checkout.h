@@ -0,0 +1,39 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+/*
+ * Parallel checkout writes the regular files of a checkout with
+ * several threads ("checkout.workers"). checkout_entry() still does,
+ * in order, everything that depends on the other entries (removing
+ * what is in the way, creating the leading directories), and only
+ * hands the writing of the file over to enqueue_checkout(). The
+ * queued entries are written by run_parallel_checkout().
+ */
+
+struct cache_entry;
+struct checkout;
+
+/* Start queueing entries, if more than one worker is configured. */
+extern void init_parallel_checkout(void);
+
+/*
+ * Queue ce to be written to path later. Returns -1 if it has to be
+ * written right away instead: parallel checkout is not active, the
+ * entry needs an external filter, or its blob is larger than
+ * core.bigFileThreshold and is better streamed.
+ */
+extern int enqueue_checkout(struct cache_entry *ce, const char *path);
+
+/*
+ * Write the queued entries and stop queueing. When entries collided
+ * with one another (e.g. "A" and "a" on a case insensitive file
+ * system), every entry of the checkout that ended up as one of the
+ * collided files, the one that won included, is then checked out
+ * again one by one, in index order, so that the last one wins as in
+ * a serial checkout. Entries still to be checked out must have
+ * CE_UPDATE set in state->istate. Returns non-zero if any entry
+ * failed; the errors have been reported.
+ */
+extern int run_parallel_checkout(const struct checkout *state);
+
+#endif
@@ -57,27 +57,46 @@ void packet_flush(int fd)
 	write_or_die(fd, "0000", 4);
 }
 
+void packet_delim(int fd)
+{
+	packet_trace("0001", 4, 1);
+	write_or_die(fd, "0001", 4);
+}
+
 void packet_buf_flush(struct strbuf *buf)
 {
 	packet_trace("0000", 4, 1);
 	strbuf_add(buf, "0000", 4);
 }
 
+void packet_buf_delim(struct strbuf *buf)
+{
+	packet_trace("0001", 4, 1);
+	strbuf_add(buf, "0001", 4);
+}
+
 #define hex(a) (hexchar[(a) & 15])
+void set_packet_header(char *buf, int size)
+{
+	static char hexchar[] = "0123456789abcdef";
+
+	buf[0] = hex(size >> 12);
+	buf[1] = hex(size >> 8);
+	buf[2] = hex(size >> 4);
+	buf[3] = hex(size);
+}
+#undef hex
+
 static char buffer[1000];
 static unsigned format_packet(const char *fmt, va_list args)
 {
-	static char hexchar[] = "0123456789abcdef";
 	unsigned n;
 
 	n = vsnprintf(buffer + 4, sizeof(buffer) - 4, fmt, args);
 	if (n >= sizeof(buffer)-4)
 		die("protocol error: impossibly long line");
 	n += 4;
-	buffer[0] = hex(n >> 12);
-	buffer[1] = hex(n >> 8);
-	buffer[2] = hex(n >> 4);
-	buffer[3] = hex(n);
+	set_packet_header(buffer, n);
 	packet_trace(buffer+4, n-4, 1);
 	return n;
 }
@@ -160,28 +179,42 @@ static int packet_length(const char *linelen)
 	return len;
 }
 
-int packet_read(int fd, char **src_buf, size_t *src_len,
-		char *buffer, unsigned size, int options)
+enum packet_read_status packet_read_with_status(int fd, char **src_buf,
+						size_t *src_len, char *buffer,
+						unsigned size, int *pktlen,
+						int options)
 {
 	int len, ret;
 	char linelen[4];
 
 	ret = get_packet_data(fd, src_buf, src_len, linelen, 4, options);
-	if (ret < 0)
-		return ret;
+	if (ret < 0) {
+		*pktlen = -1;
+		return PACKET_READ_EOF;
+	}
 	len = packet_length(linelen);
 	if (len < 0)
 		die("protocol error: bad line length character: %.4s", linelen);
 	if (!len) {
 		packet_trace("0000", 4, 0);
-		return 0;
+		*pktlen = 0;
+		return PACKET_READ_FLUSH;
 	}
+	if (len == 1) {
+		packet_trace("0001", 4, 0);
+		*pktlen = 0;
+		return PACKET_READ_DELIM;
+	}
+	if (len < 4)
+		die("protocol error: bad line length %d", len);
 	len -= 4;
 	if (len >= size)
 		die("protocol error: bad line length %d", len);
 	ret = get_packet_data(fd, src_buf, src_len, buffer, len, options);
-	if (ret < 0)
-		return ret;
+	if (ret < 0) {
+		*pktlen = -1;
+		return PACKET_READ_EOF;
+	}
 
 	if ((options & PACKET_READ_CHOMP_NEWLINE) &&
 	    len && buffer[len-1] == '\n')
@@ -189,7 +222,18 @@ int packet_read(int fd, char **src_buf, size_t *src_len,
 
 	buffer[len] = 0;
 	packet_trace(buffer, len, 0);
-	return len;
+	*pktlen = len;
+	return PACKET_READ_NORMAL;
+}
+
+int packet_read(int fd, char **src_buf, size_t *src_len,
+		char *buffer, unsigned size, int options)
+{
+	int pktlen;
+
+	packet_read_with_status(fd, src_buf, src_len, buffer, size,
+				&pktlen, options);
+	return pktlen;
 }
 
 static char *packet_read_line_generic(int fd,
@@ -213,3 +257,46 @@ char *packet_read_line_buf(char **src, size_t *src_len, int *dst_len)
 {
 	return packet_read_line_generic(-1, src, src_len, dst_len);
 }
+
+void packet_reader_init(struct packet_reader *reader, int fd,
+			char *src_buffer, size_t src_len, int options)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->fd = fd;
+	reader->src_buffer = src_buffer;
+	reader->src_len = src_len;
+	reader->buffer = packet_buffer;
+	reader->buffer_size = sizeof(packet_buffer);
+	reader->options = options;
+}
+
+enum packet_read_status packet_reader_read(struct packet_reader *reader)
+{
+	char **src = reader->src_buffer ? &reader->src_buffer : NULL;
+
+	if (reader->line_peeked) {
+		reader->line_peeked = 0;
+		return reader->status;
+	}
+
+	reader->status = packet_read_with_status(reader->fd, src,
+						 &reader->src_len,
+						 reader->buffer,
+						 reader->buffer_size,
+						 &reader->pktlen,
+						 reader->options);
+	if (reader->status == PACKET_READ_NORMAL)
+		reader->line = reader->buffer;
+	else
+		reader->line = NULL;
+	return reader->status;
+}
+
+enum packet_read_status packet_reader_peek(struct packet_reader *reader)
+{
+	if (!reader->line_peeked) {
+		packet_reader_read(reader);
+		reader->line_peeked = 1;
+	}
+	return reader->status;
+}
@@ -7,8 +7,9 @@
 /*
  * Write a packetized stream, where each line is preceded by
  * its length (including the header) as a 4-byte hex number.
- * A length of 'zero' means end of stream (and a length of 1-3
- * would be an error).
+ * A length of 'zero' means end of stream, a length of 1 is a
+ * delimiter between sections of a protocol v2 message (and a
+ * length of 2-3 would be an error).
  *
  * This is all pretty stupid, but we use this packetized line
  * format to make a streaming format possible without ever
@@ -20,9 +21,13 @@
  * side can't, we stay with pure read/write interfaces.
  */
 void packet_flush(int fd);
+void packet_delim(int fd);
 void packet_write(int fd, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
 void packet_buf_flush(struct strbuf *buf);
+void packet_buf_delim(struct strbuf *buf);
 void packet_buf_write(struct strbuf *buf, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
+/* Write the 4-byte length header for a packet of "size" bytes to "buf". */
+void set_packet_header(char *buf, int size);
 
 /*
  * Read a packetized line into the buffer, which must be at least size bytes
@@ -60,6 +65,52 @@ void packet_buf_write(struct strbuf *buf, const char *fmt, ...) __attribute__((f
 int packet_read(int fd, char **src_buffer, size_t *src_len, char
 		*buffer, unsigned size, int options);
 
+/*
+ * Like packet_read, but tells the caller what kind of packet was read
+ * instead of folding them all into a length.  A flush packet ("0000")
+ * ends a message; a delimiter packet ("0001") separates sections
+ * within one, as used by protocol v2.  The length of a normal packet
+ * is stored in *pktlen.  Plain packet_read() treats a delimiter like
+ * a flush.
+ */
+enum packet_read_status {
+	PACKET_READ_EOF,
+	PACKET_READ_NORMAL,
+	PACKET_READ_FLUSH,
+	PACKET_READ_DELIM
+};
+enum packet_read_status packet_read_with_status(int fd, char **src_buffer,
+						size_t *src_len, char *buffer,
+						unsigned size, int *pktlen,
+						int options);
+
+/*
+ * A packet_reader reads packets from a descriptor or buffer one at a
+ * time and allows peeking at the next one without consuming it, which
+ * is what a parser needs to find out which section or protocol
+ * version it is looking at.  The contents of the packet are in
+ * reader->line (NULL for flush and delimiter packets) and stay valid
+ * until the next read.
+ */
+struct packet_reader {
+	int fd;
+	char *src_buffer;
+	size_t src_len;
+	char *buffer;
+	unsigned buffer_size;
+	int options;
+
+	enum packet_read_status status;
+	int pktlen;
+	const char *line;
+	int line_peeked;
+};
+
+void packet_reader_init(struct packet_reader *reader, int fd,
+			char *src_buffer, size_t src_len, int options);
+enum packet_read_status packet_reader_read(struct packet_reader *reader);
+enum packet_read_status packet_reader_peek(struct packet_reader *reader);
+
 /*
  * Convenience wrapper for packet_read that is not gentle, and sets the
  * CHOMP_NEWLINE option. The return value is NULL for a flush packet,
@@ -4,6 +4,7 @@
 #include "cache.h"
 #include "pathspec.h"
 #include "dir.h"
+#include "fsmonitor.h"
 
 #ifdef NO_PTHREADS
 static void preload_index(struct index_state *index,
@@ -62,6 +63,8 @@ static void *preload_thread(void *_data)
 		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY))
 			continue;
 		ce_mark_uptodate(ce);
+		if (index->fsmonitor_last_update)
+			ce->ce_flags |= CE_FSMONITOR_VALID;
 	} while (--nr > 0);
 	cache_def_clear(&cache);
 	return NULL;
@@ -102,6 +105,8 @@ static void preload_index(struct index_state *index,
 			die("unable to join threaded lstat");
 	}
 	enable_fscache(0);
+	if (index->fsmonitor_last_update)
+		index->cache_changed |= FSMONITOR_CHANGED;
 }
 #endif
 
@@ -110,6 +115,7 @@ int read_index_preload(struct index_state *index,
 {
 	int retval = read_index(index);
 
+	refresh_fsmonitor(index);
 	preload_index(index, pathspec);
 	return retval;
 }
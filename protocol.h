@@ -0,0 +1,38 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+/*
+ * Version 0 is the original protocol, where the server starts by
+ * advertising every ref it has.  In version 2 the server only
+ * advertises its capabilities, and the client then issues commands
+ * ("ls-refs", "fetch"), each of which is a self-contained request.
+ */
+enum protocol_version {
+	protocol_unknown_version = -1,
+	protocol_v0 = 0,
+	protocol_v2 = 2
+};
+
+/*
+ * The client asks for a protocol version through this variable in
+ * the environment of the server process (file:// and ssh), through
+ * an extra parameter in the git:// request, or through the
+ * "Git-Protocol" header over http.  Its value is a colon-separated
+ * list of "key=value" pairs, e.g. "version=2".
+ */
+#define GIT_PROTOCOL_ENVIRONMENT "GIT_PROTOCOL"
+#define GIT_PROTOCOL_HEADER "Git-Protocol"
+
+/*
+ * The version the client should ask for, from "protocol.version";
+ * protocol_v0 if it is not set.
+ */
+extern enum protocol_version get_protocol_version_config(void);
+
+/*
+ * The highest version the client asked for in GIT_PROTOCOL, or
+ * protocol_v0 if it did not ask.
+ */
+extern enum protocol_version determine_protocol_version_server(void);
+
+#endif /* PROTOCOL_H */
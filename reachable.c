@@ -63,6 +63,9 @@ static void process_tree(struct tree *tree,
 		return;
 	obj->flags |= SEEN;
 	update_progress(cp);
+	/* a partial clone may lack it, and fetch it when it is needed */
+	if (is_promisor_object(obj->sha1) && !has_sha1_file(obj->sha1))
+		return;
 	if (parse_tree(tree) < 0)
 		die("bad tree object %s", sha1_to_hex(obj->sha1));
 	add_object(obj, p, path, name);
@@ -93,6 +96,8 @@ static void process_tag(struct tag *tag, struct object_array *p,
 	obj->flags |= SEEN;
 	update_progress(cp);
 
+	if (is_promisor_object(obj->sha1) && !has_sha1_file(obj->sha1))
+		return;
 	if (parse_tag(tag) < 0)
 		die("bad tag object %s", sha1_to_hex(obj->sha1));
 	if (tag->tagged)
@@ -214,6 +219,13 @@ void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
 			    struct progress *progress)
 {
 	struct connectivity_progress cp;
+	int save_fetch_if_missing = fetch_if_missing;
+
+	/*
+	 * What a partial clone lacks is not unreachable, and finding
+	 * out what is reachable is no reason to fetch it.
+	 */
+	fetch_if_missing = 0;
 
 	/*
 	 * Set up revision parsing, and mark us as being interested
@@ -244,4 +256,5 @@ void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
 		die("revision walk setup failed");
 	walk_commit_list(revs, &cp);
 	display_progress(cp.progress, cp.count);
+	fetch_if_missing = save_fetch_if_missing;
 }
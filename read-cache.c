@@ -16,6 +16,9 @@
 #include "varint.h"
 #include "split-index.h"
 #include "sigchain.h"
+#include "fsmonitor.h"
+#include "ewah/ewok.h"
+#include "thread-utils.h"
 
 static struct cache_entry *refresh_cache_entry(struct cache_entry *ce,
 					       unsigned int options);
@@ -37,11 +40,16 @@ static struct cache_entry *refresh_cache_entry(struct cache_entry *ce,
 #define CACHE_EXT_TREE 0x54524545	/* "TREE" */
 #define CACHE_EXT_RESOLVE_UNDO 0x52455543 /* "REUC" */
 #define CACHE_EXT_LINK 0x6c696e6b	  /* "link" */
+#define CACHE_EXT_FSMONITOR 0x46534d4e	  /* "FSMN" */
+#define CACHE_EXT_UNTRACKED 0x554E5452	  /* "UNTR" */
+#define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
+#define CACHE_EXT_INDEXENTRY_OFFSETS 0x49454F54	/* "IEOT" */
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
 		 CE_ENTRY_ADDED | CE_ENTRY_REMOVED | CE_ENTRY_CHANGED | \
-		 SPLIT_INDEX_ORDERED)
+		 SPLIT_INDEX_ORDERED | FSMONITOR_CHANGED | \
+		 UNTRACKED_CHANGED)
 
 struct index_state the_index;
 static const char *alternate_index_output;
@@ -77,6 +85,7 @@ void rename_index_entry_at(struct index_state *istate, int nr, const char *new_n
 	memcpy(new->name, new_name, namelen + 1);
 
 	cache_tree_invalidate_path(istate, old->name);
+	untracked_cache_invalidate_path(istate, old->name);
 	remove_index_entry_at(istate, nr);
 	add_index_entry(istate, new, ADD_CACHE_OK_TO_ADD|ADD_CACHE_OK_TO_REPLACE);
 }
@@ -268,22 +277,36 @@ static int ce_match_stat_basic(const struct cache_entry *ce, struct stat *st)
 	return changed;
 }
 
-static int is_racy_timestamp(const struct index_state *istate,
-			     const struct cache_entry *ce)
+int is_racy_stat(const struct index_state *istate,
+		 const struct stat_data *sd)
 {
-	return (!S_ISGITLINK(ce->ce_mode) &&
-		istate->timestamp.sec &&
+	return (istate->timestamp.sec &&
 #ifdef USE_NSEC
 		 /* nanosecond timestamped files can also be racy! */
-		(istate->timestamp.sec < ce->ce_stat_data.sd_mtime.sec ||
-		 (istate->timestamp.sec == ce->ce_stat_data.sd_mtime.sec &&
-		  istate->timestamp.nsec <= ce->ce_stat_data.sd_mtime.nsec))
+		(istate->timestamp.sec < sd->sd_mtime.sec ||
+		 (istate->timestamp.sec == sd->sd_mtime.sec &&
+		  istate->timestamp.nsec <= sd->sd_mtime.nsec))
 #else
-		istate->timestamp.sec <= ce->ce_stat_data.sd_mtime.sec
+		istate->timestamp.sec <= sd->sd_mtime.sec
 #endif
 		 );
 }
 
+static int is_racy_timestamp(const struct index_state *istate,
+			     const struct cache_entry *ce)
+{
+	return (!S_ISGITLINK(ce->ce_mode) &&
+		is_racy_stat(istate, &ce->ce_stat_data));
+}
+
+int match_stat_data_racy(const struct index_state *istate,
+			 const struct stat_data *sd, struct stat *st)
+{
+	if (is_racy_stat(istate, sd))
+		return MTIME_CHANGED;
+	return match_stat_data(sd, st);
+}
+
 int ie_match_stat(const struct index_state *istate,
 		  const struct cache_entry *ce, struct stat *st,
 		  unsigned int options)
@@ -494,6 +517,7 @@ int remove_index_entry_at(struct index_state *istate, int pos)
 	struct cache_entry *ce = istate->cache[pos];
 
 	record_resolve_undo(istate, ce);
+	untracked_cache_invalidate_path(istate, ce->name);
 	remove_name_hash(istate, ce);
 	save_or_free_index_entry(istate, ce);
 	istate->cache_changed |= CE_ENTRY_REMOVED;
@@ -518,6 +542,8 @@ void remove_marked_cache_entries(struct index_state *istate)
 
 	for (i = j = 0; i < istate->cache_nr; i++) {
 		if (ce_array[i]->ce_flags & CE_REMOVE) {
+			untracked_cache_invalidate_path(istate,
+							ce_array[i]->name);
 			remove_name_hash(istate, ce_array[i]);
 			save_or_free_index_entry(istate, ce_array[i]);
 		}
@@ -967,6 +993,9 @@ static int add_index_entry_with_check(struct index_state *istate, struct cache_e
 	}
 	pos = -pos-1;
 
+	if (!(option & ADD_CACHE_KEEP_CACHE_TREE))
+		untracked_cache_invalidate_path(istate, ce->name);
+
 	/*
 	 * Inserting a merged entry ("stage 0") into the index
 	 * will always replace all non-merged entries..
@@ -1094,6 +1123,7 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 			 */
 			if (!S_ISGITLINK(ce->ce_mode))
 				ce_mark_uptodate(ce);
+			mark_fsmonitor_valid(istate, ce);
 			return ce;
 		}
 	}
@@ -1117,6 +1147,8 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 	if (!ignore_valid && assume_unchanged &&
 	    !(ce->ce_flags & CE_VALID))
 		updated->ce_flags &= ~CE_VALID;
+	updated->ce_flags &= ~CE_FSMONITOR_VALID;
+	mark_fsmonitor_valid(istate, updated);
 
 	/* istate->cache_changed is updated in the caller */
 	return updated;
@@ -1159,6 +1191,7 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 	typechange_fmt = (in_porcelain ? "T\t%s\n" : "%s needs update\n");
 	added_fmt = (in_porcelain ? "A\t%s\n" : "%s needs update\n");
 	unmerged_fmt = (in_porcelain ? "U\t%s\n" : "%s: needs merge\n");
+	refresh_fsmonitor(istate);
 	for (i = 0; i < istate->cache_nr; i++) {
 		struct cache_entry *ce, *new;
 		int cache_errno = 0;
@@ -1324,6 +1357,49 @@ struct ondisk_cache_entry_extended {
 			    ondisk_cache_entry_extended_size(ce_namelen(ce)) : \
 			    ondisk_cache_entry_size(ce_namelen(ce)))
 
+/*
+ * "index.threads" and "index.skipHash" are read on demand, as the index
+ * is often read before the configuration. GIT_TEST_INDEX_THREADS forces
+ * a number of threads even for a small index, so that the test suite
+ * can exercise them.
+ */
+static int index_threads = 1;
+static int index_threads_forced;
+static int index_skip_hash;
+int verify_index_checksum;
+
+static int index_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "index.threads")) {
+		int is_bool;
+
+		index_threads = git_config_bool_or_int(var, value, &is_bool);
+		if (is_bool)
+			index_threads = index_threads ? 0 : 1;
+		if (index_threads < 0)
+			die("invalid number of index threads (%d)",
+			    index_threads);
+	} else if (!strcmp(var, "index.skiphash"))
+		index_skip_hash = git_config_bool(var, value);
+	return 0;
+}
+
+static void load_index_config(void)
+{
+	static int loaded;
+	const char *env;
+
+	if (loaded)
+		return;
+	loaded = 1;
+	git_config(index_config, NULL);
+	env = getenv("GIT_TEST_INDEX_THREADS");
+	if (env) {
+		index_threads = atoi(env);
+		index_threads_forced = 1;
+	}
+}
+
 static int verify_hdr(struct cache_header *hdr, unsigned long size)
 {
 	git_SHA_CTX c;
@@ -1335,6 +1411,18 @@ static int verify_hdr(struct cache_header *hdr, unsigned long size)
 	hdr_version = ntohl(hdr->hdr_version);
 	if (hdr_version < INDEX_FORMAT_LB || INDEX_FORMAT_UB < hdr_version)
 		return error("bad index version %d", hdr_version);
+
+	/*
+	 * With index.skipHash, the checksum is not computed when writing,
+	 * and is left to "git fsck" when reading.
+	 */
+	load_index_config();
+	if (index_skip_hash && !verify_index_checksum)
+		return 0;
+	/* the index was written with index.skipHash */
+	if (is_null_sha1((unsigned char *)hdr + size - 20))
+		return 0;
+
 	git_SHA1_Init(&c);
 	git_SHA1_Update(&c, hdr, size - 20);
 	git_SHA1_Final(sha1, &c);
@@ -1357,6 +1445,17 @@ static int read_index_extension(struct index_state *istate,
 		if (read_link_extension(istate, data, sz))
 			return -1;
 		break;
+	case CACHE_EXT_FSMONITOR:
+		if (read_fsmonitor_extension(istate, data, sz))
+			return -1;
+		break;
+	case CACHE_EXT_UNTRACKED:
+		istate->untracked = read_untracked_extension(data, sz);
+		break;
+	case CACHE_EXT_ENDOFINDEXENTRIES:
+	case CACHE_EXT_INDEXENTRY_OFFSETS:
+		/* already used, if at all, by do_read_index() */
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1405,14 +1504,23 @@ static struct cache_entry *cache_entry_from_ondisk(struct ondisk_cache_entry *on
  * number of bytes to be stripped from the end of the previous name,
  * and the bytes to append to the result, to come up with its name.
  */
-static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
+static unsigned long expand_name_field(struct strbuf *name, const char *cp_,
+				       int block_start)
 {
 	const unsigned char *ep, *cp = (const unsigned char *)cp_;
 	size_t len = decode_varint(&cp);
 
-	if (name->len < len)
-		die("malformed name field in the index");
-	strbuf_remove(name, name->len - len, len);
+	if (block_start) {
+		/*
+		 * The previous name may be in a block read by another
+		 * thread; the first entry of a block strips all of it.
+		 */
+		strbuf_reset(name);
+	} else {
+		if (name->len < len)
+			die("malformed name field in the index");
+		strbuf_remove(name, name->len - len, len);
+	}
 	for (ep = cp; *ep; ep++)
 		; /* find the end */
 	strbuf_add(name, cp, ep - cp);
@@ -1421,7 +1529,8 @@ static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
 
 static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 					    unsigned long *ent_size,
-					    struct strbuf *previous_name)
+					    struct strbuf *previous_name,
+					    int block_start)
 {
 	struct cache_entry *ce;
 	size_t len;
@@ -1455,7 +1564,7 @@ static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 		*ent_size = ondisk_ce_size(ce);
 	} else {
 		unsigned long consumed;
-		consumed = expand_name_field(previous_name, name);
+		consumed = expand_name_field(previous_name, name, block_start);
 		ce = cache_entry_from_ondisk(ondisk, flags,
 					     previous_name->buf,
 					     previous_name->len);
@@ -1465,16 +1574,296 @@ static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 	return ce;
 }
 
+static int get_index_threads(void)
+{
+	load_index_config();
+#ifdef NO_PTHREADS
+	return 1;
+#else
+	if (!index_threads)	/* 0 means one per processor */
+		return online_cpus();
+	return index_threads;
+#endif
+}
+
+/*
+ * Entries are recorded in the IEOT extension, and read by threads, in
+ * blocks of this many entries, which is about what it takes to make
+ * starting a thread worthwhile.
+ */
+#define THREAD_COST (10000)
+
+/*
+ * The "EOIE" extension comes last in the index, with a fixed size so
+ * that it can be found from the end of the file. It records where the
+ * entries end, so that the extensions can be read while the entries
+ * are, and a hash of the headers of the extensions between there and
+ * itself, to make sure that the offset can be trusted.
+ */
+#define EOIE_SIZE (4 + 20) /* <4-byte offset> + <20-byte hash> */
+#define EOIE_SIZE_WITH_HEADER (4 + 4 + EOIE_SIZE)
+
+#ifndef NO_PTHREADS
+static unsigned long read_eoie_extension(const char *mmap, size_t mmap_size)
+{
+	const char *eoie, *index;
+	unsigned long offset, src_offset, end;
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+
+	if (mmap_size < sizeof(struct cache_header) + EOIE_SIZE_WITH_HEADER + 20)
+		return 0;
+	eoie = mmap + mmap_size - EOIE_SIZE_WITH_HEADER - 20;
+	if (CACHE_EXT(eoie) != CACHE_EXT_ENDOFINDEXENTRIES ||
+	    get_be32(eoie + 4) != EOIE_SIZE)
+		return 0;
+	index = eoie + 8;
+	offset = get_be32(index);
+	index += 4;
+
+	end = eoie - mmap;
+	if (offset < sizeof(struct cache_header) || offset > end)
+		return 0;
+	git_SHA1_Init(&c);
+	for (src_offset = offset; src_offset < end; ) {
+		uint32_t extsize;
+
+		if (end - src_offset < 8)
+			return 0;
+		extsize = get_be32(mmap + src_offset + 4);
+		git_SHA1_Update(&c, mmap + src_offset, 8);
+		if (end - src_offset - 8 < extsize)
+			return 0;
+		src_offset += 8 + extsize;
+	}
+	git_SHA1_Final(sha1, &c);
+	if (hashcmp(sha1, (const unsigned char *)index))
+		return 0;
+	return offset;
+}
+#endif
+
+/*
+ * The "IEOT" extension records where blocks of entries start, so that
+ * they can be read by several threads.
+ */
+#define IEOT_VERSION 1
+
+struct index_entry_offset {
+	/* starting byte offset into the index file, and number of entries */
+	unsigned int offset, nr;
+};
+
+struct index_entry_offset_table {
+	int nr;
+	struct index_entry_offset entries[FLEX_ARRAY];
+};
+
+#ifndef NO_PTHREADS
+static struct index_entry_offset_table *read_ieot_extension(const char *mmap,
+							    size_t mmap_size,
+							    unsigned long offset,
+							    unsigned int cache_nr)
+{
+	const char *index = NULL;
+	unsigned long end = mmap_size - EOIE_SIZE_WITH_HEADER - 20;
+	uint32_t extsize = 0;
+	struct index_entry_offset_table *ieot;
+	unsigned int total = 0;
+	int i, nr;
+
+	/* the headers were checked along with the EOIE extension */
+	while (offset < end) {
+		const char *ext = mmap + offset;
+
+		extsize = get_be32(ext + 4);
+		if (CACHE_EXT(ext) == CACHE_EXT_INDEXENTRY_OFFSETS) {
+			index = ext + 8;
+			break;
+		}
+		offset += 8 + extsize;
+	}
+	if (!index || extsize < 4 || get_be32(index) != IEOT_VERSION ||
+	    (extsize - 4) % 8)
+		return NULL;
+	index += 4;
+	nr = (extsize - 4) / 8;
+	if (!nr)
+		return NULL;
+
+	ieot = xmalloc(sizeof(*ieot) + nr * sizeof(struct index_entry_offset));
+	ieot->nr = nr;
+	for (i = 0; i < nr; i++) {
+		ieot->entries[i].offset = get_be32(index);
+		ieot->entries[i].nr = get_be32(index + 4);
+		index += 8;
+		if (ieot->entries[i].offset >= end ||
+		    (i && ieot->entries[i].offset <= ieot->entries[i - 1].offset))
+			break;
+		total += ieot->entries[i].nr;
+	}
+	if (i < nr || total != cache_nr) {
+		free(ieot);
+		return NULL;
+	}
+	return ieot;
+}
+#endif
+
+/*
+ * Read nr entries starting at position "start" in istate->cache from
+ * the given offset; returns the offset after the last one.
+ */
+static unsigned long load_cache_entry_block(struct index_state *istate,
+					    const char *mmap,
+					    unsigned long offset,
+					    int start, int nr)
+{
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	int i;
+
+	previous_name = (istate->version == 4) ? &previous_name_buf : NULL;
+	for (i = start; i < start + nr; i++) {
+		struct ondisk_cache_entry *disk_ce;
+		struct cache_entry *ce;
+		unsigned long consumed;
+
+		disk_ce = (struct ondisk_cache_entry *)(mmap + offset);
+		ce = create_from_disk(disk_ce, &consumed, previous_name,
+				      i == start);
+		set_index_entry(istate, i, ce);
+		offset += consumed;
+	}
+	strbuf_release(&previous_name_buf);
+	return offset;
+}
+
+#ifndef NO_PTHREADS
+struct load_index_extensions {
+	pthread_t thread;
+	struct index_state *istate;
+	const char *mmap;
+	size_t mmap_size;
+	unsigned long src_offset;
+	int ret;
+};
+
+static int load_index_extensions(struct index_state *istate, const char *mmap,
+				 size_t mmap_size, unsigned long src_offset);
+
+static void *load_index_extensions_thread(void *data)
+{
+	struct load_index_extensions *p = data;
+
+	p->ret = load_index_extensions(p->istate, p->mmap, p->mmap_size,
+				       p->src_offset);
+	return NULL;
+}
+
+struct load_cache_entries_thread_data {
+	pthread_t thread;
+	struct index_state *istate;
+	const char *mmap;
+	struct index_entry_offset_table *ieot;
+	int ieot_start;		/* first block of this thread */
+	int ieot_blocks;	/* number of blocks of this thread */
+	int start;		/* position of the first entry */
+};
+
+static void *load_cache_entries_thread(void *data)
+{
+	struct load_cache_entries_thread_data *p = data;
+	int i, start = p->start;
+
+	for (i = p->ieot_start; i < p->ieot_start + p->ieot_blocks; i++) {
+		struct index_entry_offset *block = &p->ieot->entries[i];
+
+		load_cache_entry_block(p->istate, p->mmap, block->offset,
+				       start, block->nr);
+		start += block->nr;
+	}
+	return NULL;
+}
+
+/* Spread the blocks of entries over nr_threads threads. */
+static void load_cache_entries_threaded(struct index_state *istate,
+					const char *mmap,
+					struct index_entry_offset_table *ieot,
+					int nr_threads)
+{
+	struct load_cache_entries_thread_data *data;
+	int i, block = 0, start = 0;
+
+	data = xcalloc(nr_threads, sizeof(*data));
+	for (i = 0; i < nr_threads; i++) {
+		struct load_cache_entries_thread_data *p = &data[i];
+		int j, err;
+
+		p->istate = istate;
+		p->mmap = mmap;
+		p->ieot = ieot;
+		p->ieot_start = block;
+		p->ieot_blocks = (ieot->nr - block) / (nr_threads - i);
+		p->start = start;
+		for (j = block; j < block + p->ieot_blocks; j++)
+			start += ieot->entries[j].nr;
+		block += p->ieot_blocks;
+
+		err = pthread_create(&p->thread, NULL,
+				     load_cache_entries_thread, p);
+		if (err)
+			die("unable to create load_cache_entries thread: %s",
+			    strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_join(data[i].thread, NULL);
+		if (err)
+			die("unable to join load_cache_entries thread: %s",
+			    strerror(err));
+	}
+	free(data);
+}
+#endif
+
+static int load_index_extensions(struct index_state *istate, const char *mmap,
+				 size_t mmap_size, unsigned long src_offset)
+{
+	while (src_offset <= mmap_size - 20 - 8) {
+		/* After an array of active_nr index entries,
+		 * there can be arbitrary number of extended
+		 * sections, each of which is prefixed with
+		 * extension name (4-byte) and section length
+		 * in 4-byte network byte order.
+		 */
+		uint32_t extsize;
+		memcpy(&extsize, mmap + src_offset + 4, 4);
+		extsize = ntohl(extsize);
+		if (read_index_extension(istate,
+					 mmap + src_offset,
+					 (char *) mmap + src_offset + 8,
+					 extsize) < 0)
+			return -1;
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	return 0;
+}
+
 /* remember to discard_cache() before reading a different cache! */
 int do_read_index(struct index_state *istate, const char *path, int must_exist)
 {
-	int fd, i;
+	int fd;
 	struct stat st;
 	unsigned long src_offset;
 	struct cache_header *hdr;
 	void *mmap;
 	size_t mmap_size;
-	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+#ifndef NO_PTHREADS
+	int nr_threads;
+	struct load_index_extensions p;
+	unsigned long extension_offset = 0;
+	struct index_entry_offset_table *ieot = NULL;
+#endif
 
 	if (istate->initialized)
 		return istate->cache_nr;
@@ -1511,45 +1900,52 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(*istate->cache));
 	istate->initialized = 1;
 
-	if (istate->version == 4)
-		previous_name = &previous_name_buf;
-	else
-		previous_name = NULL;
-
 	src_offset = sizeof(*hdr);
-	for (i = 0; i < istate->cache_nr; i++) {
-		struct ondisk_cache_entry *disk_ce;
-		struct cache_entry *ce;
-		unsigned long consumed;
 
-		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
-		ce = create_from_disk(disk_ce, &consumed, previous_name);
-		set_index_entry(istate, i, ce);
-
-		src_offset += consumed;
+#ifndef NO_PTHREADS
+	nr_threads = get_index_threads();
+	if (nr_threads > 1)
+		extension_offset = read_eoie_extension(mmap, mmap_size);
+	if (extension_offset) {
+		/* the extensions are read while the entries are */
+		p.istate = istate;
+		p.mmap = mmap;
+		p.mmap_size = mmap_size;
+		p.src_offset = extension_offset;
+		if (pthread_create(&p.thread, NULL,
+				   load_index_extensions_thread, &p))
+			die("unable to create load_index_extensions thread");
+
+		ieot = read_ieot_extension(mmap, mmap_size, extension_offset,
+					   istate->cache_nr);
+		if (ieot) {
+			if (nr_threads > ieot->nr)
+				nr_threads = ieot->nr;
+			if (!index_threads_forced &&
+			    nr_threads > istate->cache_nr / THREAD_COST)
+				nr_threads = istate->cache_nr / THREAD_COST;
+		}
 	}
-	strbuf_release(&previous_name_buf);
+	if (ieot && nr_threads > 1)
+		load_cache_entries_threaded(istate, mmap, ieot, nr_threads);
+	else
+#endif
+		src_offset = load_cache_entry_block(istate, mmap, src_offset,
+						    0, istate->cache_nr);
 	istate->timestamp.sec = st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
-	while (src_offset <= mmap_size - 20 - 8) {
-		/* After an array of active_nr index entries,
-		 * there can be arbitrary number of extended
-		 * sections, each of which is prefixed with
-		 * extension name (4-byte) and section length
-		 * in 4-byte network byte order.
-		 */
-		uint32_t extsize;
-		memcpy(&extsize, (char *)mmap + src_offset + 4, 4);
-		extsize = ntohl(extsize);
-		if (read_index_extension(istate,
-					 (const char *) mmap + src_offset,
-					 (char *) mmap + src_offset + 8,
-					 extsize) < 0)
+#ifndef NO_PTHREADS
+	free(ieot);
+	if (extension_offset) {
+		if (pthread_join(p.thread, NULL))
+			die("unable to join load_index_extensions thread");
+		if (p.ret)
 			goto unmap;
-		src_offset += 8;
-		src_offset += extsize;
-	}
+	} else
+#endif
+	if (load_index_extensions(istate, mmap, mmap_size, src_offset) < 0)
+		goto unmap;
 	munmap(mmap, mmap_size);
 	return istate->cache_nr;
 
@@ -1569,11 +1965,11 @@ int read_index_from(struct index_state *istate, const char *path)
 
 	ret = do_read_index(istate, path, 0);
 	split_index = istate->split_index;
-	if (!split_index)
-		return ret;
-
-	if (is_null_sha1(split_index->base_sha1))
+	if (!split_index || is_null_sha1(split_index->base_sha1)) {
+		tweak_untracked_cache(istate);
+		tweak_fsmonitor(istate);
 		return ret;
+	}
 
 	if (split_index->base)
 		discard_index(split_index->base);
@@ -1589,6 +1985,8 @@ int read_index_from(struct index_state *istate, const char *path)
 				     sha1_to_hex(split_index->base_sha1)),
 		    sha1_to_hex(split_index->base->sha1));
 	merge_base_index(istate);
+	tweak_untracked_cache(istate);
+	tweak_fsmonitor(istate);
 	return ret;
 }
 
@@ -1622,6 +2020,15 @@ int discard_index(struct index_state *istate)
 	istate->cache = NULL;
 	istate->cache_alloc = 0;
 	discard_split_index(istate);
+	free(istate->fsmonitor_last_update);
+	istate->fsmonitor_last_update = NULL;
+	if (istate->fsmonitor_dirty) {
+		ewah_free(istate->fsmonitor_dirty);
+		istate->fsmonitor_dirty = NULL;
+	}
+	istate->fsmonitor_has_run_once = 0;
+	free_untracked_cache(istate->untracked);
+	istate->untracked = NULL;
 	return 0;
 }
 
@@ -1643,7 +2050,8 @@ static int ce_write_flush(git_SHA_CTX *context, int fd)
 {
 	unsigned int buffered = write_buffer_len;
 	if (buffered) {
-		git_SHA1_Update(context, write_buffer, buffered);
+		if (context)
+			git_SHA1_Update(context, write_buffer, buffered);
 		if (write_in_full(fd, write_buffer, buffered) != buffered)
 			return -1;
 		write_buffer_len = 0;
@@ -1673,11 +2081,15 @@ static int ce_write(git_SHA_CTX *context, int fd, void *data, unsigned int len)
 	return 0;
 }
 
-static int write_index_ext_header(git_SHA_CTX *context, int fd,
-				  unsigned int ext, unsigned int sz)
+static int write_index_ext_header(git_SHA_CTX *context, git_SHA_CTX *eoie_context,
+				  int fd, unsigned int ext, unsigned int sz)
 {
 	ext = htonl(ext);
 	sz = htonl(sz);
+	if (eoie_context) {
+		git_SHA1_Update(eoie_context, &ext, 4);
+		git_SHA1_Update(eoie_context, &sz, 4);
+	}
 	return ((ce_write(context, fd, &ext, 4) < 0) ||
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
@@ -1688,7 +2100,8 @@ static int ce_flush(git_SHA_CTX *context, int fd, unsigned char *sha1)
 
 	if (left) {
 		write_buffer_len = 0;
-		git_SHA1_Update(context, write_buffer, left);
+		if (context)
+			git_SHA1_Update(context, write_buffer, left);
 	}
 
 	/* Flush first if not enough space for SHA1 signature */
@@ -1698,8 +2111,11 @@ static int ce_flush(git_SHA_CTX *context, int fd, unsigned char *sha1)
 		left = 0;
 	}
 
-	/* Append the SHA1 signature at the end */
-	git_SHA1_Final(write_buffer + left, context);
+	/* Append the SHA1 signature (or, without a context, zeroes) at the end */
+	if (context)
+		git_SHA1_Final(write_buffer + left, context);
+	else
+		hashclr(write_buffer + left);
 	hashcpy(sha1, write_buffer + left);
 	left += 20;
 	return (write_in_full(fd, write_buffer, left) != left) ? -1 : 0;
@@ -1786,14 +2202,19 @@ static char *copy_cache_entry_to_ondisk(struct ondisk_cache_entry *ondisk,
 	}
 }
 
-static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce,
-			  struct strbuf *previous_name)
+/*
+ * Return the on-disk form of ce, and its size. In v4 the name only
+ * records how it differs from previous_name, except at the start of
+ * a block, which has to be readable on its own.
+ */
+static struct ondisk_cache_entry *ce_to_ondisk(struct cache_entry *ce,
+					       struct strbuf *previous_name,
+					       int block_start, int *size_p)
 {
 	int size;
 	struct ondisk_cache_entry *ondisk;
 	int saved_namelen = saved_namelen; /* compiler workaround */
 	char *name;
-	int result;
 
 	if (ce->ce_flags & CE_STRIP_NAME) {
 		saved_namelen = ce_namelen(ce);
@@ -1809,7 +2230,7 @@ static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce,
 		int common, to_remove, prefix_size;
 		unsigned char to_remove_vi[16];
 		for (common = 0;
-		     (ce->name[common] &&
+		     (!block_start && ce->name[common] &&
 		      common < previous_name->len &&
 		      ce->name[common] == previous_name->buf[common]);
 		     common++)
@@ -1836,11 +2257,137 @@ static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce,
 		ce->ce_flags &= ~CE_STRIP_NAME;
 	}
 
+	*size_p = size;
+	return ondisk;
+}
+
+static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce,
+			  struct strbuf *previous_name, int block_start)
+{
+	struct ondisk_cache_entry *ondisk;
+	int size, result;
+
+	ondisk = ce_to_ondisk(ce, previous_name, block_start, &size);
 	result = ce_write(c, fd, ondisk, size);
 	free(ondisk);
 	return result;
 }
 
+#ifndef NO_PTHREADS
+/*
+ * Threads turn blocks of entries (as recorded in the IEOT extension)
+ * into their on-disk form, while the main thread hashes and writes
+ * out, in order, the blocks that are ready.
+ */
+struct write_entries_thread_data {
+	pthread_t thread;
+	struct index_state *istate;
+	struct index_entry_offset_table *ieot;
+	int *block_pos;		/* position in the index of each block */
+	int block, nr_blocks;	/* the blocks of this thread */
+	/*
+	 * The entry written before these blocks: readers that do not
+	 * use the IEOT extension expect the first entry of a block to
+	 * strip its name in v4.
+	 */
+	const struct cache_entry *previous;
+	int v4;
+	struct strbuf *out;	/* one per block */
+};
+
+static void *write_entries_thread(void *data)
+{
+	struct write_entries_thread_data *p = data;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	int b;
+
+	previous_name = p->v4 ? &previous_name_buf : NULL;
+	if (previous_name && p->previous)
+		strbuf_add(previous_name, p->previous->name,
+			   ce_namelen(p->previous));
+	for (b = p->block; b < p->block + p->nr_blocks; b++) {
+		int i = p->block_pos[b], nr = 0;
+
+		for (; nr < p->ieot->entries[b].nr; i++) {
+			struct cache_entry *ce = p->istate->cache[i];
+			struct ondisk_cache_entry *ondisk;
+			int size;
+
+			if (ce->ce_flags & CE_REMOVE)
+				continue;
+			ondisk = ce_to_ondisk(ce, previous_name, !nr, &size);
+			strbuf_add(&p->out[b], ondisk, size);
+			free(ondisk);
+			nr++;
+		}
+	}
+	strbuf_release(&previous_name_buf);
+	return NULL;
+}
+
+static int write_entries_threaded(git_SHA_CTX *c, int fd,
+				  struct index_state *istate,
+				  struct index_entry_offset_table *ieot,
+				  int *block_pos, int nr_threads)
+{
+	struct write_entries_thread_data *data;
+	struct strbuf *out;
+	int i, b, block = 0, ret = 0;
+
+	if (nr_threads > ieot->nr)
+		nr_threads = ieot->nr;
+	out = xmalloc(ieot->nr * sizeof(*out));
+	for (b = 0; b < ieot->nr; b++)
+		strbuf_init(&out[b], 0);
+
+	data = xcalloc(nr_threads, sizeof(*data));
+	for (i = 0; i < nr_threads; i++) {
+		struct write_entries_thread_data *p = &data[i];
+		int err;
+
+		p->istate = istate;
+		p->ieot = ieot;
+		p->block_pos = block_pos;
+		p->block = block;
+		p->nr_blocks = (ieot->nr - block) / (nr_threads - i);
+		p->v4 = istate->version == 4;
+		if (block) {
+			int pos = block_pos[block];
+
+			while (istate->cache[--pos]->ce_flags & CE_REMOVE)
+				; /* skip the entries that are not written */
+			p->previous = istate->cache[pos];
+		}
+		p->out = out;
+		block += p->nr_blocks;
+
+		err = pthread_create(&p->thread, NULL, write_entries_thread, p);
+		if (err)
+			die("unable to create write_entries thread: %s",
+			    strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++) {
+		struct write_entries_thread_data *p = &data[i];
+		int err = pthread_join(p->thread, NULL);
+
+		if (err)
+			die("unable to join write_entries thread: %s",
+			    strerror(err));
+		for (b = p->block; b < p->block + p->nr_blocks; b++) {
+			if (!ret) {
+				ieot->entries[b].offset =
+					lseek(fd, 0, SEEK_CUR) + write_buffer_len;
+				ret = ce_write(c, fd, out[b].buf, out[b].len);
+			}
+			strbuf_release(&out[b]);
+		}
+	}
+	free(data);
+	free(out);
+	return ret;
+}
+#endif
+
 /*
  * This function verifies if index_state has the correct sha1 of the
  * index file.  Don't die if we have any other failure, just return 0.
@@ -1872,6 +2419,12 @@ static int verify_index_from(const struct index_state *istate, const char *path)
 	if (hashcmp(istate->sha1, sha1))
 		goto out;
 
+	/* without a checksum, all we have is the time it was written */
+	if (is_null_sha1(sha1) &&
+	    (istate->timestamp.sec != (unsigned int)st.st_mtime ||
+	     istate->timestamp.nsec != ST_MTIME_NSEC(st)))
+		goto out;
+
 	close(fd);
 	return 1;
 
@@ -1912,13 +2465,18 @@ void update_index_if_able(struct index_state *istate, struct lock_file *lockfile
 static int do_write_index(struct index_state *istate, int newfd,
 			  int strip_extensions)
 {
-	git_SHA_CTX c;
+	git_SHA_CTX c_buf, *c = &c_buf;
 	struct cache_header hdr;
 	int i, err, removed, extended, hdr_version;
 	struct cache_entry **cache = istate->cache;
 	int entries = istate->cache_nr;
 	struct stat st;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	git_SHA_CTX *eoie_c = NULL;
+	struct index_entry_offset_table *ieot = NULL;
+	int nr_threads, ieot_entries = 0, nr_written = 0, *block_pos = NULL;
+	off_t offset;
+	uint32_t be32;
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -1948,15 +2506,49 @@ static int do_write_index(struct index_state *istate, int newfd,
 	hdr.hdr_version = htonl(hdr_version);
 	hdr.hdr_entries = htonl(entries - removed);
 
-	git_SHA1_Init(&c);
-	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
+	/* a shared index is named after its checksum */
+	load_index_config();
+	if (index_skip_hash && !strip_extensions)
+		c = NULL;
+	else
+		git_SHA1_Init(c);
+	if (ce_write(c, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
 
-	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
+	/*
+	 * Record where blocks of entries start, and where the entries
+	 * end, for readers with several threads.
+	 */
+	nr_threads = get_index_threads();
+	if (!strip_extensions && nr_threads != 1) {
+		if (index_threads_forced)
+			ieot_entries = DIV_ROUND_UP(entries - removed,
+						    nr_threads > 1 ? nr_threads : 1);
+		else
+			ieot_entries = THREAD_COST;
+		if (!ieot_entries)
+			ieot_entries = 1;
+		ieot = xcalloc(1, sizeof(*ieot) +
+			       DIV_ROUND_UP(entries - removed, ieot_entries) *
+			       sizeof(struct index_entry_offset));
+		block_pos = xmalloc(DIV_ROUND_UP(entries - removed, ieot_entries) *
+				    sizeof(*block_pos));
+		eoie_c = xmalloc(sizeof(*eoie_c));
+		git_SHA1_Init(eoie_c);
+	}
+
 	for (i = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
+
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
+		if (ieot && !(nr_written % ieot_entries)) {
+			block_pos[ieot->nr] = i;
+			ieot->entries[ieot->nr++].nr = 0;
+		}
+		if (ieot)
+			ieot->entries[ieot->nr - 1].nr++;
+		nr_written++;
 		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
 			ce_smudge_racily_clean_entry(ce);
 		if (is_null_sha1(ce->sha1)) {
@@ -1965,55 +2557,156 @@ static int do_write_index(struct index_state *istate, int newfd,
 
 			if (allow < 0)
 				allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
-			if (allow)
-				warning(msg, ce->name);
-			else
-				return error(msg, ce->name);
+			if (!allow) {
+				error(msg, ce->name);
+				goto fail;
+			}
+			warning(msg, ce->name);
 		}
-		if (ce_write_entry(&c, newfd, ce, previous_name) < 0)
-			return -1;
 	}
-	strbuf_release(&previous_name_buf);
+
+#ifndef NO_PTHREADS
+	/* names are stripped on the fly when writing a split index */
+	if (ieot && nr_threads > 1 && ieot->nr > 1 && !istate->split_index) {
+		if (write_entries_threaded(c, newfd, istate, ieot, block_pos,
+					   nr_threads) < 0)
+			goto fail;
+	} else
+#endif
+	{
+		int block = 0;
+
+		previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
+		for (i = 0; i < entries; i++) {
+			struct cache_entry *ce = cache[i];
+			int block_start = 0;
+
+			if (ce->ce_flags & CE_REMOVE)
+				continue;
+			if (ieot && block < ieot->nr && block_pos[block] == i) {
+				offset = lseek(newfd, 0, SEEK_CUR) + write_buffer_len;
+				ieot->entries[block++].offset = offset;
+				block_start = 1;
+			}
+			if (ce_write_entry(c, newfd, ce, previous_name,
+					   block_start) < 0)
+				goto fail;
+		}
+		strbuf_release(&previous_name_buf);
+	}
+	free(block_pos);
+	block_pos = NULL;
+	offset = lseek(newfd, 0, SEEK_CUR) + write_buffer_len;
+
+	if (ieot && ieot->nr) {
+		struct strbuf sb = STRBUF_INIT;
+
+		put_be32(&be32, IEOT_VERSION);
+		strbuf_add(&sb, &be32, 4);
+		for (i = 0; i < ieot->nr; i++) {
+			put_be32(&be32, ieot->entries[i].offset);
+			strbuf_add(&sb, &be32, 4);
+			put_be32(&be32, ieot->entries[i].nr);
+			strbuf_add(&sb, &be32, 4);
+		}
+		err = write_index_ext_header(c, eoie_c, newfd,
+					     CACHE_EXT_INDEXENTRY_OFFSETS,
+					     sb.len) < 0
+			|| ce_write(c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			goto fail;
+	}
+	free(ieot);
+	ieot = NULL;
 
 	/* Write extension data here */
 	if (!strip_extensions && istate->split_index) {
 		struct strbuf sb = STRBUF_INIT;
 
 		err = write_link_extension(&sb, istate) < 0 ||
-			write_index_ext_header(&c, newfd, CACHE_EXT_LINK,
+			write_index_ext_header(c, eoie_c, newfd, CACHE_EXT_LINK,
 					       sb.len) < 0 ||
-			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+			ce_write(c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
-			return -1;
+			goto fail;
 	}
 	if (!strip_extensions && istate->cache_tree) {
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_TREE, sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		err = write_index_ext_header(c, eoie_c, newfd, CACHE_EXT_TREE, sb.len) < 0
+			|| ce_write(c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
-			return -1;
+			goto fail;
 	}
 	if (!strip_extensions && istate->resolve_undo) {
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_RESOLVE_UNDO,
+		err = write_index_ext_header(c, eoie_c, newfd, CACHE_EXT_RESOLVE_UNDO,
 					     sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+			|| ce_write(c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
-			return -1;
+			goto fail;
 	}
+	if (!strip_extensions && istate->fsmonitor_last_update) {
+		struct strbuf sb = STRBUF_INIT;
 
-	if (ce_flush(&c, newfd, istate->sha1) || fstat(newfd, &st))
-		return -1;
+		write_fsmonitor_extension(&sb, istate);
+		err = write_index_ext_header(c, eoie_c, newfd, CACHE_EXT_FSMONITOR,
+					     sb.len) < 0
+			|| ce_write(c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			goto fail;
+	}
+	if (!strip_extensions && istate->untracked) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_untracked_extension(&sb, istate->untracked);
+		err = write_index_ext_header(c, eoie_c, newfd, CACHE_EXT_UNTRACKED,
+					     sb.len) < 0
+			|| ce_write(c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			goto fail;
+	}
+
+	if (eoie_c) {
+		struct strbuf sb = STRBUF_INIT;
+		unsigned char sha1[20];
+
+		git_SHA1_Final(sha1, eoie_c);
+		free(eoie_c);
+		eoie_c = NULL;
+		put_be32(&be32, offset);
+		strbuf_add(&sb, &be32, 4);
+		strbuf_add(&sb, sha1, 20);
+		err = write_index_ext_header(c, NULL, newfd,
+					     CACHE_EXT_ENDOFINDEXENTRIES,
+					     sb.len) < 0
+			|| ce_write(c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			goto fail;
+	}
+
+	if (ce_flush(c, newfd, istate->sha1) || fstat(newfd, &st))
+		goto fail;
 	istate->timestamp.sec = (unsigned int)st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 	return 0;
+
+fail:
+	free(block_pos);
+	free(ieot);
+	free(eoie_c);
+	strbuf_release(&previous_name_buf);
+	return -1;
 }
 
 void set_alternate_index_output(const char *name)
@@ -2120,6 +2813,9 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 {
 	struct split_index *si = istate->split_index;
 
+	/* before the entries are split up below */
+	fill_fsmonitor_bitmap(istate);
+
 	if (!si || alternate_index_output ||
 	    (istate->cache_changed & ~EXTMASK)) {
 		if (si)
@@ -4,6 +4,8 @@
 #include "tag.h"
 #include "dir.h"
 #include "string-list.h"
+#include "reftable.h"
+#include "argv-array.h"
 
 /*
  * How to handle various characters in refnames:
@@ -155,7 +157,8 @@ struct ref_cache;
  *         or packed references, already read.
  *
  *     (ref_entry.flag & REF_INCOMPLETE) set -- a directory of loose
- *         references that hasn't been read yet (nor has any of its
+ *         references, or of packed references if REF_ISPACKED is set
+ *         too, that hasn't been read yet (nor has any of its
  *         subdirectories).
  *
  * Entries within a directory are stored within a growable array of
@@ -167,7 +170,9 @@ struct ref_cache;
  * directory of loose references is read, then all of the references
  * in that directory are stored, and REF_INCOMPLETE stubs are created
  * for any subdirectories, but the subdirectories themselves are not
- * read.  The reading is triggered by get_ref_dir().
+ * read.  The reading is triggered by get_ref_dir().  Packed references
+ * are read the same way if the packed-refs file is sorted (see
+ * read_packed_refs_dir()); otherwise they are all read at once.
  */
 struct ref_dir {
 	int nr, alloc;
@@ -204,7 +209,8 @@ struct ref_dir {
 
 /*
  * Entry has not yet been read from disk (used only for REF_DIR
- * entries representing loose references)
+ * entries).  REF_ISPACKED tells whether the directory is to be read
+ * from the loose references or from the packed-refs file.
  */
 #define REF_INCOMPLETE 0x20
 
@@ -216,8 +222,7 @@ struct ref_dir {
  * ref_entry with (flags & REF_DIR) set and containing a subdir member
  * that holds the entries in that directory that have been read so
  * far.  If (flags & REF_INCOMPLETE) is set, then the directory and
- * its subdirectories haven't been read yet.  REF_INCOMPLETE is only
- * used for loose reference directories.
+ * its subdirectories haven't been read yet.
  *
  * References are represented by a ref_entry with (flags & REF_DIR)
  * unset and a value member that describes the reference's value.  The
@@ -262,6 +267,7 @@ struct ref_entry {
 };
 
 static void read_loose_refs(const char *dirname, struct ref_dir *dir);
+static void read_packed_refs_dir(const char *dirname, struct ref_dir *dir);
 
 static struct ref_dir *get_ref_dir(struct ref_entry *entry)
 {
@@ -269,7 +275,10 @@ static struct ref_dir *get_ref_dir(struct ref_entry *entry)
 	assert(entry->flag & REF_DIR);
 	dir = &entry->u.subdir;
 	if (entry->flag & REF_INCOMPLETE) {
-		read_loose_refs(entry->name, dir);
+		if (entry->flag & REF_ISPACKED)
+			read_packed_refs_dir(entry->name, dir);
+		else
+			read_loose_refs(entry->name, dir);
 		entry->flag &= ~REF_INCOMPLETE;
 	}
 	return dir;
@@ -294,6 +303,15 @@ static struct ref_entry *create_ref_entry(const char *refname,
 	return ref;
 }
 
+/* Copy a ref_entry that is not a directory */
+static struct ref_entry *copy_ref_entry(const struct ref_entry *entry)
+{
+	struct ref_entry *ref = create_ref_entry(entry->name, entry->u.value.sha1,
+						 entry->flag, 0);
+	hashcpy(ref->u.value.peeled, entry->u.value.peeled);
+	return ref;
+}
+
 static void clear_ref_dir(struct ref_dir *dir);
 
 static void free_ref_entry(struct ref_entry *entry)
@@ -836,6 +854,9 @@ static int is_refname_available(const char *refname, const char *oldrefname,
 	return 1;
 }
 
+/* What the traits of a packed-refs file say about peeled values */
+enum packed_refs_peeled { PEELED_NONE, PEELED_TAGS, PEELED_FULLY };
+
 struct packed_ref_cache {
 	struct ref_entry *root;
 
@@ -858,6 +879,19 @@ struct packed_ref_cache {
 
 	/* The metadata from when this packed-refs cache was read */
 	struct stat_validity validity;
+
+	/*
+	 * If the packed-refs file is sorted, its contents are kept in
+	 * buf (mmapped unless MMAP_PREVENTS_DELETE), and the directories
+	 * under root are filled from it only when they are needed; see
+	 * read_packed_refs_dir().  The references proper start at
+	 * refs_start, after the header.  buf is NULL if the file was read
+	 * at once, or once all of it has been read.
+	 */
+	char *buf;
+	size_t buf_len;
+	const char *refs_start;
+	enum packed_refs_peeled peeled;
 };
 
 /*
@@ -868,6 +902,8 @@ static struct ref_cache {
 	struct ref_cache *next;
 	struct ref_entry *loose;
 	struct packed_ref_cache *packed;
+	/* The reftable stack holding the packed refs, if any */
+	struct reftable_stack *tables;
 	/*
 	 * The submodule name, or "" for the main repo.  We allocate
 	 * length 1 rather than FLEX_ARRAY so that the main ref_cache
@@ -879,6 +915,18 @@ static struct ref_cache {
 /* Lock used for the main packed-refs file: */
 static struct lock_file packlock;
 
+/*
+ * Whether packlock is held on "reftable/tables.list" rather than on
+ * "packed-refs", and the names of the packed refs that were added,
+ * changed or removed since it was taken. Only those have to be written
+ * to a new reftable.
+ */
+static int packlock_is_reftable;
+static struct string_list packed_refs_touched = STRING_LIST_INIT_DUP;
+
+/* Merge the whole reftable stack when committing the packed refs */
+static int packed_refs_compact_all;
+
 /*
  * Increment the reference count of *packed_refs.
  */
@@ -891,10 +939,36 @@ static void acquire_packed_ref_cache(struct packed_ref_cache *packed_refs)
  * Decrease the reference count of *packed_refs.  If it goes to zero,
  * free *packed_refs and return true; otherwise return false.
  */
+static void release_packed_refs_buf(struct packed_ref_cache *packed_refs)
+{
+	if (!packed_refs->buf)
+		return;
+#ifdef MMAP_PREVENTS_DELETE
+	free(packed_refs->buf);
+#else
+	munmap(packed_refs->buf, packed_refs->buf_len);
+#endif
+	packed_refs->buf = NULL;
+	packed_refs->refs_start = NULL;
+}
+
+/*
+ * Read whatever has not been read yet of the packed-refs file behind
+ * *packed_refs, and let go of its contents.
+ */
+static void materialize_packed_refs(struct packed_ref_cache *packed_refs)
+{
+	if (!packed_refs->buf)
+		return;
+	prime_ref_dir(get_ref_dir(packed_refs->root));
+	release_packed_refs_buf(packed_refs);
+}
+
 static int release_packed_ref_cache(struct packed_ref_cache *packed_refs)
 {
 	if (!--packed_refs->referrers) {
 		free_ref_entry(packed_refs->root);
+		release_packed_refs_buf(packed_refs);
 		stat_validity_clear(&packed_refs->validity);
 		free(packed_refs);
 		return 1;
@@ -910,6 +984,13 @@ static void clear_packed_ref_cache(struct ref_cache *refs)
 
 		if (packed_refs->lock)
 			die("internal error: packed-ref cache cleared while locked");
+		/*
+		 * The directories that are still to be read are read
+		 * from refs->packed; if somebody keeps using the old
+		 * cache, read all of it while that is still right.
+		 */
+		if (packed_refs->referrers > 1)
+			materialize_packed_refs(packed_refs);
 		refs->packed = NULL;
 		release_packed_ref_cache(packed_refs);
 	}
@@ -958,6 +1039,49 @@ static struct ref_cache *get_ref_cache(const char *submodule)
 	return refs;
 }
 
+/*
+ * The packed refs of a repository are kept either in the "packed-refs"
+ * file or, once it has been converted, in a stack of reftables in
+ * "$GIT_DIR/reftable" (see reftable.h). Loose refs take precedence
+ * over both in the same way.
+ */
+static const char *reftable_path(struct ref_cache *refs, const char *file)
+{
+	if (*refs->name)
+		return git_path_submodule(refs->name, "reftable%s", file);
+	return git_path("reftable%s", file);
+}
+
+static int packed_refs_in_reftable(struct ref_cache *refs)
+{
+	return !access(reftable_path(refs, "/tables.list"), F_OK);
+}
+
+/*
+ * New packed refs go to reftables if so configured, or if the
+ * repository has been converted already.
+ */
+static int write_packed_refs_to_reftable(void)
+{
+	return ref_storage_format == REF_STORAGE_REFTABLE ||
+	       packed_refs_in_reftable(&ref_cache);
+}
+
+/*
+ * Return the reftable stack of refs, reopening it if it changed on
+ * disk, or NULL if the packed refs are not kept in reftables.
+ */
+static struct reftable_stack *get_ref_tables(struct ref_cache *refs)
+{
+	if (refs->tables && !reftable_stack_is_current(refs->tables)) {
+		reftable_stack_close(refs->tables);
+		refs->tables = NULL;
+	}
+	if (!refs->tables)
+		refs->tables = reftable_stack_open(reftable_path(refs, ""));
+	return refs->tables;
+}
+
 /* The length of a peeled reference line in packed-refs, including EOL: */
 #define PEELED_LINE_LENGTH 42
 
@@ -966,7 +1090,7 @@ static struct ref_cache *get_ref_cache(const char *submodule)
  * traits will be added later.  The trailing space is required.
  */
 static const char PACKED_REFS_HEADER[] =
-	"# pack-refs with: peeled fully-peeled \n";
+	"# pack-refs with: peeled fully-peeled sorted \n";
 
 /*
  * Parse one line from a packed-refs file.  Write the SHA1 to sha1.
@@ -1027,12 +1151,28 @@ static const char *parse_ref_line(char *line, unsigned char *sha1)
  *      trait should typically be written alongside "peeled" for
  *      compatibility with older clients, but we do not require it
  *      (i.e., "peeled" is a no-op if "fully-peeled" is set).
+ *
+ *   sorted:
+ *
+ *      The references are sorted by name, in strcmp() order, and no
+ *      name occurs twice. Such a file is not parsed as a whole but
+ *      searched in place (see read_packed_refs_dir()); this function
+ *      is used for files without the trait.
  */
+static enum packed_refs_peeled parse_peeled_trait(const char *traits)
+{
+	if (strstr(traits, " fully-peeled "))
+		return PEELED_FULLY;
+	else if (strstr(traits, " peeled "))
+		return PEELED_TAGS;
+	return PEELED_NONE;
+}
+
 static void read_packed_refs(FILE *f, struct ref_dir *dir)
 {
 	struct ref_entry *last = NULL;
 	char refline[PATH_MAX];
-	enum { PEELED_NONE, PEELED_TAGS, PEELED_FULLY } peeled = PEELED_NONE;
+	enum packed_refs_peeled peeled = PEELED_NONE;
 
 	while (fgets(refline, sizeof(refline), f)) {
 		unsigned char sha1[20];
@@ -1040,12 +1180,7 @@ static void read_packed_refs(FILE *f, struct ref_dir *dir)
 		static const char header[] = "# pack-refs with:";
 
 		if (!strncmp(refline, header, sizeof(header)-1)) {
-			const char *traits = refline + sizeof(header) - 1;
-			if (strstr(traits, " fully-peeled "))
-				peeled = PEELED_FULLY;
-			else if (strstr(traits, " peeled "))
-				peeled = PEELED_TAGS;
-			/* perhaps other traits later as well */
+			peeled = parse_peeled_trait(refline + sizeof(header) - 1);
 			continue;
 		}
 
@@ -1074,6 +1209,252 @@ static void read_packed_refs(FILE *f, struct ref_dir *dir)
 	}
 }
 
+/*
+ * A sorted packed-refs file is searched in place.  A "record" is a
+ * reference line, followed by its peeled line if it has one.  Every
+ * line, including the last one, is known to end with LF.
+ */
+static const char *find_start_of_line(const char *buf, const char *p)
+{
+	while (p > buf && p[-1] != '\n')
+		p--;
+	return p;
+}
+
+static const char *find_end_of_line(const char *p, const char *eof)
+{
+	return (const char *)memchr(p, '\n', eof - p) + 1;
+}
+
+static const char *find_end_of_record(const char *p, const char *eof)
+{
+	p = find_end_of_line(p, eof);
+	if (p < eof && *p == '^')
+		p = find_end_of_line(p, eof);
+	return p;
+}
+
+/*
+ * Compare the name in the record at rec to refname, like strcmp().
+ */
+static int cmp_packed_record(const char *rec, const char *refname)
+{
+	const unsigned char *p, *r = (const unsigned char *)refname;
+
+	if (memchr(rec, '\n', 42) || rec[40] != ' ')
+		die("unexpected line in packed-refs: %.*s",
+		    (int)strcspn(rec, "\n"), rec);
+	for (p = (const unsigned char *)rec + 41; *p != '\n'; p++, r++)
+		if (*p != *r)
+			return *p - *r;
+	return *r ? -1 : 0;
+}
+
+/*
+ * Return the first record at or after start whose name is not less
+ * than refname, or the end of the file if there is none.  start must
+ * be the start of a record.
+ */
+static const char *find_packed_record(struct packed_ref_cache *packed_refs,
+				      const char *start, const char *refname)
+{
+	const char *lo = start, *hi = packed_refs->buf + packed_refs->buf_len;
+
+	while (lo < hi) {
+		const char *rec = find_start_of_line(lo, lo + (hi - lo) / 2);
+		int cmp;
+
+		if (*rec == '^')
+			rec = find_start_of_line(lo, rec - 1);
+		cmp = cmp_packed_record(rec, refname);
+		if (!cmp)
+			return rec;
+		if (cmp < 0)
+			lo = find_end_of_record(rec, hi);
+		else
+			hi = rec;
+	}
+	return lo;
+}
+
+/*
+ * Create a ref_entry for the record at rec, whose name is the
+ * namelen bytes at rec + 41.
+ */
+static struct ref_entry *create_packed_record_entry(struct packed_ref_cache *packed_refs,
+						    const char *rec, size_t namelen,
+						    int check_name)
+{
+	const char *eof = packed_refs->buf + packed_refs->buf_len;
+	const char *next = find_end_of_line(rec, eof);
+	unsigned char sha1[20];
+	struct ref_entry *entry;
+	char *refname;
+
+	if (get_sha1_hex(rec, sha1))
+		die("unexpected line in packed-refs: %.*s",
+		    (int)(next - rec - 1), rec);
+	refname = xmemdupz(rec + 41, namelen);
+	entry = create_ref_entry(refname, sha1, REF_ISPACKED, check_name);
+	free(refname);
+	if (packed_refs->peeled == PEELED_FULLY ||
+	    (packed_refs->peeled == PEELED_TAGS &&
+	     starts_with(entry->name, "refs/tags/")))
+		entry->flag |= REF_KNOWS_PEELED;
+	if (next < eof && *next == '^') {
+		if (find_end_of_line(next, eof) - next != PEELED_LINE_LENGTH ||
+		    get_sha1_hex(next + 1, sha1))
+			die("unexpected line in packed-refs: %.*s",
+			    (int)strcspn(next, "\n"), next);
+		hashcpy(entry->u.value.peeled, sha1);
+		entry->flag |= REF_KNOWS_PEELED;
+	}
+	return entry;
+}
+
+/*
+ * Read the packed references directly within dirname from the sorted
+ * packed-refs file into dir, and create REF_INCOMPLETE stubs for its
+ * subdirectories.  Each subdirectory is skipped over with another
+ * binary search, so this costs O(log n) per entry of dir, however
+ * many references there are below it.
+ */
+static void read_packed_refs_dir(const char *dirname, struct ref_dir *dir)
+{
+	struct ref_cache *refs = dir->ref_cache;
+	struct packed_ref_cache *packed_refs = refs->packed;
+	size_t dirnamelen = strlen(dirname);
+	const char *p, *eof;
+	struct strbuf subdir = STRBUF_INIT;
+
+	if (!packed_refs || !packed_refs->buf)
+		die("BUG: packed ref directory '%s' read without its file",
+		    dirname);
+	eof = packed_refs->buf + packed_refs->buf_len;
+
+	p = find_packed_record(packed_refs, packed_refs->refs_start, dirname);
+	while (p < eof) {
+		const char *name = p + 41;
+		const char *eol = find_end_of_line(p, eof) - 1;
+		const char *slash;
+
+		if (cmp_packed_record(p, dirname) < 0 ||
+		    (size_t)(eol - name) < dirnamelen ||
+		    memcmp(name, dirname, dirnamelen))
+			break;
+		slash = memchr(name + dirnamelen, '/', eol - name - dirnamelen);
+		if (slash) {
+			struct ref_entry *entry;
+
+			strbuf_reset(&subdir);
+			strbuf_add(&subdir, name, slash - name + 1);
+			entry = create_dir_entry(refs, subdir.buf, subdir.len, 1);
+			entry->flag |= REF_ISPACKED;
+			add_entry_to_dir(dir, entry);
+			/* '/' + 1 sorts after everything in subdir */
+			subdir.buf[subdir.len - 1]++;
+			p = find_packed_record(packed_refs, p, subdir.buf);
+		} else {
+			add_entry_to_dir(dir, create_packed_record_entry(
+					packed_refs, p, eol - name, 1));
+			p = find_end_of_record(p, eof);
+		}
+	}
+	strbuf_release(&subdir);
+}
+
+/*
+ * Look refname up in the sorted packed-refs file of packed_refs,
+ * without reading anything else.  The entry returned is not part of
+ * any ref_dir; the caller must free() it.
+ */
+static struct ref_entry *lookup_packed_record(struct packed_ref_cache *packed_refs,
+					      const char *refname)
+{
+	const char *eof = packed_refs->buf + packed_refs->buf_len;
+	const char *rec;
+
+	rec = find_packed_record(packed_refs, packed_refs->refs_start, refname);
+	if (rec == eof || cmp_packed_record(rec, refname))
+		return NULL;
+	return create_packed_record_entry(packed_refs, rec, strlen(refname), 0);
+}
+
+/*
+ * Keep the contents of the packed-refs file at path in packed_refs,
+ * to be read lazily, if the file says it is sorted.  Return 0 on
+ * success, or -1 if the file has to be read as a whole (or does not
+ * exist).
+ */
+static int open_sorted_packed_refs(struct packed_ref_cache *packed_refs,
+				   const char *path)
+{
+	static const char header[] = "# pack-refs with:";
+	struct stat st;
+	size_t size;
+	char *buf;
+	const char *eol;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		close(fd);
+		return -1;
+	}
+	size = xsize_t(st.st_size);
+	stat_validity_update(&packed_refs->validity, fd);
+#ifdef MMAP_PREVENTS_DELETE
+	buf = xmalloc(size);
+	if (read_in_full(fd, buf, size) != size) {
+		free(buf);
+		close(fd);
+		return -1;
+	}
+#else
+	buf = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+#endif
+	close(fd);
+	packed_refs->buf = buf;
+	packed_refs->buf_len = size;
+
+	eol = memchr(buf, '\n', size);
+	if (buf[size - 1] != '\n' || !eol ||
+	    size < sizeof(header) - 1 || memcmp(buf, header, sizeof(header) - 1)) {
+		release_packed_refs_buf(packed_refs);
+		return -1;
+	} else {
+		char *traits = xmemdupz(buf + sizeof(header) - 1,
+					eol - buf - (sizeof(header) - 1));
+		int sorted = !!strstr(traits, " sorted ");
+
+		packed_refs->peeled = parse_peeled_trait(traits);
+		free(traits);
+		if (!sorted) {
+			release_packed_refs_buf(packed_refs);
+			return -1;
+		}
+	}
+	packed_refs->refs_start = eol + 1;
+	return 0;
+}
+
+static int add_reftable_ref(const char *refname, const unsigned char *sha1,
+			    const unsigned char *peeled, void *cb_data)
+{
+	struct ref_dir *dir = cb_data;
+	struct ref_entry *entry;
+
+	/* reftables record the peeled value of every ref that has one */
+	entry = create_ref_entry(refname, sha1,
+				 REF_ISPACKED | REF_KNOWS_PEELED, 1);
+	if (peeled)
+		hashcpy(entry->u.value.peeled, peeled);
+	add_ref(dir, entry);
+	return 0;
+}
+
 /*
  * Get the packed_ref_cache for the specified ref_cache, creating it
  * if necessary.
@@ -1081,8 +1462,11 @@ static void read_packed_refs(FILE *f, struct ref_dir *dir)
 static struct packed_ref_cache *get_packed_ref_cache(struct ref_cache *refs)
 {
 	const char *packed_refs_file;
+	int use_tables = packed_refs_in_reftable(refs);
 
-	if (*refs->name)
+	if (use_tables)
+		packed_refs_file = reftable_path(refs, "/tables.list");
+	else if (*refs->name)
 		packed_refs_file = git_path_submodule(refs->name, "packed-refs");
 	else
 		packed_refs_file = git_path("packed-refs");
@@ -1097,6 +1481,29 @@ static struct packed_ref_cache *get_packed_ref_cache(struct ref_cache *refs)
 		refs->packed = xcalloc(1, sizeof(*refs->packed));
 		acquire_packed_ref_cache(refs->packed);
 		refs->packed->root = create_dir_entry(refs, "", 0, 0);
+		if (use_tables) {
+			struct reftable_stack *st;
+			int fd = open(packed_refs_file, O_RDONLY);
+
+			/*
+			 * Take the stat data before reading the stack, so
+			 * that a concurrent update at worst causes another
+			 * reload later.
+			 */
+			if (fd >= 0) {
+				stat_validity_update(&refs->packed->validity, fd);
+				close(fd);
+			}
+			st = get_ref_tables(refs);
+			if (st)
+				reftable_stack_for_each_ref(st, "", add_reftable_ref,
+							    get_ref_dir(refs->packed->root));
+			return refs->packed;
+		}
+		if (!open_sorted_packed_refs(refs->packed, packed_refs_file)) {
+			refs->packed->root->flag |= REF_INCOMPLETE | REF_ISPACKED;
+			return refs->packed;
+		}
 		f = fopen(packed_refs_file, "r");
 		if (f) {
 			stat_validity_update(&refs->packed->validity, fileno(f));
@@ -1126,6 +1533,7 @@ void add_packed_ref(const char *refname, const unsigned char *sha1)
 		die("internal error: packed refs not locked");
 	add_ref(get_packed_ref_dir(packed_ref_cache),
 		create_ref_entry(refname, sha1, REF_ISPACKED, 1));
+	string_list_append(&packed_refs_touched, refname);
 }
 
 /*
@@ -1295,12 +1703,43 @@ int resolve_gitlink_ref(const char *path, const char *refname, unsigned char *sh
 }
 
 /*
- * Return the ref_entry for the given refname from the packed
- * references.  If it does not exist, return NULL.
+ * Return a copy of the ref_entry for the given refname from the
+ * packed references, which the caller must free().  If it does not
+ * exist, return NULL.
  */
 static struct ref_entry *get_packed_ref(const char *refname)
 {
-	return find_ref(get_packed_refs(&ref_cache), refname);
+	struct packed_ref_cache *packed_ref_cache;
+	struct reftable_stack *st;
+	struct ref_entry *entry;
+
+	/*
+	 * A reftable answers a single lookup with a binary search;
+	 * only use the in-core cache if it has been read already.
+	 */
+	if (!ref_cache.packed && packed_refs_in_reftable(&ref_cache) &&
+	    (st = get_ref_tables(&ref_cache))) {
+		unsigned char sha1[20], peeled[20];
+
+		if (reftable_stack_lookup(st, refname, sha1, peeled))
+			return NULL;
+		entry = create_ref_entry(refname, sha1,
+					 REF_ISPACKED | REF_KNOWS_PEELED, 0);
+		hashcpy(entry->u.value.peeled, peeled);
+		return entry;
+	}
+
+	/*
+	 * The same goes for a sorted packed-refs file, as long as it
+	 * is not being rewritten.
+	 */
+	packed_ref_cache = get_packed_ref_cache(&ref_cache);
+	if (packed_ref_cache->buf && !packed_ref_cache->lock)
+		return lookup_packed_record(packed_ref_cache, refname);
+	entry = find_ref(get_packed_ref_dir(packed_ref_cache), refname);
+	if (!entry)
+		return NULL;
+	return copy_ref_entry(entry);
 }
 
 /*
@@ -1321,6 +1760,7 @@ static const char *handle_missing_loose_ref(const char *refname,
 	entry = get_packed_ref(refname);
 	if (entry) {
 		hashcpy(sha1, entry->u.value.sha1);
+		free(entry);
 		if (flag)
 			*flag |= REF_ISPACKED;
 		return refname;
@@ -1619,10 +2059,12 @@ int peel_ref(const char *refname, unsigned char *sha1)
 	if (flag & REF_ISPACKED) {
 		struct ref_entry *r = get_packed_ref(refname);
 		if (r) {
-			if (peel_entry(r, 0))
-				return -1;
-			hashcpy(sha1, r->u.value.peeled);
-			return 0;
+			int ret = peel_entry(r, 0);
+
+			if (!ret)
+				hashcpy(sha1, r->u.value.peeled);
+			free(r);
+			return ret ? -1 : 0;
 		}
 	}
 
@@ -1942,6 +2384,15 @@ int refname_match(const char *abbrev_name, const char *full_name)
 	return 0;
 }
 
+void expand_ref_prefix(struct argv_array *prefixes, const char *prefix)
+{
+	const char **p;
+	int len = strlen(prefix);
+
+	for (p = ref_rev_parse_rules; *p; p++)
+		argv_array_pushf(prefixes, *p, len, prefix);
+}
+
 /* This function should make sure errno is meaningful on error */
 static struct ref_lock *verify_lock(struct ref_lock *lock,
 	const unsigned char *old_sha1, int mustexist)
@@ -2229,13 +2680,29 @@ static int write_packed_entry_fn(struct ref_entry *entry, void *cb_data)
 	return 0;
 }
 
+static const char *packed_refs_lock_path(void)
+{
+	if (write_packed_refs_to_reftable())
+		return reftable_path(&ref_cache, "/tables.list");
+	return git_path("packed-refs");
+}
+
 /* This should return a meaningful errno on failure */
 int lock_packed_refs(int flags)
 {
 	struct packed_ref_cache *packed_ref_cache;
+	int use_tables = write_packed_refs_to_reftable();
+	const char *path = packed_refs_lock_path();
 
-	if (hold_lock_file_for_update(&packlock, git_path("packed-refs"), flags) < 0)
+	if (use_tables && safe_create_leading_directories_const(path)) {
+		if (flags & LOCK_DIE_ON_ERROR)
+			die_errno("unable to create directory for %s", path);
 		return -1;
+	}
+	if (hold_lock_file_for_update(&packlock, path, flags) < 0)
+		return -1;
+	packlock_is_reftable = use_tables;
+	string_list_clear(&packed_refs_touched, 0);
 	/*
 	 * Get the current packed-refs while holding the lock.  If the
 	 * packed-refs file has been modified since we last read it,
@@ -2249,6 +2716,102 @@ int lock_packed_refs(int flags)
 	return 0;
 }
 
+struct reftable_updates {
+	struct reftable_update *items;
+	int nr, alloc;
+};
+
+static void add_reftable_update(struct reftable_updates *updates,
+				const char *refname, struct ref_entry *entry)
+{
+	struct reftable_update *u;
+
+	ALLOC_GROW(updates->items, updates->nr + 1, updates->alloc);
+	u = &updates->items[updates->nr++];
+	memset(u, 0, sizeof(*u));
+	u->refname = refname;
+	if (!entry) {
+		u->type = REFTABLE_DELETION;
+		return;
+	}
+
+	switch (peel_entry(entry, 0)) {
+	case PEEL_PEELED:
+		u->type = REFTABLE_VALUE_PEELED;
+		hashcpy(u->peeled, entry->u.value.peeled);
+		break;
+	case PEEL_NON_TAG:
+		u->type = REFTABLE_VALUE;
+		break;
+	default:
+		error("internal error: %s is not a valid packed reference!",
+		      entry->name);
+		u->type = REFTABLE_VALUE;
+		break;
+	}
+	hashcpy(u->sha1, entry->u.value.sha1);
+}
+
+/*
+ * An each_ref_entry_fn that adds the entry to a reftable_updates.
+ */
+static int add_reftable_update_fn(struct ref_entry *entry, void *cb_data)
+{
+	add_reftable_update(cb_data, entry->name, entry);
+	return 0;
+}
+
+/*
+ * Mark the repository as keeping its packed refs in reftables, so
+ * that versions of Git that do not know about them refuse to use it
+ * rather than see all packed refs vanish.
+ */
+static int set_reftable_extension(void)
+{
+	if (repository_format_version < 1 &&
+	    git_config_set("core.repositoryformatversion", "1"))
+		return -1;
+	repository_format_version = 1;
+	return git_config_set("extensions.refstorage", "reftable");
+}
+
+/*
+ * Write the packed refs touched since the lock was taken as a new
+ * reftable. If the packed refs are still in "packed-refs", set the
+ * repository extension, then write all of them and remove that file.
+ */
+static int commit_packed_refs_to_reftable(struct packed_ref_cache *packed_ref_cache)
+{
+	struct ref_dir *packed = get_packed_ref_dir(packed_ref_cache);
+	struct reftable_updates updates = { NULL, 0, 0 };
+	int convert = !packed_refs_in_reftable(&ref_cache);
+	int ret;
+
+	if (convert && set_reftable_extension())
+		return error("unable to set the reftable repository extension");
+	if (convert) {
+		do_for_each_entry_in_dir(packed, 0, add_reftable_update_fn,
+					 &updates);
+	} else {
+		struct string_list_item *item;
+
+		sort_string_list(&packed_refs_touched);
+		string_list_remove_duplicates(&packed_refs_touched, 0);
+		for_each_string_list_item(item, &packed_refs_touched)
+			add_reftable_update(&updates, item->string,
+					    find_ref(packed, item->string));
+	}
+
+	ret = reftable_stack_add(reftable_path(&ref_cache, ""),
+				 packed_ref_cache->lock,
+				 updates.items, updates.nr,
+				 packed_refs_compact_all);
+	if (!ret && convert)
+		unlink_or_warn(git_path("packed-refs"));
+	free(updates.items);
+	return ret;
+}
+
 /*
  * Commit the packed refs changes.
  * On error we must make sure that errno contains a meaningful value.
@@ -2262,16 +2825,26 @@ int commit_packed_refs(void)
 
 	if (!packed_ref_cache->lock)
 		die("internal error: packed-refs not locked");
-	write_or_die(packed_ref_cache->lock->fd,
-		     PACKED_REFS_HEADER, strlen(PACKED_REFS_HEADER));
-
-	do_for_each_entry_in_dir(get_packed_ref_dir(packed_ref_cache),
-				 0, write_packed_entry_fn,
-				 &packed_ref_cache->lock->fd);
-	if (commit_lock_file(packed_ref_cache->lock)) {
-		save_errno = errno;
-		error = -1;
+	/* The old file is about to be replaced */
+	materialize_packed_refs(packed_ref_cache);
+	if (packlock_is_reftable) {
+		if (commit_packed_refs_to_reftable(packed_ref_cache)) {
+			save_errno = errno;
+			error = -1;
+		}
+	} else {
+		write_or_die(packed_ref_cache->lock->fd,
+			     PACKED_REFS_HEADER, strlen(PACKED_REFS_HEADER));
+
+		do_for_each_entry_in_dir(get_packed_ref_dir(packed_ref_cache),
+					 0, write_packed_entry_fn,
+					 &packed_ref_cache->lock->fd);
+		if (commit_lock_file(packed_ref_cache->lock)) {
+			save_errno = errno;
+			error = -1;
+		}
 	}
+	string_list_clear(&packed_refs_touched, 0);
 	packed_ref_cache->lock = NULL;
 	release_packed_ref_cache(packed_ref_cache);
 	errno = save_errno;
@@ -2285,6 +2858,7 @@ void rollback_packed_refs(void)
 
 	if (!packed_ref_cache->lock)
 		die("internal error: packed-refs not locked");
+	string_list_clear(&packed_refs_touched, 0);
 	rollback_lock_file(packed_ref_cache->lock);
 	packed_ref_cache->lock = NULL;
 	release_packed_ref_cache(packed_ref_cache);
@@ -2340,6 +2914,7 @@ static int pack_if_possible_fn(struct ref_entry *entry, void *cb_data)
 		add_ref(cb->packed_refs, packed_entry);
 	}
 	hashcpy(packed_entry->u.value.peeled, entry->u.value.peeled);
+	string_list_append(&packed_refs_touched, entry->name);
 
 	/* Schedule the loose reference for pruning if requested. */
 	if ((cb->flags & PACK_REFS_PRUNE)) {
@@ -2417,8 +2992,10 @@ int pack_refs(unsigned int flags)
 	do_for_each_entry_in_dir(get_loose_refs(&ref_cache), 0,
 				 pack_if_possible_fn, &cbdata);
 
+	packed_refs_compact_all = 1;
 	if (commit_packed_refs())
 		die_errno("unable to overwrite old ref-pack file");
+	packed_refs_compact_all = 0;
 
 	prune_refs(cbdata.ref_to_prune);
 	return 0;
@@ -2489,9 +3066,14 @@ int repack_without_refs(const char **refnames, int n, struct strbuf *err)
 	int i, ret, removed = 0;
 
 	/* Look for a packed ref */
-	for (i = 0; i < n; i++)
-		if (get_packed_ref(refnames[i]))
+	for (i = 0; i < n; i++) {
+		struct ref_entry *entry = get_packed_ref(refnames[i]);
+
+		if (entry) {
+			free(entry);
 			break;
+		}
+	}
 
 	/* Avoid locking if we have nothing to do */
 	if (i == n)
@@ -2499,19 +3081,21 @@ int repack_without_refs(const char **refnames, int n, struct strbuf *err)
 
 	if (lock_packed_refs(0)) {
 		if (err) {
-			unable_to_lock_message(git_path("packed-refs"), errno,
+			unable_to_lock_message(packed_refs_lock_path(), errno,
 					       err);
 			return -1;
 		}
-		unable_to_lock_error(git_path("packed-refs"), errno);
+		unable_to_lock_error(packed_refs_lock_path(), errno);
 		return error("cannot delete '%s' from packed refs", refnames[i]);
 	}
 	packed = get_packed_refs(&ref_cache);
 
 	/* Remove refnames from the cache */
 	for (i = 0; i < n; i++)
-		if (remove_entry(packed, refnames[i]) != -1)
+		if (remove_entry(packed, refnames[i]) != -1) {
+			string_list_append(&packed_refs_touched, refnames[i]);
 			removed = 1;
+		}
 	if (!removed) {
 		/*
 		 * All packed entries disappeared while we were
@@ -2526,6 +3110,7 @@ int repack_without_refs(const char **refnames, int n, struct strbuf *err)
 	for_each_string_list_item(ref_to_delete, &refs_to_delete) {
 		if (remove_entry(packed, ref_to_delete->string) == -1)
 			die("internal error");
+		string_list_append(&packed_refs_touched, ref_to_delete->string);
 	}
 
 	/* Write what remains */
@@ -0,0 +1,872 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "varint.h"
+#include "reftable.h"
+
+#define REFTABLE_HEADER_SIZE 24
+#define REFTABLE_FOOTER_SIZE (4 + 8 + 8 + 20)
+
+#define REFTABLE_BLOCK_REFS 'r'
+#define REFTABLE_BLOCK_INDEX 'i'
+
+#define REFTABLE_MAX_BLOCK_LEN 0xffffff
+#define REFTABLE_MAX_RESTARTS 0xffff
+
+static uint32_t get_be24(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+static void put_be24(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 16;
+	p[1] = v >> 8;
+	p[2] = v;
+}
+
+static void put_be16(unsigned char *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static void put_be64(unsigned char *p, uint64_t v)
+{
+	put_be32(p, v >> 32);
+	put_be32(p + 4, v);
+}
+
+static NORETURN void die_corrupt(const struct reftable *t)
+{
+	die("reftable %s is corrupt", t->name);
+}
+
+static struct reftable *reftable_open(const char *dir, const char *name)
+{
+	struct reftable *t;
+	const unsigned char *footer;
+	char *path = xstrfmt("%s/%s", dir, name);
+	struct stat st;
+	size_t size;
+	int fd;
+
+	fd = git_open_noatime(path);
+	free(path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		int save_errno = errno;
+		close(fd);
+		errno = save_errno;
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+
+	t = xcalloc(1, sizeof(*t) + strlen(name) + 1);
+	strcpy(t->name, name);
+	if (size < REFTABLE_HEADER_SIZE + REFTABLE_FOOTER_SIZE) {
+		close(fd);
+		die_corrupt(t);
+	}
+	t->data = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	t->data_len = size;
+	close(fd);
+
+	footer = t->data + size - REFTABLE_FOOTER_SIZE;
+	if (get_be32(t->data) != REFTABLE_SIGNATURE ||
+	    get_be32(footer) != REFTABLE_SIGNATURE)
+		die_corrupt(t);
+	if (t->data[4] != REFTABLE_VERSION)
+		die("reftable %s has unknown version %d", t->name, t->data[4]);
+
+	t->block_size = get_be24(t->data + 5);
+	t->min_update_index = get_be64(t->data + 8);
+	t->max_update_index = get_be64(t->data + 16);
+	t->index_offset = get_be64(footer + 4);
+	t->num_records = get_be64(footer + 12);
+
+	if (t->index_offset &&
+	    (t->index_offset < REFTABLE_HEADER_SIZE ||
+	     t->index_offset >= size - REFTABLE_FOOTER_SIZE))
+		die_corrupt(t);
+	t->refs_end = t->index_offset ? t->index_offset
+				      : size - REFTABLE_FOOTER_SIZE;
+	return t;
+}
+
+static void reftable_close(struct reftable *t)
+{
+	munmap((void *)t->data, t->data_len);
+	free(t);
+}
+
+struct block_reader {
+	struct reftable *t;
+	int type;
+	size_t off; /* start of the block */
+	size_t len;
+	size_t records_end; /* start of the restart table */
+	uint32_t restart_count;
+};
+
+static void block_init(struct block_reader *b, struct reftable *t,
+		       size_t off, size_t end)
+{
+	const unsigned char *p = t->data + off;
+
+	if (off + 4 > end)
+		die_corrupt(t);
+	b->t = t;
+	b->off = off;
+	b->type = p[0];
+	b->len = get_be24(p + 1);
+	if (b->len < 4 + 2 || off + b->len > end)
+		die_corrupt(t);
+	b->restart_count = get_be16(p + b->len - 2);
+	if (4 + 3 * (size_t)b->restart_count + 2 > b->len)
+		die_corrupt(t);
+	b->records_end = off + b->len - 2 - 3 * b->restart_count;
+}
+
+static size_t block_restart(struct block_reader *b, uint32_t i)
+{
+	return b->off + get_be24(b->t->data + b->records_end + 3 * i);
+}
+
+/*
+ * Decode the record at "pos" of block "b" on top of the previous key
+ * in "key". Ref records point "value" at their object name(s), index
+ * records set "offset". Returns the position of the next record.
+ */
+static size_t decode_record(struct block_reader *b, size_t pos,
+			    struct strbuf *key, int *type,
+			    const unsigned char **value, uint64_t *offset)
+{
+	const unsigned char *p = b->t->data + pos;
+	const unsigned char *end = b->t->data + b->records_end;
+	uintmax_t prefix_len, suffix_len, x;
+
+	if (pos >= b->records_end)
+		die_corrupt(b->t);
+	prefix_len = decode_varint(&p);
+	x = decode_varint(&p);
+	suffix_len = x >> 3;
+	*type = x & 7;
+	if (prefix_len > key->len || p > end || suffix_len > end - p)
+		die_corrupt(b->t);
+	strbuf_setlen(key, prefix_len);
+	strbuf_add(key, p, suffix_len);
+	p += suffix_len;
+
+	*value = NULL;
+	if (b->type == REFTABLE_BLOCK_INDEX) {
+		*offset = decode_varint(&p);
+	} else {
+		switch (*type) {
+		case REFTABLE_DELETION:
+			break;
+		case REFTABLE_VALUE:
+			*value = p;
+			p += 20;
+			break;
+		case REFTABLE_VALUE_PEELED:
+			*value = p;
+			p += 40;
+			break;
+		default:
+			die_corrupt(b->t);
+		}
+	}
+	if (p > end)
+		die_corrupt(b->t);
+	return p - b->t->data;
+}
+
+/*
+ * Find the first record of block "b" whose key is at least "target".
+ * Returns 1 and fills in the record (and the position of the next
+ * one in "next"), or 0 if all keys of the block are smaller.
+ */
+static int block_seek(struct block_reader *b, const char *target,
+		      struct strbuf *key, size_t *next, int *type,
+		      const unsigned char **value, uint64_t *offset)
+{
+	uint32_t lo = 0, hi = b->restart_count;
+	size_t pos;
+
+	/* restart records store their whole key; bisect over them */
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+
+		strbuf_reset(key);
+		decode_record(b, block_restart(b, mi), key, type, value, offset);
+		if (strcmp(key->buf, target) <= 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+
+	pos = lo ? block_restart(b, lo - 1) : b->off + 4;
+	strbuf_reset(key);
+	while (pos < b->records_end) {
+		pos = decode_record(b, pos, key, type, value, offset);
+		if (strcmp(key->buf, target) >= 0) {
+			*next = pos;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Iterates over the ref records of one table, including deletions. */
+struct table_iter {
+	struct reftable *t;
+	struct block_reader b;
+	size_t next;
+	int valid;
+
+	/* the current record */
+	struct strbuf key;
+	int type;
+	const unsigned char *value;
+};
+
+static void table_iter_init(struct table_iter *it, struct reftable *t)
+{
+	memset(it, 0, sizeof(*it));
+	it->t = t;
+	strbuf_init(&it->key, 0);
+}
+
+static void table_iter_release(struct table_iter *it)
+{
+	strbuf_release(&it->key);
+}
+
+static void table_iter_next(struct table_iter *it)
+{
+	struct reftable *t = it->t;
+	uint64_t unused;
+
+	while (it->next >= it->b.records_end) {
+		size_t off = it->b.off + it->b.len;
+
+		if (off >= t->refs_end) {
+			it->valid = 0;
+			return;
+		}
+		block_init(&it->b, t, off, t->refs_end);
+		if (it->b.type != REFTABLE_BLOCK_REFS)
+			die_corrupt(t);
+		it->next = off + 4;
+		strbuf_reset(&it->key);
+	}
+	it->next = decode_record(&it->b, it->next, &it->key,
+				 &it->type, &it->value, &unused);
+	it->valid = 1;
+}
+
+/* Position "it" at the first record whose key is at least "target". */
+static void table_iter_seek(struct table_iter *it, const char *target)
+{
+	struct reftable *t = it->t;
+	size_t block_off = REFTABLE_HEADER_SIZE;
+	uint64_t offset;
+
+	it->valid = 0;
+	if (t->refs_end <= REFTABLE_HEADER_SIZE)
+		return; /* no refs at all */
+
+	if (t->index_offset) {
+		struct block_reader index;
+		struct strbuf key = STRBUF_INIT;
+		const unsigned char *unused;
+		size_t next;
+		int type, found;
+
+		block_init(&index, t, t->index_offset,
+			   t->data_len - REFTABLE_FOOTER_SIZE);
+		if (index.type != REFTABLE_BLOCK_INDEX)
+			die_corrupt(t);
+		found = block_seek(&index, target, &key, &next, &type,
+				   &unused, &offset);
+		strbuf_release(&key);
+		if (!found)
+			return; /* past the last key of the table */
+		if (offset < REFTABLE_HEADER_SIZE || offset >= t->refs_end)
+			die_corrupt(t);
+		block_off = offset;
+	}
+
+	block_init(&it->b, t, block_off, t->refs_end);
+	if (it->b.type != REFTABLE_BLOCK_REFS)
+		die_corrupt(t);
+	if (block_seek(&it->b, target, &it->key, &it->next,
+		       &it->type, &it->value, &offset)) {
+		it->valid = 1;
+		return;
+	}
+	it->next = it->b.records_end;
+	table_iter_next(it);
+}
+
+/*
+ * Iterates over the union of several tables; of several records with
+ * the same key, the one from the newest table wins.
+ */
+struct merged_iter {
+	struct table_iter *its;
+	int nr;
+
+	struct strbuf key;
+	int type;
+	const unsigned char *value;
+};
+
+static void merged_iter_init(struct merged_iter *mi,
+			     struct reftable **tables, int nr)
+{
+	int i;
+
+	mi->its = xcalloc(nr, sizeof(*mi->its));
+	mi->nr = nr;
+	for (i = 0; i < nr; i++)
+		table_iter_init(&mi->its[i], tables[i]);
+	strbuf_init(&mi->key, 0);
+}
+
+static void merged_iter_release(struct merged_iter *mi)
+{
+	int i;
+
+	for (i = 0; i < mi->nr; i++)
+		table_iter_release(&mi->its[i]);
+	free(mi->its);
+	strbuf_release(&mi->key);
+}
+
+static void merged_iter_seek(struct merged_iter *mi, const char *target)
+{
+	int i;
+
+	for (i = 0; i < mi->nr; i++)
+		table_iter_seek(&mi->its[i], target);
+}
+
+static int merged_iter_next(struct merged_iter *mi)
+{
+	int i, best = -1;
+
+	for (i = 0; i < mi->nr; i++) {
+		if (!mi->its[i].valid)
+			continue;
+		if (best < 0 ||
+		    strcmp(mi->its[i].key.buf, mi->its[best].key.buf) <= 0)
+			best = i;
+	}
+	if (best < 0)
+		return 0;
+
+	strbuf_reset(&mi->key);
+	strbuf_addbuf(&mi->key, &mi->its[best].key);
+	mi->type = mi->its[best].type;
+	mi->value = mi->its[best].value;
+
+	for (i = 0; i < mi->nr; i++)
+		if (mi->its[i].valid && !strcmp(mi->its[i].key.buf, mi->key.buf))
+			table_iter_next(&mi->its[i]);
+	return 1;
+}
+
+static struct reftable_stack *reftable_stack_read(const char *dir, int *retry)
+{
+	struct reftable_stack *st;
+	struct strbuf line = STRBUF_INIT;
+	char *list = xstrfmt("%s/tables.list", dir);
+	FILE *f;
+	int alloc = 0;
+
+	f = fopen(list, "r");
+	if (!f) {
+		if (errno != ENOENT)
+			die_errno("unable to read %s", list);
+		free(list);
+		return NULL;
+	}
+
+	st = xcalloc(1, sizeof(*st));
+	st->dir = xstrdup(dir);
+	stat_validity_update(&st->validity, fileno(f));
+	while (strbuf_getline(&line, f, '\n') != EOF) {
+		struct reftable *t;
+
+		if (!line.len)
+			continue;
+		t = reftable_open(dir, line.buf);
+		if (!t) {
+			/* compacted away since we read the list? */
+			if (errno == ENOENT) {
+				*retry = 1;
+				break;
+			}
+			die_errno("unable to open reftable %s/%s", dir, line.buf);
+		}
+		ALLOC_GROW(st->tables, st->nr + 1, alloc);
+		st->tables[st->nr++] = t;
+	}
+	fclose(f);
+	strbuf_release(&line);
+	free(list);
+
+	if (*retry) {
+		reftable_stack_close(st);
+		return NULL;
+	}
+	return st;
+}
+
+struct reftable_stack *reftable_stack_open(const char *dir)
+{
+	int tries;
+
+	for (tries = 0; tries < 5; tries++) {
+		int retry = 0;
+		struct reftable_stack *st = reftable_stack_read(dir, &retry);
+		if (!retry)
+			return st;
+	}
+	die("unable to read a consistent set of reftables from %s", dir);
+}
+
+void reftable_stack_close(struct reftable_stack *st)
+{
+	int i;
+
+	if (!st)
+		return;
+	for (i = 0; i < st->nr; i++)
+		reftable_close(st->tables[i]);
+	free(st->tables);
+	stat_validity_clear(&st->validity);
+	free(st->dir);
+	free(st);
+}
+
+int reftable_stack_is_current(struct reftable_stack *st)
+{
+	char *list = xstrfmt("%s/tables.list", st->dir);
+	int ret = stat_validity_check(&st->validity, list);
+
+	free(list);
+	return ret;
+}
+
+int reftable_stack_lookup(struct reftable_stack *st, const char *refname,
+			  unsigned char *sha1, unsigned char *peeled)
+{
+	int i;
+
+	for (i = st->nr - 1; i >= 0; i--) {
+		struct table_iter it;
+		int ret = -1;
+
+		table_iter_init(&it, st->tables[i]);
+		table_iter_seek(&it, refname);
+		if (!it.valid || strcmp(it.key.buf, refname)) {
+			table_iter_release(&it);
+			continue;
+		}
+		if (it.type != REFTABLE_DELETION) {
+			hashcpy(sha1, it.value);
+			if (it.type == REFTABLE_VALUE_PEELED)
+				hashcpy(peeled, it.value + 20);
+			else
+				hashclr(peeled);
+			ret = 0;
+		}
+		table_iter_release(&it);
+		return ret;
+	}
+	return -1;
+}
+
+int reftable_stack_for_each_ref(struct reftable_stack *st, const char *prefix,
+				each_reftable_ref_fn fn, void *cb_data)
+{
+	struct merged_iter mi;
+	int ret = 0;
+
+	merged_iter_init(&mi, st->tables, st->nr);
+	merged_iter_seek(&mi, prefix);
+	while (merged_iter_next(&mi)) {
+		if (!starts_with(mi.key.buf, prefix))
+			break;
+		if (mi.type == REFTABLE_DELETION)
+			continue;
+		ret = fn(mi.key.buf, mi.value,
+			 mi.type == REFTABLE_VALUE_PEELED ? mi.value + 20 : NULL,
+			 cb_data);
+		if (ret)
+			break;
+	}
+	merged_iter_release(&mi);
+	return ret;
+}
+
+struct reftable_writer {
+	struct sha1file *f;
+	struct strbuf tmp_path;
+	uint64_t min_update_index, max_update_index;
+	uint64_t offset;
+	uint64_t num_records;
+
+	/* the block being built */
+	struct strbuf block;
+	uint32_t *restarts;
+	int restarts_nr, restarts_alloc;
+	int block_records;
+	struct strbuf last_key;
+
+	/* last key and offset of every ref block, for the index */
+	char **index_keys;
+	uint64_t *index_offsets;
+	int index_nr, index_alloc, index_offsets_alloc;
+};
+
+static void writer_start_block(struct reftable_writer *w, int type)
+{
+	strbuf_reset(&w->block);
+	strbuf_addch(&w->block, type);
+	strbuf_add(&w->block, "\0\0\0", 3);
+	strbuf_reset(&w->last_key);
+	w->restarts_nr = 0;
+	w->block_records = 0;
+}
+
+static void writer_flush_block(struct reftable_writer *w)
+{
+	unsigned char buf[3];
+	int i;
+
+	if (w->restarts_nr > REFTABLE_MAX_RESTARTS)
+		die("too many records for a reftable block");
+	for (i = 0; i < w->restarts_nr; i++) {
+		put_be24(buf, w->restarts[i]);
+		strbuf_add(&w->block, buf, 3);
+	}
+	put_be16(buf, w->restarts_nr);
+	strbuf_add(&w->block, buf, 2);
+	if (w->block.len > REFTABLE_MAX_BLOCK_LEN)
+		die("reftable block too large");
+	put_be24((unsigned char *)w->block.buf + 1, w->block.len);
+
+	sha1write(w->f, w->block.buf, w->block.len);
+	if (w->block.buf[0] == REFTABLE_BLOCK_REFS) {
+		ALLOC_GROW(w->index_keys, w->index_nr + 1, w->index_alloc);
+		ALLOC_GROW(w->index_offsets, w->index_nr + 1,
+			   w->index_offsets_alloc);
+		w->index_keys[w->index_nr] = strbuf_detach(&w->last_key, NULL);
+		w->index_offsets[w->index_nr] = w->offset;
+		w->index_nr++;
+	}
+	w->offset += w->block.len;
+	strbuf_reset(&w->block);
+}
+
+static void encode_record(struct strbuf *out, const char *last_key,
+			  const char *key, int restart, int type,
+			  const unsigned char *value, size_t value_len)
+{
+	unsigned char varint[16];
+	size_t prefix_len = 0, key_len = strlen(key);
+
+	if (!restart)
+		while (last_key[prefix_len] &&
+		       last_key[prefix_len] == key[prefix_len])
+			prefix_len++;
+
+	strbuf_reset(out);
+	strbuf_add(out, varint, encode_varint(prefix_len, varint));
+	strbuf_add(out, varint,
+		   encode_varint(((uintmax_t)(key_len - prefix_len) << 3) | type,
+				 varint));
+	strbuf_add(out, key + prefix_len, key_len - prefix_len);
+	if (value_len)
+		strbuf_add(out, value, value_len);
+}
+
+static void writer_add(struct reftable_writer *w, const char *key, int type,
+		       const unsigned char *value, size_t value_len)
+{
+	struct strbuf rec = STRBUF_INIT;
+	int restart = !(w->block_records % REFTABLE_RESTART_INTERVAL);
+
+	encode_record(&rec, w->last_key.buf, key, restart, type,
+		      value, value_len);
+
+	/* ref blocks are cut at the block size; the index is one block */
+	if (w->block.buf[0] == REFTABLE_BLOCK_REFS && w->block_records &&
+	    w->block.len + rec.len + 3 * (w->restarts_nr + restart) + 2 >
+	    REFTABLE_DEFAULT_BLOCK_SIZE) {
+		writer_flush_block(w);
+		writer_start_block(w, REFTABLE_BLOCK_REFS);
+		restart = 1;
+		encode_record(&rec, "", key, restart, type, value, value_len);
+	}
+
+	if (restart) {
+		ALLOC_GROW(w->restarts, w->restarts_nr + 1, w->restarts_alloc);
+		w->restarts[w->restarts_nr++] = w->block.len;
+	}
+	strbuf_addbuf(&w->block, &rec);
+	w->block_records++;
+	strbuf_reset(&w->last_key);
+	strbuf_addstr(&w->last_key, key);
+	strbuf_release(&rec);
+}
+
+static void writer_add_ref(struct reftable_writer *w, const char *refname,
+			   int type, const unsigned char *value)
+{
+	size_t len = type == REFTABLE_VALUE_PEELED ? 40 :
+		     type == REFTABLE_VALUE ? 20 : 0;
+
+	writer_add(w, refname, type, value, len);
+	w->num_records++;
+}
+
+static void writer_begin(struct reftable_writer *w, const char *dir,
+			 uint64_t min_update_index, uint64_t max_update_index)
+{
+	unsigned char header[REFTABLE_HEADER_SIZE];
+	int fd;
+
+	memset(w, 0, sizeof(*w));
+	strbuf_init(&w->tmp_path, 0);
+	strbuf_init(&w->block, 0);
+	strbuf_init(&w->last_key, 0);
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+
+	strbuf_addf(&w->tmp_path, "%s/tmp_reftable_XXXXXX", dir);
+	fd = git_mkstemp_mode(w->tmp_path.buf, 0444);
+	if (fd < 0)
+		die_errno("unable to create '%s'", w->tmp_path.buf);
+	w->f = sha1fd(fd, w->tmp_path.buf);
+
+	put_be32(header, REFTABLE_SIGNATURE);
+	header[4] = REFTABLE_VERSION;
+	put_be24(header + 5, REFTABLE_DEFAULT_BLOCK_SIZE);
+	put_be64(header + 8, min_update_index);
+	put_be64(header + 16, max_update_index);
+	sha1write(w->f, header, sizeof(header));
+	w->offset = sizeof(header);
+
+	writer_start_block(w, REFTABLE_BLOCK_REFS);
+}
+
+/*
+ * Finish the table and move it into place. Returns its file name
+ * (relative to "dir"), or NULL with errno set.
+ */
+static char *writer_commit(struct reftable_writer *w, const char *dir)
+{
+	unsigned char footer[4 + 8 + 8];
+	uint64_t index_offset = 0;
+	char *name, *path;
+	int i;
+
+	if (w->block_records)
+		writer_flush_block(w);
+
+	if (w->index_nr > 1) {
+		index_offset = w->offset;
+		writer_start_block(w, REFTABLE_BLOCK_INDEX);
+		for (i = 0; i < w->index_nr; i++) {
+			unsigned char varint[16];
+			writer_add(w, w->index_keys[i], 0, varint,
+				   encode_varint(w->index_offsets[i], varint));
+		}
+		writer_flush_block(w);
+	}
+
+	put_be32(footer, REFTABLE_SIGNATURE);
+	put_be64(footer + 4, index_offset);
+	put_be64(footer + 12, w->num_records);
+	sha1write(w->f, footer, sizeof(footer));
+	sha1close(w->f, NULL, CSUM_CLOSE | CSUM_FSYNC);
+
+	name = xstrfmt("%012"PRIuMAX"-%012"PRIuMAX".ref",
+		       (uintmax_t)w->min_update_index,
+		       (uintmax_t)w->max_update_index);
+	path = xstrfmt("%s/%s", dir, name);
+	if (rename(w->tmp_path.buf, path)) {
+		int save_errno = errno;
+		unlink_or_warn(w->tmp_path.buf);
+		free(name);
+		name = NULL;
+		errno = save_errno;
+	}
+	free(path);
+
+	for (i = 0; i < w->index_nr; i++)
+		free(w->index_keys[i]);
+	free(w->index_keys);
+	free(w->index_offsets);
+	free(w->restarts);
+	strbuf_release(&w->block);
+	strbuf_release(&w->last_key);
+	strbuf_release(&w->tmp_path);
+	return name;
+}
+
+static int update_cmp(const void *a_, const void *b_)
+{
+	const struct reftable_update *a = a_, *b = b_;
+	return strcmp(a->refname, b->refname);
+}
+
+/*
+ * Merge tables [first, st->nr) into a single new table. Deletions are
+ * only needed to shadow refs in older tables, so they are dropped
+ * when merging the base of the stack.
+ */
+static char *merge_tables(struct reftable_stack *st, int first)
+{
+	struct reftable_writer w;
+	struct merged_iter mi;
+
+	writer_begin(&w, st->dir, st->tables[first]->min_update_index,
+		     st->tables[st->nr - 1]->max_update_index);
+	merged_iter_init(&mi, st->tables + first, st->nr - first);
+	merged_iter_seek(&mi, "");
+	while (merged_iter_next(&mi)) {
+		if (!first && mi.type == REFTABLE_DELETION)
+			continue;
+		writer_add_ref(&w, mi.key.buf, mi.type, mi.value);
+	}
+	merged_iter_release(&mi);
+	return writer_commit(&w, st->dir);
+}
+
+/*
+ * Keep the stack geometric: merge the newest tables for as long as
+ * the next older table is not at least twice their combined size.
+ */
+static int first_table_to_merge(struct reftable_stack *st)
+{
+	int i = st->nr - 1;
+	uint64_t sum = st->tables[i]->data_len;
+
+	while (i > 0 && st->tables[i - 1]->data_len <= 2 * sum) {
+		i--;
+		sum += st->tables[i]->data_len;
+	}
+	return i;
+}
+
+static void unlink_table(const char *dir, const char *name)
+{
+	char *path = xstrfmt("%s/%s", dir, name);
+	unlink_or_warn(path);
+	free(path);
+}
+
+int reftable_stack_add(const char *dir, struct lock_file *lock,
+		       struct reftable_update *updates, int nr,
+		       int compact_all)
+{
+	struct reftable_stack *st;
+	struct reftable_writer w;
+	struct reftable *t;
+	struct strbuf list = STRBUF_INIT;
+	char *name, *merged = NULL;
+	uint64_t update_index;
+	int i, first, alloc, save_errno;
+
+	st = reftable_stack_open(dir);
+	if (!st) {
+		st = xcalloc(1, sizeof(*st));
+		st->dir = xstrdup(dir);
+	}
+	update_index = st->nr ? st->tables[st->nr - 1]->max_update_index + 1 : 1;
+
+	qsort(updates, nr, sizeof(*updates), update_cmp);
+	writer_begin(&w, dir, update_index, update_index);
+	for (i = 0; i < nr; i++) {
+		if (i && !strcmp(updates[i - 1].refname, updates[i].refname))
+			die("BUG: duplicate reftable update for %s",
+			    updates[i].refname);
+		if (!st->nr && updates[i].type == REFTABLE_DELETION)
+			continue;
+		if (updates[i].type == REFTABLE_VALUE_PEELED) {
+			unsigned char value[40];
+			hashcpy(value, updates[i].sha1);
+			hashcpy(value + 20, updates[i].peeled);
+			writer_add_ref(&w, updates[i].refname,
+				       updates[i].type, value);
+		} else {
+			writer_add_ref(&w, updates[i].refname,
+				       updates[i].type, updates[i].sha1);
+		}
+	}
+	name = writer_commit(&w, dir);
+	if (!name)
+		goto fail;
+
+	t = reftable_open(dir, name);
+	if (!t)
+		die_errno("unable to open reftable %s/%s", dir, name);
+	alloc = st->nr;
+	ALLOC_GROW(st->tables, st->nr + 1, alloc);
+	st->tables[st->nr++] = t;
+
+	first = compact_all ? 0 : first_table_to_merge(st);
+	if (first < st->nr - 1) {
+		merged = merge_tables(st, first);
+		if (!merged)
+			goto fail_unlink;
+	} else {
+		first = st->nr;
+	}
+
+	for (i = 0; i < first; i++)
+		strbuf_addf(&list, "%s\n", st->tables[i]->name);
+	if (merged)
+		strbuf_addf(&list, "%s\n", merged);
+	if (write_in_full(lock->fd, list.buf, list.len) != list.len ||
+	    commit_lock_file(lock)) {
+		if (merged)
+			unlink_table(dir, merged);
+		goto fail_unlink;
+	}
+
+	/* Readers that raced with us will retry with the new list. */
+	for (i = first; merged && i < st->nr; i++)
+		unlink_table(dir, st->tables[i]->name);
+
+	strbuf_release(&list);
+	free(name);
+	free(merged);
+	reftable_stack_close(st);
+	return 0;
+
+fail_unlink:
+	save_errno = errno;
+	unlink_table(dir, name);
+	errno = save_errno;
+fail:
+	save_errno = errno;
+	rollback_lock_file(lock);
+	strbuf_release(&list);
+	free(name);
+	free(merged);
+	reftable_stack_close(st);
+	errno = save_errno;
+	return -1;
+}
@@ -0,0 +1,109 @@
+#ifndef REFTABLE_H
+#define REFTABLE_H
+
+/*
+ * A reftable is an immutable, sorted, binary table of references. The
+ * records are stored prefix-compressed in blocks of roughly fixed size,
+ * with "restart points" that store a full name so that a block can be
+ * binary searched, and an index block that maps the last name of every
+ * block to its offset. A lookup therefore costs O(log n) and touches
+ * only a couple of blocks.
+ *
+ * Tables are arranged in a stack in "$GIT_DIR/reftable/": the file
+ * "tables.list" names the tables, oldest first. A table higher in the
+ * stack overrides the records of the tables below it; a deletion is
+ * recorded as a tombstone. Updating refs thus means writing a small new
+ * table and rewriting "tables.list", instead of rewriting every ref;
+ * tables are merged every now and then to keep the stack short.
+ *
+ * See Documentation/technical/reftable.txt for the file format.
+ */
+
+#define REFTABLE_SIGNATURE 0x52454654 /* "REFT" */
+#define REFTABLE_VERSION 1
+#define REFTABLE_DEFAULT_BLOCK_SIZE 4096
+#define REFTABLE_RESTART_INTERVAL 16
+
+/* Value types of a record in a ref block */
+#define REFTABLE_DELETION 0
+#define REFTABLE_VALUE 1 /* sha1; known not to peel */
+#define REFTABLE_VALUE_PEELED 2 /* sha1 followed by its peeled value */
+
+struct reftable {
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t block_size;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+	uint64_t num_records;
+
+	/* ref blocks live in [header, refs_end); the index follows */
+	size_t refs_end;
+	size_t index_offset; /* 0 if the table has no index block */
+
+	char name[FLEX_ARRAY];
+};
+
+struct reftable_stack {
+	char *dir;
+	int nr;
+	struct reftable **tables; /* oldest first */
+
+	/* stat data of "tables.list" at the time it was read */
+	struct stat_validity validity;
+};
+
+/* A ref to be written to a new table */
+struct reftable_update {
+	const char *refname;
+	int type;
+	unsigned char sha1[20];
+	unsigned char peeled[20];
+};
+
+/*
+ * Open the stack in "dir". Returns NULL if "dir/tables.list" does not
+ * exist; dies if a table it names is corrupt.
+ */
+extern struct reftable_stack *reftable_stack_open(const char *dir);
+extern void reftable_stack_close(struct reftable_stack *st);
+
+/* Does "st" still reflect the tables.list on disk? */
+extern int reftable_stack_is_current(struct reftable_stack *st);
+
+/*
+ * Look "refname" up in the stack. Returns 0 and fills "sha1" (and
+ * "peeled", with null_sha1 if the ref does not peel) if found, or -1
+ * if there is no such ref.
+ */
+extern int reftable_stack_lookup(struct reftable_stack *st, const char *refname,
+				 unsigned char *sha1, unsigned char *peeled);
+
+typedef int each_reftable_ref_fn(const char *refname,
+				 const unsigned char *sha1,
+				 const unsigned char *peeled,
+				 void *cb_data);
+
+/*
+ * Call "fn" for every ref starting with "prefix", in sorted order,
+ * with the newest value of each ref. "peeled" is NULL for refs that
+ * do not peel. Stops and returns the value of "fn" if it is nonzero.
+ */
+extern int reftable_stack_for_each_ref(struct reftable_stack *st,
+				       const char *prefix,
+				       each_reftable_ref_fn fn, void *cb_data);
+
+/*
+ * Add a table holding "updates" to the stack in "dir", whose
+ * "tables.list" must be locked by "lock"; the lock is committed on
+ * success and rolled back on failure. Tables are merged as needed to
+ * keep the stack logarithmic in size; with "compact_all", the whole
+ * stack is merged into a single table. Returns 0 on success, or -1
+ * with errno set.
+ */
+extern int reftable_stack_add(const char *dir, struct lock_file *lock,
+			      struct reftable_update *updates, int nr,
+			      int compact_all);
+
+#endif
@@ -11,6 +11,7 @@
 #include "argv-array.h"
 #include "credential.h"
 #include "sha1-array.h"
+#include "protocol.h"
 
 static struct remote *remote;
 /* always ends with a trailing slash */
@@ -118,6 +119,7 @@ struct discovery {
 	size_t len;
 	struct ref *refs;
 	struct sha1_array shallow;
+	enum protocol_version version;
 	unsigned proto_git : 1;
 };
 static struct discovery *last_discovery;
@@ -125,11 +127,30 @@ static struct discovery *last_discovery;
 static struct ref *parse_git_refs(struct discovery *heads, int for_push)
 {
 	struct ref *list = NULL;
-	get_remote_heads(-1, heads->buf, heads->len, &list,
+	struct packet_reader reader;
+
+	packet_reader_init(&reader, -1, heads->buf, heads->len,
+			   PACKET_READ_CHOMP_NEWLINE |
+			   PACKET_READ_GENTLE_ON_EOF);
+	get_remote_heads(&reader, &list,
 			 for_push ? REF_NORMAL : 0, NULL, &heads->shallow);
 	return list;
 }
 
+/* Does the advertisement start with "version 2"?  Nothing is consumed. */
+static enum protocol_version discover_http_version(struct discovery *heads)
+{
+	struct packet_reader reader;
+
+	packet_reader_init(&reader, -1, heads->buf, heads->len,
+			   PACKET_READ_CHOMP_NEWLINE |
+			   PACKET_READ_GENTLE_ON_EOF);
+	if (packet_reader_peek(&reader) == PACKET_READ_NORMAL &&
+	    !strcmp(reader.line, "version 2"))
+		return protocol_v2;
+	return protocol_v0;
+}
+
 static struct ref *parse_info_refs(struct discovery *heads)
 {
 	char *data, *start, *mid;
@@ -232,6 +253,7 @@ static struct discovery* discover_refs(const char *service, int for_push)
 	struct discovery *last = last_discovery;
 	int http_ret, maybe_smart = 0;
 	struct http_get_options options;
+	struct string_list extra_headers = STRING_LIST_INIT_DUP;
 
 	if (last && !strcmp(service, last->service))
 		return last;
@@ -256,6 +278,18 @@ static struct discovery* discover_refs(const char *service, int for_push)
 	options.no_cache = 1;
 	options.keep_error = 1;
 
+	/* only upload-pack knows about protocol v2 */
+	if (get_protocol_version_config() == protocol_v2 &&
+	    !strcmp(service, "git-upload-pack")) {
+		struct strbuf protocol_header = STRBUF_INIT;
+
+		strbuf_addf(&protocol_header, GIT_PROTOCOL_HEADER ": version=%d",
+			    protocol_v2);
+		string_list_append(&extra_headers, protocol_header.buf);
+		strbuf_release(&protocol_header);
+		options.extra_headers = &extra_headers;
+	}
+
 	http_ret = http_get_strbuf(refs_url.buf, &buffer, &options);
 	switch (http_ret) {
 	case HTTP_OK:
@@ -302,9 +336,13 @@ static struct discovery* discover_refs(const char *service, int for_push)
 			;
 
 		last->proto_git = 1;
+		last->version = discover_http_version(last);
 	}
 
-	if (last->proto_git)
+	/* a v2 server lists its refs only when asked to */
+	if (last->version == protocol_v2)
+		;
+	else if (last->proto_git)
 		last->refs = parse_git_refs(last, for_push);
 	else
 		last->refs = parse_info_refs(last);
@@ -315,6 +353,7 @@ static struct discovery* discover_refs(const char *service, int for_push)
 	strbuf_release(&charset);
 	strbuf_release(&effective_url);
 	strbuf_release(&buffer);
+	string_list_clear(&extra_headers, 0);
 	last_discovery = last;
 	return last;
 }
@@ -351,6 +390,7 @@ struct rpc_state {
 	char *service_url;
 	char *hdr_content_type;
 	char *hdr_accept;
+	char *hdr_protocol;
 	char *buf;
 	size_t alloc;
 	size_t len;
@@ -360,8 +400,52 @@ struct rpc_state {
 	struct strbuf result;
 	unsigned gzip_request : 1;
 	unsigned initial_buffer : 1;
+	/*
+	 * Pass the packets of the request on as they are, up to and
+	 * including the flush that ends it (stateless-connect), rather
+	 * than unwrapping them from the pkt-line framing of the
+	 * --stateless-rpc clients.
+	 */
+	unsigned write_line_lengths : 1;
+	unsigned flush_read_but_not_sent : 1;
 };
 
+/*
+ * Read the next part of the request from the client into "buf".
+ * Returns the number of bytes read, or 0 at the end of the request.
+ */
+static int rpc_read_from_out(struct rpc_state *rpc, char *buf, size_t size)
+{
+	int pktlen;
+
+	if (!rpc->write_line_lengths)
+		return packet_read(rpc->out, NULL, NULL, buf, size, 0);
+
+	if (rpc->flush_read_but_not_sent) {
+		rpc->flush_read_but_not_sent = 0;
+		return 0;
+	}
+	if (size < 4)
+		die("BUG: no room for a packet header");
+	switch (packet_read_with_status(rpc->out, NULL, NULL, buf + 4,
+					size - 4, &pktlen,
+					PACKET_READ_GENTLE_ON_EOF)) {
+	case PACKET_READ_EOF:
+		return 0;
+	case PACKET_READ_FLUSH:
+		memcpy(buf, "0000", 4);
+		rpc->flush_read_but_not_sent = 1;
+		return 4;
+	case PACKET_READ_DELIM:
+		memcpy(buf, "0001", 4);
+		return 4;
+	case PACKET_READ_NORMAL:
+		break;
+	}
+	set_packet_header(buf, pktlen + 4);
+	return pktlen + 4;
+}
+
 static size_t rpc_out(void *ptr, size_t eltsize,
 		size_t nmemb, void *buffer_)
 {
@@ -371,7 +455,7 @@ static size_t rpc_out(void *ptr, size_t eltsize,
 
 	if (!avail) {
 		rpc->initial_buffer = 0;
-		avail = packet_read(rpc->out, NULL, NULL, rpc->buf, rpc->alloc, 0);
+		avail = rpc_read_from_out(rpc, rpc->buf, rpc->alloc);
 		if (!avail)
 			return 0;
 		rpc->pos = 0;
@@ -490,7 +574,7 @@ static int post_rpc(struct rpc_state *rpc)
 			break;
 		}
 
-		n = packet_read(rpc->out, NULL, NULL, buf, left, 0);
+		n = rpc_read_from_out(rpc, buf, left);
 		if (!n)
 			break;
 		rpc->len += n;
@@ -515,6 +599,8 @@ static int post_rpc(struct rpc_state *rpc)
 	headers = curl_slist_append(headers, rpc->hdr_accept);
 	headers = curl_slist_append(headers, needs_100_continue ?
 		"Expect: 100-continue" : "Expect:");
+	if (rpc->hdr_protocol)
+		headers = curl_slist_append(headers, rpc->hdr_protocol);
 
 retry:
 	slot = get_active_slot();
@@ -685,6 +771,88 @@ static int rpc_service(struct rpc_state *rpc, struct discovery *heads)
 	return err;
 }
 
+/*
+ * Give the caller a full-duplex connection to a protocol v2
+ * upload-pack, by turning each request it writes into a POST and
+ * copying the response back.  If the server does not speak v2, tell
+ * the caller to fall back to the other commands.
+ */
+static int stateless_connect(const char *service_name)
+{
+	struct discovery *discover;
+	struct rpc_state rpc;
+	struct strbuf buf = STRBUF_INIT;
+
+	discover = discover_refs(service_name, 0);
+	if (discover->version != protocol_v2) {
+		printf("fallback\n");
+		fflush(stdout);
+		return -1;
+	}
+	/* the connection is established */
+	printf("\n");
+	fflush(stdout);
+
+	memset(&rpc, 0, sizeof(rpc));
+	rpc.service_name = service_name;
+	strbuf_addf(&buf, "%s%s", url.buf, service_name);
+	rpc.service_url = strbuf_detach(&buf, NULL);
+	strbuf_addf(&buf, "Content-Type: application/x-%s-request",
+		    service_name);
+	rpc.hdr_content_type = strbuf_detach(&buf, NULL);
+	strbuf_addf(&buf, "Accept: application/x-%s-result", service_name);
+	rpc.hdr_accept = strbuf_detach(&buf, NULL);
+	strbuf_addf(&buf, GIT_PROTOCOL_HEADER ": version=%d", protocol_v2);
+	rpc.hdr_protocol = strbuf_detach(&buf, NULL);
+	rpc.alloc = http_post_buffer;
+	rpc.buf = xmalloc(rpc.alloc);
+	rpc.in = 1;
+	rpc.out = 0;
+	rpc.write_line_lengths = 1;
+
+	/* the capability advertisement came with the discovery */
+	write_or_die(rpc.in, discover->buf, discover->len);
+
+	/* one POST per request, until the caller hangs up or says bye */
+	for (;;) {
+		rpc.pos = 0;
+		rpc.len = rpc_read_from_out(&rpc, rpc.buf, rpc.alloc);
+		if (!rpc.len || rpc.flush_read_but_not_sent)
+			break;
+		if (post_rpc(&rpc))
+			exit(1);
+	}
+
+	free(rpc.service_url);
+	free(rpc.hdr_content_type);
+	free(rpc.hdr_accept);
+	free(rpc.hdr_protocol);
+	free(rpc.buf);
+	return 0;
+}
+
+/*
+ * "get <url> <path>": download url to path, resuming what an earlier,
+ * interrupted "get" of the same path left behind.
+ */
+static void get_file(const char *arg)
+{
+	struct strbuf url = STRBUF_INIT;
+	const char *path = strchr(arg, ' ');
+
+	if (!path || !path[1])
+		die("remote-curl: get requires a url and a path");
+	strbuf_add(&url, arg, path - arg);
+	path++;
+
+	if (http_get_file(url.buf, path, NULL) != HTTP_OK)
+		die("remote-curl: unable to get '%s': %s", url.buf, curl_errorstr);
+	strbuf_release(&url);
+
+	printf("\n");
+	fflush(stdout);
+}
+
 static int fetch_dumb(int nr_heads, struct ref **to_fetch)
 {
 	struct walker *walker;
@@ -717,9 +885,9 @@ static int fetch_git(struct discovery *heads,
 {
 	struct rpc_state rpc;
 	struct strbuf preamble = STRBUF_INIT;
-	char *depth_arg = NULL;
+	char *depth_arg = NULL, *negotiation_arg = NULL;
 	int argc = 0, i, err;
-	const char *argv[17];
+	const char *argv[18];
 
 	argv[argc++] = "fetch-pack";
 	argv[argc++] = "--stateless-rpc";
@@ -747,6 +915,13 @@ static int fetch_git(struct discovery *heads,
 		depth_arg = strbuf_detach(&buf, NULL);
 		argv[argc++] = depth_arg;
 	}
+	if (remote->negotiation_algorithm) {
+		struct strbuf buf = STRBUF_INIT;
+		strbuf_addf(&buf, "--negotiation-algorithm=%s",
+			    remote->negotiation_algorithm);
+		negotiation_arg = strbuf_detach(&buf, NULL);
+		argv[argc++] = negotiation_arg;
+	}
 	argv[argc++] = url.buf;
 	argv[argc++] = NULL;
 
@@ -771,6 +946,7 @@ static int fetch_git(struct discovery *heads,
 	strbuf_release(&rpc.result);
 	strbuf_release(&preamble);
 	free(depth_arg);
+	free(negotiation_arg);
 	return err;
 }
 
@@ -989,6 +1165,9 @@ int main(int argc, const char **argv)
 		} else if (starts_with(buf.buf, "push ")) {
 			parse_push(&buf);
 
+		} else if (skip_prefix(buf.buf, "get ", &arg)) {
+			get_file(arg);
+
 		} else if (skip_prefix(buf.buf, "option ", &arg)) {
 			char *value = strchr(arg, ' ');
 			int result;
@@ -1012,8 +1191,13 @@ int main(int argc, const char **argv)
 			printf("option\n");
 			printf("push\n");
 			printf("check-connectivity\n");
+			printf("stateless-connect\n");
+			printf("get\n");
 			printf("\n");
 			fflush(stdout);
+		} else if (skip_prefix(buf.buf, "stateless-connect ", &arg)) {
+			if (!stateless_connect(arg))
+				break;
 		} else {
 			error("remote-curl: unknown command '%s' from git", buf.buf);
 			return 1;
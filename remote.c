@@ -8,6 +8,7 @@
 #include "tag.h"
 #include "string-list.h"
 #include "mergesort.h"
+#include "argv-array.h"
 
 enum map_direction { FROM_SRC, FROM_DST };
 
@@ -404,6 +405,14 @@ static int handle_config(const char *key, const char *value, void *cb)
 		remote->skip_default_update = git_config_bool(key, value);
 	else if (!strcmp(subkey, ".prune"))
 		remote->prune = git_config_bool(key, value);
+	else if (!strcmp(subkey, ".promisor"))
+		remote->promisor = git_config_bool(key, value);
+	else if (!strcmp(subkey, ".partialclonefilter"))
+		return git_config_string(&remote->partial_clone_filter,
+					 key, value);
+	else if (!strcmp(subkey, ".negotiationalgorithm"))
+		return git_config_string(&remote->negotiation_algorithm,
+					 key, value);
 	else if (!strcmp(subkey, ".url")) {
 		const char *v;
 		if (git_config_string(&v, key, value))
@@ -1777,6 +1786,27 @@ int get_fetch_map(const struct ref *remote_refs,
 	return 0;
 }
 
+void refspec_ref_prefixes(const struct refspec *refspec, int nr,
+			  struct argv_array *ref_prefixes)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		const struct refspec *item = &refspec[i];
+		const char *src = item->src && item->src[0] ? item->src : "HEAD";
+
+		if (item->exact_sha1)
+			continue;
+		if (item->pattern) {
+			const char *glob = strchr(src, '*');
+			argv_array_pushf(ref_prefixes, "%.*s",
+					 (int)(glob - src), src);
+		} else {
+			expand_ref_prefix(ref_prefixes, src);
+		}
+	}
+}
+
 int resolve_remote_symref(struct ref *ref, struct ref *list)
 {
 	if (!ref->symref)
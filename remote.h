@@ -44,6 +44,17 @@ struct remote {
 	int mirror;
 	int prune;
 
+	/*
+	 * This remote lazily provides the objects a partial clone
+	 * lacks; partial_clone_filter is the filter-spec to use when
+	 * fetching from it.
+	 */
+	int promisor;
+	const char *partial_clone_filter;
+
+	/* overrides fetch.negotiationAlgorithm for this remote */
+	const char *negotiation_algorithm;
+
 	const char *receivepack;
 	const char *uploadpack;
 
@@ -140,11 +151,29 @@ int check_ref_type(const struct ref *ref, int flags);
 void free_refs(struct ref *ref);
 
 struct sha1_array;
-extern struct ref **get_remote_heads(int in, char *src_buf, size_t src_len,
+struct packet_reader;
+struct argv_array;
+extern struct ref **get_remote_heads(struct packet_reader *reader,
 				     struct ref **list, unsigned int flags,
 				     struct sha1_array *extra_have,
 				     struct sha1_array *shallow);
 
+/*
+ * Protocol v2: ask the server for its refs with the "ls-refs"
+ * command, limited to those starting with one of ref_prefixes (all
+ * of them if it is NULL or empty), and read the answer.
+ */
+extern struct ref **get_remote_refs(int fd_out, struct packet_reader *reader,
+				    struct ref **list, int for_push,
+				    const struct argv_array *ref_prefixes);
+
+/*
+ * Add to ref_prefixes the prefixes of the remote refs the refspecs
+ * can possibly match, for use with get_remote_refs().
+ */
+extern void refspec_ref_prefixes(const struct refspec *refspec, int nr,
+				 struct argv_array *ref_prefixes);
+
 int resolve_remote_symref(struct ref *ref, struct ref *list);
 int ref_newer(const unsigned char *new_sha1, const unsigned char *old_sha1);
 
@@ -17,6 +17,8 @@
 #include "mailmap.h"
 #include "commit-slab.h"
 #include "dir.h"
+#include "commit-graph.h"
+#include "bloom.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -457,9 +459,95 @@ static void file_change(struct diff_options *options,
 	DIFF_OPT_SET(options, HAS_CHANGES);
 }
 
+static struct trace_key trace_bloom_filter = TRACE_KEY_INIT(BLOOM_FILTER);
+static int bloom_filter_checked;
+static int bloom_filter_definitely_not;
+static int bloom_filter_false_positive;
+
+static void trace_bloom_filter_statistics(void)
+{
+	trace_printf_key(&trace_bloom_filter,
+			 "bloom filter: %d checked, %d definitely not, %d false positive\n",
+			 bloom_filter_checked, bloom_filter_definitely_not,
+			 bloom_filter_false_positive);
+}
+
+/*
+ * The Bloom filters can answer for a pathspec of plain paths, which
+ * match the changed paths (or their leading directories) exactly.
+ */
+static void prepare_to_use_bloom_filter(struct rev_info *revs)
+{
+	const struct bloom_filter_settings *settings;
+	struct pathspec *ps = &revs->prune_data;
+	int i;
+
+	if (!revs->prune || !ps->nr || revs->bloom_keys_nr)
+		return;
+	if (DIFF_OPT_TST(&revs->diffopt, FOLLOW_RENAMES))
+		return;
+	if (ps->magic & (PATHSPEC_GLOB | PATHSPEC_ICASE | PATHSPEC_EXCLUDE))
+		return;
+	for (i = 0; i < ps->nr; i++)
+		if (!ps->items[i].len ||
+		    ps->items[i].nowildcard_len < ps->items[i].len)
+			return;
+
+	settings = get_bloom_filter_settings();
+	if (!settings)
+		return;
+
+	revs->bloom_filter_settings = settings;
+	revs->bloom_keys = xcalloc(ps->nr, sizeof(*revs->bloom_keys));
+	for (i = 0; i < ps->nr; i++) {
+		const char *path = ps->items[i].match;
+		int len = ps->items[i].len;
+
+		while (len && path[len - 1] == '/')
+			len--;
+		fill_bloom_key(path, len, &revs->bloom_keys[i], settings);
+	}
+	revs->bloom_keys_nr = ps->nr;
+
+	if (trace_want(&trace_bloom_filter)) {
+		static int registered;
+
+		if (!registered)
+			atexit(trace_bloom_filter_statistics);
+		registered = 1;
+	}
+}
+
+/*
+ * Returns 0 if the Bloom filter of "commit" says that none of the
+ * paths changed against its first parent, 1 if they may have, and -1
+ * if there is no filter to ask.
+ */
+static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
+						 struct commit *commit)
+{
+	struct bloom_filter filter;
+	int i, ret = 0;
+
+	if (!get_bloom_filter(commit, &filter))
+		return -1;
+	for (i = 0; i < revs->bloom_keys_nr && !ret; i++)
+		ret = bloom_filter_contains(&filter, &revs->bloom_keys[i],
+					    revs->bloom_filter_settings);
+	if (ret < 0)
+		return -1;
+	bloom_filter_checked++;
+	if (!ret)
+		bloom_filter_definitely_not++;
+	return ret;
+}
+
 static int rev_compare_tree(struct rev_info *revs,
-			    struct commit *parent, struct commit *commit)
+			    struct commit *parent, struct commit *commit,
+			    int nth_parent)
 {
+	int bloom_ret = -1;
+
 	struct tree *t1 = parent->tree;
 	struct tree *t2 = commit->tree;
 
@@ -486,11 +574,20 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
+	/* the filters record the changes against the first parent */
+	if (revs->bloom_keys_nr && !nth_parent) {
+		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
+		if (!bloom_ret)
+			return REV_TREE_SAME;
+	}
+
 	tree_difference = REV_TREE_SAME;
 	DIFF_OPT_CLR(&revs->pruning, HAS_CHANGES);
 	if (diff_tree_sha1(t1->object.sha1, t2->object.sha1, "",
 			   &revs->pruning) < 0)
 		return REV_TREE_DIFFERENT;
+	if (bloom_ret == 1 && tree_difference == REV_TREE_SAME)
+		bloom_filter_false_positive++;
 	return tree_difference;
 }
 
@@ -688,7 +785,7 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 			die("cannot simplify commit %s (because of %s)",
 			    sha1_to_hex(commit->object.sha1),
 			    sha1_to_hex(p->object.sha1));
-		switch (rev_compare_tree(revs, p, commit)) {
+		switch (rev_compare_tree(revs, p, commit, nth_parent)) {
 		case REV_TREE_SAME:
 			if (!revs->simplify_history || !relevant_commit(p)) {
 				/* Even if a merge with an uninteresting
@@ -1965,6 +2062,13 @@ static int handle_revision_opt(struct rev_info *revs, int argc, const char **arg
 		revs->limited = 1;
 	} else if (!strcmp(arg, "--ignore-missing")) {
 		revs->ignore_missing = 1;
+	} else if (!strcmp(arg, "--exclude-promisor-objects")) {
+		/*
+		 * The point is to walk a partial clone without
+		 * fetching what it lacks.
+		 */
+		fetch_if_missing = 0;
+		revs->exclude_promisor_objects = 1;
 	} else {
 		int opts = diff_opt_parse(&revs->diffopt, argv, argc);
 		if (!opts)
@@ -2686,6 +2790,7 @@ int prepare_revision_walk(struct rev_info *revs)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
 		return 0;
+	prepare_to_use_bloom_filter(revs);
 	if (revs->limited)
 		if (limit_list(revs) < 0)
 			return -1;
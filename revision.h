@@ -28,6 +28,8 @@
 struct rev_info;
 struct log_info;
 struct string_list;
+struct bloom_filter_settings;
+struct bloom_key;
 struct saved_parents;
 
 struct rev_cmdline_info {
@@ -76,7 +78,8 @@ struct rev_info {
 
 	unsigned int	early_output:1,
 			ignore_missing:1,
-			ignore_missing_links:1;
+			ignore_missing_links:1,
+			exclude_promisor_objects:1;
 
 	/* Traversal flags */
 	unsigned int	dense:1,
@@ -186,6 +189,14 @@ struct rev_info {
 	struct diff_options diffopt;
 	struct diff_options pruning;
 
+	/*
+	 * The changed-path Bloom filter keys of the pathspec, when the
+	 * commit-graph has filters that can answer for it.
+	 */
+	const struct bloom_filter_settings *bloom_filter_settings;
+	struct bloom_key *bloom_keys;
+	int bloom_keys_nr;
+
 	struct reflog_walk_info *reflog_info;
 	struct decoration children;
 	struct decoration merge_simplification;
@@ -5,6 +5,14 @@
 static int inside_git_dir = -1;
 static int inside_work_tree = -1;
 
+/*
+ * Repository extensions, as found in the "extensions" section of the
+ * config. They only take effect in a repository of format version 1
+ * or later, which older versions of Git refuse to touch.
+ */
+static int extension_reftable;
+static struct string_list unknown_extensions = STRING_LIST_INIT_DUP;
+
 /*
  * The input parameter must contain an absolute path, and it must already be
  * normalized.
@@ -318,17 +326,33 @@ static int check_repository_format_gently(const char *gitdir, int *nongit_ok)
 	 * is a good one.
 	 */
 	snprintf(repo_config, PATH_MAX, "%s/config", gitdir);
+	extension_reftable = 0;
+	string_list_clear(&unknown_extensions, 0);
 	git_config_early(check_repository_format_version, NULL, repo_config);
-	if (GIT_REPO_VERSION < repository_format_version) {
+	if (GIT_REPO_VERSION_READ < repository_format_version) {
 		if (!nongit_ok)
 			die ("Expected git repo version <= %d, found %d",
-			     GIT_REPO_VERSION, repository_format_version);
+			     GIT_REPO_VERSION_READ, repository_format_version);
 		warning("Expected git repo version <= %d, found %d",
-			GIT_REPO_VERSION, repository_format_version);
+			GIT_REPO_VERSION_READ, repository_format_version);
 		warning("Please upgrade Git");
 		*nongit_ok = -1;
 		return -1;
 	}
+	if (repository_format_version < 1)
+		return 0;
+	if (unknown_extensions.nr) {
+		if (!nongit_ok)
+			die("unknown repository extension found: %s",
+			    unknown_extensions.items[0].string);
+		warning("unknown repository extension found: %s",
+			unknown_extensions.items[0].string);
+		warning("Please upgrade Git");
+		*nongit_ok = -1;
+		return -1;
+	}
+	if (extension_reftable)
+		ref_storage_format = REF_STORAGE_REFTABLE;
 	return 0;
 }
 
@@ -789,8 +813,20 @@ int git_config_perm(const char *var, const char *value)
 
 int check_repository_format_version(const char *var, const char *value, void *cb)
 {
+	const char *ext;
+
 	if (strcmp(var, "core.repositoryformatversion") == 0)
 		repository_format_version = git_config_int(var, value);
+	else if (skip_prefix(var, "extensions.", &ext)) {
+		if (!strcmp(ext, "refstorage")) {
+			if (!value)
+				return config_error_nonbool(var);
+			if (strcmp(value, "reftable"))
+				return error("unknown ref storage format '%s'", value);
+			extension_reftable = 1;
+		} else
+			string_list_append(&unknown_extensions, ext);
+	}
 	else if (strcmp(var, "core.sharedrepository") == 0)
 		shared_repository = git_config_perm(var, value);
 	else if (strcmp(var, "core.bare") == 0) {
@@ -803,6 +839,16 @@ int check_repository_format_version(const char *var, const char *value, void *cb
 		free(git_work_tree_cfg);
 		git_work_tree_cfg = xstrdup(value);
 		inside_work_tree = -1;
+	} else if (strcmp(var, "core.refstorage") == 0) {
+		/* read here, as every command that writes refs must obey it */
+		if (!value)
+			return config_error_nonbool(var);
+		if (!strcmp(value, "files"))
+			ref_storage_format = REF_STORAGE_FILES;
+		else if (!strcmp(value, "reftable"))
+			ref_storage_format = REF_STORAGE_REFTABLE;
+		else
+			return error("unknown ref storage format '%s'", value);
 	}
 	return 0;
 }
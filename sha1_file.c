@@ -19,9 +19,12 @@
 #include "refs.h"
 #include "pack-revindex.h"
 #include "sha1-lookup.h"
+#include "midx.h"
 #include "bulk-checkin.h"
 #include "streaming.h"
 #include "dir.h"
+#include "sha1-array.h"
+#include "fetch-object.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -181,9 +184,8 @@ static void fill_sha1_path(char *pathbuf, const unsigned char *sha1)
 	}
 }
 
-const char *sha1_file_name(const unsigned char *sha1)
+static void fill_sha1_file_name(char *buf, const unsigned char *sha1)
 {
-	static char buf[PATH_MAX];
 	const char *objdir;
 	int len;
 
@@ -198,6 +200,13 @@ const char *sha1_file_name(const unsigned char *sha1)
 	buf[len+3] = '/';
 	buf[len+42] = '\0';
 	fill_sha1_path(buf + len + 1, sha1);
+}
+
+const char *sha1_file_name(const unsigned char *sha1)
+{
+	static char buf[PATH_MAX];
+
+	fill_sha1_file_name(buf, sha1);
 	return buf;
 }
 
@@ -805,6 +814,7 @@ void free_pack_by_name(const char *pack_name)
 	while (*pp) {
 		p = *pp;
 		if (strcmp(pack_name, p->pack_name) == 0) {
+			midx_forget_pack(p);
 			clear_delta_base_cache();
 			close_pack_windows(p);
 			if (p->pack_fd != -1) {
@@ -1080,6 +1090,10 @@ struct packed_git *add_packed_git(const char *path, int path_len, int local)
 	if (!access(p->pack_name, F_OK))
 		p->pack_keep = 1;
 
+	strcpy(p->pack_name + path_len, ".promisor");
+	if (!access(p->pack_name, F_OK))
+		p->pack_promisor = 1;
+
 	strcpy(p->pack_name + path_len, ".pack");
 	if (stat(p->pack_name, &st) || !S_ISREG(st.st_mode)) {
 		free(p);
@@ -1230,18 +1244,24 @@ static void prepare_packed_git_one(char *objdir, int local)
 		if (!report_garbage)
 			continue;
 
+		if (starts_with(de->d_name, "multi-pack-index-") &&
+		    ends_with(de->d_name, ".bitmap"))
+			continue;
 		if (ends_with(de->d_name, ".idx") ||
 		    ends_with(de->d_name, ".pack") ||
 		    ends_with(de->d_name, ".bitmap") ||
-		    ends_with(de->d_name, ".keep"))
+		    ends_with(de->d_name, ".keep") ||
+		    ends_with(de->d_name, ".promisor"))
 			string_list_append(&garbage, path.buf);
-		else
+		else if (strcmp(de->d_name, "multi-pack-index"))
 			report_garbage("garbage found", path.buf);
 	}
 	closedir(dir);
 	report_pack_garbage(&garbage);
 	string_list_clear(&garbage, 0);
 	strbuf_release(&path);
+
+	prepare_multi_pack_index_one(objdir);
 }
 
 static int sort_pack(const void *a_, const void *b_)
@@ -2440,7 +2460,9 @@ static int fill_pack_entry(const unsigned char *sha1,
  */
 static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
+	struct multi_pack_index *m;
 	struct packed_git *p;
+	int probe_all = 0;
 
 	prepare_packed_git();
 	if (!packed_git)
@@ -2449,9 +2471,25 @@ static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 	if (last_found_pack && fill_pack_entry(sha1, e, last_found_pack))
 		return 1;
 
+	for (m = multi_pack_index; m; m = m->next) {
+		int ret = fill_midx_entry(sha1, e, m);
+		if (ret > 0) {
+			last_found_pack = e->p;
+			return 1;
+		}
+		/*
+		 * The copy the index points at is unusable; another pack
+		 * it covers may still have one.
+		 */
+		if (ret < 0)
+			probe_all = 1;
+	}
+
 	for (p = packed_git; p; p = p->next) {
 		if (p == last_found_pack)
 			continue; /* we already checked this one */
+		if (p->multi_pack_index && !probe_all)
+			continue; /* not there, or the index would know */
 
 		if (fill_pack_entry(sha1, e, p)) {
 			last_found_pack = p;
@@ -2552,8 +2590,12 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 
 		/* Not a loose object; someone else may have just packed it. */
 		reprepare_packed_git();
-		if (!find_pack_entry(real, &e))
+		if (!find_pack_entry(real, &e)) {
+			if (fetch_if_missing && !is_null_sha1(real) &&
+			    !fetch_object(real))
+				return sha1_object_info_extended(real, oi, 0);
 			return -1;
+		}
 	}
 
 	rtype = packed_object_info(e.p, e.offset, oi);
@@ -2652,7 +2694,12 @@ static void *read_object(const unsigned char *sha1, enum object_type *type,
 		return buf;
 	}
 	reprepare_packed_git();
-	return read_packed_sha1(sha1, type, size);
+	buf = read_packed_sha1(sha1, type, size);
+	/* the null sha1 names no object, e.g. in a reflog creation entry */
+	if (!buf && fetch_if_missing && !is_null_sha1(sha1) &&
+	    !fetch_object(sha1))
+		buf = read_object(sha1, type, size);
+	return buf;
 }
 
 /*
@@ -2696,6 +2743,84 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 	return NULL;
 }
 
+int read_sha1_deflated(const unsigned char *sha1, struct deflated_object *obj)
+{
+	struct pack_entry e;
+	struct pack_window *w_curs = NULL;
+	struct revindex_entry *revidx;
+	off_t curpos;
+	unsigned long len, copied;
+
+	memset(obj, 0, sizeof(*obj));
+	if (lookup_replace_object(sha1) != sha1 || find_cached_object(sha1))
+		return -1;
+
+	if (!find_pack_entry(sha1, &e)) {
+		obj->data = map_sha1_file(sha1, &obj->len);
+		if (!obj->data)
+			return -1;
+		obj->loose = 1;
+		return 0;
+	}
+
+	curpos = e.offset;
+	obj->type = unpack_object_header(e.p, &w_curs, &curpos, &obj->size);
+	if (obj->type < OBJ_COMMIT || obj->type > OBJ_TAG) {
+		/* deltas need their base, and the lock for it */
+		unuse_pack(&w_curs);
+		return -1;
+	}
+	revidx = find_pack_revindex(e.p, e.offset);
+	len = (revidx + 1)->offset - curpos;
+	obj->data = xmalloc(len);
+	obj->len = len;
+	for (copied = 0; copied < len; ) {
+		unsigned long avail;
+		unsigned char *in = use_pack(e.p, &w_curs, curpos + copied, &avail);
+
+		if (avail > len - copied)
+			avail = len - copied;
+		memcpy(obj->data + copied, in, avail);
+		copied += avail;
+	}
+	unuse_pack(&w_curs);
+	return 0;
+}
+
+void *inflate_sha1_deflated(const unsigned char *sha1, struct deflated_object *obj,
+			    enum object_type *type, unsigned long *size)
+{
+	git_zstream stream;
+	unsigned char *buffer;
+	int st;
+
+	if (obj->loose) {
+		buffer = unpack_sha1_file(obj->data, obj->len, type, size, sha1);
+		munmap(obj->data, obj->len);
+		obj->data = NULL;
+		return buffer;
+	}
+
+	buffer = xmallocz(obj->size);
+	memset(&stream, 0, sizeof(stream));
+	stream.next_in = obj->data;
+	stream.avail_in = obj->len;
+	stream.next_out = buffer;
+	stream.avail_out = obj->size + 1;
+	git_inflate_init(&stream);
+	st = git_inflate(&stream, Z_FINISH);
+	git_inflate_end(&stream);
+	free(obj->data);
+	obj->data = NULL;
+	if (st != Z_STREAM_END || stream.total_out != obj->size) {
+		free(buffer);
+		return NULL;
+	}
+	*type = obj->type;
+	*size = obj->size;
+	return buffer;
+}
+
 void *read_object_with_reference(const unsigned char *sha1,
 				 const char *required_type_name,
 				 unsigned long *size,
@@ -2882,9 +3007,10 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 	git_zstream stream;
 	git_SHA_CTX c;
 	unsigned char parano_sha1[20];
-	static char tmp_file[PATH_MAX];
-	const char *filename = sha1_file_name(sha1);
+	char tmp_file[PATH_MAX];
+	char filename[PATH_MAX];
 
+	fill_sha1_file_name(filename, sha1);
 	fd = create_tmpfile(tmp_file, sizeof(tmp_file), filename);
 	if (fd < 0) {
 		if (errno == EACCES)
@@ -2960,6 +3086,16 @@ int write_sha1_file(const void *buf, unsigned long len, const char *type, unsign
 	return write_loose_object(sha1, hdr, hdrlen, buf, len, 0);
 }
 
+int write_loose_sha1_file(const void *buf, unsigned long len,
+			  const char *type, const unsigned char *sha1)
+{
+	char hdr[32];
+	int hdrlen;
+
+	hdrlen = sprintf(hdr, "%s %lu", type, len) + 1;
+	return write_loose_object(sha1, hdr, hdrlen, buf, len, 0);
+}
+
 int force_object_loose(const unsigned char *sha1, time_t mtime)
 {
 	void *buf;
@@ -2989,6 +3125,72 @@ int has_pack_index(const unsigned char *sha1)
 	return 1;
 }
 
+static struct sha1_array promisor_objects;
+static int promisor_objects_prepared;
+
+static void add_promisor_object(const unsigned char *sha1)
+{
+	struct object *obj = parse_object(sha1);
+
+	sha1_array_append(&promisor_objects, sha1);
+	if (!obj)
+		return;
+
+	/*
+	 * What the object points at may be missing without that
+	 * being an error; the promisor remote has it.
+	 */
+	if (obj->type == OBJ_TREE) {
+		struct tree *tree = (struct tree *)obj;
+		struct tree_desc desc;
+		struct name_entry entry;
+
+		if (!tree->buffer && parse_tree(tree))
+			return;
+		init_tree_desc(&desc, tree->buffer, tree->size);
+		while (tree_entry(&desc, &entry))
+			if (!S_ISGITLINK(entry.mode))
+				sha1_array_append(&promisor_objects, entry.sha1);
+		free_tree_buffer(tree);
+	} else if (obj->type == OBJ_COMMIT) {
+		struct commit *commit = (struct commit *)obj;
+		struct commit_list *parents;
+
+		sha1_array_append(&promisor_objects, commit->tree->object.sha1);
+		for (parents = commit->parents; parents; parents = parents->next)
+			sha1_array_append(&promisor_objects,
+					  parents->item->object.sha1);
+	} else if (obj->type == OBJ_TAG) {
+		struct tag *tag = (struct tag *)obj;
+
+		if (tag->tagged)
+			sha1_array_append(&promisor_objects,
+					  tag->tagged->sha1);
+	}
+}
+
+int is_promisor_object(const unsigned char *sha1)
+{
+	if (!promisor_objects_prepared) {
+		struct packed_git *p;
+		int save_fetch_if_missing = fetch_if_missing;
+
+		fetch_if_missing = 0;
+		prepare_packed_git();
+		for (p = packed_git; p; p = p->next) {
+			uint32_t i;
+
+			if (!p->pack_promisor || open_pack_index(p))
+				continue;
+			for (i = 0; i < p->num_objects; i++)
+				add_promisor_object(nth_packed_object_sha1(p, i));
+		}
+		fetch_if_missing = save_fetch_if_missing;
+		promisor_objects_prepared = 1;
+	}
+	return sha1_array_lookup(&promisor_objects, sha1) >= 0;
+}
+
 int has_sha1_pack(const unsigned char *sha1)
 {
 	struct pack_entry e;
@@ -0,0 +1,133 @@
+#!/bin/sh
+
+test_description='packed refs stored in a stack of reftables'
+. ./test-lib.sh
+
+num_tables () {
+	wc -l <.git/reftable/tables.list | tr -d " "
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m "annotated" annotated one &&
+	git branch side one &&
+	git branch other &&
+	git pack-refs --all --prune &&
+	test_path_is_file .git/packed-refs &&
+	git show-ref -d >expect-refs &&
+	git config core.refStorage reftable
+'
+
+test_expect_success 'packed refs are still read from packed-refs' '
+	git show-ref -d >actual &&
+	test_cmp expect-refs actual
+'
+
+test_expect_success 'pack-refs converts packed-refs to a reftable' '
+	git pack-refs --all --prune &&
+	test_path_is_missing .git/packed-refs &&
+	test "$(num_tables)" = 1 &&
+	git show-ref -d >actual &&
+	test_cmp expect-refs actual &&
+	test "$(git rev-parse side)" = "$(git rev-parse one)" &&
+	test "$(git rev-parse annotated^{})" = "$(git rev-parse one)"
+'
+
+test_expect_success 'conversion sets a repository extension' '
+	test "$(git config core.repositoryformatversion)" = 1 &&
+	test "$(git config extensions.refStorage)" = reftable &&
+	git init &&
+	test "$(git config core.repositoryformatversion)" = 1 &&
+	git -c core.refStorage=files show-ref -d >actual &&
+	test_cmp expect-refs actual
+'
+
+test_expect_success 'unknown repository extensions are refused' '
+	test_when_finished "git config --unset extensions.unknown" &&
+	git config extensions.unknown true &&
+	test_must_fail git rev-parse HEAD 2>err &&
+	grep "unknown repository extension" err
+'
+
+test_expect_success 'deleting a packed ref adds a table with a tombstone' '
+	git branch -D other &&
+	test_must_fail git rev-parse --verify refs/heads/other &&
+	test_path_is_missing .git/refs/heads/other &&
+	test "$(num_tables)" = 2 &&
+	grep -v refs/heads/other expect-refs >expect &&
+	git show-ref -d >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'loose refs override the tables' '
+	git update-ref refs/heads/side two &&
+	test "$(git rev-parse side)" = "$(git rev-parse two)" &&
+	git pack-refs --all --prune &&
+	test_path_is_missing .git/refs/heads/side &&
+	test "$(git rev-parse side)" = "$(git rev-parse two)"
+'
+
+test_expect_success 'pack-refs merges the stack into one table' '
+	test "$(num_tables)" = 1 &&
+	git for-each-ref --format="%(refname)" >actual &&
+	! grep refs/heads/other actual
+'
+
+test_expect_success 'many refs spanning several blocks' '
+	for i in $(test_seq 2000)
+	do
+		echo "create refs/heads/many/$i HEAD" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	git pack-refs --all --prune &&
+	test "$(git for-each-ref refs/heads/many | wc -l)" = 2000 &&
+	for i in 1 999 1000 2000
+	do
+		git rev-parse --verify refs/heads/many/$i || return 1
+	done &&
+	test_must_fail git rev-parse --verify refs/heads/many/2001 &&
+	test_must_fail git rev-parse --verify refs/heads/many/0
+'
+
+test_expect_success 'incremental deletions and re-creations' '
+	git branch -D many/1500 &&
+	git branch -D many/7 &&
+	test_must_fail git rev-parse --verify refs/heads/many/1500 &&
+	git update-ref refs/heads/many/7 one &&
+	git pack-refs --all &&
+	test "$(git rev-parse many/7)" = "$(git rev-parse one)" &&
+	test "$(git for-each-ref refs/heads/many | wc -l)" = 1999 &&
+	git update-ref -d refs/heads/many/7 &&
+	test_must_fail git rev-parse --verify refs/heads/many/7 &&
+	test "$(git for-each-ref refs/heads/many | wc -l)" = 1998
+'
+
+test_expect_success 'peeled values are kept for annotated tags' '
+	git show-ref -d annotated >actual &&
+	grep "annotated^{}" actual &&
+	git ls-remote . refs/tags/annotated^{} >actual &&
+	test_line_count = 1 actual
+'
+
+test_expect_success 'gc and fsck work with reftables' '
+	git gc &&
+	git fsck &&
+	test "$(num_tables)" = 1 &&
+	test "$(git rev-parse annotated^{})" = "$(git rev-parse one)"
+'
+
+test_expect_success 'clone into a reftable repository' '
+	git -c core.refStorage=reftable clone --bare . clone.git &&
+	test_path_is_file clone.git/reftable/tables.list &&
+	test_path_is_missing clone.git/packed-refs &&
+	test "$(git --git-dir=clone.git config extensions.refStorage)" = reftable &&
+	(
+		cd clone.git &&
+		git show-ref >../clone-refs
+	) &&
+	git show-ref >expect &&
+	test_cmp expect clone-refs
+'
+
+test_done
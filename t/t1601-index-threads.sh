@@ -0,0 +1,116 @@
+#!/bin/sh
+
+test_description='reading and writing the index with several threads'
+
+. ./test-lib.sh
+
+# The last extension (after which come only the 20 bytes of the
+# checksum) is EOIE, of 32 bytes with its header.
+last_extension () {
+	tail -c 52 .git/index | head -c 4
+}
+
+# Compare what is read with the given number of threads to what is
+# read by a single one.
+check_read () {
+	git -c index.threads=1 ls-files -s --debug >expect &&
+	GIT_TEST_INDEX_THREADS=$1 git ls-files -s --debug >actual &&
+	test_cmp expect actual &&
+	test-dump-cache-tree >expect &&
+	GIT_TEST_INDEX_THREADS=$1 test-dump-cache-tree >actual &&
+	test_cmp expect actual
+}
+
+# Write the index again in the given version, optionally forcing a
+# number of threads.
+write_index () {
+	if test $1 = 4
+	then
+		git update-index --index-version 3
+	else
+		git update-index --index-version 4
+	fi &&
+	if test -n "$2"
+	then
+		GIT_TEST_INDEX_THREADS=$2 git update-index --index-version $1
+	else
+		git update-index --index-version $1
+	fi
+}
+
+test_expect_success 'setup' '
+	for d in a b c d e f
+	do
+		mkdir $d &&
+		for f in 1 2 3 4 5 6 7 8 9
+		do
+			echo $d$f >$d/file$f || return 1
+		done || return 1
+	done &&
+	git add . &&
+	git commit -m initial &&
+	git rm -q --cached a/file1 &&
+	git update-index --skip-worktree b/file3 &&
+	git write-tree >/dev/null
+'
+
+for version in 4 3 2
+do
+	test_expect_success "index v$version with recorded offsets" '
+		test_config index.threads 3 &&
+		write_index $version &&
+		test "$(last_extension)" = EOIE &&
+		check_read 1 &&
+		check_read 2 &&
+		check_read 3
+	'
+
+	test_expect_success "index v$version written in small blocks" '
+		write_index $version 7 &&
+		test "$(last_extension)" = EOIE &&
+		check_read 2 &&
+		check_read 7 &&
+		check_read 20
+	'
+done
+
+test_expect_success 'the offsets are not recorded by default' '
+	write_index 2 &&
+	test "$(last_extension)" != EOIE &&
+	check_read 4
+'
+
+test_expect_success 'other extensions are read along with the entries' '
+	git add a/file1 &&
+	git update-index --no-skip-worktree b/file3 &&
+	git checkout -q -b side &&
+	echo side >b/file1 &&
+	git commit -q -a -m side &&
+	git checkout -q master &&
+	echo master >b/file1 &&
+	git commit -q -a -m master &&
+	test_must_fail git merge side &&
+	echo resolved >b/file1 &&
+	git add b/file1 &&
+	git ls-files --resolve-undo >expect.reuc &&
+	test -s expect.reuc &&
+	write_index 2 3 &&
+	test "$(last_extension)" = EOIE &&
+	GIT_TEST_INDEX_THREADS=3 git ls-files --resolve-undo >actual.reuc &&
+	test_cmp expect.reuc actual.reuc &&
+	git ls-files --resolve-undo >actual.reuc &&
+	test_cmp expect.reuc actual.reuc
+'
+
+test_expect_success 'split index with recorded offsets' '
+	git ls-files -s >expect &&
+	GIT_TEST_INDEX_THREADS=3 git update-index --split-index &&
+	test "$(last_extension)" = EOIE &&
+	GIT_TEST_INDEX_THREADS=3 git ls-files -s >actual &&
+	test_cmp expect actual &&
+	git ls-files -s >actual &&
+	test_cmp expect actual &&
+	git update-index --no-split-index
+'
+
+test_done
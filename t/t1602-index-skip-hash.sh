@@ -0,0 +1,72 @@
+#!/bin/sh
+
+test_description='index.skipHash'
+
+. ./test-lib.sh
+
+# The trailing checksum of the index, in hex.
+index_checksum () {
+	tail -c 20 .git/index | od -An -tx1 | tr -d " \n"
+}
+
+null_checksum=0000000000000000000000000000000000000000
+
+test_expect_success 'setup' '
+	mkdir dir &&
+	for i in 1 2 3 4 5
+	do
+		echo $i >file$i &&
+		echo $i >dir/file$i || return 1
+	done &&
+	git add . &&
+	git commit -m initial
+'
+
+test_expect_success 'the checksum is written by default' '
+	git update-index --index-version 4 &&
+	test "$(index_checksum)" != $null_checksum
+'
+
+test_expect_success 'index.skipHash writes a null checksum' '
+	test_config index.skipHash true &&
+	git update-index --index-version 2 &&
+	test "$(index_checksum)" = $null_checksum &&
+	git ls-files >actual &&
+	test_line_count = 10 actual
+'
+
+test_expect_success 'an index without a checksum is read without it' '
+	test "$(index_checksum)" = $null_checksum &&
+	git ls-files >actual &&
+	test_line_count = 10 actual &&
+	git diff-files --name-only >actual &&
+	test_must_be_empty actual &&
+	git diff-index --cached --name-only HEAD >actual &&
+	test_must_be_empty actual &&
+	git fsck
+'
+
+test_expect_success 'index.skipHash with several threads' '
+	test_config index.skipHash true &&
+	GIT_TEST_INDEX_THREADS=3 git update-index --index-version 4 &&
+	test "$(index_checksum)" = $null_checksum &&
+	git -c index.threads=1 ls-files -s >expect &&
+	GIT_TEST_INDEX_THREADS=3 git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a bad checksum is left to fsck with index.skipHash' '
+	git update-index --index-version 2 &&
+	test "$(index_checksum)" != $null_checksum &&
+	cp .git/index index.good &&
+	size=$(wc -c <.git/index) &&
+	printf "\0\0\0\1" |
+	dd of=.git/index bs=1 seek=$(($size - 4)) conv=notrunc 2>/dev/null &&
+	test_must_fail git ls-files &&
+	git -c index.skipHash=true ls-files >actual &&
+	test_line_count = 10 actual &&
+	test_must_fail git -c index.skipHash=true fsck &&
+	cp index.good .git/index
+'
+
+test_done
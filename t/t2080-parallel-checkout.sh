@@ -0,0 +1,185 @@
+#!/bin/sh
+
+test_description='parallel checkout'
+
+. ./test-lib.sh
+
+# Check out with the given number of workers, keeping the trace of
+# the parallel checkout in ../trace.
+checkout_with () {
+	workers=$1 &&
+	shift &&
+	: >"$TRASH_DIRECTORY/trace" &&
+	GIT_TRACE_PARALLEL_CHECKOUT="$TRASH_DIRECTORY/trace" \
+	git -c checkout.workers=$workers "$@"
+}
+
+# Compare the working trees (but not the repositories) of two clones.
+compare_worktrees () {
+	(cd "$1" && find . -name .git -prune -o -print | sort) >tree1 &&
+	(cd "$2" && find . -name .git -prune -o -print | sort) >tree2 &&
+	test_cmp tree1 tree2 &&
+	for f in $(cd "$1" && find . -name .git -prune -o -type f -print)
+	do
+		test_cmp "$1/$f" "$2/$f" &&
+		if test -x "$1/$f"
+		then
+			test -x "$2/$f"
+		else
+			! test -x "$2/$f"
+		fi || return 1
+	done
+}
+
+test_expect_success 'setup' '
+	mkdir -p a/b c &&
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		echo "file $i" >a/f$i &&
+		echo "file $i" >a/b/f$i &&
+		echo "file $i" >c/f$i &&
+		printf "line one\nline two\n" >crlf$i.txt || return 1
+	done &&
+	echo "\$Id\$" >ident &&
+	echo "to be smudged" >smudged &&
+	echo "#!/bin/sh" >script &&
+	chmod +x script &&
+	cat >.gitattributes <<-\EOF &&
+	*.txt text eol=crlf
+	ident ident
+	smudged filter=upcase
+	EOF
+	git config --global filter.upcase.smudge "tr a-z A-Z" &&
+	git config --global filter.upcase.clean "tr A-Z a-z" &&
+	git add . &&
+	git commit -m initial &&
+	git branch initial &&
+	git rm -q -r c &&
+	echo "now a file" >c &&
+	echo changed >a/f1 &&
+	git rm -q a/f2 &&
+	echo "changed \$Id\$" >ident &&
+	printf "line three\n" >>crlf1.txt &&
+	mkdir d &&
+	echo new >d/new &&
+	git add . &&
+	git commit -m second
+'
+
+test_expect_success 'clone with parallel checkout' '
+	checkout_with 1 clone -q . sequential &&
+	checkout_with 4 clone -q . parallel &&
+	# all 36 entries but "smudged", which needs the filter driver
+	grep "parallel checkout: 35 entries, 4 workers, 0 collided" trace &&
+	compare_worktrees sequential parallel &&
+	test_cmp sequential/smudged parallel/smudged &&
+	echo "TO BE SMUDGED" >expect &&
+	test_cmp expect parallel/smudged &&
+	printf "line one\r\nline two\r\nline three\r\n" >expect &&
+	test_cmp expect parallel/crlf1.txt &&
+	grep "Id: [0-9a-f]\{40\} " parallel/ident
+'
+
+test_expect_success 'stat data of the new entries is recorded' '
+	(
+		cd parallel &&
+		git diff-files --name-only >../actual
+	) &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'only the entries that change are queued' '
+	checkout_with 2 -C parallel checkout -q initial &&
+	grep "parallel checkout: 14 entries, 2 workers" trace
+'
+
+test_expect_success 'switching branches with parallel checkout' '
+	checkout_with 1 -C sequential checkout -q initial &&
+	compare_worktrees sequential parallel &&
+	checkout_with 3 -C sequential checkout -q master &&
+	checkout_with 3 -C parallel checkout -q master &&
+	grep "3 workers" trace &&
+	compare_worktrees sequential parallel &&
+	(
+		cd parallel &&
+		git status --porcelain >../actual
+	) &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'checkout.workers=0 uses one worker per processor' '
+	checkout_with 0 -C parallel checkout -q initial &&
+	checkout_with 1 -C sequential checkout -q initial &&
+	compare_worktrees sequential parallel
+'
+
+test_expect_success 'no parallel checkout with a single worker' '
+	checkout_with 1 -C parallel checkout -q master &&
+	test_must_be_empty trace
+'
+
+test_expect_success 'a file in the way is replaced in order' '
+	git -C parallel checkout -q initial &&
+	git -C sequential checkout -q initial &&
+	rm -rf parallel/d sequential/d &&
+	echo untracked >parallel/d &&
+	echo untracked >sequential/d &&
+	checkout_with 1 -C sequential checkout -q -f master &&
+	checkout_with 4 -C parallel checkout -q -f master &&
+	compare_worktrees sequential parallel
+'
+
+test_expect_success 'large blobs are left to the streaming serial path' '
+	rm -rf sequential parallel &&
+	checkout_with 1 -c core.bigFileThreshold=10 clone -q . sequential &&
+	checkout_with 4 -c core.bigFileThreshold=10 clone -q . parallel &&
+	# only a/*, a/b/*, d/new and script are no larger than 10 bytes
+	grep "parallel checkout: 21 entries" trace &&
+	compare_worktrees sequential parallel
+'
+
+test_expect_success CASE_INSENSITIVE_FS 'colliding entries are written in index order' '
+	git init collide &&
+	(
+		cd collide &&
+		for i in 1 2 3 4 5 6 7 8
+		do
+			upper=$(echo upper$i | git hash-object -w --stdin) &&
+			lower=$(echo lower$i | git hash-object -w --stdin) &&
+			printf "100644 %s\tFILE$i\n100644 %s\tfile$i\n" \
+				$upper $lower || return 1
+		done | git update-index --index-info &&
+		git commit -q -m collide
+	) &&
+	for i in 1 2 3
+	do
+		rm -rf parallel &&
+		checkout_with 4 clone -q collide parallel &&
+		grep "parallel checkout: 16 entries" trace &&
+		for j in 1 2 3 4 5 6 7 8
+		do
+			echo lower$j >expect &&
+			test_cmp expect parallel/file$j || return 1
+		done || return 1
+	done
+'
+
+test_expect_success CASE_INSENSITIVE_FS 'an entry written right away joins its colliding group' '
+	git init collide-big &&
+	(
+		cd collide-big &&
+		small=$(echo small | git hash-object -w --stdin) &&
+		large=$(echo larger than ten bytes | git hash-object -w --stdin) &&
+		printf "100644 %s\tFILE\n100644 %s\tfile\n100644 %s\tx\n" \
+			$small $large $small |
+		git update-index --index-info &&
+		git commit -q -m collide
+	) &&
+	rm -rf parallel &&
+	checkout_with 4 -c core.bigFileThreshold=10 clone -q collide-big parallel &&
+	grep "parallel checkout: 2 entries, 2 workers, 1 collided" trace &&
+	echo larger than ten bytes >expect &&
+	test_cmp expect parallel/file
+'
+
+test_done
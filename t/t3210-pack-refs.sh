@@ -151,4 +151,76 @@ test_expect_success 'delete ref while another dangling packed ref' '
 	test_cmp /dev/null result
 '
 
+test_expect_success 'pack-refs writes a sorted packed-refs file' '
+	git pack-refs --all &&
+	head -n 1 .git/packed-refs >header &&
+	grep " sorted " header &&
+	sed -e 1d -e "/^\^/d" -e "s/^[0-9a-f]* //" .git/packed-refs >names &&
+	LC_ALL=C sort names >sorted-names &&
+	test_cmp sorted-names names
+'
+
+test_expect_success 'set up refs whose names sort around a directory' '
+	git tag -m annotated s/tag &&
+	for name in a-b a/x a/y/z a0 b
+	do
+		git update-ref refs/heads/s/$name HEAD || return 1
+	done &&
+	git for-each-ref --format="%(refname) %(objectname)" refs/heads/s/ \
+		refs/tags/s/ >expect &&
+	git show-ref -d >expect-show &&
+	git pack-refs --all --prune
+'
+
+test_expect_success 'lookups and iteration in a sorted packed-refs file' '
+	git for-each-ref --format="%(refname) %(objectname)" refs/heads/s/ \
+		refs/tags/s/ >actual &&
+	test_cmp expect actual &&
+	git show-ref -d >actual-show &&
+	test_cmp expect-show actual-show &&
+	for name in a-b a/x a/y/z a0 b
+	do
+		git rev-parse --verify refs/heads/s/$name || return 1
+	done &&
+	test_must_fail git rev-parse --verify refs/heads/s/a &&
+	test_must_fail git rev-parse --verify refs/heads/s/a/y &&
+	git rev-parse s/tag^{commit} >actual &&
+	git rev-parse HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'deleting from a sorted packed-refs file' '
+	git branch -D s/a/x &&
+	test_must_fail git rev-parse --verify refs/heads/s/a/x &&
+	git rev-parse --verify refs/heads/s/a/y/z &&
+	git rev-parse --verify refs/heads/s/a0 &&
+	head -n 1 .git/packed-refs >header &&
+	grep " sorted " header
+'
+
+test_expect_success 'packed-refs without the sorted trait is read as a whole' '
+	H=$(git rev-parse HEAD) &&
+	{
+		echo "# pack-refs with: peeled fully-peeled " &&
+		echo "$H refs/heads/unsorted/z" &&
+		echo "$H refs/heads/unsorted/a"
+	} >.git/packed-refs &&
+	git for-each-ref --format="%(refname)" refs/heads/unsorted/ >actual &&
+	cat >expect <<-\EOF &&
+	refs/heads/unsorted/a
+	refs/heads/unsorted/z
+	EOF
+	test_cmp expect actual &&
+	git rev-parse --verify refs/heads/unsorted/z
+'
+
+test_expect_success 'corrupt sorted packed-refs file is reported' '
+	{
+		echo "# pack-refs with: peeled fully-peeled sorted " &&
+		echo "garbage"
+	} >.git/packed-refs &&
+	test_must_fail git rev-parse --verify refs/heads/unsorted/z 2>err &&
+	grep "unexpected line in packed-refs" err
+'
+
 test_done
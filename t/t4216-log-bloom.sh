@@ -0,0 +1,133 @@
+#!/bin/sh
+
+test_description='git log and blame with changed-path Bloom filters'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir A A/B A/B/C &&
+	test_commit c1 A/file1 &&
+	test_commit c2 A/B/file2 &&
+	test_commit c3 A/B/C/file3 &&
+	test_commit c4 A/file1 &&
+	test_commit c5 A/B/file2 &&
+	test_commit c6 A/B/C/file3 &&
+	test_commit c7 A/file1 &&
+	test_commit c8 A/B/file2 &&
+	test_commit c9 A/B/C/file3 &&
+	git checkout -b side HEAD~4 &&
+	test_commit side1 A/file4 &&
+	test_commit side2 A/B/C/file6 &&
+	git checkout master &&
+	test_merge m1 side &&
+	git rm -q A/file4 &&
+	git mv A/B/file2 A/file5 &&
+	git commit -m "remove and rename" &&
+	test_commit c10 file_root &&
+	test_seq 600 >many &&
+	mkdir big &&
+	for i in $(test_seq 520)
+	do
+		echo $i >big/file$i || return 1
+	done &&
+	git add many big &&
+	git commit -m "many changes" &&
+	test_commit c11 A/file1 &&
+	git commit-graph write --reachable --changed-paths &&
+	git commit-graph verify
+'
+
+# Compare the output of a command with and without the commit-graph,
+# and check that the Bloom filters were asked.
+bloom_two_modes () {
+	git -c core.commitGraph=false "$@" >expect &&
+	: >"$TRASH_DIRECTORY/trace" &&
+	GIT_TRACE_BLOOM_FILTER="$TRASH_DIRECTORY/trace" git "$@" >actual &&
+	test_cmp expect actual
+}
+
+filters_used () {
+	grep "bloom filter: [1-9][0-9]* checked" "$TRASH_DIRECTORY/trace"
+}
+
+filters_not_used () {
+	test_must_be_empty "$TRASH_DIRECTORY/trace"
+}
+
+for path in A A/ A/file1 A/B A/B/file2 A/B/C/file3 A/B/C/file6 A/file4 \
+	    A/file5 file_root many big big/file7 not_there
+do
+	for option in "" --full-history --simplify-merges --first-parent \
+		      --topo-order --dense --sparse
+	do
+		test_expect_success "git log $option -- $path" '
+			bloom_two_modes log --format=%H $option -- $path &&
+			filters_used
+		'
+	done
+done
+
+test_expect_success 'several paths' '
+	bloom_two_modes log --format=%H -- A/file1 A/B/C/file3 &&
+	filters_used &&
+	bloom_two_modes log --format=%H -- A/file4 file_root &&
+	filters_used
+'
+
+test_expect_success 'paths from a subdirectory' '
+	(
+		cd A &&
+		bloom_two_modes log --format=%H -- file1 B/file2 &&
+		filters_used
+	)
+'
+
+test_expect_success 'the filters rule out most commits' '
+	bloom_two_modes log --format=%H -- A/B/C/file3 &&
+	grep "bloom filter: 13 checked, 9 definitely not" trace
+'
+
+test_expect_success 'the filters are not used for wildcards and renames' '
+	bloom_two_modes log --format=%H -- "A/*" &&
+	filters_not_used &&
+	bloom_two_modes log --format=%H -- ":(icase)a/file1" &&
+	filters_not_used &&
+	bloom_two_modes log --format=%H --follow -- A/file5 &&
+	filters_not_used
+'
+
+test_expect_success 'blame with Bloom filters' '
+	git -c core.commitGraph=false blame A/file1 >expect &&
+	git blame A/file1 >actual &&
+	test_cmp expect actual &&
+	git -c core.commitGraph=false blame A/file5 >expect &&
+	git blame A/file5 >actual &&
+	test_cmp expect actual &&
+	git -c core.commitGraph=false blame -M -C A/B/C/file3 >expect &&
+	git blame -M -C A/B/C/file3 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rewriting the graph keeps the filters' '
+	git commit-graph write --reachable &&
+	bloom_two_modes log --format=%H -- A/file1 &&
+	filters_used &&
+	git commit-graph verify
+'
+
+test_expect_success 'the filters can be dropped' '
+	git commit-graph write --reachable --no-changed-paths &&
+	bloom_two_modes log --format=%H -- A/file1 &&
+	filters_not_used &&
+	git commit-graph verify
+'
+
+test_expect_success 'new commits are not in the filters' '
+	git commit-graph write --reachable --changed-paths &&
+	test_commit c12 A/file1 &&
+	bloom_two_modes log --format=%H -- A/file1 &&
+	filters_used &&
+	bloom_two_modes log --format=%H -- A/B/C/file3 &&
+	filters_used
+'
+
+test_done
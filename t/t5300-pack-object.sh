@@ -380,6 +380,70 @@ test_expect_success 'index-pack with --strict' '
 	)
 '
 
+test_expect_success 'setup delta chains for threaded unpack' '
+	test_create_repo threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 1 40)
+		do
+			test_seq 1 $i >file &&
+			test_seq $i 40 >other &&
+			git add file other &&
+			test_tick &&
+			git commit -q -m $i || return 1
+		done &&
+		git rev-list --objects HEAD >objs &&
+		pack=$(git pack-objects --delta-base-offset ../threads-ofs <objs) &&
+		mv ../threads-ofs-$pack.pack ../threads-ofs.pack &&
+		pack=$(git pack-objects ../threads-ref <objs) &&
+		mv ../threads-ref-$pack.pack ../threads-ref.pack
+	)
+'
+
+for flavor in ofs ref
+do
+	test_expect_success "unpack $flavor deltas with threads" '
+		for n in 1 4
+		do
+			rm -rf unpack-$n &&
+			test_create_repo unpack-$n &&
+			(
+				cd unpack-$n &&
+				git unpack-objects --threads=$n \
+					<../threads-'$flavor'.pack &&
+				cd .git &&
+				find objects -type f | sort >../../objects-$n
+			) || return 1
+		done &&
+		test_cmp objects-1 objects-4 &&
+		while read path
+		do
+			cmp unpack-1/.git/$path unpack-4/.git/$path || return 1
+		done <objects-1 &&
+		test_line_count = $(wc -l <threads/objs) objects-4 &&
+		git --git-dir=unpack-4/.git fsck --strict
+	'
+done
+
+test_expect_success 'unpacking with --strict and threads' '
+	rm -rf test-5t test-6t &&
+	test_create_repo test-5t &&
+	(
+		cd test-5t &&
+		GIT_FORCE_THREADS=1 git unpack-objects --strict --threads=2 \
+			<../test-5-$PACK5.pack &&
+		git ls-tree -r $LIST &&
+		git ls-tree -r $LI &&
+		git ls-tree -r $ST
+	) &&
+	test_create_repo test-6t &&
+	(
+		cd test-6t &&
+		test_must_fail git unpack-objects --strict --threads=2 \
+			<../test-6-$PACK6.pack
+	)
+'
+
 test_expect_success 'honor pack.packSizeLimit' '
 	git config pack.packSizeLimit 3m &&
 	packname_10=$(git pack-objects test-10 <obj-list) &&
@@ -73,6 +73,32 @@ test_expect_success 'index-pack --verify on index version 2' '
 	git index-pack --verify "test-2-${pack2}.pack"
 '
 
+test_expect_success 'index-pack with threads gives the same index' '
+	git index-pack --threads=4 --index-version=2 -o 2t.idx \
+		"test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" 2t.idx &&
+	GIT_FORCE_THREADS=1 git index-pack --threads=1 --strict \
+		--stdin strict-t.pack <"test-1-${pack1}.pack" &&
+	cmp "test-1-${pack1}.pack" strict-t.pack &&
+	cmp "test-2-${pack2}.idx" strict-t.idx
+'
+
+test_expect_success 'index-pack resolves OFS_DELTA while receiving' '
+	pack3=$(git pack-objects --delta-base-offset test-ofs <obj-list) &&
+	git index-pack --threads=1 -o ofs-1.idx "test-ofs-${pack3}.pack" &&
+	for limit in 96m 4k 1
+	do
+		rm -f ofs-t.pack ofs-t.idx &&
+		git -c core.deltaBaseCacheLimit=$limit index-pack \
+			--threads=4 --stdin ofs-t.pack <"test-ofs-${pack3}.pack" &&
+		cmp ofs-1.idx ofs-t.idx &&
+		git index-pack --threads=1 --verify-stat ofs-t.pack >expect &&
+		git -c core.deltaBaseCacheLimit=$limit index-pack \
+			--threads=4 --verify-stat ofs-t.pack >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_expect_success \
     'pack-objects --index-version=2, is not accepted' \
     'test_must_fail git pack-objects --index-version=2, test-3 <obj-list'
@@ -119,6 +119,37 @@ test_expect_success 'fetch (full bitmap)' '
 	test_cmp expect actual
 '
 
+test_expect_success 'fetch checks connectivity with the bitmap' '
+	test_commit more-3 &&
+	GIT_TRACE="$TRASH_DIRECTORY/trace" \
+		git --git-dir=clone.git fetch origin master:master &&
+	grep "rev-list.*--use-bitmap-index" trace &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack.useBitmaps=false checks connectivity by walking' '
+	test_commit more-4 &&
+	rm -f trace &&
+	GIT_TRACE="$TRASH_DIRECTORY/trace" \
+		git --git-dir=clone.git -c pack.usebitmaps=false \
+		fetch origin master:master &&
+	grep "rev-list.*--objects" trace &&
+	! grep "rev-list.*--use-bitmap-index" trace
+'
+
+test_expect_success 'bitmap --objects notices blobs missing outside the bitmap' '
+	blob=$(echo "missing new blob" | git hash-object -w --stdin) &&
+	tree=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
+	commit=$(echo new | git commit-tree $tree -p HEAD) &&
+	git rev-list --objects --use-bitmap-index $commit --not --all >actual &&
+	grep $blob actual &&
+	rm $(objpath $blob) &&
+	test_must_fail git rev-list --objects --use-bitmap-index \
+		$commit --not --all
+'
+
 test_expect_success 'create objects for missing-HAVE tests' '
 	blob=$(echo "missing have" | git hash-object -w --stdin) &&
 	tree=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
@@ -146,6 +177,56 @@ test_expect_success 'pack with missing parent' '
 	git pack-objects --stdout --revs <revs >/dev/null
 '
 
+test_expect_success 'setup on-disk delta against a "have" object' '
+	git init delta-reuse &&
+	(
+		cd delta-reuse &&
+		test_seq 1 1000 >file &&
+		git add file &&
+		git commit -m old &&
+		test_seq 1 500 >file &&
+		git commit -a -m new &&
+		git repack -adb &&
+		git cat-file --batch-check="%(objectname) %(deltabase)" \
+			<<-\EOF >deltas
+		HEAD:file
+		EOF
+		echo "$(git rev-parse HEAD:file) $(git rev-parse HEAD^:file)" >expect &&
+		test_cmp expect deltas
+	)
+'
+
+test_expect_success 'thin pack reuses the delta against a "have" object' '
+	(
+		cd delta-reuse &&
+		printf "HEAD\n^HEAD^\n" >revs &&
+		GIT_TRACE_PERFORMANCE="$TRASH_DIRECTORY/trace" \
+			git pack-objects --thin --stdout --revs <revs >thin.pack &&
+		grep "check objects for reuse (1 deltas, 1 thin bases)" \
+			"$TRASH_DIRECTORY/trace" &&
+		grep "bitmap walk" "$TRASH_DIRECTORY/trace" &&
+		grep "write pack (3 objects, 3 reused, 1 reused deltas)" \
+			"$TRASH_DIRECTORY/trace" &&
+		git clone --bare --no-local . ../delta-reuse-old.git &&
+		cd ../delta-reuse-old.git &&
+		git update-ref refs/heads/master HEAD^ &&
+		git index-pack --stdin --fix-thin <../delta-reuse/thin.pack &&
+		git update-ref refs/heads/master $(git --git-dir=../delta-reuse/.git rev-parse HEAD) &&
+		git fsck
+	)
+'
+
+test_expect_success 'non-thin pack does not use "have" objects as bases' '
+	(
+		cd delta-reuse &&
+		rm -f "$TRASH_DIRECTORY/trace" &&
+		GIT_TRACE_PERFORMANCE="$TRASH_DIRECTORY/trace" \
+			git pack-objects --stdout --revs <revs >full.pack &&
+		grep "check objects for reuse (0 deltas, 0 thin bases)" \
+			"$TRASH_DIRECTORY/trace"
+	)
+'
+
 test_lazy_prereq JGIT '
 	type jgit
 '
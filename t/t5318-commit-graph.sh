@@ -0,0 +1,283 @@
+#!/bin/sh
+
+test_description='commit graph'
+. ./test-lib.sh
+
+test_expect_success 'setup full repo' '
+	mkdir full &&
+	cd "$TRASH_DIRECTORY/full" &&
+	git init &&
+	objdir=".git/objects"
+'
+
+test_expect_success 'verify graph with no graph file' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph verify
+'
+
+test_expect_success 'write graph with no packs' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write --object-dir . &&
+	test_path_is_file info/commit-graph
+'
+
+test_expect_success 'create commits and repack' '
+	cd "$TRASH_DIRECTORY/full" &&
+	for i in $(test_seq 3)
+	do
+		test_commit $i &&
+		git branch commits/$i
+	done &&
+	git repack
+'
+
+graph_git_two_modes() {
+	git -c core.commitGraph=true $1 >output
+	git -c core.commitGraph=false $1 >expect
+	test_cmp expect output
+}
+
+graph_is_ancestor_two_modes() {
+	git -c core.commitGraph=true merge-base --is-ancestor $1 $2
+	echo $? >output
+	git -c core.commitGraph=false merge-base --is-ancestor $1 $2
+	echo $? >expect
+	test_cmp expect output
+}
+
+graph_git_behavior() {
+	MSG=$1
+	BRANCH=$2
+	COMPARE=$3
+	test_expect_success "check normal git operations: $MSG" '
+		cd "$TRASH_DIRECTORY/full" &&
+		graph_git_two_modes "log --oneline $BRANCH" &&
+		graph_git_two_modes "log --topo-order $BRANCH" &&
+		graph_git_two_modes "log --graph $COMPARE..$BRANCH" &&
+		graph_git_two_modes "branch -vv" &&
+		graph_git_two_modes "merge-base -a $BRANCH $COMPARE" &&
+		graph_git_two_modes "tag --contains $COMPARE" &&
+		graph_git_two_modes "branch --contains $BRANCH" &&
+		graph_git_two_modes "branch --contains $COMPARE" &&
+		graph_is_ancestor_two_modes $COMPARE $BRANCH &&
+		graph_is_ancestor_two_modes $BRANCH $COMPARE
+	'
+}
+
+graph_git_behavior 'no graph' commits/3 commits/1
+
+test_expect_success 'write graph' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write &&
+	test_path_is_file $objdir/info/commit-graph &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'graph exists' commits/3 commits/1
+
+test_expect_success 'Add more commits' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git reset --hard commits/1 &&
+	for i in $(test_seq 4 5)
+	do
+		test_commit $i &&
+		git branch commits/$i
+	done &&
+	git reset --hard commits/2 &&
+	for i in $(test_seq 6 7)
+	do
+		test_commit $i &&
+		git branch commits/$i
+	done &&
+	git reset --hard commits/2 &&
+	git merge commits/4 &&
+	git branch merge/1 &&
+	git reset --hard commits/4 &&
+	git merge commits/6 &&
+	git branch merge/2 &&
+	git reset --hard commits/3 &&
+	git merge commits/5 commits/7 &&
+	git branch merge/3 &&
+	git repack
+'
+
+# Current graph structure:
+#
+#   __M3___
+#  /   |   \
+# 3 M1 5 M2 7
+# |/  \|/  \|
+# 2    4    6
+# |___/____/
+# 1
+
+graph_git_behavior 'stale graph, merge/1 vs master' merge/1 master
+
+test_expect_success 'write graph with merges' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write &&
+	test_path_is_file $objdir/info/commit-graph &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'merge 1 vs 2' merge/1 merge/2
+graph_git_behavior 'merge 1 vs 3' merge/1 merge/3
+graph_git_behavior 'merge 2 vs 3' merge/2 merge/3
+
+test_expect_success 'Add one more commit' '
+	cd "$TRASH_DIRECTORY/full" &&
+	test_commit 8 &&
+	git branch commits/8 &&
+	ls $objdir/pack | grep idx >existing-idx &&
+	git repack &&
+	ls $objdir/pack| grep idx | grep -v --file=existing-idx >new-idx
+'
+
+graph_git_behavior 'mixed mode, commit 8 vs merge 1' commits/8 merge/1
+graph_git_behavior 'mixed mode, commit 8 vs merge 2' commits/8 merge/2
+
+test_expect_success 'write graph from refs' '
+	cd "$TRASH_DIRECTORY/full" &&
+	rm -f $objdir/info/commit-graph &&
+	git commit-graph write --reachable &&
+	test_path_is_file $objdir/info/commit-graph &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'graph from refs, commit 8 vs merge 1' commits/8 merge/1
+graph_git_behavior 'graph from refs, commit 8 vs merge 2' commits/8 merge/2
+
+test_expect_success 'write graph from stdin commits' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git rev-parse merge/3 commits/8 |
+	git commit-graph write --stdin-commits &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'graph from stdin, commit 8 vs merge 3' commits/8 merge/3
+
+test_expect_success 'graph is ignored with grafts' '
+	cd "$TRASH_DIRECTORY/full" &&
+	echo "$(git rev-parse merge/1) $(git rev-parse commits/3)" >.git/info/grafts &&
+	git log --format=%H -1 merge/1^ >actual &&
+	git rev-parse commits/3 >expect &&
+	rm .git/info/grafts &&
+	test_cmp expect actual
+'
+
+test_expect_success 'graph is ignored with replace refs' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git replace commits/2 commits/6 &&
+	git log --format=%s -1 merge/1^ >actual &&
+	git replace -d commits/2 &&
+	echo 6 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'gc writes the graph with gc.writeCommitGraph' '
+	cd "$TRASH_DIRECTORY/full" &&
+	rm -f $objdir/info/commit-graph &&
+	git gc &&
+	test_path_is_missing $objdir/info/commit-graph &&
+	git -c gc.writeCommitGraph=true gc &&
+	test_path_is_file $objdir/info/commit-graph &&
+	git commit-graph verify
+'
+
+test_expect_success 'graph records generation numbers' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write --reachable &&
+	git commit-graph verify &&
+	git -c core.commitGraph=true branch --contains commits/1 >output &&
+	git -c core.commitGraph=false branch --contains commits/1 >expect &&
+	test_cmp expect output &&
+	git -c core.commitGraph=true tag --contains commits/8 >output &&
+	echo 8 >expect &&
+	test_cmp expect output
+'
+
+test_expect_success 'verify detects corrupt checksum' '
+	cd "$TRASH_DIRECTORY/full" &&
+	cp $objdir/info/commit-graph commit-graph-backup &&
+	test_when_finished "mv commit-graph-backup $objdir/info/commit-graph" &&
+	chmod u+w $objdir/info/commit-graph &&
+	size=$(wc -c <$objdir/info/commit-graph) &&
+	printf "\377" |
+	dd of=$objdir/info/commit-graph bs=1 seek=$(($size - 1)) conv=notrunc &&
+	test_must_fail git commit-graph verify 2>err &&
+	grep "incorrect checksum" err
+'
+
+test_expect_success 'graph with a truncated commit data chunk is ignored' '
+	cd "$TRASH_DIRECTORY/full" &&
+	cp $objdir/info/commit-graph commit-graph-backup &&
+	test_when_finished "mv commit-graph-backup $objdir/info/commit-graph" &&
+	chmod u+w $objdir/info/commit-graph &&
+	# move the start of the chunk after DATA (the fourth entry of the
+	# chunk table) back by one commit, so that DATA is one entry short
+	perl -e '\''
+		open(my $fh, "+<", $ARGV[0]) or die;
+		binmode $fh;
+		seek($fh, 8 + 3 * 12 + 4, 0);
+		read($fh, my $buf, 8);
+		my ($hi, $lo) = unpack("NN", $buf);
+		seek($fh, 8 + 3 * 12 + 4, 0);
+		print $fh pack("NN", $hi, $lo - 36);
+		close($fh);
+	'\'' $objdir/info/commit-graph &&
+	git -c core.commitGraph=true log --format=%H merge/1 >output 2>err &&
+	grep "commit data does not match" err &&
+	git -c core.commitGraph=false log --format=%H merge/1 >expect &&
+	test_cmp expect output
+'
+
+test_expect_success 'graph with an out-of-order fanout is ignored' '
+	cd "$TRASH_DIRECTORY/full" &&
+	cp $objdir/info/commit-graph commit-graph-backup &&
+	test_when_finished "mv commit-graph-backup $objdir/info/commit-graph" &&
+	chmod u+w $objdir/info/commit-graph &&
+	# make the first fanout entry larger than all that follow
+	perl -e '\''
+		open(my $fh, "+<", $ARGV[0]) or die;
+		binmode $fh;
+		seek($fh, 8 + 4, 0);
+		read($fh, my $buf, 8);
+		my ($hi, $lo) = unpack("NN", $buf);
+		seek($fh, $lo, 0);
+		print $fh pack("N", 0xffffffff);
+		close($fh);
+	'\'' $objdir/info/commit-graph &&
+	git -c core.commitGraph=true log --format=%H merge/1 >output 2>err &&
+	grep "fanout is out of order" err &&
+	git -c core.commitGraph=false log --format=%H merge/1 >expect &&
+	test_cmp expect output
+'
+
+test_expect_success 'no graph is written in a grafted repository' '
+	cd "$TRASH_DIRECTORY/full" &&
+	cp $objdir/info/commit-graph commit-graph-backup &&
+	test_when_finished "mv commit-graph-backup $objdir/info/commit-graph" &&
+	echo "$(git rev-parse merge/1) $(git rev-parse commits/3)" >.git/info/grafts &&
+	test_when_finished "rm -f .git/info/grafts" &&
+	rm $objdir/info/commit-graph &&
+	test_must_fail git commit-graph write --reachable 2>err &&
+	grep "shallow or grafted" err &&
+	git -c gc.writeCommitGraph=true gc &&
+	test_path_is_missing $objdir/info/commit-graph
+'
+
+test_expect_success 'no graph is written in a shallow repository' '
+	cd "$TRASH_DIRECTORY" &&
+	git clone --no-local --depth=1 full shallow &&
+	test_must_fail git -C shallow commit-graph write --reachable &&
+	git -C shallow -c gc.writeCommitGraph=true gc &&
+	test_path_is_missing shallow/.git/objects/info/commit-graph &&
+	git -C shallow fetch --unshallow &&
+	git -C shallow merge-base --is-ancestor HEAD~1 HEAD &&
+	git -C shallow commit-graph write --reachable &&
+	git -C shallow commit-graph verify &&
+	git -C shallow -c core.commitGraph=true \
+		merge-base --is-ancestor HEAD~1 HEAD
+'
+
+test_done
@@ -0,0 +1,166 @@
+#!/bin/sh
+
+test_description='multi-pack-index'
+. ./test-lib.sh
+
+objdir=.git/objects
+
+midx_num_packs () {
+	od -An -tu1 -j8 -N4 "$1/pack/multi-pack-index" |
+	awk '{ print $1 * 16777216 + $2 * 65536 + $3 * 256 + $4 }'
+}
+
+midx_git_two_modes () {
+	git -c core.multiPackIndex=true $1 <"${2:-/dev/null}" >output &&
+	git -c core.multiPackIndex=false $1 <"${2:-/dev/null}" >expect &&
+	test_cmp expect output
+}
+
+all_objects () {
+	git rev-list --objects --all --reflog | cut -c1-40 | sort
+}
+
+test_expect_success 'verify with no multi-pack-index' '
+	git multi-pack-index verify
+'
+
+test_expect_success 'write midx with no packs' '
+	git multi-pack-index write &&
+	test_path_is_file $objdir/pack/multi-pack-index &&
+	test "$(midx_num_packs $objdir)" = 0 &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'create objects in several packs' '
+	for i in 1 2 3 4 5
+	do
+		test_commit $i &&
+		if test $i = 1
+		then
+			git rev-list --objects HEAD
+		else
+			git rev-list --objects HEAD~1..HEAD
+		fi >list &&
+		git pack-objects $objdir/pack/test-$i <list >/dev/null &&
+		git prune-packed || return 1
+	done &&
+	test "$(ls $objdir/pack/*.pack | wc -l)" = 5
+'
+
+test_expect_success 'write midx with five packs' '
+	git multi-pack-index write &&
+	test "$(midx_num_packs $objdir)" = 5 &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'object lookups agree with and without midx' '
+	all_objects >objects &&
+	midx_git_two_modes "cat-file --batch-check" objects &&
+	midx_git_two_modes "log --raw --stat" &&
+	midx_git_two_modes "rev-list --objects --all" &&
+	git fsck
+'
+
+test_expect_success 'count-objects does not report the midx as garbage' '
+	git count-objects -v >count &&
+	grep "^garbage: 0" count
+'
+
+test_expect_success 'objects in packs added later are still found' '
+	test_commit 6 &&
+	git rev-list --objects HEAD~1..HEAD >list &&
+	git pack-objects $objdir/pack/test-6 <list >/dev/null &&
+	git prune-packed &&
+	all_objects >objects &&
+	midx_git_two_modes "cat-file --batch-check" objects &&
+	test "$(midx_num_packs $objdir)" = 5
+'
+
+test_expect_success 'rewrite midx to cover the new pack' '
+	git multi-pack-index write &&
+	test "$(midx_num_packs $objdir)" = 6 &&
+	git multi-pack-index verify &&
+	midx_git_two_modes "cat-file --batch-check" objects
+'
+
+test_expect_success 'midx is ignored when a pack it names is gone' '
+	git clone --no-local --bare . gone &&
+	git --git-dir=gone fetch --quiet . "refs/tags/*:refs/tags/*" &&
+	git --git-dir=gone multi-pack-index write &&
+	git --git-dir=gone rev-list --objects --all | cut -c1-40 >gone-objects &&
+	all=$(git --git-dir=gone pack-objects gone/objects/pack/all <gone-objects) &&
+	for p in gone/objects/pack/pack-*.pack
+	do
+		rm -f "$p" "${p%.pack}.idx" || return 1
+	done &&
+	git --git-dir=gone cat-file --batch-check <gone-objects >actual &&
+	! grep missing actual
+'
+
+test_expect_success 'repack rewrites an existing midx' '
+	git repack -adf &&
+	test "$(midx_num_packs $objdir)" = 1 &&
+	git multi-pack-index verify &&
+	all_objects >objects &&
+	midx_git_two_modes "cat-file --batch-check" objects
+'
+
+test_expect_success 'repack.writeMultiPackIndex=false leaves no fresh midx' '
+	rm -f $objdir/pack/multi-pack-index &&
+	git -c repack.writeMultiPackIndex=false repack -ad &&
+	test_path_is_missing $objdir/pack/multi-pack-index &&
+	git -c repack.writeMultiPackIndex=true repack -ad &&
+	test_path_is_file $objdir/pack/multi-pack-index
+'
+
+test_expect_success 'midx in an alternate object directory' '
+	git clone -s . alt &&
+	(
+		cd alt &&
+		test_commit alt &&
+		git repack -d &&
+		git multi-pack-index write &&
+		test "$(midx_num_packs .git/objects)" = 1 &&
+		all_objects >objects &&
+		midx_git_two_modes "cat-file --batch-check" objects
+	) &&
+	git multi-pack-index --object-dir=alt/.git/objects verify
+'
+
+test_expect_success 'verify detects a corrupt checksum' '
+	cp $objdir/pack/multi-pack-index midx-backup &&
+	test_when_finished "mv midx-backup $objdir/pack/multi-pack-index" &&
+	chmod u+w $objdir/pack/multi-pack-index &&
+	size=$(wc -c <$objdir/pack/multi-pack-index) &&
+	printf "\001" |
+	dd of=$objdir/pack/multi-pack-index bs=1 seek=$(($size - 1)) conv=notrunc 2>/dev/null &&
+	test_must_fail git multi-pack-index verify 2>err &&
+	grep "incorrect checksum" err
+'
+
+test_expect_success 'midx whose chunks do not match its object count is ignored' '
+	cp $objdir/pack/multi-pack-index midx-backup &&
+	test_when_finished "mv midx-backup $objdir/pack/multi-pack-index" &&
+	chmod u+w $objdir/pack/multi-pack-index &&
+	# raise the object count in the last fanout entry, so that the
+	# OID lookup and object offset chunks are too short for it
+	perl -e '\''
+		open(my $fh, "+<", $ARGV[0]) or die;
+		binmode $fh;
+		seek($fh, 12 + 12 + 4, 0);
+		read($fh, my $buf, 8);
+		my ($hi, $lo) = unpack("NN", $buf);
+		seek($fh, $lo + 4 * 255, 0);
+		read($fh, $buf, 4);
+		seek($fh, $lo + 4 * 255, 0);
+		print $fh pack("N", unpack("N", $buf) + 1000);
+		close($fh);
+	'\'' $objdir/pack/multi-pack-index &&
+	test_must_fail git multi-pack-index verify 2>err &&
+	grep "do not match the number of objects" err &&
+	all_objects >objects &&
+	git cat-file --batch-check <objects >actual &&
+	! grep missing actual
+'
+
+test_done
@@ -0,0 +1,109 @@
+#!/bin/sh
+
+test_description='exercise delta islands'
+. ./test-lib.sh
+
+# returns true iff $1 is a delta based on $2
+is_delta_base () {
+	delta_base=$(echo $1 | git cat-file --batch-check="%(deltabase)") &&
+	echo >&2 "$1 has base $delta_base" &&
+	test "$delta_base" = "$2"
+}
+
+# generate a commit on branch $1 with a single file, "file", whose
+# content is mostly based on the seed $2, but with a unique bit
+# of content $3 appended. This should allow us to see whether
+# blobs of different refs delta against each other.
+commit () {
+	blob=$({ test-genrandom "$2" 10240 && echo "$3"; } |
+	       git hash-object -w --stdin) &&
+	tree=$(printf '100644 blob %s\tfile\n' "$blob" | git mktree) &&
+	commit=$(echo "$2-$3" | git commit-tree "$tree" ${4:+-p "$4"}) &&
+	git update-ref "refs/heads/$1" "$commit" &&
+	eval "$1"'=$(git rev-parse $1:file)' &&
+	eval "echo >&2 $1=\$$1"
+}
+
+test_expect_success 'setup commits' '
+	commit one seed 1 &&
+	commit two seed 12
+'
+
+# Note: This is heavily dependent on the "prefer larger objects as base"
+# heuristic.
+test_expect_success 'vanilla repack deltas one against two' '
+	git repack -adf &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'island repack with no island definition is vanilla' '
+	git repack -adfi &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'island repack with no matches is vanilla' '
+	git -c "pack.island=refs/foo" repack -adfi &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'separate islands disallows delta' '
+	git -c "pack.island=refs/heads/(.*)" repack -adfi &&
+	! is_delta_base $one $two &&
+	! is_delta_base $two $one
+'
+
+test_expect_success 'same island allows delta' '
+	git -c "pack.island=refs/heads" repack -adfi &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'coalesce same-named islands' '
+	git \
+		-c "pack.island=refs/(.*)/one" \
+		-c "pack.island=refs/(.*)/two" \
+		repack -adfi &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'existing deltas across islands are not reused' '
+	git repack -adf &&
+	is_delta_base $one $two &&
+	git -c "pack.island=refs/heads/(.*)" repack -adi &&
+	! is_delta_base $one $two
+'
+
+test_expect_success 'repack.useDeltaIslands enables islands' '
+	git repack -adf &&
+	git -c "pack.island=refs/heads/(.*)" -c repack.useDeltaIslands=true \
+		repack -adf &&
+	! is_delta_base $one $two
+'
+
+test_expect_success 'shared history does not join separate islands' '
+	commit root seed 123 &&
+	commit one seed 1 $(git rev-parse root) &&
+	commit two seed 12 $(git rev-parse root) &&
+	git -c "pack.island=refs/heads/(.*)" repack -adfi &&
+	! is_delta_base $one $two &&
+	! is_delta_base $two $one
+'
+
+test_expect_success 'objects reachable from both islands may be bases' '
+	# "root" is reachable from both one and two, so both of their
+	# blobs may use it as a base, but not the other way around
+	git -c "pack.island=refs/heads/(one|two)" repack -adfi &&
+	! is_delta_base $root $one &&
+	! is_delta_base $root $two &&
+	is_delta_base $one $root &&
+	is_delta_base $two $root
+'
+
+test_expect_success 'annotated tags join the island of their ref' '
+	git tag -m "tag one" tagged-one one &&
+	git -c "pack.island=refs/heads/(.*)" \
+		-c "pack.island=refs/tags/tagged-(.*)" repack -adfi &&
+	! is_delta_base $one $two &&
+	git fsck
+'
+
+test_done
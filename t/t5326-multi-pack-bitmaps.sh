@@ -0,0 +1,138 @@
+#!/bin/sh
+
+test_description='reachability bitmaps over a multi-pack-index'
+. ./test-lib.sh
+
+objdir=.git/objects
+
+midx_bitmap () {
+	ls $objdir/pack/ | sed -n "/^multi-pack-index-.*\.bitmap$/p"
+}
+
+test_expect_success 'setup history in several packs' '
+	for i in $(test_seq 1 10)
+	do
+		test_commit $i &&
+		git repack -d || return 1
+	done &&
+	git checkout -b other HEAD~5 &&
+	for i in $(test_seq 1 5)
+	do
+		test_commit side-$i &&
+		git repack -d || return 1
+	done &&
+	git checkout master &&
+	blob=$(echo tagged-blob | git hash-object -w --stdin) &&
+	git tag tagged-blob $blob &&
+	git repack -d &&
+	test "$(ls $objdir/pack/*.pack | wc -l)" -gt 1 &&
+	test_must_fail ls $objdir/pack/*.bitmap
+'
+
+test_expect_success 'write midx with a bitmap' '
+	git multi-pack-index write --bitmap &&
+	midx_bitmap >bitmaps &&
+	test_line_count = 1 bitmaps
+'
+
+test_expect_success 'count-objects does not report the bitmap as garbage' '
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_expect_success 'rev-list --test-bitmap verifies the bitmap' '
+	git rev-list --test-bitmap HEAD 2>out &&
+	grep "^OK!" out
+'
+
+rev_list_tests () {
+	state=$1
+
+	test_expect_success "counting commits via bitmap ($state)" '
+		git rev-list --count HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting non-linear history ($state)" '
+		git rev-list --count other...master >expect &&
+		git rev-list --use-bitmap-index --count other...master >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerate --objects ($state)" '
+		git rev-list --objects --use-bitmap-index --all >tmp &&
+		cut -d" " -f1 <tmp | sort >actual &&
+		git rev-list --objects --all >tmp &&
+		cut -d" " -f1 <tmp | sort >expect &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "disk usage ($state)" '
+		git rev-list --disk-usage --objects HEAD~3..other >expect &&
+		git rev-list --disk-usage --objects --use-bitmap-index \
+			HEAD~3..other >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "partial --objects ($state)" '
+		git rev-list --objects --use-bitmap-index HEAD~3..other >tmp &&
+		cut -d" " -f1 <tmp | sort >actual &&
+		git rev-list --objects HEAD~3..other >tmp &&
+		cut -d" " -f1 <tmp | sort >expect &&
+		test_cmp expect actual
+	'
+}
+
+rev_list_tests 'multi-pack bitmap'
+
+test_expect_success 'objects outside the midx are found through the bitmap walk' '
+	test_commit loose &&
+	git rev-list --count HEAD >expect &&
+	git rev-list --use-bitmap-index --count HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone from the bitmapped repository' '
+	git clone --no-local --bare . clone.git &&
+	git rev-parse --all >expect &&
+	git --git-dir=clone.git rev-parse --all >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'writing fails for objects missing from the midx' '
+	test_must_fail git multi-pack-index write --bitmap 2>err &&
+	grep "not in the multi-pack-index" err
+'
+
+test_expect_success 'incremental repack keeps the bitmap' '
+	git repack -d &&
+	midx_bitmap >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	git rev-list --test-bitmap HEAD 2>out &&
+	grep "^OK!" out
+'
+
+rev_list_tests 'after incremental repack'
+
+test_expect_success 'stale bitmaps are removed when the midx is rewritten' '
+	test_commit more &&
+	git repack -d &&
+	midx_bitmap >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	test_commit even-more &&
+	git rev-list --objects HEAD^..HEAD >list &&
+	git pack-objects $objdir/pack/extra <list &&
+	git multi-pack-index write &&
+	midx_bitmap >bitmaps &&
+	test_line_count = 0 bitmaps
+'
+
+test_expect_success 'bitmap is not used when the midx is disabled' '
+	git multi-pack-index write --bitmap &&
+	git -c core.multiPackIndex=false rev-list --test-bitmap HEAD 2>err;
+	test_i18ngrep "failed to load bitmap" err
+'
+
+test_done
@@ -0,0 +1,102 @@
+#!/bin/sh
+
+test_description='upload-pack answers repeated requests from its pack cache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git clone --bare . server.git
+'
+
+test_expect_success 'no pack is cached by default' '
+	git clone "file://$PWD/server.git" uncached &&
+	test_path_is_missing server.git/upload-pack-cache
+'
+
+test_expect_success 'a request seen for the first time is not cached' '
+	git -C server.git config uploadpack.packCache true &&
+	git clone "file://$PWD/server.git" first &&
+	ls server.git/upload-pack-cache/*/*.seen >seen &&
+	test_line_count = 1 seen &&
+	! ls server.git/upload-pack-cache/*/*.pack
+'
+
+test_expect_success 'the second identical request caches its pack' '
+	GIT_TRACE="$PWD/second.trace" \
+		git clone "file://$PWD/server.git" second &&
+	grep "run_command: .pack-objects" second.trace &&
+	ls server.git/upload-pack-cache/*/*.pack >packs &&
+	test_line_count = 1 packs
+'
+
+test_expect_success 'the same request is answered from the cache' '
+	GIT_TRACE="$PWD/third.trace" \
+		git clone "file://$PWD/server.git" third &&
+	! grep "run_command: .pack-objects" third.trace &&
+	git -C third fsck &&
+	git -C first rev-parse --all >expect &&
+	git -C third rev-parse --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a request with other haves is cached separately' '
+	for repo in have-one-a have-one-b
+	do
+		git init $repo &&
+		git -C $repo fetch .. one:refs/heads/one &&
+		git -C $repo fetch "file://$PWD/server.git" master &&
+		git -C $repo fsck || return 1
+	done &&
+	ls server.git/upload-pack-cache/*/*.pack >packs &&
+	test_line_count = 2 packs
+'
+
+test_expect_success 'packs beyond uploadpack.packCacheLimit are not kept' '
+	test_when_finished "git -C server.git config --unset uploadpack.packCacheLimit" &&
+	git -C server.git config uploadpack.packCacheLimit 1 &&
+	git clone --depth=1 "file://$PWD/server.git" limited-1 &&
+	GIT_TRACE="$PWD/limited.trace" \
+		git clone --depth=1 "file://$PWD/server.git" limited-2 &&
+	grep "run_command:.*pack-objects" limited.trace &&
+	git -C limited-2 fsck &&
+	ls server.git/upload-pack-cache/*/*.pack >packs &&
+	test_line_count = 2 packs &&
+	! ls server.git/upload-pack-cache/*/tmp_pack_*
+'
+
+test_expect_success 'abandoned temporary packs are removed' '
+	dir=$(ls -d server.git/upload-pack-cache/*) &&
+	: >"$dir/tmp_pack_old" &&
+	test-chmtime -7200 "$dir/tmp_pack_old" &&
+	: >"$dir/tmp_pack_new" &&
+	git clone --depth=2 "file://$PWD/server.git" tmp-cleanup &&
+	test_path_is_missing "$dir/tmp_pack_old" &&
+	test_path_is_file "$dir/tmp_pack_new" &&
+	rm -f "$dir/tmp_pack_new"
+'
+
+test_expect_success 'moving a ref drops the cached packs at the next request' '
+	ls -d server.git/upload-pack-cache/* >dirs &&
+	test_line_count = 1 dirs &&
+	old=$(cat dirs) &&
+	test_commit four &&
+	git push server.git master &&
+	git clone "file://$PWD/server.git" after-push &&
+	test_path_is_missing "$old" &&
+	ls server.git/upload-pack-cache/*/*.seen >seen &&
+	test_line_count = 1 seen &&
+	! ls server.git/upload-pack-cache/*/*.pack
+'
+
+test_expect_success 'protocol v2 fetches use the cache too' '
+	git -c protocol.version=2 clone "file://$PWD/server.git" v2-first &&
+	git -c protocol.version=2 clone "file://$PWD/server.git" v2-second &&
+	GIT_TRACE="$PWD/v2.trace" \
+		git -c protocol.version=2 clone "file://$PWD/server.git" v2-third &&
+	! grep "run_command: .pack-objects" v2.trace &&
+	git -C v2-third fsck
+'
+
+test_done
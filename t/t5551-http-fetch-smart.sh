@@ -213,6 +213,35 @@ test_expect_success 'cookies stored in http.cookiefile when http.savecookies set
 	test_cmp expect_cookies.txt cookies_tail.txt
 '
 
+test_expect_success 'remote helper resumes an interrupted download' '
+	git bundle create "$HTTPD_DOCUMENT_ROOT_PATH/repo.bundle" master &&
+	head -c 100 "$HTTPD_DOCUMENT_ROOT_PATH/repo.bundle" >partial.bundle.temp &&
+	printf "get %s %s\n\n" "$HTTPD_URL/dumb/repo.bundle" partial.bundle |
+		git remote-http "$HTTPD_URL/dumb/repo.bundle" &&
+	test_cmp "$HTTPD_DOCUMENT_ROOT_PATH/repo.bundle" partial.bundle &&
+	test_path_is_missing partial.bundle.temp
+'
+
+test_expect_success 'clone --bundle-uri downloads the bundle over http' '
+	git clone --bundle-uri="$HTTPD_URL/dumb/repo.bundle" \
+		$HTTPD_URL/smart/repo.git bundle-clone &&
+	git rev-parse master >expect &&
+	git --git-dir=bundle-clone/.git rev-parse refs/bundles/heads/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone uses http bundles the server offers' '
+	server="$HTTPD_DOCUMENT_ROOT_PATH/repo.git" &&
+	test_when_finished "git --git-dir=\"$server\" config --unset-all uploadpack.bundleURI" &&
+	git --git-dir="$server" config uploadpack.bundleURI \
+		"$HTTPD_URL/dumb/repo.bundle" &&
+	git -c protocol.version=2 -c transfer.bundleURI=true \
+		clone "file://$server" offered-clone &&
+	git rev-parse master >expect &&
+	git --git-dir=offered-clone/.git rev-parse refs/bundles/heads/master >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success EXPENSIVE 'create 50,000 tags in the repo' '
 	(
 	cd "$HTTPD_DOCUMENT_ROOT_PATH/repo.git" &&
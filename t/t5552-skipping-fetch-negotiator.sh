@@ -0,0 +1,207 @@
+#!/bin/sh
+
+test_description='test skipping fetch negotiator'
+. ./test-lib.sh
+
+# Print the "have" lines the client sent in the packet trace $1, one
+# per line, as commit subjects.
+have_sent () {
+	sed -n -e "s/.*fetch> have \([0-9a-f]\{40\}\).*/\1/p" "$1" |
+	while read sha1
+	do
+		git -C client log -1 --format=%s "$sha1"
+	done
+}
+
+# Print "<rounds> <haves>" for the packet trace $1: the number of
+# rounds of negotiation, each of which is a round trip over a
+# stateless transport like http, and the number of "have" lines sent.
+# In protocol v2 every round is a new "fetch" request; in v0 every
+# batch of haves ends with a flush, after the one ending the wants.
+negotiation_stats () {
+	rounds=$(grep -c "fetch> command=fetch" "$1")
+	if test "$rounds" = 0
+	then
+		rounds=$(($(grep -c "fetch> 0000" "$1") - 1))
+	fi
+	echo $rounds $(grep -c "fetch> have " "$1")
+}
+
+# Make a commit on top of "$1" in the repository "$2" whose subject is
+# "$3", without a tag, so that it is not a tip of its own.  Callers
+# run test_tick first, as it would be lost in a command substitution.
+commit_on () {
+	git -C "$2" commit-tree -m "$3" ${1:+-p "$1"} \
+		"$(git -C "$2" hash-object -t tree -w /dev/null)"
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	(
+		cd server &&
+		test_commit to_fetch
+	) &&
+
+	git init client &&
+	parent= &&
+	for i in $(test_seq 1 20)
+	do
+		test_tick &&
+		parent=$(commit_on "$parent" client c$i) || return 1
+	done &&
+	git -C client update-ref refs/heads/master $parent
+'
+
+test_expect_success 'commits are sent at exponentially growing distances' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client \
+		-c fetch.negotiationAlgorithm=skipping \
+		fetch "$(pwd)/server" &&
+	have_sent trace >actual &&
+	cat >expect <<-\EOF &&
+	c20
+	c18
+	c15
+	c10
+	c2
+	c1
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'default negotiator sends every commit' '
+	(cd server && test_commit second) &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client \
+		fetch "$(pwd)/server" &&
+	have_sent trace >actual &&
+	test_line_count = 20 actual
+'
+
+test_expect_success 'remote.<name>.negotiationAlgorithm overrides the default' '
+	(cd server && test_commit third) &&
+	git -C client remote add origin "$(pwd)/server" &&
+	git -C client config remote.origin.negotiationAlgorithm skipping &&
+	git -C client config fetch.negotiationAlgorithm default &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client fetch origin &&
+	have_sent trace >actual &&
+	test_line_count = 6 actual
+'
+
+test_expect_success 'unknown algorithms are rejected' '
+	(cd server && test_commit fourth) &&
+	test_must_fail git -C client \
+		-c remote.origin.negotiationAlgorithm=bogus \
+		fetch origin 2>err &&
+	grep "unknown fetch negotiation algorithm .bogus." err
+'
+
+# The tip of a ref is sent even when a newer tip skips over it, as it
+# is the most likely to be known to the server.  All of these fit in
+# the first batch of haves, before the server could have acknowledged
+# anything.
+test_expect_success 'ref tips are never skipped' '
+	rm -rf server client &&
+	git init server &&
+	parent= &&
+	for i in $(test_seq 1 5)
+	do
+		test_tick &&
+		parent=$(commit_on "$parent" server base$i) || return 1
+	done &&
+	git -C server update-ref refs/heads/master $parent &&
+	git clone server client &&
+	parent=$(git -C client rev-parse HEAD) &&
+	for i in $(test_seq 1 12)
+	do
+		test_tick &&
+		parent=$(commit_on "$parent" client local$i) || return 1
+	done &&
+	git -C client update-ref refs/heads/local $parent &&
+	test_tick &&
+	commit_on master server new >new &&
+	git -C server update-ref refs/heads/master $(cat new) &&
+
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client \
+		-c fetch.negotiationAlgorithm=skipping fetch origin &&
+	have_sent trace >actual &&
+	cat >expect <<-\EOF &&
+	local12
+	local10
+	local7
+	local2
+	base5
+	base3
+	base1
+	EOF
+	test_cmp expect actual &&
+	grep "fetch< ACK $(git -C server rev-parse master^)" trace
+'
+
+# Many local-only branches, each a long way ahead of the history we
+# share with the server, make the default negotiator walk all of them
+# before it gets to a common commit.
+test_expect_success 'setup many local branches' '
+	rm -rf server client &&
+	git init server &&
+	test_tick &&
+	git -C server commit --allow-empty -m base &&
+	git clone server client &&
+	base=$(git -C client rev-parse HEAD) &&
+	(
+		for b in $(test_seq 1 20)
+		do
+			for i in $(test_seq 1 40)
+			do
+				test_tick &&
+				echo "commit refs/heads/local$b" &&
+				echo "committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE" &&
+				echo "data <<EOF" &&
+				echo "local$b-$i" &&
+				echo "EOF" &&
+				if test $i = 1
+				then
+					echo "from $base"
+				fi &&
+				echo "M 644 inline file$b" &&
+				echo "data <<EOF" &&
+				echo "$b $i" &&
+				echo "EOF" &&
+				echo || return 1
+			done
+		done
+	) >stream &&
+	git -C client fast-import --quiet <stream &&
+	test_tick &&
+	git -C server commit --allow-empty -m new
+'
+
+for version in 0 2
+do
+	test_expect_success "skipping needs fewer haves (protocol v$version)" '
+		for algo in default skipping
+		do
+			rm -rf fetched trace.$algo &&
+			cp -R client fetched &&
+			GIT_TRACE_PACKET="$(pwd)/trace.$algo" git -C fetched \
+				-c protocol.version='$version' \
+				-c fetch.negotiationAlgorithm=$algo \
+				fetch origin &&
+			git -C fetched rev-parse origin/master >actual &&
+			git -C server rev-parse master >expect &&
+			test_cmp expect actual || return 1
+		done &&
+		set -- $(negotiation_stats trace.default) &&
+		default_rounds=$1 default_haves=$2 &&
+		set -- $(negotiation_stats trace.skipping) &&
+		skipping_rounds=$1 skipping_haves=$2 &&
+		echo "default: $default_rounds rounds, $default_haves haves" &&
+		echo "skipping: $skipping_rounds rounds, $skipping_haves haves" &&
+		test $skipping_haves -lt $default_haves &&
+		test $skipping_rounds -le $default_rounds
+	'
+done
+
+test_done
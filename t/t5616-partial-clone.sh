@@ -0,0 +1,200 @@
+#!/bin/sh
+
+test_description='partial clone and lazy fetching of missing objects'
+. ./test-lib.sh
+
+# count the blobs stored in the packs of the given repository
+count_packed_blobs () {
+	for idx in "$1"/.git/objects/pack/*.idx
+	do
+		git verify-pack -v "$idx"
+	done >verify &&
+	sed -n "/^[0-9a-f]\{40\} blob /p" verify | wc -l | tr -d " "
+}
+
+count_fetches () {
+	sed -n "/fetching .* missing object/p" "$1" | wc -l | tr -d " "
+}
+
+test_expect_success 'setup server' '
+	git init srv &&
+	mkdir -p srv/dir &&
+	for i in 1 2 3
+	do
+		echo "file $i" >srv/file.$i &&
+		echo "deep $i" >srv/dir/deep.$i || return 1
+	done &&
+	git -C srv add . &&
+	git -C srv commit -m one &&
+	echo more >>srv/file.1 &&
+	git -C srv commit -a -m two &&
+	git -C srv config uploadpack.allowfilter true &&
+	git -C srv config uploadpack.allowanysha1inwant true
+'
+
+test_expect_success 'clone with --filter=blob:none' '
+	git clone --no-checkout --filter=blob:none "file://$(pwd)/srv" pc1 &&
+	test "$(git -C pc1 config remote.origin.promisor)" = true &&
+	test "$(git -C pc1 config remote.origin.partialclonefilter)" = blob:none &&
+	ls pc1/.git/objects/pack/*.promisor &&
+	test "$(count_packed_blobs pc1)" = 0
+'
+
+test_expect_success 'rev-list --exclude-promisor-objects does not fetch' '
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C pc1 rev-list --objects \
+		--exclude-promisor-objects --all >actual &&
+	test "$(count_fetches trace)" = 0 &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'missing blob is fetched lazily' '
+	git -C srv rev-parse HEAD:file.2 >blob &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C pc1 cat-file -p $(cat blob) >actual &&
+	echo "file 2" >expect &&
+	test_cmp expect actual &&
+	test "$(count_fetches trace)" = 1 &&
+	test "$(count_packed_blobs pc1)" = 1
+'
+
+test_expect_success 'checkout fetches the blobs it needs' '
+	git -C pc1 checkout -f master &&
+	for i in 1 2 3
+	do
+		test_cmp srv/file.$i pc1/file.$i &&
+		test_cmp srv/dir/deep.$i pc1/dir/deep.$i || return 1
+	done &&
+	git -C pc1 fsck --connectivity-only 2>&1 >/dev/null | sed -n "/missing blob/p" >missing &&
+	test_must_be_empty missing
+'
+
+test_expect_success 'fetch into a partial clone uses the filter' '
+	echo new >srv/file.new &&
+	git -C srv add file.new &&
+	git -C srv commit -m three &&
+	git -C pc1 fetch origin &&
+	git -C pc1 rev-parse origin/master >actual &&
+	git -C srv rev-parse master >expect &&
+	test_cmp expect actual &&
+	blob=$(git -C srv rev-parse HEAD:file.new) &&
+	for idx in pc1/.git/objects/pack/*.idx
+	do
+		git show-index <$idx || return 1
+	done >objs &&
+	! grep $blob objs
+'
+
+test_expect_success 'repack leaves promisor packs alone' '
+	git -C pc1 commit --allow-empty -m local &&
+	ls pc1/.git/objects/pack/*.promisor | sort >before &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C pc1 repack -a -d &&
+	test "$(count_fetches trace)" = 0 &&
+	ls pc1/.git/objects/pack/*.promisor | sort >after &&
+	test_cmp before after &&
+	git -C pc1 log --oneline -1 >/dev/null
+'
+
+test_expect_success 'clone with --filter=tree:0' '
+	git clone --no-checkout --filter=tree:0 "file://$(pwd)/srv" pc2 &&
+	git -C pc2 rev-list --objects --all --exclude-promisor-objects >actual &&
+	test_must_be_empty actual &&
+	git -C pc2 checkout -f master &&
+	test_cmp srv/dir/deep.1 pc2/dir/deep.1
+'
+
+test_expect_success 'fsck accepts the objects a partial clone lacks' '
+	git clone --no-checkout --filter=blob:none "file://$(pwd)/srv" pc-fsck &&
+	git clone --no-checkout --filter=tree:0 "file://$(pwd)/srv" pc-fsck-tree &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C pc-fsck fsck &&
+	GIT_TRACE="$(pwd)/trace" git -C pc-fsck-tree fsck &&
+	test "$(count_fetches trace)" = 0
+'
+
+test_expect_success 'gc and prune work in a partial clone without fetching' '
+	git clone --filter=blob:none "file://$(pwd)/srv" pc-gc &&
+	git -C pc-gc reflog >reflog &&
+	test_line_count = 1 reflog &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C pc-gc gc &&
+	GIT_TRACE="$(pwd)/trace" git -C pc-gc prune --expire now &&
+	GIT_TRACE="$(pwd)/trace" git -C pc-fsck-tree prune --expire now 2>err &&
+	test_must_be_empty err &&
+	test "$(count_fetches trace)" = 0 &&
+	git -C pc-gc fsck &&
+	git -C pc-fsck-tree fsck
+'
+
+test_expect_success 'blob:limit clone keeps small blobs' '
+	printf "%5000s\n" big >srv/big &&
+	git -C srv add big &&
+	git -C srv commit -m big &&
+	git clone --no-checkout --filter=blob:limit=1k "file://$(pwd)/srv" pc3 &&
+	big=$(git -C srv rev-parse HEAD:big) &&
+	small=$(git -C srv rev-parse HEAD:file.3) &&
+	for idx in pc3/.git/objects/pack/*.idx
+	do
+		git show-index <$idx || return 1
+	done >objs &&
+	grep $small objs &&
+	! grep $big objs
+'
+
+test_expect_success 'checkout fetches missing blobs in one batch' '
+	git clone --no-checkout --filter=blob:none "file://$(pwd)/srv" pc5 &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C pc5 checkout -f master &&
+	test "$(count_fetches trace)" = 1 &&
+	test_cmp srv/dir/deep.3 pc5/dir/deep.3
+'
+
+test_expect_success 'diff fetches missing blobs in one batch' '
+	git clone --no-checkout --filter=blob:none "file://$(pwd)/srv" pc6 &&
+	git -C srv diff master~3 master >expect &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C pc6 diff master~3 master >actual &&
+	test_cmp expect actual &&
+	test "$(count_fetches trace)" = 1 &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C pc6 diff --name-only master~3 master &&
+	test "$(count_fetches trace)" = 0
+'
+
+test_expect_success 'blame fetches parent blobs together' '
+	git -C srv checkout -b blame master &&
+	echo base >srv/blamed &&
+	git -C srv add blamed &&
+	git -C srv commit -m base &&
+	git -C srv checkout -b side &&
+	echo side >>srv/blamed &&
+	git -C srv commit -a -m side &&
+	git -C srv checkout blame &&
+	echo main >srv/other &&
+	git -C srv add other &&
+	git -C srv commit -m main &&
+	git -C srv merge --no-edit side &&
+	git -C srv checkout master &&
+	git clone --no-checkout --filter=blob:none -b blame \
+		"file://$(pwd)/srv" pc7 &&
+	git -C srv blame -s blame -- blamed >expect &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C pc7 blame -s blame -- blamed >actual &&
+	test_cmp expect actual &&
+	# one batch per commit that has blobs to compare
+	test "$(count_fetches trace)" = 2
+'
+
+test_expect_success 'lazy fetch of an object the server lacks fails' '
+	test_must_fail git -C pc1 cat-file -p 0123456789012345678901234567890123456789
+'
+
+test_expect_success 'server without filter support sends everything' '
+	git -C srv config uploadpack.allowfilter false &&
+	git clone --no-checkout --filter=blob:none "file://$(pwd)/srv" pc4 2>err &&
+	grep "filtering not recognized by server" err &&
+	test "$(count_packed_blobs pc4)" != 0
+'
+
+test_done
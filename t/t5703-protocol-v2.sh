@@ -0,0 +1,242 @@
+#!/bin/sh
+
+test_description='protocol v2: capabilities, ls-refs and fetch'
+
+. ./test-lib.sh
+
+# Turn each argument into a pkt-line; "0000" and "0001" are passed
+# through as flush and delimiter packets.
+packetize () {
+	for arg
+	do
+		case "$arg" in
+		0000|0001)
+			printf "%s" "$arg" ;;
+		*)
+			printf "%04x%s\n" $((${#arg} + 5)) "$arg" ;;
+		esac
+	done
+}
+
+# Show pkt-lines on stdin one per line, flush and delimiter packets
+# as "0000" and "0001".
+depacketize () {
+	perl -e '
+		while (read(STDIN, $len, 4) == 4) {
+			if ($len eq "0000" || $len eq "0001") {
+				print "$len\n";
+				next;
+			}
+			read(STDIN, $buf, hex($len) - 4);
+			$buf =~ s/\n$//;
+			print "$buf\n";
+		}
+	'
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git branch other one &&
+	git tag -a -m "annotated" annotated two &&
+	git clone --bare . server.git
+'
+
+test_expect_success 'upload-pack advertises refs without GIT_PROTOCOL' '
+	git upload-pack --advertise-refs server.git >out &&
+	depacketize <out >actual &&
+	grep "^$(git rev-parse master) HEAD" actual
+'
+
+test_expect_success 'upload-pack advertises capabilities for version 2' '
+	GIT_PROTOCOL=version=2 GIT_USER_AGENT=git/test \
+		git upload-pack --advertise-refs server.git >out &&
+	depacketize <out >actual &&
+	cat >expect <<-EOF &&
+	version 2
+	agent=git/test
+	ls-refs
+	fetch=shallow
+	0000
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'ls-refs lists refs with symrefs and peeled tags' '
+	packetize command=ls-refs 0001 peel symrefs 0000 >in &&
+	GIT_PROTOCOL=version=2 \
+		git upload-pack --stateless-rpc server.git <in >out &&
+	depacketize <out >actual &&
+	cat >expect <<-EOF &&
+	$(git rev-parse master) HEAD symref-target:refs/heads/master
+	$(git rev-parse master) refs/heads/master
+	$(git rev-parse other) refs/heads/other
+	$(git rev-parse annotated) refs/tags/annotated peeled:$(git rev-parse two)
+	$(git rev-parse one) refs/tags/one
+	$(git rev-parse two) refs/tags/two
+	0000
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'ls-refs only lists refs matching a prefix' '
+	packetize command=ls-refs 0001 "ref-prefix refs/heads/" 0000 >in &&
+	GIT_PROTOCOL=version=2 \
+		git upload-pack --stateless-rpc server.git <in >out &&
+	depacketize <out >actual &&
+	cat >expect <<-EOF &&
+	$(git rev-parse master) refs/heads/master
+	$(git rev-parse other) refs/heads/other
+	0000
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'unknown commands are rejected' '
+	packetize command=frobnicate 0001 0000 >in &&
+	test_must_fail env GIT_PROTOCOL=version=2 \
+		git upload-pack --stateless-rpc server.git <in
+'
+
+test_expect_success 'bundle-uri is advertised when bundles are configured' '
+	git -C server.git config uploadpack.bundleURI https://example.com/a.bundle &&
+	git -C server.git config --add uploadpack.bundleURI /srv/b.bundle &&
+	GIT_PROTOCOL=version=2 \
+		git upload-pack --advertise-refs server.git >out &&
+	depacketize <out >actual &&
+	grep "^bundle-uri$" actual
+'
+
+test_expect_success 'bundle-uri lists the configured bundles' '
+	test_when_finished "git -C server.git config --unset-all uploadpack.bundleURI" &&
+	packetize command=bundle-uri 0001 0000 >in &&
+	GIT_PROTOCOL=version=2 \
+		git upload-pack --stateless-rpc server.git <in >out &&
+	depacketize <out >actual &&
+	cat >expect <<-EOF &&
+	https://example.com/a.bundle
+	/srv/b.bundle
+	0000
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch acknowledges common commits' '
+	packetize command=fetch 0001 \
+		"want $(git rev-parse master)" \
+		"have $(git rev-parse one)" 0000 >in &&
+	GIT_PROTOCOL=version=2 \
+		git upload-pack --stateless-rpc server.git <in >out &&
+	depacketize <out >actual &&
+	cat >expect <<-EOF &&
+	acknowledgments
+	ACK $(git rev-parse one)
+	ready
+	0001
+	packfile
+	EOF
+	head -n 5 actual >actual.head &&
+	test_cmp expect actual.head
+'
+
+test_expect_success 'ls-remote with protocol v2' '
+	git ls-remote server.git >expect &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c protocol.version=2 ls-remote "file://$(pwd)/server.git" >actual &&
+	test_cmp expect actual &&
+	grep "< version 2" trace
+'
+
+test_expect_success 'ls-remote --heads only asks for branches' '
+	git ls-remote --heads server.git >expect &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		ls-remote --heads "file://$(pwd)/server.git" >actual &&
+	test_cmp expect actual &&
+	grep "ref-prefix refs/heads/" trace &&
+	! grep "refs/tags/one" trace
+'
+
+test_expect_success 'clone with protocol v2' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		clone "file://$(pwd)/server.git" client &&
+	grep "< version 2" trace &&
+	git -C client rev-parse origin/master origin/other >actual &&
+	git rev-parse master other >expect &&
+	test_cmp expect actual &&
+	git -C client fsck
+'
+
+test_expect_success 'fetch with protocol v2 only lists the refs it needs' '
+	test_commit three &&
+	git push server.git master &&
+	rm -f trace &&
+	(
+		cd client &&
+		GIT_TRACE_PACKET="$(pwd)/../trace" git -c protocol.version=2 \
+			fetch origin master
+	) &&
+	grep "fetch> command=fetch" trace &&
+	grep "fetch> ref-prefix refs/heads/master" trace &&
+	! grep "refs/heads/other" trace &&
+	git -C client rev-parse origin/master >actual &&
+	git rev-parse master >expect &&
+	test_cmp expect actual &&
+	git -C client fsck
+'
+
+test_expect_success 'fetch with protocol v2 negotiates common history' '
+	test_commit four &&
+	git push server.git master &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client -c protocol.version=2 \
+		fetch origin &&
+	grep "fetch< ACK $(git rev-parse three)" trace &&
+	grep "fetch< ready" trace &&
+	git -C client rev-parse origin/master >actual &&
+	git rev-parse master >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch with protocol v2 follows tags' '
+	git tag -a -m "new tag" newtag master &&
+	git push server.git newtag &&
+	git -C client -c protocol.version=2 fetch origin &&
+	git -C client rev-parse newtag >actual &&
+	git rev-parse newtag >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'shallow clone and deepen with protocol v2' '
+	git -c protocol.version=2 \
+		clone --depth=1 "file://$(pwd)/server.git" shallow &&
+	git -C shallow rev-list --count HEAD >actual &&
+	echo 1 >expect &&
+	test_cmp expect actual &&
+	git -C shallow -c protocol.version=2 fetch --depth=2 origin &&
+	git -C shallow rev-list --count origin/master >actual &&
+	echo 2 >expect &&
+	test_cmp expect actual &&
+	git -C shallow -c protocol.version=2 fetch --unshallow origin &&
+	test_path_is_missing shallow/.git/shallow &&
+	git -C shallow fsck
+'
+
+test_expect_success 'fetch from a shallow repository with protocol v2' '
+	git clone --depth=2 "file://$(pwd)/server.git" shallow-src &&
+	git -c protocol.version=2 \
+		clone --no-local "file://$(pwd)/shallow-src" from-shallow &&
+	test_cmp shallow-src/.git/shallow from-shallow/.git/shallow &&
+	git -C from-shallow fsck
+'
+
+test_expect_success 'push falls back to protocol v0' '
+	git -C client commit --allow-empty -m pushed &&
+	git -C client -c protocol.version=2 push origin HEAD:refs/heads/pushed &&
+	git -C server.git rev-parse pushed >actual &&
+	git -C client rev-parse HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_done
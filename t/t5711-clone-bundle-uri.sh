@@ -0,0 +1,91 @@
+#!/bin/sh
+
+test_description='clone seeded from pre-built bundles'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git bundle create base.bundle master &&
+	git bundle create incremental.bundle one..master &&
+	test_commit three &&
+	git clone --bare . server.git
+'
+
+test_expect_success 'clone --bundle-uri only fetches what the bundle lacks' '
+	GIT_TRACE_PACKET="$PWD/trace" \
+		git clone --bundle-uri=base.bundle "file://$PWD/server.git" from-path &&
+	git rev-parse two >expect &&
+	git -C from-path rev-parse refs/bundles/heads/master >actual &&
+	test_cmp expect actual &&
+	git rev-parse three >expect &&
+	git -C from-path rev-parse master >actual &&
+	test_cmp expect actual &&
+	grep "> have $(git rev-parse two)" trace &&
+	git -C from-path fsck
+'
+
+test_expect_success 'clone --bundle-uri accepts file:// URLs' '
+	git clone --bundle-uri="file://$PWD/base.bundle" \
+		"file://$PWD/server.git" from-url &&
+	git rev-parse two >expect &&
+	git -C from-url rev-parse refs/bundles/heads/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone refuses bundles offered as local paths' '
+	test_when_finished "git -C server.git config --unset-all uploadpack.bundleURI" &&
+	git -C server.git config uploadpack.bundleURI "$PWD/base.bundle" &&
+	git -C server.git config --add uploadpack.bundleURI "file://$PWD/base.bundle" &&
+	git -c protocol.version=2 -c transfer.bundleURI=true \
+		clone "file://$PWD/server.git" offered-path 2>err &&
+	test_i18ngrep "refusing bundle .$PWD/base.bundle" err &&
+	test_i18ngrep "refusing bundle .file://$PWD/base.bundle" err &&
+	test_must_fail git -C offered-path rev-parse --verify refs/bundles/heads/master &&
+	git rev-parse three >expect &&
+	git -C offered-path rev-parse master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone does not run helpers named by offered bundles' '
+	test_when_finished "git -C server.git config --unset-all uploadpack.bundleURI" &&
+	git -C server.git config uploadpack.bundleURI "evil://example.com/x.bundle" &&
+	write_script git-remote-evil <<-\EOF &&
+	: >"$TRASH_DIRECTORY/helper-ran"
+	EOF
+	PATH="$PWD:$PATH" git -c protocol.version=2 -c transfer.bundleURI=true \
+		clone "file://$PWD/server.git" offered-helper 2>err &&
+	test_i18ngrep "refusing bundle .evil://" err &&
+	test_path_is_missing helper-ran
+'
+
+test_expect_success 'offered bundles are ignored without transfer.bundleURI' '
+	git -c protocol.version=2 clone "file://$PWD/server.git" not-offered &&
+	test_must_fail git -C not-offered rev-parse --verify refs/bundles/heads/master
+'
+
+test_expect_success 'clone goes on without a bundle it cannot get' '
+	git clone --bundle-uri="$PWD/missing.bundle" \
+		"file://$PWD/server.git" missing 2>err &&
+	grep "ignoring bundle" err &&
+	git rev-parse three >expect &&
+	git -C missing rev-parse master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone ignores a bundle that needs other history' '
+	git clone --bundle-uri=incremental.bundle \
+		"file://$PWD/server.git" incremental 2>err &&
+	grep "ignoring bundle" err &&
+	test_must_fail git -C incremental rev-parse --verify refs/bundles/heads/master &&
+	git -C incremental fsck
+'
+
+test_expect_success 'shallow clones do not use bundles' '
+	git clone --depth=1 --bundle-uri=base.bundle \
+		"file://$PWD/server.git" shallow &&
+	test_must_fail git -C shallow rev-parse --verify refs/bundles/heads/master
+'
+
+test_done
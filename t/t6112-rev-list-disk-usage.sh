@@ -0,0 +1,51 @@
+#!/bin/sh
+
+test_description='rev-list --disk-usage'
+. ./test-lib.sh
+
+# we want objects in the bitmapped pack as well as some outside of it
+test_expect_success 'set up repository' '
+	test_commit one &&
+	test_commit two &&
+	git repack -adb &&
+	git reset --hard HEAD^ &&
+	test_commit three &&
+	test_commit four &&
+	git reset --hard HEAD^
+'
+
+# We don't want to hardcode sizes, because they depend on the exact details of
+# packing, zlib, etc. We'll assume that the regular rev-list and cat-file
+# machinery works and compare the --disk-usage output to that.
+disk_usage_slow () {
+	git rev-list "$@" |
+	cut -d" " -f1 |
+	git cat-file --batch-check="%(objectsize:disk)" |
+	awk "{ sum += \$1 } END { print sum }"
+}
+
+# check behavior with given rev-list options; note that
+# whitespace is not preserved in args
+check_du () {
+	args=$*
+
+	test_expect_success "generate expected size ($args)" "
+		disk_usage_slow $args >expect
+	"
+
+	test_expect_success "rev-list --disk-usage without bitmaps ($args)" "
+		git rev-list --disk-usage $args >actual &&
+		test_cmp expect actual
+	"
+
+	test_expect_success "rev-list --disk-usage with bitmaps ($args)" "
+		git rev-list --disk-usage --use-bitmap-index $args >actual &&
+		test_cmp expect actual
+	"
+}
+
+check_du HEAD
+check_du --objects HEAD
+check_du --objects HEAD^..HEAD
+
+test_done
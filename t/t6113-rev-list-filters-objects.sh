@@ -0,0 +1,137 @@
+#!/bin/sh
+
+test_description='rev-list and pack-objects with --filter'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p dir/sub &&
+	echo small >small &&
+	echo file >dir/file &&
+	echo deep >dir/sub/deep &&
+	printf "%2000s\n" big >big &&
+	git add . &&
+	git commit -m one &&
+	echo more >>small &&
+	git commit -a -m two
+'
+
+object_types () {
+	cut -d" " -f1 |
+	git cat-file --batch-check="%(objecttype)" |
+	sort -u
+}
+
+test_expect_success 'blob:none omits all blobs' '
+	git rev-list --objects --filter=blob:none HEAD >objs &&
+	object_types <objs >actual &&
+	printf "commit\ntree\n" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blob:none keeps trees and commits' '
+	git rev-list --objects HEAD >all &&
+	sed -n "/ /p" <all >named &&
+	cut -d" " -f1 <named |
+	git cat-file --batch-check="%(objectname) %(objecttype)" |
+	sed -n "s/ tree$//p" >expect &&
+	git rev-list HEAD >>expect &&
+	cut -d" " -f1 <objs >actual &&
+	sort expect >expect.sorted &&
+	sort actual >actual.sorted &&
+	test_cmp expect.sorted actual.sorted
+'
+
+test_expect_success 'blob:none keeps a blob named on the command line' '
+	git rev-parse HEAD:small >expect &&
+	git rev-list --objects --filter=blob:none HEAD:small >actual &&
+	cut -d" " -f1 <actual >actual.sha1 &&
+	test_cmp expect actual.sha1
+'
+
+test_expect_success 'blob:limit omits only large blobs' '
+	big=$(git rev-parse HEAD:big) &&
+	git rev-list --objects HEAD | cut -d" " -f1 |
+	sed "/^$big$/d" | sort >expect &&
+	git rev-list --objects --filter=blob:limit=1k HEAD |
+	cut -d" " -f1 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blob:limit omits blobs of exactly the limit' '
+	git rev-list --objects --filter=blob:limit=1 HEAD >objs &&
+	object_types <objs >actual &&
+	printf "commit\ntree\n" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'tree:0 omits all trees and blobs' '
+	git rev-list HEAD >expect &&
+	git rev-list --objects --filter=tree:0 HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'tree:1 keeps only root trees' '
+	{
+		git rev-list HEAD &&
+		git rev-parse HEAD^{tree} HEAD^^{tree}
+	} | sort >expect &&
+	git rev-list --objects --filter=tree:1 HEAD | cut -d" " -f1 |
+	sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'tree:2 keeps the entries of root trees' '
+	git rev-list --objects --filter=tree:2 HEAD >actual &&
+	grep " dir$" actual &&
+	grep " big$" actual &&
+	! grep " file$" actual &&
+	! grep " sub$" actual
+'
+
+test_expect_success 'a tree seen deeper first is walked again' '
+	git init deeper &&
+	(
+		cd deeper &&
+		mkdir x &&
+		echo content >x/file &&
+		git add x &&
+		git commit -m shallow &&
+		mkdir a &&
+		git mv x a/ &&
+		git commit -m deep &&
+		git rev-list --objects --filter=tree:3 HEAD >actual &&
+		grep "^$(git rev-parse HEAD^:x/file) " actual
+	)
+'
+
+test_expect_success 'pack-objects --filter=blob:none' '
+	git rev-parse HEAD >revs &&
+	git pack-objects --revs --stdout --filter=blob:none <revs >filtered.pack &&
+	git index-pack filtered.pack &&
+	git verify-pack -v filtered.idx >verify &&
+	grep " tree " verify &&
+	! grep " blob " verify
+'
+
+test_expect_success 'pack-objects --filter needs --revs' '
+	git rev-list --objects HEAD >objs &&
+	test_must_fail git pack-objects --stdout --filter=blob:none \
+		<objs >/dev/null
+'
+
+test_expect_success 'invalid filters are rejected' '
+	test_must_fail git rev-list --objects --filter=blob:nothing HEAD &&
+	test_must_fail git rev-list --objects --filter=blob:limit=x HEAD &&
+	test_must_fail git rev-list --objects --filter=tree: HEAD &&
+	test_must_fail git rev-list --objects --filter=tree:1x HEAD &&
+	test_must_fail git rev-list --objects \
+		--filter=blob:none --filter=tree:0 HEAD
+'
+
+test_expect_success '--no-filter cancels an earlier --filter' '
+	git rev-list --objects HEAD >expect &&
+	git rev-list --objects --filter=blob:none --no-filter HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_done
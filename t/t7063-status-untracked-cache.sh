@@ -0,0 +1,302 @@
+#!/bin/sh
+
+test_description='test untracked cache'
+
+. ./test-lib.sh
+
+# Directories whose mtime is not older than the index cannot be
+# trusted, and are read again. Move them back in time, so that the
+# next status can use what it recorded about them; further back every
+# time, so that a change made in the meantime is not hidden.
+racy_offset=0
+avoid_racy () {
+	racy_offset=$(($racy_offset + 1000)) &&
+	if test $# = 0
+	then
+		set -- $(find . -name .git -prune -o -type d -print)
+	fi &&
+	test-chmtime =-$racy_offset "$@"
+}
+
+# Run "git status --porcelain" and keep the statistics of the
+# untracked cache.
+status_with_stats () {
+	: >../trace &&
+	GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+	git status --porcelain "$@" >../actual &&
+	sed -n -e "s/.*untracked cache: //p" ../trace >../stats
+}
+
+expect_stats () {
+	echo "node creation $1, gitignore invalidation $2, directory invalidation $3, opendir $4" >../stats.expect &&
+	test_cmp ../stats.expect ../stats
+}
+
+test_expect_success 'setup' '
+	git init worktree &&
+	cd worktree &&
+	mkdir done dtwo dthree &&
+	touch one two three done/one dtwo/two dthree/three &&
+	git add one two done/one &&
+	: >.git/info/exclude &&
+	git update-index --untracked-cache
+'
+
+test_expect_success 'untracked cache is empty' '
+	test-dump-untracked-cache >../actual &&
+	cat >../expect <<-EOF &&
+	info/exclude $_z40
+	core.excludesfile $_z40
+	flags 00000000
+	EOF
+	test_cmp ../expect ../actual
+'
+
+cat >../status.expect <<EOF
+A  done/one
+A  one
+A  two
+?? dthree/
+?? dtwo/
+?? three
+EOF
+
+EMPTY_BLOB=$(git hash-object --stdin </dev/null)
+
+cat >../dump.expect <<EOF
+info/exclude $EMPTY_BLOB
+core.excludesfile $_z40
+exclude_per_dir .gitignore
+flags 00000006
+/ $_z40 valid
+dthree/
+dtwo/
+three
+/done/ $_z40 valid
+/dthree/ $_z40 check_only valid
+three
+/dtwo/ $_z40 check_only valid
+two
+EOF
+
+test_expect_success 'status first time (empty cache)' '
+	avoid_racy &&
+	status_with_stats &&
+	test_cmp ../status.expect ../actual &&
+	expect_stats 4 1 0 4
+'
+
+test_expect_success 'untracked cache after first status' '
+	test-dump-untracked-cache >../actual &&
+	test_cmp ../dump.expect ../actual
+'
+
+test_expect_success 'status second time (fully populated cache)' '
+	status_with_stats &&
+	test_cmp ../status.expect ../actual &&
+	expect_stats 0 0 0 0
+'
+
+test_expect_success 'untracked cache after second status' '
+	test-dump-untracked-cache >../actual &&
+	test_cmp ../dump.expect ../actual
+'
+
+test_expect_success 'new file in the root directory' '
+	: >four &&
+	avoid_racy . &&
+	status_with_stats &&
+	cat >../status.expect <<-EOF &&
+	A  done/one
+	A  one
+	A  two
+	?? dthree/
+	?? dtwo/
+	?? four
+	?? three
+	EOF
+	test_cmp ../status.expect ../actual &&
+	expect_stats 0 0 1 1
+'
+
+test_expect_success 'new file in an untracked directory' '
+	: >dtwo/more &&
+	avoid_racy dtwo &&
+	status_with_stats &&
+	test_cmp ../status.expect ../actual &&
+	expect_stats 0 0 1 1
+'
+
+test_expect_success 'new .gitignore invalidates the directory and below' '
+	echo three >.gitignore &&
+	avoid_racy . &&
+	status_with_stats &&
+	cat >../status.expect <<-EOF &&
+	A  done/one
+	A  one
+	A  two
+	?? .gitignore
+	?? dtwo/
+	?? four
+	EOF
+	test_cmp ../status.expect ../actual &&
+	expect_stats 0 4 4 4 &&
+	status_with_stats &&
+	test_cmp ../status.expect ../actual &&
+	expect_stats 0 0 0 0
+'
+
+test_expect_success 'change to info/exclude invalidates everything' '
+	echo four >.git/info/exclude &&
+	status_with_stats &&
+	cat >../status.expect <<-EOF &&
+	A  done/one
+	A  one
+	A  two
+	?? .gitignore
+	?? dtwo/
+	EOF
+	test_cmp ../status.expect ../actual &&
+	expect_stats 0 4 4 4
+'
+
+test_expect_success 'adding to the index invalidates the directories above' '
+	git add dtwo/two &&
+	status_with_stats &&
+	cat >../status.expect <<-EOF &&
+	A  done/one
+	A  dtwo/two
+	A  one
+	A  two
+	?? .gitignore
+	?? dtwo/more
+	EOF
+	test_cmp ../status.expect ../actual &&
+	expect_stats 0 0 0 2
+'
+
+test_expect_success 'removing from the index invalidates, too' '
+	git rm -q --cached dtwo/two &&
+	status_with_stats &&
+	cat >../status.expect <<-EOF &&
+	A  done/one
+	A  one
+	A  two
+	?? .gitignore
+	?? dtwo/
+	EOF
+	test_cmp ../status.expect ../actual &&
+	expect_stats 0 0 0 2
+'
+
+test_expect_success 'status -uall rebuilds the cache for all untracked files' '
+	status_with_stats -uall &&
+	cat >../status.expect <<-EOF &&
+	A  done/one
+	A  one
+	A  two
+	?? .gitignore
+	?? dtwo/more
+	?? dtwo/two
+	EOF
+	test_cmp ../status.expect ../actual &&
+	test-dump-untracked-cache >../actual &&
+	grep "^flags 00000000" ../actual &&
+	status_with_stats -uall &&
+	test_cmp ../status.expect ../actual &&
+	expect_stats 0 0 0 0
+'
+
+test_expect_success 'add -A uses the same cache as status -uall' '
+	: >../trace &&
+	GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+	git add -A &&
+	sed -n -e "s/.*untracked cache: //p" ../trace >../stats &&
+	expect_stats 0 0 0 0 &&
+	git status --porcelain -uall >../actual &&
+	cat >../status.expect <<-EOF &&
+	A  .gitignore
+	A  done/one
+	A  dtwo/more
+	A  dtwo/two
+	A  one
+	A  two
+	EOF
+	test_cmp ../status.expect ../actual &&
+	git commit -q -m first
+'
+
+test_expect_success 'a new nested repository is noticed' '
+	mkdir dfour &&
+	avoid_racy &&
+	git status --porcelain -uall >../actual &&
+	test_must_be_empty ../actual &&
+	(
+		cd dfour &&
+		git init -q &&
+		: >file &&
+		git add file &&
+		git commit -q -m nested
+	) &&
+	git status --porcelain -uall >../actual &&
+	echo "?? dfour/" >../status.expect &&
+	test_cmp ../status.expect ../actual &&
+	rm -rf dfour
+'
+
+test_expect_success 'checkout keeps the cache and invalidates what it touches' '
+	git checkout -q -b side &&
+	: >done/two &&
+	git add done/two &&
+	git commit -q -m side &&
+	git checkout -q master &&
+	: >done/untracked &&
+	: >dtwo/untracked &&
+	avoid_racy &&
+	status_with_stats &&
+	git checkout -q side &&
+	test-dump-untracked-cache >../actual &&
+	grep "^/ " ../actual &&
+	avoid_racy . done &&
+	status_with_stats &&
+	cat >../status.expect <<-EOF &&
+	?? done/untracked
+	?? dtwo/untracked
+	EOF
+	test_cmp ../status.expect ../actual &&
+	expect_stats 0 0 0 2
+'
+
+test_expect_success 'reset invalidates the directories of the entries it drops' '
+	git reset -q master &&
+	status_with_stats &&
+	cat >../status.expect <<-EOF &&
+	?? done/two
+	?? done/untracked
+	?? dtwo/untracked
+	EOF
+	test_cmp ../status.expect ../actual &&
+	git checkout -q master
+'
+
+test_expect_success 'core.untrackedCache=false drops the cache' '
+	git -c core.untrackedCache=false status >/dev/null &&
+	test-dump-untracked-cache >../actual &&
+	echo "no untracked cache" >../expect &&
+	test_cmp ../expect ../actual
+'
+
+test_expect_success 'core.untrackedCache=true adds it back' '
+	git -c core.untrackedCache=true status >/dev/null &&
+	test-dump-untracked-cache >../actual &&
+	grep "^/ " ../actual
+'
+
+test_expect_success 'update-index --no-untracked-cache' '
+	git update-index --no-untracked-cache &&
+	test-dump-untracked-cache >../actual &&
+	echo "no untracked cache" >../expect &&
+	test_cmp ../expect ../actual
+'
+
+test_done
@@ -0,0 +1,193 @@
+#!/bin/sh
+
+test_description='git status with a file system monitor'
+
+. ./test-lib.sh
+
+# The hook logs its arguments and answers with whatever is in
+# .git/fsmonitor-answer, a NUL separated token and list of paths.
+write_answer () {
+	printf "%s\0" "$@" >.git/fsmonitor-answer
+}
+
+dump_fsmonitor () {
+	test-dump-fsmonitor
+}
+
+test_expect_success 'setup' '
+	cat >.git/fsmonitor-hook <<-\EOF &&
+	#!/bin/sh
+	echo "$*" >>.git/fsmonitor-queries
+	cat .git/fsmonitor-answer
+	EOF
+	chmod +x .git/fsmonitor-hook &&
+	mkdir dir &&
+	for f in a b dir/one dir/two
+	do
+		echo $f >$f || return 1
+	done &&
+	git add a b dir &&
+	git commit -m initial &&
+	git config core.fsmonitor .git/fsmonitor-hook
+'
+
+test_expect_success 'first refresh starts with an empty token' '
+	write_answer token1 / &&
+	git update-index --refresh &&
+	echo "1 " >expect &&
+	test_cmp expect .git/fsmonitor-queries &&
+	cat >expect <<-\EOF &&
+	fsmonitor last update token1
+	+ a
+	+ b
+	+ dir/one
+	+ dir/two
+	EOF
+	dump_fsmonitor >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unreported changes are trusted to be absent' '
+	echo changed >b &&
+	write_answer token2 &&
+	git diff-files --name-only >actual &&
+	test_must_be_empty actual &&
+	tail -n 1 .git/fsmonitor-queries >queries &&
+	echo "1 token1" >expect &&
+	test_cmp expect queries
+'
+
+test_expect_success 'reported changes are noticed' '
+	git update-index --refresh &&
+	write_answer token3 b &&
+	test_must_fail git update-index --refresh >actual &&
+	echo "b: needs update" >expect &&
+	test_cmp expect actual &&
+	git add b &&
+	git update-index --refresh &&
+	cat >expect <<-\EOF &&
+	fsmonitor last update token3
+	+ a
+	+ b
+	+ dir/one
+	+ dir/two
+	EOF
+	dump_fsmonitor >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a reported directory invalidates everything below it' '
+	echo changed >dir/one &&
+	echo changed >dir/two &&
+	write_answer token4 dir/ &&
+	git diff-files --name-only >actual &&
+	cat >expect <<-\EOF &&
+	dir/one
+	dir/two
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'entries found modified are recorded as such' '
+	# diff-files did not write the index, so we are asked again
+	write_answer token5 dir/one dir/two &&
+	test_must_fail git update-index --refresh &&
+	cat >expect <<-\EOF &&
+	fsmonitor last update token5
+	+ a
+	+ b
+	- dir/one
+	- dir/two
+	EOF
+	dump_fsmonitor >actual &&
+	test_cmp expect actual &&
+	git add dir &&
+	git commit -m changed
+'
+
+test_expect_success 'a failing hook makes us check everything' '
+	echo again >a &&
+	git update-index --refresh &&
+	write_answer token6 &&
+	git -c core.fsmonitor=false diff-files --name-only >actual &&
+	echo a >expect &&
+	test_cmp expect actual &&
+	test_must_fail git -c core.fsmonitor=false update-index --refresh &&
+	dump_fsmonitor >actual &&
+	head -n 1 actual >first &&
+	echo "fsmonitor last update " >expect &&
+	test_cmp expect first
+'
+
+test_expect_success 'status agrees with the real state of the working tree' '
+	write_answer token7 / &&
+	git status --porcelain -uno >actual &&
+	echo " M a" >expect &&
+	test_cmp expect actual &&
+	echo more >>b &&
+	write_answer token8 b &&
+	git status --porcelain -uno >actual &&
+	cat >expect <<-\EOF &&
+	 M a
+	 M b
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'status with a split index' '
+	git update-index --split-index &&
+	write_answer token9 / &&
+	git status --porcelain -uno >actual &&
+	test_cmp expect actual &&
+	echo split >dir/one &&
+	write_answer token10 dir/one &&
+	git status --porcelain -uno >actual &&
+	cat >expect <<-\EOF &&
+	 M a
+	 M b
+	 M dir/one
+	EOF
+	test_cmp expect actual &&
+	git update-index --no-split-index
+'
+
+test_expect_success 'checkout keeps the fsmonitor token' '
+	git checkout -b other &&
+	echo other >dir/two &&
+	git commit -m other dir/two &&
+	write_answer token11 / &&
+	git checkout master &&
+	dump_fsmonitor >actual &&
+	grep "^fsmonitor last update token11" actual &&
+	write_answer token12 &&
+	git status --porcelain -uno >actual &&
+	tail -n 1 .git/fsmonitor-queries >queries &&
+	echo "1 token11" >expect &&
+	test_cmp expect queries
+'
+
+test_expect_success 'unsetting core.fsmonitor drops the extension' '
+	git config --unset core.fsmonitor &&
+	git add -u &&
+	dump_fsmonitor >actual &&
+	echo "no fsmonitor" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the untracked cache trusts the fsmonitor' '
+	git config core.fsmonitor .git/fsmonitor-hook &&
+	git update-index --untracked-cache &&
+	write_answer token11 / &&
+	git status --porcelain >actual &&
+	write_answer token12 &&
+	git status --porcelain >actual &&
+	: >dir/untracked &&
+	write_answer token13 &&
+	git status --porcelain >actual &&
+	! grep untracked actual &&
+	write_answer token14 dir/untracked &&
+	git status --porcelain >actual &&
+	grep "^?? dir/untracked" actual
+'
+
+test_done
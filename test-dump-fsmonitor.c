@@ -0,0 +1,21 @@
+#include "cache.h"
+
+int main(int ac, char **av)
+{
+	int i;
+
+	setup_git_directory();
+	if (read_cache() < 0)
+		die("unable to read index file");
+	if (!the_index.fsmonitor_last_update) {
+		printf("no fsmonitor\n");
+		return 0;
+	}
+	printf("fsmonitor last update %s\n", the_index.fsmonitor_last_update);
+	for (i = 0; i < the_index.cache_nr; i++) {
+		struct cache_entry *ce = the_index.cache[i];
+		printf("%c %s\n", ce->ce_flags & CE_FSMONITOR_VALID ? '+' : '-',
+		       ce->name);
+	}
+	return 0;
+}
@@ -12,6 +12,7 @@
 #include "sigchain.h"
 #include "argv-array.h"
 #include "refs.h"
+#include "protocol.h"
 
 static int debug;
 /* TODO: put somewhere sensible, e.g. git_transport_options? */
@@ -28,6 +29,7 @@ struct helper_data {
 		option : 1,
 		push : 1,
 		connect : 1,
+		stateless_connect : 1,
 		signed_tags : 1,
 		check_connectivity : 1,
 		no_disconnect_req : 1,
@@ -192,6 +194,8 @@ static struct child_process *get_helper(struct transport *transport)
 			refspecs[refspec_nr++] = xstrdup(arg);
 		} else if (!strcmp(capname, "connect")) {
 			data->connect = 1;
+		} else if (!strcmp(capname, "stateless-connect")) {
+			data->stateless_connect = 1;
 		} else if (!strcmp(capname, "signed-tags")) {
 			data->signed_tags = 1;
 		} else if (skip_prefix(capname, "export-marks ", &arg)) {
@@ -569,6 +573,11 @@ static int process_connect_service(struct transport *transport,
 
 	if (data->connect)
 		strbuf_addf(&cmdbuf, "connect %s\n", name);
+	else if (data->stateless_connect &&
+		 get_protocol_version_config() == protocol_v2 &&
+		 !strcmp(name, "git-upload-pack"))
+		/* each request is sent separately, see remote-curl.c */
+		strbuf_addf(&cmdbuf, "stateless-connect %s\n", name);
 	else
 		goto exit;
 
@@ -992,7 +1001,8 @@ static int has_attribute(const char *attrs, const char *attr) {
 	}
 }
 
-static struct ref *get_refs_list(struct transport *transport, int for_push)
+static struct ref *get_refs_list(struct transport *transport, int for_push,
+				 const struct argv_array *ref_prefixes)
 {
 	struct helper_data *data = transport->data;
 	struct child_process *helper;
@@ -1005,7 +1015,8 @@ static struct ref *get_refs_list(struct transport *transport, int for_push)
 
 	if (process_connect(transport, for_push)) {
 		do_take_over(transport);
-		return transport->get_refs_list(transport, for_push);
+		return transport->get_refs_list(transport, for_push,
+						ref_prefixes);
 	}
 
 	if (data->push && for_push)
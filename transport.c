@@ -197,7 +197,8 @@ static const char *rsync_url(const char *url)
 	return url;
 }
 
-static struct ref *get_refs_via_rsync(struct transport *transport, int for_push)
+static struct ref *get_refs_via_rsync(struct transport *transport, int for_push,
+				      const struct argv_array *ref_prefixes)
 {
 	struct strbuf buf = STRBUF_INIT, temp_dir = STRBUF_INIT;
 	struct ref dummy = {NULL}, *tail = &dummy;
@@ -399,7 +400,8 @@ struct bundle_transport_data {
 	struct bundle_header header;
 };
 
-static struct ref *get_refs_from_bundle(struct transport *transport, int for_push)
+static struct ref *get_refs_from_bundle(struct transport *transport, int for_push,
+					const struct argv_array *ref_prefixes)
 {
 	struct bundle_transport_data *data = transport->data;
 	struct ref *result = NULL;
@@ -445,6 +447,7 @@ struct git_transport_data {
 	struct child_process *conn;
 	int fd[2];
 	unsigned got_remote_heads : 1;
+	enum protocol_version version;
 	struct sha1_array extra_have;
 	struct sha1_array shallow;
 };
@@ -470,6 +473,19 @@ static int set_git_option(struct git_transport_options *opts,
 	} else if (!strcmp(name, TRANS_OPT_UPDATE_SHALLOW)) {
 		opts->update_shallow = !!value;
 		return 0;
+	} else if (!strcmp(name, TRANS_OPT_FROM_PROMISOR)) {
+		opts->from_promisor = !!value;
+		return 0;
+	} else if (!strcmp(name, TRANS_OPT_NO_DEPENDENTS)) {
+		opts->no_dependents = !!value;
+		return 0;
+	} else if (!strcmp(name, TRANS_OPT_LIST_OBJECTS_FILTER)) {
+		list_objects_filter_release(&opts->filter_options);
+		if (!value)
+			return 0;
+		if (parse_list_objects_filter(&opts->filter_options, value))
+			die("transport: invalid filter option '%s'", value);
+		return 0;
 	} else if (!strcmp(name, TRANS_OPT_DEPTH)) {
 		if (!value)
 			opts->depth = 0;
@@ -499,21 +515,46 @@ static int connect_setup(struct transport *transport, int for_push, int verbose)
 	return 0;
 }
 
-static struct ref *get_refs_via_connect(struct transport *transport, int for_push)
+static struct ref *get_refs_via_connect(struct transport *transport, int for_push,
+					const struct argv_array *ref_prefixes)
 {
 	struct git_transport_data *data = transport->data;
-	struct ref *refs;
+	struct ref *refs = NULL;
+	struct packet_reader reader;
 
 	connect_setup(transport, for_push, 0);
-	get_remote_heads(data->fd[0], NULL, 0, &refs,
-			 for_push ? REF_NORMAL : 0,
-			 &data->extra_have,
-			 &data->shallow);
+
+	packet_reader_init(&reader, data->fd[0], NULL, 0,
+			   PACKET_READ_CHOMP_NEWLINE |
+			   PACKET_READ_GENTLE_ON_EOF);
+	data->version = discover_version(&reader);
+	if (data->version == protocol_v2)
+		get_remote_refs(data->fd[1], &reader, &refs, for_push,
+				ref_prefixes);
+	else
+		get_remote_heads(&reader, &refs,
+				 for_push ? REF_NORMAL : 0,
+				 &data->extra_have,
+				 &data->shallow);
 	data->got_remote_heads = 1;
 
 	return refs;
 }
 
+static int get_bundle_uris_via_connect(struct transport *transport,
+				       struct string_list *uris)
+{
+	struct git_transport_data *data = transport->data;
+	struct packet_reader reader;
+
+	if (!data->got_remote_heads || data->version != protocol_v2)
+		return -1;
+	packet_reader_init(&reader, data->fd[0], NULL, 0,
+			   PACKET_READ_CHOMP_NEWLINE |
+			   PACKET_READ_GENTLE_ON_EOF);
+	return get_bundle_uris(data->fd[1], &reader, uris);
+}
+
 static int fetch_refs_via_pack(struct transport *transport,
 			       int nr_heads, struct ref **to_fetch)
 {
@@ -537,18 +578,32 @@ static int fetch_refs_via_pack(struct transport *transport,
 		data->options.check_self_contained_and_connected;
 	args.cloning = transport->cloning;
 	args.update_shallow = data->options.update_shallow;
+	args.from_promisor = data->options.from_promisor;
+	args.no_dependents = data->options.no_dependents;
+	args.filter_options = data->options.filter_options;
+	if (transport->remote)
+		args.negotiation_algorithm =
+			transport->remote->negotiation_algorithm;
 
 	if (!data->got_remote_heads) {
+		struct packet_reader reader;
+
 		connect_setup(transport, 0, 0);
-		get_remote_heads(data->fd[0], NULL, 0, &refs_tmp, 0,
-				 NULL, &data->shallow);
+		packet_reader_init(&reader, data->fd[0], NULL, 0,
+				   PACKET_READ_CHOMP_NEWLINE |
+				   PACKET_READ_GENTLE_ON_EOF);
+		data->version = discover_version(&reader);
+		/* with v2 we only ask for what is in to_fetch */
+		if (data->version == protocol_v0)
+			get_remote_heads(&reader, &refs_tmp, 0,
+					 NULL, &data->shallow);
 		data->got_remote_heads = 1;
 	}
 
 	refs = fetch_pack(&args, data->fd, data->conn,
 			  refs_tmp ? refs_tmp : transport->remote_refs,
 			  dest, to_fetch, nr_heads, &data->shallow,
-			  &transport->pack_lockfile);
+			  &transport->pack_lockfile, data->version);
 	close(data->fd[0]);
 	close(data->fd[1]);
 	if (finish_connect(data->conn))
@@ -807,9 +862,13 @@ static int git_transport_push(struct transport *transport, struct ref *remote_re
 
 	if (!data->got_remote_heads) {
 		struct ref *tmp_refs;
+		struct packet_reader reader;
 		connect_setup(transport, 1, 0);
 
-		get_remote_heads(data->fd[0], NULL, 0, &tmp_refs, REF_NORMAL,
+		packet_reader_init(&reader, data->fd[0], NULL, 0,
+				   PACKET_READ_CHOMP_NEWLINE |
+				   PACKET_READ_GENTLE_ON_EOF);
+		get_remote_heads(&reader, &tmp_refs, REF_NORMAL,
 				 NULL, &data->shallow);
 		data->got_remote_heads = 1;
 	}
@@ -881,6 +940,7 @@ void transport_take_over(struct transport *transport,
 
 	transport->set_option = NULL;
 	transport->get_refs_list = get_refs_via_connect;
+	transport->get_bundle_uris = get_bundle_uris_via_connect;
 	transport->fetch = fetch_refs_via_pack;
 	transport->push = NULL;
 	transport->push_refs = git_transport_push;
@@ -956,6 +1016,7 @@ struct transport *transport_get(struct remote *remote, const char *url)
 		ret->data = data;
 		ret->set_option = NULL;
 		ret->get_refs_list = get_refs_via_connect;
+		ret->get_bundle_uris = get_bundle_uris_via_connect;
 		ret->fetch = fetch_refs_via_pack;
 		ret->push_refs = git_transport_push;
 		ret->connect = connect_git;
@@ -1134,7 +1195,7 @@ int transport_push(struct transport *transport,
 		if (check_push_refs(local_refs, refspec_nr, refspec) < 0)
 			return -1;
 
-		remote_refs = transport->get_refs_list(transport, 1);
+		remote_refs = transport->get_refs_list(transport, 1, NULL);
 
 		if (flags & TRANSPORT_PUSH_ALL)
 			match_flags |= MATCH_REFS_ALL;
@@ -1213,16 +1274,26 @@ int transport_push(struct transport *transport,
 	return 1;
 }
 
-const struct ref *transport_get_remote_refs(struct transport *transport)
+const struct ref *transport_get_remote_refs(struct transport *transport,
+					    const struct argv_array *ref_prefixes)
 {
 	if (!transport->got_remote_refs) {
-		transport->remote_refs = transport->get_refs_list(transport, 0);
+		transport->remote_refs =
+			transport->get_refs_list(transport, 0, ref_prefixes);
 		transport->got_remote_refs = 1;
 	}
 
 	return transport->remote_refs;
 }
 
+int transport_get_bundle_uris(struct transport *transport,
+			      struct string_list *uris)
+{
+	if (!transport->got_remote_refs || !transport->get_bundle_uris)
+		return -1;
+	return transport->get_bundle_uris(transport, uris);
+}
+
 int transport_fetch_refs(struct transport *transport, struct ref *refs)
 {
 	int rc;
@@ -1365,7 +1436,7 @@ static int refs_from_alternate_cb(struct alternate_object_database *e,
 	other[len - 8] = '\0';
 	remote = remote_get(other);
 	transport = transport_get(remote, other);
-	for (extra = transport_get_remote_refs(transport);
+	for (extra = transport_get_remote_refs(transport, NULL);
 	     extra;
 	     extra = extra->next)
 		cb->fn(extra, cb->data);
@@ -4,6 +4,10 @@
 #include "cache.h"
 #include "run-command.h"
 #include "remote.h"
+#include "list-objects-filter-options.h"
+
+struct argv_array;
+struct string_list;
 
 struct git_transport_options {
 	unsigned thin : 1;
@@ -12,10 +16,13 @@ struct git_transport_options {
 	unsigned check_self_contained_and_connected : 1;
 	unsigned self_contained_and_connected : 1;
 	unsigned update_shallow : 1;
+	unsigned from_promisor : 1;
+	unsigned no_dependents : 1;
 	int depth;
 	const char *uploadpack;
 	const char *receivepack;
 	struct push_cas_option *cas;
+	struct list_objects_filter_options filter_options;
 };
 
 struct transport {
@@ -58,8 +65,22 @@ struct transport {
 	 * If the transport is able to determine the remote hash for
 	 * the ref without a huge amount of effort, it should store it
 	 * in the ref's old_sha1 field; otherwise it should be all 0.
+	 *
+	 * If ref_prefixes is not NULL, the caller is only interested in
+	 * refs starting with one of them; a transport may use this to
+	 * avoid listing the rest, but it is free to return more.
+	 **/
+	struct ref *(*get_refs_list)(struct transport *transport, int for_push,
+				     const struct argv_array *ref_prefixes);
+
+	/**
+	 * Append to uris the bundles the remote side offers to be
+	 * downloaded before fetching from it. Called after
+	 * get_refs_list(); returns -1 if the transport cannot ask.
+	 * May be NULL.
 	 **/
-	struct ref *(*get_refs_list)(struct transport *transport, int for_push);
+	int (*get_bundle_uris)(struct transport *transport,
+			       struct string_list *uris);
 
 	/**
 	 * Fetch the objects for the given refs. Note that this gets
@@ -156,6 +177,15 @@ struct transport *transport_get(struct remote *, const char *);
 /* Accept refs that may update .git/shallow without --depth */
 #define TRANS_OPT_UPDATE_SHALLOW "updateshallow"
 
+/* Ask the server to leave out objects, see "--filter" in rev-list */
+#define TRANS_OPT_LIST_OBJECTS_FILTER "filter"
+
+/* Mark the fetched pack as coming from the promisor remote */
+#define TRANS_OPT_FROM_PROMISOR "from-promisor"
+
+/* Fetch only the requested objects, without negotiating history */
+#define TRANS_OPT_NO_DEPENDENTS "no-dependents"
+
 /**
  * Returns 0 if the option was used, non-zero otherwise. Prints a
  * message to stderr if the option is not used.
@@ -175,7 +205,19 @@ int transport_push(struct transport *connection,
 		   int refspec_nr, const char **refspec, int flags,
 		   unsigned int * reject_reasons);
 
-const struct ref *transport_get_remote_refs(struct transport *transport);
+/*
+ * Retrieve the refs of the remote; ref_prefixes (which may be NULL)
+ * is a hint, see get_refs_list() above.
+ */
+const struct ref *transport_get_remote_refs(struct transport *transport,
+					    const struct argv_array *ref_prefixes);
+
+/*
+ * Ask the remote for the URIs of the bundles it offers (see
+ * uploadpack.bundleURI); must follow transport_get_remote_refs().
+ */
+int transport_get_bundle_uris(struct transport *transport,
+			      struct string_list *uris);
 
 int transport_fetch_refs(struct transport *transport, struct ref *refs);
 void transport_unlock_pack(struct transport *transport);
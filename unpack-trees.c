@@ -9,6 +9,9 @@
 #include "refs.h"
 #include "attr.h"
 #include "split-index.h"
+#include "parallel-checkout.h"
+#include "sha1-array.h"
+#include "fetch-object.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -184,6 +187,27 @@ static void unlink_entry(const struct cache_entry *ce)
 }
 
 static struct checkout state;
+/*
+ * In a partial clone, fetch the blobs of all the entries we are about
+ * to check out in a single request.
+ */
+static void prefetch_cache_entries(const struct index_state *index)
+{
+	struct sha1_array to_fetch = SHA1_ARRAY_INIT;
+	int i;
+
+	if (!promisor_remote())
+		return;
+	for (i = 0; i < index->cache_nr; i++) {
+		const struct cache_entry *ce = index->cache[i];
+
+		if ((ce->ce_flags & CE_UPDATE) && !S_ISGITLINK(ce->ce_mode))
+			sha1_array_append(&to_fetch, ce->sha1);
+	}
+	prefetch_objects(&to_fetch);
+	sha1_array_clear(&to_fetch);
+}
+
 static int check_updates(struct unpack_trees_options *o)
 {
 	unsigned cnt = 0, total = 0;
@@ -211,6 +235,7 @@ static int check_updates(struct unpack_trees_options *o)
 
 		if (ce->ce_flags & CE_WT_REMOVE) {
 			display_progress(progress, ++cnt);
+			untracked_cache_invalidate_path(index, ce->name);
 			if (o->update && !o->dry_run)
 				unlink_entry(ce);
 			continue;
@@ -219,17 +244,26 @@ static int check_updates(struct unpack_trees_options *o)
 	remove_marked_cache_entries(&o->result);
 	remove_scheduled_dirs();
 
+	if (o->update && !o->dry_run) {
+		prefetch_cache_entries(index);
+		init_parallel_checkout();
+	}
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
 		if (ce->ce_flags & CE_UPDATE) {
 			display_progress(progress, ++cnt);
-			ce->ce_flags &= ~CE_UPDATE;
+			untracked_cache_invalidate_path(index, ce->name);
 			if (o->update && !o->dry_run) {
 				errs |= checkout_entry(ce, &state, NULL);
 			}
 		}
 	}
+	/* it needs CE_UPDATE to find all entries of a colliding group */
+	if (o->update && !o->dry_run)
+		errs |= run_parallel_checkout(&state);
+	for (i = 0; i < index->cache_nr; i++)
+		index->cache[i]->ce_flags &= ~CE_UPDATE;
 	stop_progress(&progress);
 	if (o->update)
 		git_attr_set_direction(GIT_ATTR_CHECKIN, NULL);
@@ -997,6 +1031,31 @@ static void mark_new_skip_worktree(struct exclude_list *el,
 static int verify_absent(const struct cache_entry *,
 			 enum unpack_trees_error_types,
 			 struct unpack_trees_options *);
+
+/*
+ * Hand the extensions of src that still hold for the new index over
+ * to dst.
+ */
+static void move_index_extensions(struct index_state *dst,
+				  struct index_state *src)
+{
+	/*
+	 * The fsmonitor token stays valid: what we wrote out is newer
+	 * than it, and will be reported by the next query.
+	 */
+	dst->fsmonitor_last_update = src->fsmonitor_last_update;
+	dst->fsmonitor_has_run_once = src->fsmonitor_has_run_once;
+	src->fsmonitor_last_update = NULL;
+
+	/*
+	 * The directories whose index entries changed have been
+	 * invalidated while merging; check_updates() invalidates those
+	 * it touches in the working tree.
+	 */
+	dst->untracked = src->untracked;
+	src->untracked = NULL;
+}
+
 /*
  * N-way merge "len" trees.  Returns 0 on success, -1 on failure to manipulate the
  * resulting index, -2 on failure to reflect the changes to the work tree.
@@ -1008,6 +1067,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	int i, ret;
 	static struct cache_entry *dfc;
 	struct exclude_list el;
+	struct index_state *src_index;
 
 	if (len > MAX_UNPACK_TREES)
 		die("unpack_trees takes at most %d trees", MAX_UNPACK_TREES);
@@ -1150,7 +1210,10 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		}
 	}
 
+	src_index = o->src_index;
 	o->src_index = NULL;
+	if (o->dst_index)
+		move_index_extensions(&o->result, src_index);
 	ret = check_updates(o) ? (-2) : 0;
 	if (o->dst_index) {
 		discard_index(o->dst_index);
@@ -1254,8 +1317,10 @@ static int verify_uptodate_sparse(const struct cache_entry *ce,
 static void invalidate_ce_path(const struct cache_entry *ce,
 			       struct unpack_trees_options *o)
 {
-	if (ce)
-		cache_tree_invalidate_path(o->src_index, ce->name);
+	if (!ce)
+		return;
+	cache_tree_invalidate_path(o->src_index, ce->name);
+	untracked_cache_invalidate_path(o->src_index, ce->name);
 }
 
 /*
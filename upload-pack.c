@@ -9,11 +9,15 @@
 #include "diff.h"
 #include "revision.h"
 #include "list-objects.h"
+#include "list-objects-filter-options.h"
 #include "run-command.h"
 #include "connect.h"
 #include "sigchain.h"
 #include "version.h"
 #include "string-list.h"
+#include "argv-array.h"
+#include "protocol.h"
+#include "dir.h"
 
 static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=<n>] <dir>";
 
@@ -36,6 +40,12 @@ static int no_done;
 static int use_thin_pack, use_ofs_delta, use_include_tag;
 static int no_progress, daemon_mode;
 static int allow_tip_sha1_in_want;
+static int allow_any_sha1_in_want;
+static int allow_filter;
+static int pack_cache;
+static unsigned long pack_cache_limit = 256 * 1024 * 1024;
+static struct list_objects_filter_options filter_options;
+static struct string_list bundle_uris = STRING_LIST_INIT_DUP;
 static int shallow_nr;
 static struct object_array have_obj;
 static struct object_array want_obj;
@@ -48,6 +58,8 @@ static int keepalive = 5;
 static int use_sideband;
 static int advertise_refs;
 static int stateless_rpc;
+/* each v2 "fetch" is a self-contained request, like stateless_rpc */
+static int serve_v2;
 
 static void reset_timeout(void)
 {
@@ -72,12 +84,224 @@ static ssize_t send_client_data(int fd, const char *data, ssize_t sz)
 
 static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 {
-	FILE *fp = cb_data;
+	struct strbuf *sb = cb_data;
 	if (graft->nr_parent == -1)
-		fprintf(fp, "--shallow %s\n", sha1_to_hex(graft->sha1));
+		strbuf_addf(sb, "--shallow %s\n", sha1_to_hex(graft->sha1));
 	return 0;
 }
 
+/*
+ * The pack cache (uploadpack.packCache) keeps the packs pack-objects
+ * made in $GIT_DIR/upload-pack-cache/<refs>/<request>.pack, where
+ * <refs> hashes all the refs and <request> the arguments and input of
+ * pack-objects, i.e. the wants, haves, shallow commits and options of
+ * the client.  A request that is the same as an earlier one while no
+ * ref moved is answered from there instead of running pack-objects.
+ *
+ * Only a request that has been seen before, as recorded by an empty
+ * <request>.seen, has its pack kept, and only while the packs kept
+ * for <refs> stay within uploadpack.packCacheLimit.
+ */
+
+/* how old a temporary pack must be before we assume it was abandoned */
+#define PACK_CACHE_TMP_EXPIRE 3600
+
+static struct strbuf pack_cache_tmp = STRBUF_INIT;
+static int pack_cache_tmp_installed;
+
+static void remove_pack_cache_tmp(void)
+{
+	if (pack_cache_tmp.len)
+		unlink_or_warn(pack_cache_tmp.buf);
+	strbuf_reset(&pack_cache_tmp);
+}
+
+static void remove_pack_cache_tmp_on_signal(int signo)
+{
+	remove_pack_cache_tmp();
+	sigchain_pop(signo);
+	raise(signo);
+}
+
+static int hash_one_ref(const char *refname, const unsigned char *sha1,
+			int flag, void *cb_data)
+{
+	git_SHA_CTX *ctx = cb_data;
+
+	git_SHA1_Update(ctx, sha1, 20);
+	git_SHA1_Update(ctx, refname, strlen(refname) + 1);
+	return 0;
+}
+
+static void pack_cache_path(struct strbuf *path, const char **argv,
+			    const struct strbuf *input)
+{
+	git_SHA_CTX ctx;
+	unsigned char sha1[20];
+	int i;
+
+	git_SHA1_Init(&ctx);
+	for_each_rawref(hash_one_ref, &ctx);
+	git_SHA1_Final(sha1, &ctx);
+	strbuf_addf(path, "%s/%s/", git_path("upload-pack-cache"),
+		    sha1_to_hex(sha1));
+
+	git_SHA1_Init(&ctx);
+	for (i = 0; argv[i]; i++) {
+		/* progress does not change the pack */
+		if (!strcmp(argv[i], "--progress"))
+			continue;
+		git_SHA1_Update(&ctx, argv[i], strlen(argv[i]) + 1);
+	}
+	git_SHA1_Update(&ctx, input->buf, input->len);
+	git_SHA1_Final(sha1, &ctx);
+	strbuf_addf(path, "%s.pack", sha1_to_hex(sha1));
+}
+
+static int send_cached_pack(const char *path)
+{
+	char data[8192];
+	ssize_t sz;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	while ((sz = xread(fd, data, sizeof(data))) > 0) {
+		reset_timeout();
+		send_client_data(1, data, sz);
+	}
+	if (sz < 0)
+		die_errno("git upload-pack: unable to read '%s'", path);
+	close(fd);
+	if (use_sideband)
+		packet_flush(1);
+	return 0;
+}
+
+/*
+ * Remove what the cache keeps for other states of the refs, which no
+ * request can hit any more, and the temporary packs of upload-packs
+ * that died midway from the directory of "path".  Returns the size of
+ * the packs that are left there.
+ */
+static off_t prune_pack_cache(const char *path)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const char *refs_dir;
+	size_t baselen;
+	time_t expire = time(NULL) - PACK_CACHE_TMP_EXPIRE;
+	off_t used = 0;
+	DIR *dir;
+	struct dirent *de;
+
+	strbuf_addstr(&buf, git_path("upload-pack-cache"));
+	/* path is <cache_dir>/<refs>/<request>.pack */
+	refs_dir = path + buf.len + 1;
+	dir = opendir(buf.buf);
+	strbuf_addch(&buf, '/');
+	baselen = buf.len;
+	while (dir && (de = readdir(dir)) != NULL) {
+		size_t len = strlen(de->d_name);
+
+		if (is_dot_or_dotdot(de->d_name) ||
+		    (!strncmp(refs_dir, de->d_name, len) && refs_dir[len] == '/'))
+			continue;
+		strbuf_addstr(&buf, de->d_name);
+		remove_dir_recursively(&buf, 0);
+		strbuf_setlen(&buf, baselen);
+	}
+	if (dir)
+		closedir(dir);
+
+	strbuf_add(&buf, refs_dir, strrchr(refs_dir, '/') + 1 - refs_dir);
+	baselen = buf.len;
+	dir = opendir(buf.buf);
+	while (dir && (de = readdir(dir)) != NULL) {
+		struct stat st;
+
+		strbuf_setlen(&buf, baselen);
+		strbuf_addstr(&buf, de->d_name);
+		if (stat(buf.buf, &st) || !S_ISREG(st.st_mode))
+			continue;
+		if (starts_with(de->d_name, "tmp_pack_")) {
+			if (st.st_mtime < expire)
+				unlink_or_warn(buf.buf);
+		} else if (ends_with(de->d_name, ".pack")) {
+			used += st.st_size;
+		}
+	}
+	if (dir)
+		closedir(dir);
+	strbuf_release(&buf);
+	return used;
+}
+
+/*
+ * Return whether the request whose pack goes to "path" has been seen
+ * before, and remember that it has been seen now.
+ */
+static int pack_cache_seen(const char *path)
+{
+	struct strbuf seen = STRBUF_INIT;
+	int fd, ret = 0;
+
+	strbuf_addstr(&seen, path);
+	strbuf_setlen(&seen, seen.len - strlen(".pack"));
+	strbuf_addstr(&seen, ".seen");
+	if (!access(seen.buf, F_OK))
+		ret = 1;
+	else if (!safe_create_leading_directories(seen.buf)) {
+		fd = open(seen.buf, O_WRONLY | O_CREAT, 0444);
+		if (0 <= fd)
+			close(fd);
+	}
+	strbuf_release(&seen);
+	return ret;
+}
+
+/*
+ * Start a temporary file next to "path" to keep a copy of the pack
+ * being sent; returns -1 if we cannot, and the pack is not cached.
+ * The file is removed if we die before finish_cached_pack().
+ */
+static int start_cached_pack(const char *path)
+{
+	int fd;
+
+	if (!pack_cache_tmp_installed) {
+		atexit(remove_pack_cache_tmp);
+		sigchain_push_common(remove_pack_cache_tmp_on_signal);
+		pack_cache_tmp_installed = 1;
+	}
+	strbuf_addstr(&pack_cache_tmp, path);
+	strbuf_setlen(&pack_cache_tmp,
+		      strrchr(pack_cache_tmp.buf, '/') - pack_cache_tmp.buf);
+	strbuf_addstr(&pack_cache_tmp, "/tmp_pack_XXXXXX");
+	if (safe_create_leading_directories(pack_cache_tmp.buf)) {
+		strbuf_reset(&pack_cache_tmp);
+		return -1;
+	}
+	fd = git_mkstemp_mode(pack_cache_tmp.buf, 0444);
+	if (fd < 0)
+		strbuf_reset(&pack_cache_tmp);
+	return fd;
+}
+
+/* Install the copy of a complete pack. */
+static void finish_cached_pack(const char *path)
+{
+	if (rename(pack_cache_tmp.buf, path))
+		remove_pack_cache_tmp();
+	strbuf_reset(&pack_cache_tmp);
+}
+
+static void drop_cached_pack(int *fd)
+{
+	close(*fd);
+	*fd = -1;
+	remove_pack_cache_tmp();
+}
+
 static void create_pack_file(void)
 {
 	struct child_process pack_objects;
@@ -86,9 +310,13 @@ static void create_pack_file(void)
 		"corruption on the remote side.";
 	int buffered = -1;
 	ssize_t sz;
-	const char *argv[12];
+	const char *argv[13];
 	int i, arg = 0;
 	FILE *pipe_fd;
+	struct strbuf input = STRBUF_INIT;
+	struct strbuf cache_path = STRBUF_INIT;
+	int cache_fd = -1;
+	off_t cache_room = 0;
 
 	if (shallow_nr) {
 		argv[arg++] = "--shallow-file";
@@ -106,8 +334,35 @@ static void create_pack_file(void)
 		argv[arg++] = "--delta-base-offset";
 	if (use_include_tag)
 		argv[arg++] = "--include-tag";
+	if (filter_options.choice)
+		argv[arg++] = xstrfmt("--filter=%s",
+				      filter_options.filter_spec);
 	argv[arg++] = NULL;
 
+	if (shallow_nr)
+		for_each_commit_graft(write_one_shallow, &input);
+	for (i = 0; i < want_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    sha1_to_hex(want_obj.objects[i].item->sha1));
+	strbuf_addstr(&input, "--not\n");
+	for (i = 0; i < have_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    sha1_to_hex(have_obj.objects[i].item->sha1));
+	for (i = 0; i < extra_edge_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    sha1_to_hex(extra_edge_obj.objects[i].item->sha1));
+	strbuf_addch(&input, '\n');
+
+	if (pack_cache) {
+		pack_cache_path(&cache_path, argv, &input);
+		if (!send_cached_pack(cache_path.buf))
+			goto out;
+		cache_room = (off_t)pack_cache_limit -
+			prune_pack_cache(cache_path.buf);
+		if (0 < cache_room && pack_cache_seen(cache_path.buf))
+			cache_fd = start_cached_pack(cache_path.buf);
+	}
+
 	memset(&pack_objects, 0, sizeof(pack_objects));
 	pack_objects.in = -1;
 	pack_objects.out = -1;
@@ -119,21 +374,7 @@ static void create_pack_file(void)
 		die("git upload-pack: unable to fork git-pack-objects");
 
 	pipe_fd = xfdopen(pack_objects.in, "w");
-
-	if (shallow_nr)
-		for_each_commit_graft(write_one_shallow, pipe_fd);
-
-	for (i = 0; i < want_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			sha1_to_hex(want_obj.objects[i].item->sha1));
-	fprintf(pipe_fd, "--not\n");
-	for (i = 0; i < have_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			sha1_to_hex(have_obj.objects[i].item->sha1));
-	for (i = 0; i < extra_edge_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			sha1_to_hex(extra_edge_obj.objects[i].item->sha1));
-	fprintf(pipe_fd, "\n");
+	fwrite(input.buf, 1, input.len, pipe_fd);
 	fflush(pipe_fd);
 	fclose(pipe_fd);
 
@@ -211,8 +452,13 @@ static void create_pack_file(void)
 			}
 			sz = xread(pack_objects.out, cp,
 				  sizeof(data) - outsz);
-			if (0 < sz)
-				;
+			if (0 < sz) {
+				if (0 <= cache_fd &&
+				    (cache_room < sz ||
+				     write_in_full(cache_fd, cp, sz) != sz))
+					drop_cached_pack(&cache_fd);
+				cache_room -= sz;
+			}
 			else if (sz == 0) {
 				close(pack_objects.out);
 				pack_objects.out = -1;
@@ -262,14 +508,25 @@ static void create_pack_file(void)
 	}
 	if (use_sideband)
 		packet_flush(1);
+	if (0 <= cache_fd) {
+		if (close(cache_fd))
+			remove_pack_cache_tmp();
+		else
+			finish_cached_pack(cache_path.buf);
+	}
+ out:
+	strbuf_release(&input);
+	strbuf_release(&cache_path);
 	return;
 
  fail:
+	if (0 <= cache_fd)
+		drop_cached_pack(&cache_fd);
 	send_client_data(3, abort_msg, sizeof(abort_msg));
 	die("git upload-pack: %s", abort_msg);
 }
 
-static int got_sha1(char *hex, unsigned char *sha1)
+static int got_sha1(const char *hex, unsigned char *sha1)
 {
 	struct object *o;
 	int we_knew_they_have = 0;
@@ -454,7 +711,7 @@ static void check_non_tip(void)
 	int i;
 
 	/* In the normal in-process case non-tip request can never happen */
-	if (!stateless_rpc)
+	if (!stateless_rpc && !serve_v2)
 		goto error;
 
 	cmd.argv = argv;
@@ -528,6 +785,69 @@ error:
 	}
 }
 
+/*
+ * Work out the shallow boundary for the given depth (if any) and the
+ * commits the client told us it has shallow, tell the client about
+ * the changes to its boundary, and register the result so that
+ * pack-objects stops there.
+ */
+static void deepen(int depth, struct object_array *shallows)
+{
+	if (depth > 0) {
+		struct commit_list *result = NULL, *backup = NULL;
+		int i;
+		if (depth == INFINITE_DEPTH && !is_repository_shallow())
+			for (i = 0; i < shallows->nr; i++) {
+				struct object *object = shallows->objects[i].item;
+				object->flags |= NOT_SHALLOW;
+			}
+		else
+			backup = result =
+				get_shallow_commits(&want_obj, depth,
+						    SHALLOW, NOT_SHALLOW);
+		while (result) {
+			struct object *object = &result->item->object;
+			if (!(object->flags & (CLIENT_SHALLOW|NOT_SHALLOW))) {
+				packet_write(1, "shallow %s",
+						sha1_to_hex(object->sha1));
+				register_shallow(object->sha1);
+				shallow_nr++;
+			}
+			result = result->next;
+		}
+		free_commit_list(backup);
+		for (i = 0; i < shallows->nr; i++) {
+			struct object *object = shallows->objects[i].item;
+			if (object->flags & NOT_SHALLOW) {
+				struct commit_list *parents;
+				packet_write(1, "unshallow %s",
+					sha1_to_hex(object->sha1));
+				object->flags &= ~CLIENT_SHALLOW;
+				/* make sure the real parents are parsed */
+				unregister_shallow(object->sha1);
+				object->parsed = 0;
+				parse_commit_or_die((struct commit *)object);
+				parents = ((struct commit *)object)->parents;
+				while (parents) {
+					add_object_array(&parents->item->object,
+							NULL, &want_obj);
+					parents = parents->next;
+				}
+				add_object_array(object, NULL, &extra_edge_obj);
+			}
+			/* make sure commit traversal conforms to client */
+			register_shallow(object->sha1);
+		}
+	} else
+		if (shallows->nr > 0) {
+			int i;
+			for (i = 0; i < shallows->nr; i++)
+				register_shallow(shallows->objects[i].item->sha1);
+		}
+
+	shallow_nr += shallows->nr;
+}
+
 static void receive_needs(void)
 {
 	struct object_array shallows = OBJECT_ARRAY_INIT;
@@ -537,7 +857,7 @@ static void receive_needs(void)
 	shallow_nr = 0;
 	for (;;) {
 		struct object *o;
-		const char *features;
+		const char *features, *arg;
 		unsigned char sha1_buf[20];
 		char *line = packet_read_line(0, NULL);
 		reset_timeout();
@@ -567,6 +887,12 @@ static void receive_needs(void)
 				die("Invalid deepen: %s", line);
 			continue;
 		}
+		if (allow_filter && skip_prefix(line, "filter ", &arg)) {
+			list_objects_filter_release(&filter_options);
+			if (parse_list_objects_filter(&filter_options, arg))
+				die("git upload-pack: invalid filter: %s", line);
+			continue;
+		}
 		if (!starts_with(line, "want ") ||
 		    get_sha1_hex(line+5, sha1_buf))
 			die("git upload-pack: protocol error, "
@@ -612,7 +938,7 @@ static void receive_needs(void)
 	 * have been based on the set of older refs advertised
 	 * by another process that handled the initial request.
 	 */
-	if (has_non_tip)
+	if (has_non_tip && !allow_any_sha1_in_want)
 		check_non_tip();
 
 	if (!use_sideband && daemon_mode)
@@ -620,60 +946,9 @@ static void receive_needs(void)
 
 	if (depth == 0 && shallows.nr == 0)
 		return;
-	if (depth > 0) {
-		struct commit_list *result = NULL, *backup = NULL;
-		int i;
-		if (depth == INFINITE_DEPTH && !is_repository_shallow())
-			for (i = 0; i < shallows.nr; i++) {
-				struct object *object = shallows.objects[i].item;
-				object->flags |= NOT_SHALLOW;
-			}
-		else
-			backup = result =
-				get_shallow_commits(&want_obj, depth,
-						    SHALLOW, NOT_SHALLOW);
-		while (result) {
-			struct object *object = &result->item->object;
-			if (!(object->flags & (CLIENT_SHALLOW|NOT_SHALLOW))) {
-				packet_write(1, "shallow %s",
-						sha1_to_hex(object->sha1));
-				register_shallow(object->sha1);
-				shallow_nr++;
-			}
-			result = result->next;
-		}
-		free_commit_list(backup);
-		for (i = 0; i < shallows.nr; i++) {
-			struct object *object = shallows.objects[i].item;
-			if (object->flags & NOT_SHALLOW) {
-				struct commit_list *parents;
-				packet_write(1, "unshallow %s",
-					sha1_to_hex(object->sha1));
-				object->flags &= ~CLIENT_SHALLOW;
-				/* make sure the real parents are parsed */
-				unregister_shallow(object->sha1);
-				object->parsed = 0;
-				parse_commit_or_die((struct commit *)object);
-				parents = ((struct commit *)object)->parents;
-				while (parents) {
-					add_object_array(&parents->item->object,
-							NULL, &want_obj);
-					parents = parents->next;
-				}
-				add_object_array(object, NULL, &extra_edge_obj);
-			}
-			/* make sure commit traversal conforms to client */
-			register_shallow(object->sha1);
-		}
+	deepen(depth, &shallows);
+	if (depth > 0)
 		packet_flush(1);
-	} else
-		if (shallows.nr > 0) {
-			int i;
-			for (i = 0; i < shallows.nr; i++)
-				register_shallow(shallows.objects[i].item->sha1);
-		}
-
-	shallow_nr += shallows.nr;
 	free(shallows.objects);
 }
 
@@ -717,10 +992,12 @@ static int send_ref(const char *refname, const unsigned char *sha1, int flag, vo
 		struct strbuf symref_info = STRBUF_INIT;
 
 		format_symref_info(&symref_info, cb_data);
-		packet_write(1, "%s %s%c%s%s%s%s agent=%s\n",
+		packet_write(1, "%s %s%c%s%s%s%s%s agent=%s\n",
 			     sha1_to_hex(sha1), refname_nons,
 			     0, capabilities,
-			     allow_tip_sha1_in_want ? " allow-tip-sha1-in-want" : "",
+			     allow_tip_sha1_in_want || allow_any_sha1_in_want ?
+			     " allow-tip-sha1-in-want" : "",
+			     allow_filter ? " filter" : "",
 			     stateless_rpc ? " no-done" : "",
 			     symref_info.buf,
 			     git_user_agent_sanitized());
@@ -778,11 +1055,337 @@ static void upload_pack(void)
 	}
 }
 
+/*
+ * Protocol v2: the server advertises its capabilities only, and the
+ * client then sends commands, each of which is a complete request:
+ *
+ *   command=<name>
+ *   [agent=<agent>]
+ *   0001 (delim)
+ *   <command-specific arguments>
+ *   0000 (flush)
+ */
+static void advertise_capabilities_v2(void)
+{
+	packet_write(1, "version 2\n");
+	packet_write(1, "agent=%s\n", git_user_agent_sanitized());
+	packet_write(1, "ls-refs\n");
+	packet_write(1, "fetch=shallow%s\n", allow_filter ? " filter" : "");
+	if (bundle_uris.nr)
+		packet_write(1, "bundle-uri\n");
+	packet_flush(1);
+}
+
+/*
+ * List the pre-built bundles (uploadpack.bundleURI) a client may
+ * download and unbundle before fetching whatever they do not cover.
+ */
+static void bundle_uri(struct packet_reader *reader)
+{
+	struct string_list_item *item;
+
+	if (packet_reader_read(reader) != PACKET_READ_FLUSH)
+		die("git upload-pack: unexpected bundle-uri argument '%s'",
+		    reader->status == PACKET_READ_NORMAL ? reader->line : "");
+	for_each_string_list_item(item, &bundle_uris)
+		packet_write(1, "%s\n", item->string);
+	packet_flush(1);
+}
+
+struct ls_refs_data {
+	unsigned peel:1;
+	unsigned symrefs:1;
+	struct argv_array prefixes;
+};
+
+static int ref_match_prefixes(const char *refname,
+			      const struct argv_array *prefixes)
+{
+	int i;
+
+	if (!prefixes->argc)
+		return 1;
+	for (i = 0; i < prefixes->argc; i++)
+		if (starts_with(refname, prefixes->argv[i]))
+			return 1;
+	return 0;
+}
+
+static int send_ref_v2(const char *refname, const unsigned char *sha1,
+		       int flag, void *cb_data)
+{
+	struct ls_refs_data *data = cb_data;
+	const char *refname_nons = strip_namespace(refname);
+	struct strbuf line = STRBUF_INIT;
+	unsigned char peeled[20];
+
+	if (ref_is_hidden(refname))
+		return 0;
+	if (!ref_match_prefixes(refname_nons, &data->prefixes))
+		return 0;
+
+	strbuf_addf(&line, "%s %s", sha1_to_hex(sha1), refname_nons);
+	if (data->symrefs && (flag & REF_ISSYMREF)) {
+		unsigned char unused[20];
+		const char *target = resolve_ref_unsafe(refname, unused, 0, NULL);
+		if (target)
+			strbuf_addf(&line, " symref-target:%s",
+				    strip_namespace(target));
+	}
+	if (data->peel && !peel_ref(refname, peeled))
+		strbuf_addf(&line, " peeled:%s", sha1_to_hex(peeled));
+	strbuf_addch(&line, '\n');
+	packet_write(1, "%s", line.buf);
+	strbuf_release(&line);
+	return 0;
+}
+
+static void ls_refs(struct packet_reader *reader)
+{
+	struct ls_refs_data data;
+	const char *arg;
+
+	memset(&data, 0, sizeof(data));
+	argv_array_init(&data.prefixes);
+
+	while (packet_reader_read(reader) == PACKET_READ_NORMAL) {
+		if (!strcmp(reader->line, "peel"))
+			data.peel = 1;
+		else if (!strcmp(reader->line, "symrefs"))
+			data.symrefs = 1;
+		else if (skip_prefix(reader->line, "ref-prefix ", &arg))
+			argv_array_push(&data.prefixes, arg);
+		else
+			die("git upload-pack: unexpected ls-refs argument '%s'",
+			    reader->line);
+	}
+	if (reader->status != PACKET_READ_FLUSH)
+		die("git upload-pack: expected flush after ls-refs arguments");
+
+	reset_timeout();
+	head_ref_namespaced(send_ref_v2, &data);
+	for_each_namespaced_ref(send_ref_v2, &data);
+	packet_flush(1);
+	argv_array_clear(&data.prefixes);
+}
+
+static void reset_fetch_state(void)
+{
+	clear_object_flags(THEY_HAVE | WANTED | COMMON_KNOWN | REACHABLE |
+			   SHALLOW | NOT_SHALLOW | CLIENT_SHALLOW);
+	have_obj.nr = 0;
+	want_obj.nr = 0;
+	extra_edge_obj.nr = 0;
+	oldest_have = 0;
+	shallow_nr = 0;
+	use_thin_pack = use_ofs_delta = use_include_tag = 0;
+	no_progress = 0;
+	list_objects_filter_release(&filter_options);
+}
+
+static void fetch_v2(struct packet_reader *reader)
+{
+	struct object_array shallows = OBJECT_ARRAY_INIT;
+	struct strbuf acks = STRBUF_INIT;
+	int depth = 0, done = 0, has_non_tip = 0;
+	unsigned char sha1[20];
+	const char *arg;
+
+	reset_fetch_state();
+
+	while (packet_reader_read(reader) == PACKET_READ_NORMAL) {
+		const char *line = reader->line;
+		struct object *o;
+
+		if (skip_prefix(line, "want ", &arg)) {
+			if (get_sha1_hex(arg, sha1))
+				die("git upload-pack: protocol error, "
+				    "expected to get sha, not '%s'", line);
+			o = parse_object(sha1);
+			if (!o)
+				die("git upload-pack: not our ref %s",
+				    sha1_to_hex(sha1));
+			if (!(o->flags & WANTED)) {
+				o->flags |= WANTED;
+				if (!is_our_ref(o))
+					has_non_tip = 1;
+				add_object_array(o, NULL, &want_obj);
+			}
+		} else if (skip_prefix(line, "have ", &arg)) {
+			if (got_sha1(arg, sha1) >= 0)
+				packet_buf_write(&acks, "ACK %s\n",
+						 sha1_to_hex(sha1));
+		} else if (!strcmp(line, "done"))
+			done = 1;
+		else if (!strcmp(line, "thin-pack"))
+			use_thin_pack = 1;
+		else if (!strcmp(line, "ofs-delta"))
+			use_ofs_delta = 1;
+		else if (!strcmp(line, "no-progress"))
+			no_progress = 1;
+		else if (!strcmp(line, "include-tag"))
+			use_include_tag = 1;
+		else if (skip_prefix(line, "shallow ", &arg)) {
+			if (get_sha1_hex(arg, sha1))
+				die("invalid shallow line: %s", line);
+			o = parse_object(sha1);
+			if (!o)
+				continue;
+			if (o->type != OBJ_COMMIT)
+				die("invalid shallow object %s", sha1_to_hex(sha1));
+			if (!(o->flags & CLIENT_SHALLOW)) {
+				o->flags |= CLIENT_SHALLOW;
+				add_object_array(o, NULL, &shallows);
+			}
+		} else if (skip_prefix(line, "deepen ", &arg)) {
+			char *end;
+			depth = strtol(arg, &end, 0);
+			if (end == arg || depth <= 0)
+				die("Invalid deepen: %s", line);
+		} else if (allow_filter && skip_prefix(line, "filter ", &arg)) {
+			list_objects_filter_release(&filter_options);
+			if (parse_list_objects_filter(&filter_options, arg))
+				die("git upload-pack: invalid filter: %s", line);
+		} else
+			die("git upload-pack: unexpected fetch argument '%s'",
+			    line);
+	}
+	if (reader->status != PACKET_READ_FLUSH)
+		die("git upload-pack: expected flush after fetch arguments");
+	reset_timeout();
+
+	if (has_non_tip && !allow_any_sha1_in_want)
+		check_non_tip();
+
+	if (!done) {
+		/*
+		 * Acknowledge every "have" we share with the client and
+		 * tell it whether that is enough for us to send a pack.
+		 */
+		packet_write(1, "acknowledgments\n");
+		if (acks.len)
+			write_or_die(1, acks.buf, acks.len);
+		else
+			packet_write(1, "NAK\n");
+		if (!want_obj.nr || !ok_to_give_up()) {
+			packet_flush(1);
+			goto out;
+		}
+		packet_write(1, "ready\n");
+		packet_delim(1);
+	}
+
+	if (depth > 0 || shallows.nr || is_repository_shallow()) {
+		packet_write(1, "shallow-info\n");
+		if (!depth)
+			advertise_shallow_grafts(1);
+		deepen(depth, &shallows);
+		packet_delim(1);
+	}
+
+	packet_write(1, "packfile\n");
+	use_sideband = LARGE_PACKET_MAX;
+	if (want_obj.nr)
+		create_pack_file();
+	else
+		packet_flush(1);
+out:
+	strbuf_release(&acks);
+	free(shallows.objects);
+}
+
+/*
+ * Read and run one command; returns 0 when the client ends the
+ * session with a flush (or by hanging up) instead of a command.
+ */
+static int process_request_v2(void)
+{
+	struct packet_reader reader;
+	const char *command = NULL, *arg;
+	char *name = NULL;
+
+	packet_reader_init(&reader, 0, NULL, 0,
+			   PACKET_READ_CHOMP_NEWLINE |
+			   PACKET_READ_GENTLE_ON_EOF);
+
+	for (;;) {
+		switch (packet_reader_read(&reader)) {
+		case PACKET_READ_EOF:
+			if (command)
+				die("git upload-pack: unexpected end of request");
+			return 0;
+		case PACKET_READ_FLUSH:
+			if (!command)
+				return 0;
+			die("git upload-pack: expected delim before "
+			    "arguments of '%s'", command);
+		case PACKET_READ_DELIM:
+			if (!command)
+				die("git upload-pack: no command requested");
+			goto run;
+		case PACKET_READ_NORMAL:
+			break;
+		}
+		if (skip_prefix(reader.line, "command=", &arg)) {
+			if (command)
+				die("git upload-pack: command requested twice");
+			command = name = xstrdup(arg);
+		} else if (!starts_with(reader.line, "agent="))
+			die("git upload-pack: unknown capability '%s'",
+			    reader.line);
+	}
+
+run:
+	if (!strcmp(command, "ls-refs"))
+		ls_refs(&reader);
+	else if (!strcmp(command, "fetch"))
+		fetch_v2(&reader);
+	else if (!strcmp(command, "bundle-uri") && bundle_uris.nr)
+		bundle_uri(&reader);
+	else
+		die("git upload-pack: invalid command '%s'", command);
+	free(name);
+	return 1;
+}
+
+static void upload_pack_v2(void)
+{
+	serve_v2 = 1;
+	if (advertise_refs || !stateless_rpc)
+		advertise_capabilities_v2();
+	if (advertise_refs)
+		return;
+
+	head_ref_namespaced(mark_our_ref, NULL);
+	for_each_namespaced_ref(mark_our_ref, NULL);
+
+	if (stateless_rpc)
+		process_request_v2();
+	else
+		while (process_request_v2())
+			; /* keep serving until the client is done */
+}
+
 static int upload_pack_config(const char *var, const char *value, void *unused)
 {
 	if (!strcmp("uploadpack.allowtipsha1inwant", var))
 		allow_tip_sha1_in_want = git_config_bool(var, value);
-	else if (!strcmp("uploadpack.keepalive", var)) {
+	else if (!strcmp("uploadpack.allowanysha1inwant", var))
+		allow_any_sha1_in_want = git_config_bool(var, value);
+	else if (!strcmp("uploadpack.allowfilter", var))
+		allow_filter = git_config_bool(var, value);
+	else if (!strcmp("uploadpack.packcache", var))
+		pack_cache = git_config_bool(var, value);
+	else if (!strcmp("uploadpack.packcachelimit", var))
+		pack_cache_limit = git_config_ulong(var, value);
+	else if (!strcmp("uploadpack.bundleuri", var)) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (!*value)
+			string_list_clear(&bundle_uris, 0);
+		else
+			string_list_append(&bundle_uris, value);
+	} else if (!strcmp("uploadpack.keepalive", var)) {
 		keepalive = git_config_int(var, value);
 		if (!keepalive)
 			keepalive = -1;
@@ -841,6 +1444,9 @@ int main(int argc, char **argv)
 		die("'%s' does not appear to be a git repository", dir);
 
 	git_config(upload_pack_config, NULL);
-	upload_pack();
+	if (determine_protocol_version_server() == protocol_v2)
+		upload_pack_v2();
+	else
+		upload_pack();
 	return 0;
 }